@@ -0,0 +1,53 @@
+#pragma once
+
+#include "AstRewriter.hpp"
+
+// Deep copies expressions and statements. Every node is copied and the
+// default visit of AstRewriter then swaps its children for their copies.
+// Passes that need a variant of the copy override the visit for the
+// nodes they change.
+class AstCloner : public AstRewriter {
+  template <typename T, typename Visit>
+  void copyExpr(T* expr, Visit visit) {
+    auto node = std::make_shared<T>(*expr);
+    visit(node.get());
+    exprReplacement = node;
+  }
+
+  template <typename T, typename Visit>
+  void copyStmt(T* stmt, Visit visit) {
+    auto node = std::make_shared<T>(*stmt);
+    visit(node.get());
+    stmtReplacement = node;
+  }
+
+public:
+  Expr::ExprPtr clone(Expr::ExprPtr expr);
+  Stmt::StmtPtr clone(Stmt::StmtPtr stmt);
+  std::shared_ptr<Stmt::Function> clone(const Stmt::Function& function);
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* stmt) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+
+#include <string>
+
+// Questions the optimization passes ask about parts of the program
+
+// Text that is the same for two pure expressions computing the same value
+// in the same scope, empty for anything that could have side effects.
+// Pure are literals, variable reads, `this`, operators and property reads
+// on pure operands. Expressions of more than MAX_KEYED nodes get no key,
+// so the operators of a long chain aren't keyed at the length of the chain.
+constexpr size_t MAX_KEYED = 64;
+std::string pureKey(Expr::Expr* expr);
+
+// A literal as it would be written in Lox, strings in quotes. Values of
+// different types, or numbers that differ, are never spelled the same.
+std::string literalSpelling(const Value& value);
+
+// Whether `body` declares functions or classes that could capture locals
+// of the function it belongs to. Top level declarations of the script
+// capture none.
+bool declaresClosures(Stmt::Stmts& body, bool topLevel);
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Expr.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+
+// Walks the whole program and lets passes replace nodes in place. A visit
+// method puts the new node in `exprReplacement` or `stmtReplacement`, or
+// sets `removeStmt`, and rewrite() swaps it in where the old node was.
+// Statements put in `insertBefore` run right before the visited one.
+// The default visits only recurse into the children. The operators of a
+// chain like `a + b - c` are visited innermost first, the visit of each one
+// finds its left operand rewritten already.
+class AstRewriter : public Visitor<Value> {
+protected:
+  Expr::ExprPtr exprReplacement;
+  Stmt::StmtPtr stmtReplacement;
+  bool removeStmt { false };
+  Stmt::Stmts insertBefore;
+  // nodes rewrite() went through
+  size_t nodes { 0 };
+
+private:
+  // the left operand of the chain operator being visited, which rewrite()
+  // gives `leftRewrite` instead of visiting it again
+  Expr::Expr* rewrittenLeft { nullptr };
+  Expr::ExprPtr leftRewrite;
+
+public:
+  virtual ~AstRewriter() = default;
+
+  void rewrite(Expr::ExprPtr& expr);
+  // a removed statement is left as an empty block, one with statements
+  // to insert before it becomes a block of both
+  void rewrite(Stmt::StmtPtr& stmt);
+  // a removed statement is erased
+  void rewrite(Stmt::Stmts& statements);
+  void rewriteFunction(Stmt::Function* function);
+
+  size_t nodeCount() const { return nodes; }
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* stmt) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
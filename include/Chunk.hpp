@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+// X-macro list so the opcode enum and the VM dispatch table stay in sync
+#define LOX_OPCODES(X) \
+  X(OP_CONSTANT)       \
+  X(OP_NIL)            \
+  X(OP_TRUE)           \
+  X(OP_FALSE)          \
+  X(OP_POP)            \
+  X(OP_GET_LOCAL)      \
+  X(OP_SET_LOCAL)      \
+  X(OP_GET_GLOBAL)     \
+  X(OP_DEFINE_GLOBAL)  \
+  X(OP_SET_GLOBAL)     \
+  X(OP_GET_UPVALUE)    \
+  X(OP_SET_UPVALUE)    \
+  X(OP_GET_PROPERTY)   \
+  X(OP_SET_PROPERTY)   \
+  X(OP_GET_METHOD)     \
+  X(OP_EQUAL)          \
+  X(OP_NOT_EQUAL)      \
+  X(OP_GREATER)        \
+  X(OP_GREATER_EQUAL)  \
+  X(OP_LESS)           \
+  X(OP_LESS_EQUAL)     \
+  X(OP_ADD)            \
+  X(OP_SUBTRACT)       \
+  X(OP_MULTIPLY)       \
+  X(OP_DIVIDE)         \
+  X(OP_BIT_AND)        \
+  X(OP_BIT_OR)         \
+  X(OP_BIT_XOR)        \
+  X(OP_SHIFT_LEFT)     \
+  X(OP_SHIFT_RIGHT)    \
+  X(OP_NOT)            \
+  X(OP_NEGATE)         \
+  X(OP_INCREMENT)      \
+  X(OP_DECREMENT)      \
+  X(OP_BIT_NOT)        \
+  X(OP_PRINT)          \
+  X(OP_JUMP)           \
+  X(OP_JUMP_IF_FALSE)  \
+  X(OP_LOOP)           \
+  X(OP_CALL)           \
+  X(OP_CALL_METHOD)    \
+  X(OP_CLOSURE)        \
+  X(OP_CLOSE_UPVALUE)  \
+  X(OP_RETURN)         \
+  X(OP_CLASS)          \
+  X(OP_METHOD)
+
+enum OpCode : uint8_t {
+#define LOX_OPCODE_ENUM(op) op,
+  LOX_OPCODES(LOX_OPCODE_ENUM)
+#undef LOX_OPCODE_ENUM
+  OP_COUNT_
+};
+
+class VMFunction;
+
+// Sequence of instructions together with everything they refer to:
+// constants, nested function prototypes and the source lines.
+class Chunk {
+  // run-length encoded line table, one entry per change of line
+  struct LineStart {
+    int offset;
+    int line;
+  };
+  std::vector<LineStart> lines;
+
+public:
+  std::vector<uint8_t> code;
+  std::vector<Value> constants;
+  std::vector<std::shared_ptr<VMFunction>> functions;
+
+  void write(uint8_t byte, int line);
+  int addConstant(const Value& value);
+  int addFunction(std::shared_ptr<VMFunction> function);
+  int getLine(int offset) const;
+};
+
+// Compiled function prototype, closures are created from it at runtime
+class VMFunction {
+public:
+  std::string name;
+  int arity { 0 };
+  int upvalueCount { 0 };
+  Chunk chunk;
+
+  VMFunction(const std::string& name);
+};
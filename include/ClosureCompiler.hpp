@@ -0,0 +1,113 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Expr.hpp"
+#include "Interpreter.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+
+// Code compiled into closures. Every node is a function pointer and the
+// data it runs on, slots, operators and literals are picked when it is
+// compiled, so running one is a single indirect call instead of a
+// visitor's double dispatch and a switch on the operator.
+namespace Closures {
+
+struct ExprNode {
+  using Run = Value (*)(const ExprNode* node, Interpreter& interpreter);
+
+  Run run;
+  // whether running it may allocate, and so collect values nothing but
+  // the C++ stack refers to
+  bool allocates { true };
+
+  explicit ExprNode(Run run) : run { run } {}
+  virtual ~ExprNode() = default;
+  Value operator()(Interpreter& interpreter) const {
+    return run(this, interpreter);
+  }
+};
+
+struct StmtNode {
+  using Run = Completion (*)(const StmtNode* node, Interpreter& interpreter);
+
+  Run run;
+
+  explicit StmtNode(Run run) : run { run } {}
+  virtual ~StmtNode() = default;
+  Completion operator()(Interpreter& interpreter) const {
+    return run(this, interpreter);
+  }
+};
+
+using ExprCode = std::unique_ptr<ExprNode>;
+using StmtCode = std::unique_ptr<StmtNode>;
+
+// the top level of a program or the body of a function
+struct Body {
+  std::vector<StmtCode> statements;
+
+  Completion run(Interpreter& interpreter) const {
+    for(const auto& stmt: statements) {
+      Completion completion = (*stmt)(interpreter);
+      if(completion != Completion::NORMAL) return completion;
+    }
+    return Completion::NORMAL;
+  }
+};
+
+}
+
+// Compiles a resolved program into closures, --closures. Function bodies
+// are compiled once along with it and kept on their declarations, calls
+// run them in the tree-walker's frames, so upvalues, property caches and
+// errors are the tree-walker's.
+class ClosureCompiler : public Visitor<Value> {
+  // the nodes, defined next to the compiler
+  struct Nodes;
+
+  // what the last visit compiled
+  Closures::ExprCode compiledExpr;
+  Closures::StmtCode compiledStmt;
+  // the statement being compiled, functions keep a reference to theirs
+  StmtPtr compiling;
+
+  Closures::ExprCode compile(const ExprPtr& expr);
+  Closures::StmtCode compile(const StmtPtr& stmt);
+  Closures::Body compileAll(const Stmts& statements);
+  void compileFunction(Stmt::Function& function);
+  // one operator of a chain, given the code of its left operand
+  Closures::ExprCode compileOperator(Expr::Binop* expr,
+      Closures::ExprCode left);
+  Closures::ExprCode compileShortCircuit(Expr::Logical* expr,
+      Closures::ExprCode left);
+
+public:
+  Closures::Body compile(const Stmts& program);
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* varstmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Expr.hpp"
+#include "Lox.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+
+class VM;
+
+// Lowers a resolved program into bytecode for the VM. Scoping mirrors
+// the Resolver: locals live in stack slots, variables of enclosing
+// functions are reached through upvalues and everything else is global.
+class Compiler : public Visitor<Value> {
+  enum class FunctionType {
+    SCRIPT,
+    FUNCTION,
+    METHOD
+  };
+
+  struct Local {
+    std::string name;
+    int depth;
+    bool isCaptured;
+  };
+
+  struct Upvalue {
+    uint8_t index;
+    bool isLocal;
+  };
+
+  struct Loop {
+    int scopeDepth;
+    std::vector<int> breakJumps;
+  };
+
+  struct FunctionState {
+    FunctionState* enclosing;
+    std::shared_ptr<VMFunction> function;
+    FunctionType type;
+    std::vector<Local> locals {};
+    std::vector<Upvalue> upvalues {};
+    std::vector<Loop> loops {};
+    std::map<std::string, int> identifiers {};
+    int scopeDepth { 0 };
+
+    FunctionState(FunctionState* enclosing, FunctionType type,
+        const std::string& name);
+  };
+
+  Lox& lox;
+  VM& vm;
+  FunctionState* current { nullptr };
+  int line { 0 };
+
+  Chunk& chunk();
+  void emitByte(uint8_t byte);
+  void emitBytes(uint8_t first, uint8_t second);
+  void emitShort(uint16_t value);
+  void emitOp(OpCode op, uint16_t operand);
+  int emitJump(OpCode op);
+  void patchJump(int offset);
+  void emitLoop(int loopStart);
+  void emitReturn();
+  // one operator of a chain, after its left operand
+  void emitOperator(Expr::Binop* expr);
+  void emitShortCircuit(Expr::Logical* expr);
+  uint16_t makeConstant(const Value& value);
+  uint16_t identifierConstant(const std::string& name);
+
+  void beginScope();
+  void endScope();
+  void discardLocals(int depth);
+  void addLocal(const std::string& name);
+  void markInitialized();
+  void declareVariable(const Token& name);
+  void defineVariable(const Token& name);
+
+  int resolveLocal(FunctionState* state, const std::string& name);
+  int addUpvalue(FunctionState* state, uint8_t index, bool isLocal);
+  int resolveUpvalue(FunctionState* state, const std::string& name);
+  void namedVariable(const Token& name, bool assign);
+
+  void function(Stmt::Function* stmt, FunctionType type);
+
+  void compile(const Expr::ExprPtr& expr);
+  void compile(const Stmt::StmtPtr& stmt);
+
+public:
+  Compiler(Lox& lox, VM& vm);
+
+  std::shared_ptr<VMFunction> compile(const Stmt::Stmts& program);
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* varstmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
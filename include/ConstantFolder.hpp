@@ -0,0 +1,61 @@
+#pragma once
+
+#include "AstRewriter.hpp"
+#include "Lox.hpp"
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Evaluates operators whose operands are all literals, replaces reads of
+// locals that are never assigned after their literal initializer with the
+// literal and drops if and while branches whose condition is a literal
+// that never lets them run. Globals are left alone, they are bound late.
+class ConstantFolder : public AstRewriter {
+  // declarations visible by name, nullptr for anything that is not a var
+  using Scope = std::map<std::string, Stmt::Var*>;
+
+  Lox& lox;
+  std::vector<Scope> scopes;
+  // first walk only collects the locals something assigns to
+  bool scanning { false };
+  std::set<Stmt::Var*> reassigned;
+  std::map<Stmt::Var*, LiteralPtr> constants;
+
+  size_t nodesBefore { 0 };
+  size_t nodesAfter { 0 };
+  int folded { 0 };
+  int propagated { 0 };
+  int droppedBranches { 0 };
+
+  void declare(const Token& name, Stmt::Var* var = nullptr);
+  Stmt::Var* lookUp(const Token& name);
+  void replaceWith(Value value);
+  bool foldBinop(Expr::Binop* expr, Value left, Value right);
+
+public:
+  ConstantFolder(Lox& lox);
+
+  void fold(Stmt::Stmts& program);
+  void printSummary(std::ostream& out) const;
+  int foldedCount() const { return folded; }
+  int branchesDropped() const { return droppedBranches; }
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Environment.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+
+// Translates a resolved and type checked program into a C++ program that
+// runs on the Runtime library, for lox2cpp. Every Lox function becomes a
+// C++ function working on the same frame slots the Resolver gave the
+// interpreter, with the temporaries of its expressions in the slots after
+// them. Operators the type checker proved to get numbers, strings or
+// booleans skip the run time checks, comparisons of numbers in conditions
+// don't box their result at all.
+class CppTranslator : public Visitor<Value> {
+  struct FunctionState {
+    std::string name;
+    std::string code {};
+    int indent { 1 };
+    // first temporary, the locals come before it
+    int slotCount;
+    int nextTemp;
+    int frameSize;
+    // first slot of every enclosing block that closes upvalues
+    std::vector<int> closingBlocks {};
+    // closingBlocks.size() when each enclosing loop started
+    std::vector<size_t> loops {};
+  };
+
+  Globals& globals;
+  std::vector<FunctionState> functions;
+  // definitions of the translated functions, nested ones first
+  std::vector<std::string> definitions;
+  // how the constants table and the property sites are set up
+  std::vector<std::string> constants;
+  std::map<std::string, int> stringConstants;
+  std::vector<std::string> sites;
+  int functionCount { 0 };
+  // the expression translated last: a C++ expression of its value, and
+  // whether that is a variable later code may assign
+  std::string result;
+  bool isVariable { false };
+
+  FunctionState& current() { return functions.back(); }
+  void emit(const std::string& code);
+  void resetTemps();
+  std::string temp();
+  int temps(int count);
+  std::string slot(int index) const;
+  // An operand evaluated before others. A variable is copied into a
+  // temporary when the code of the later operands could have assigned
+  // it, the temporary is taken up front so their calls don't use it.
+  struct Held {
+    std::string operand;
+    size_t mark;
+    int temp;
+  };
+  Held hold(const std::string& operand);
+  std::string release(const Held& held);
+
+  std::string constant(Value value);
+  int site(const std::string& name);
+  std::string operand(const Expr::ExprPtr& expr);
+  // the expression as a C++ bool
+  std::string condition(const Expr::ExprPtr& expr);
+  // one operator of a chain, returns the temporary holding its value
+  std::string operate(Expr::Binop* expr, const std::string& leftOperand);
+  std::string variable(const Expr::VarSlot& slot, const Token& name);
+  void assign(const Expr::VarSlot& slot, const Token& name,
+      const std::string& value);
+  void define(const Expr::VarSlot& slot, const std::string& value);
+  // emits the callee and the arguments into temporaries, returns the first
+  int setUpCall(Expr::Call* expr);
+  std::string makeFunction(Stmt::Function* stmt, bool isMethod);
+  void translate(const Stmt::Stmts& statements);
+
+public:
+  CppTranslator(Globals& globals);
+
+  // the whole C++ program, `slotCount` is what the top level needs
+  std::string translate(const Stmt::Stmts& program, int slotCount);
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* varstmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
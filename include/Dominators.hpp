@@ -0,0 +1,29 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include "IR.hpp"
+
+// Dominator tree of a function's reachable blocks, computed with the
+// iterative algorithm of Cooper, Harvey and Kennedy ("A Simple, Fast
+// Dominance Algorithm")
+class DominatorTree {
+  // blocks in reverse postorder, the entry first
+  std::vector<IR::Block*> order;
+  std::map<const IR::Block*, int> orderIndex;
+  std::map<const IR::Block*, IR::Block*> idoms;
+  std::map<const IR::Block*, std::vector<IR::Block*>> children;
+
+  IR::Block* intersect(IR::Block* a, IR::Block* b) const;
+
+public:
+  explicit DominatorTree(const IR::Function& function);
+
+  bool isReachable(const IR::Block* block) const;
+  // nullptr for the entry
+  IR::Block* idom(const IR::Block* block) const;
+  bool dominates(const IR::Block* a, const IR::Block* b) const;
+  const std::vector<IR::Block*>& childrenOf(const IR::Block* block) const;
+  const std::vector<IR::Block*>& reversePostorder() const { return order; }
+};
@@ -3,30 +3,40 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "Types.hpp"
 #include "Token.hpp"
 
-class Environment {
-  std::map<std::string, Value> values;
-  std::shared_ptr<Environment> enclosing;
+// Local captured by a closure. Points into the interpreter's stack while
+// the frame that declared it runs and holds the value itself afterwards.
+class ObjUpvalue : public Obj {
 public:
-  Environment(std::shared_ptr<Environment> enclosing);
-  Environment();
-
-  void define(std::string name, Value value);
-  Value get(const Token& name) const;
-  Value getAt(int distance, const std::string& name);
-  Environment* ancestor(int distance);
-  void assign(Token name, Value value);
-  void assignAt(int distance, Token name, Value value);
+  Value* location;
+  Value closed;
+
+  ObjUpvalue(Value* slot);
+  virtual void trace(Heap& heap) override;
 };
 
-class TemporaryEnv {
-  std::shared_ptr<Environment>& env;
-  std::shared_ptr<Environment> prevEnv;
-  public:
-  TemporaryEnv(std::shared_ptr<Environment>& currentEnv,
-      std::shared_ptr<Environment> newEnv);
-  ~TemporaryEnv(); 
+// Top level variables. They are late bound, so a slot may be used before
+// anything was defined in it.
+class Globals {
+  std::map<std::string, int> slots;
+  std::vector<std::string> names;
+  std::vector<Value> values;
+  std::vector<uint8_t> defined;
+public:
+  int slotFor(const std::string& name);
+
+  bool isDefined(int slot) const { return defined[slot]; }
+  Value& at(int slot) { return values[slot]; }
+  const std::string& nameOf(int slot) const { return names[slot]; }
+  int size() const { return values.size(); }
+
+  void define(int slot, Value value);
+  Value get(int slot, const Token& name) const;
+  void assign(int slot, const Token& name, Value value);
+  void mark(Heap& heap) const;
 };
+
@@ -1,17 +1,36 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <vector>
 
+#include "InlineCache.hpp"
+#include "Numbers.hpp"
 #include "Token.hpp"
+#include "TypeFeedback.hpp"
 #include "Types.hpp"
 
 template <typename T> class Visitor;
 
 namespace Expr {
 
+// Where a variable lives, filled in by the Resolver. Locals are `slot`
+// in the frame of the running function, upvalues index the cells its
+// closure captured and globals index the interpreter's table of globals.
+struct VarSlot {
+  enum Kind : uint8_t { GLOBAL, LOCAL, UPVALUE };
+
+  Kind kind { GLOBAL };
+  int slot { -1 };
+
+  bool isGlobal() const { return kind == GLOBAL; }
+};
+
 class Expr {
 public:
+  // what the type checker proved every value of this expression to be
+  Type type { Type::ANY };
+
   virtual Value accept(Visitor<Value> *visitor) = 0;
   virtual Type accept(Visitor<Type> *visitor) = 0;
   virtual ~Expr() = default;
@@ -22,16 +41,22 @@ using Exprs = std::vector<ExprPtr>;
 
 struct This : public Expr {
   Token keyword;
+  VarSlot slot;
   This(Token keyword);
   virtual Value accept(Visitor<Value> *visitor) override;
   virtual Type accept(Visitor<Type> *visitor) override;
 };
 
+class Get;
+
 class Call : public Expr {
 public:
   ExprPtr callee;
   Token paren;
   Exprs arguments;
+  // callee when it is a property access, `obj.method(args)` calls the
+  // method without binding it first
+  Get* property;
   Call(ExprPtr callee, Token paren, const std::vector<ExprPtr> &arguments);
   virtual Value accept(Visitor<Value> *visitor) override;
   virtual Type accept(Visitor<Type> *visitor) override;
@@ -41,6 +66,8 @@ class Get : public Expr {
 public:
   ExprPtr object;
   Token name;
+  PropertyCache cache;
+  TypeFeedback feedback;
 
   Get(ExprPtr object, Token name);
   virtual Value accept(Visitor<Value> *visitor) override;
@@ -52,6 +79,7 @@ public:
   ExprPtr object;
   Token name;
   ExprPtr value;
+  PropertyCache cache;
 
   Set(ExprPtr object, Token name, ExprPtr value);
   virtual Value accept(Visitor<Value> *visitor) override;
@@ -63,8 +91,11 @@ public:
   ExprPtr left;
   Token op;
   ExprPtr right;
+  // like Binop::chain, for a chain like a or b or c
+  std::vector<Logical*> chain;
 
   Logical(ExprPtr left, Token op, ExprPtr right);
+  ~Logical();
   virtual Value accept(Visitor<Value> *visitor) override;
   virtual Type accept(Visitor<Type> *visitor) override;
 };
@@ -73,6 +104,10 @@ class Assign : public Expr {
 public:
   Token name;
   ExprPtr value;
+  VarSlot slot;
+  // set when the loop optimizer found this to be `name = name + step`
+  // for a counter of the loop, which can then skip evaluating the Binop
+  Value step { Nil() };
 
   Assign(Token name, ExprPtr expr);
   Assign(const Assign &other);
@@ -83,6 +118,7 @@ public:
 class Variable : public Expr {
 public:
   Token name;
+  VarSlot slot;
   Variable(Token name);
   Variable(const Variable &other);
   virtual Value accept(Visitor<Value> *visitor) override;
@@ -94,8 +130,15 @@ public:
   ExprPtr left;
   ExprPtr right;
   Token op;
+  // what the operator does to numbers, nothing for == and !=
+  std::optional<Numbers::Op> arithmetic;
+  TypeFeedback feedback;
+  // set by the resolver on the last operator of a chain like a + b - c:
+  // all of its operators innermost first, which the interpreter runs in a loop
+  std::vector<Binop*> chain;
 
   Binop(ExprPtr left, Token op, ExprPtr right);
+  ~Binop();
   virtual Value accept(Visitor<Value> *visitor) override;
   virtual Type accept(Visitor<Type> *visitor) override;
 };
@@ -104,6 +147,7 @@ class Unop : public Expr {
 public:
   ExprPtr expr;
   Token op;
+  TypeFeedback feedback;
 
   Unop(Token op, ExprPtr expr);
   virtual Value accept(Visitor<Value> *visitor) override;
@@ -124,11 +168,17 @@ public:
   LiteralPtr value;
   Literal(LiteralPtr value);
   Literal(bool b);
-  Literal(float f);
-  Literal(std::string s);
+  Literal(double d);
   Literal(Nil s);
   virtual Value accept(Visitor<Value> *visitor) override;
   virtual Type accept(Visitor<Type> *visitor) override;
 };
 
+// Chains like `a + b - c` nest to the left, a level deeper with every
+// operator. Passes go through one in a loop over these instead of recursing
+// into the left operands: `expr` and the nodes of its class down its left
+// operands, innermost first.
+std::vector<Binop*> leftChain(Binop* expr);
+std::vector<Logical*> leftChain(Logical* expr);
+
 }; // namespace Expr
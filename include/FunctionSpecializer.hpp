@@ -0,0 +1,85 @@
+#pragma once
+
+#include "AstRewriter.hpp"
+#include "Lox.hpp"
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Clones top level functions for calls that pass literals. The clone
+// takes only the other parameters and declares the literal ones as
+// locals, so constant folding inside it propagates them and drops the
+// branches they rule out:
+//
+//   render(item, true, 80)  =>  render$1(item)
+//   fun render$1(item) { var wide = true; var width = 80; ...folded... }
+//
+// Clones are shared by every call with the same literals and a function
+// gets at most `limit` of them. A clone in which folding evaluates no
+// operator and drops no branch is thrown away and the call is left as it
+// was.
+class FunctionSpecializer : public AstRewriter {
+  struct Variant {
+    // empty when specializing didn't pay off
+    std::string name;
+    // which arguments the clone keeps
+    std::vector<bool> kept;
+  };
+
+  struct Candidate {
+    Stmt::Function* function;
+    int declarations { 0 };
+    bool assigned { false };
+    // set when the top level declaration has run
+    bool declared { false };
+    size_t size { 0 };
+    // by signatureOf the calls
+    std::map<std::string, Variant> variants;
+    int clones { 0 };
+  };
+
+  struct Site {
+    std::string function;
+    std::string signature;
+    std::string clone;
+    int line;
+
+    bool operator==(const Site& other) const = default;
+  };
+
+  // functions bigger than this, in nodes, are not cloned
+  static constexpr size_t MAX_CLONED = 400;
+
+  Lox& lox;
+  int limit;
+  std::map<std::string, Candidate> candidates;
+  // clones to declare after the function they were made from
+  std::vector<std::pair<Stmt::Function*, Stmt::StmtPtr>> clones;
+  int functionDepth { 0 };
+  int cloneDepth { 0 };
+  int freshNames { 0 };
+  int capped { 0 };
+  int droppedBranches { 0 };
+  std::vector<Site> sites;
+
+  void collect(Stmt::Stmts& program);
+  Candidate* specializableCall(Expr::Call* call);
+  // the literals as written and "_" for the other arguments
+  static std::string signatureOf(Expr::Call* call);
+  Variant& variantFor(Candidate& candidate, Expr::Call* call);
+  std::shared_ptr<Stmt::Function> specialize(Candidate& candidate,
+      Expr::Call* call, const std::string& name);
+
+public:
+  FunctionSpecializer(Lox& lox, int limit);
+
+  void specialize(Stmt::Stmts& program);
+  void printSummary(std::ostream& out) const;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+};
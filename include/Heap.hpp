@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <new>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Types.hpp"
+
+class Heap;
+
+// Something that holds references the collector cannot see on its own,
+// like an interpreter's environments or the VM stack
+class RootSource {
+public:
+  virtual void markRoots(Heap& heap) = 0;
+protected:
+  ~RootSource() = default;
+};
+
+// Owns every object a Value can point to. Objects are chained into a
+// list as they are allocated and reclaimed by a mark and sweep collector
+// once the heap grew past the threshold.
+class Heap {
+  Obj* objects { nullptr };
+  size_t bytesAllocated { 0 };
+  size_t nextGC;
+  // the heap never waits for less than this before collecting
+  size_t minThreshold;
+
+  std::vector<RootSource*> roots;
+  // objects kept alive no matter what, like string literals in the AST
+  std::vector<Obj*> pinned;
+  std::vector<Obj*> grayStack;
+
+  struct Stats {
+    size_t collections { 0 };
+    size_t bytesAllocated { 0 };
+    size_t bytesFreed { 0 };
+    std::chrono::duration<double, std::milli> totalPause { 0 };
+    std::chrono::duration<double, std::milli> maxPause { 0 };
+  } stats;
+
+  void link(Obj* object, size_t size);
+  void traceReferences();
+  void sweep();
+
+public:
+  static constexpr size_t DEFAULT_THRESHOLD = 1024 * 1024;
+  static constexpr double DEFAULT_GROWTH = 2.0;
+
+  // after a collection the next one runs once the heap grew to
+  // growthFactor times the bytes that survived
+  double growthFactor { DEFAULT_GROWTH };
+
+  Heap(size_t threshold = DEFAULT_THRESHOLD);
+  Heap(const Heap&) = delete;
+  Heap& operator=(const Heap&) = delete;
+  ~Heap();
+
+  template <typename T, typename... Args>
+  T* make(Args&&... args) {
+    T* object = new T(std::forward<Args>(args)...);
+    link(object, sizeof(T));
+    return object;
+  }
+
+  // for objects followed by a variable sized array, like instance fields
+  template <typename T, typename... Args>
+  T* makeWithTail(size_t tailBytes, Args&&... args) {
+    void* memory = ::operator new(sizeof(T) + tailBytes);
+    T* object = new(memory) T(std::forward<Args>(args)...);
+    link(object, sizeof(T) + tailBytes);
+    return object;
+  }
+
+  ObjString* makeString(std::string chars);
+  // boxed only when it doesn't fit in the Value itself
+  Value makeInteger(int64_t value);
+  // memory an object owns besides itself, counted until it is freed
+  void charge(Obj* object, size_t bytes);
+
+  void setThreshold(size_t threshold) { nextGC = minThreshold = threshold; }
+  void addRoots(RootSource* source);
+  void removeRoots(RootSource* source);
+  void pin(Obj* object);
+  void unpinAll();
+
+  void markValue(Value value);
+  void markObject(Obj* object);
+  void collect(Obj* newest = nullptr);
+
+  void printStats(std::ostream& out) const;
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Token.hpp"
+#include "Types.hpp"
+
+// X-macro list so the opcode enum and the names in the dump stay in sync
+#define LOX_IR_OPS(X)  \
+  X(CONST)             \
+  X(PARAM)             \
+  X(PHI)               \
+  X(ADD)               \
+  X(SUBTRACT)          \
+  X(MULTIPLY)          \
+  X(DIVIDE)            \
+  X(EQUAL)             \
+  X(NOT_EQUAL)         \
+  X(GREATER)           \
+  X(GREATER_EQUAL)     \
+  X(LESS)              \
+  X(LESS_EQUAL)        \
+  X(BIT_AND)           \
+  X(BIT_OR)            \
+  X(BIT_XOR)           \
+  X(SHIFT_LEFT)        \
+  X(SHIFT_RIGHT)       \
+  X(NEGATE)            \
+  X(NOT)               \
+  X(INCREMENT)         \
+  X(DECREMENT)         \
+  X(BIT_NOT)           \
+  X(NEW_CELL)          \
+  X(LOAD_CELL)         \
+  X(STORE_CELL)        \
+  X(UPVALUE_CELL)      \
+  X(GET_GLOBAL)        \
+  X(SET_GLOBAL)        \
+  X(DEFINE_GLOBAL)     \
+  X(CLOSURE)           \
+  X(CLASS)             \
+  X(GET_PROPERTY)      \
+  X(SET_PROPERTY)      \
+  X(CALL)              \
+  X(INVOKE)            \
+  X(PRINT)             \
+  X(JUMP)              \
+  X(BRANCH)            \
+  X(RETURN)
+
+// SSA form of a resolved program. Every instruction defines at most one
+// value, which is the instruction itself, and is defined exactly once.
+// Locals no closure captures are plain SSA values joined by phis, the
+// captured ones live in cells that are loaded and stored explicitly.
+namespace IR {
+
+enum class Op : uint8_t {
+#define LOX_IR_OP_ENUM(op) op,
+  LOX_IR_OPS(LOX_IR_OP_ENUM)
+#undef LOX_IR_OP_ENUM
+};
+
+const char* opName(Op op);
+bool hasResult(Op op);
+bool isTerminator(Op op);
+// can't fail and changes nothing, so it can go once nothing uses it
+bool isRemovable(Op op);
+
+class Block;
+class Function;
+
+class Instr {
+public:
+  Op op;
+  // register the value lives in, see Function::renumber
+  int id { 0 };
+  std::vector<Instr*> operands;
+  Block* block;
+  // names for the dump and lines for errors
+  Token token;
+
+  // CONST
+  Value constant;
+  // PARAM number, UPVALUE_CELL index or global slot
+  int index { 0 };
+  // CLOSURE
+  Function* function { nullptr };
+  // JUMP goes to the first, BRANCH to the first when the condition is
+  // truthy and to the second otherwise
+  Block* targets[2] { nullptr, nullptr };
+
+  Instr(Op op, Block* block, Token token);
+};
+
+class Block {
+public:
+  int id;
+  // phis first, the terminator last
+  std::vector<std::unique_ptr<Instr>> instrs;
+  // a phi has one operand per predecessor, in this order
+  std::vector<Block*> preds;
+
+  Block(int id);
+  Instr* terminator() const;
+  std::vector<Block*> successors() const;
+  size_t phiCount() const;
+  // drops the edge from `pred` and the phi operands coming along it
+  void removePred(Block* pred);
+};
+
+class Function {
+public:
+  std::string name;
+  int arity { 0 };
+  // the receiver of a method is parameter zero
+  bool isMethod { false };
+  int upvalueCount { 0 };
+  // the entry block is the first one
+  std::vector<std::unique_ptr<Block>> blocks;
+  int registerCount { 0 };
+  int nextBlockId { 0 };
+
+  int paramCount() const { return arity + (isMethod ? 1 : 0); }
+  Block* newBlock();
+  Block* entry() const { return blocks.front().get(); }
+  void replaceUses(Instr* from, Instr* to);
+  // gives every instruction a register, after the passes removed some
+  void renumber();
+  void print(std::ostream& out) const;
+};
+
+class Module {
+public:
+  // the script comes first, then every function in the order it appears
+  std::vector<std::unique_ptr<Function>> functions;
+
+  Function* newFunction(const std::string& name);
+  void print(std::ostream& out) const;
+};
+
+}
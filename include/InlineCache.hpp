@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class LoxFunction;
+class Shape;
+
+// Remembers what a property access site found for the last few shapes
+// it saw. Gets cache either a field slot or a method, sets cache the slot
+// and, when the field had to be added, the shape the instance moves to.
+// Past MAX_ENTRIES shapes the site is megamorphic and stops caching.
+class PropertyCache {
+public:
+  static constexpr int MAX_ENTRIES = 4;
+
+  struct Entry {
+    uint64_t shapeId;
+    // field slot, -1 when the property is a method
+    int slot;
+    LoxFunction* method;
+    Shape* transition;
+  };
+
+private:
+  Entry entries[MAX_ENTRIES];
+  int count { 0 };
+  bool megamorphic { false };
+
+public:
+  size_t hits { 0 };
+  size_t misses { 0 };
+
+  Entry* find(uint64_t shapeId) {
+    for(int i = 0; i < count; i++) {
+      if(entries[i].shapeId == shapeId) {
+        hits++;
+        return &entries[i];
+      }
+    }
+    misses++;
+    return nullptr;
+  }
+
+  // returns true when this entry turned the site megamorphic
+  bool add(const Entry& entry) {
+    if(megamorphic) return false;
+    if(count == MAX_ENTRIES) {
+      megamorphic = true;
+      return true;
+    }
+    entries[count++] = entry;
+    return false;
+  }
+
+  bool isMegamorphic() const { return megamorphic; }
+  int size() const { return count; }
+};
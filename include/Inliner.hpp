@@ -0,0 +1,81 @@
+#pragma once
+
+#include "AstRewriter.hpp"
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Replaces calls to small top level functions with their body. A function
+// qualifies when its body is a single `return expr;` of at most `budget`
+// nodes, it can't reach itself through calls and its name is declared
+// once and never assigned.
+//
+// Arguments that are literals or variable reads are substituted for the
+// parameters when the body can't change them in between. Otherwise, when
+// the call is what its statement evaluates first, the arguments go into
+// fresh locals declared before the statement, named after the parameters.
+class Inliner : public AstRewriter {
+  struct Candidate {
+    Stmt::Function* function;
+    // the returned expression as it was before anything got inlined
+    Expr::ExprPtr body;
+    // calls the global functions named here
+    std::set<std::string> callees;
+    // top level declarations with this name
+    int declarations { 0 };
+    bool assigned { false };
+    bool recursive { false };
+    bool inlinable { false };
+    // names the body reads from the globals
+    std::set<std::string> globals;
+    // the body calls or assigns, so parameters can't be substituted by
+    // variable reads
+    bool hasEffects { false };
+    // set when the top level declaration has run
+    bool declared { false };
+  };
+
+  struct Site {
+    std::string function;
+    int line;
+    bool throughLocals;
+  };
+
+  size_t budget;
+  std::map<std::string, Candidate> candidates;
+  // local names visible from the node being rewritten
+  std::vector<std::set<std::string>> scopes;
+  int functionDepth { 0 };
+  int freshNames { 0 };
+  std::vector<Site> sites;
+
+  void collect(Stmt::Stmts& program);
+  bool reaches(const std::string& from, const std::string& to,
+      std::set<std::string>& seen);
+  Candidate* inlinableCall(Expr::Call* call);
+  bool substitutable(Candidate& candidate, Expr::Call* call);
+  Expr::ExprPtr inlineBody(Candidate& candidate, Expr::Call* call,
+      bool throughLocals);
+  // inlines the call at the root of a statement through fresh locals
+  void inlineRoot(Expr::ExprPtr& expr);
+  void declare(const std::string& name);
+
+public:
+  Inliner(size_t budget);
+
+  void inlineCalls(Stmt::Stmts& program);
+  void printSummary(std::ostream& out) const;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* stmt) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+};
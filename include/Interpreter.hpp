@@ -4,16 +4,22 @@
 #include <vector>
 #include <stdexcept>
 #include <map>
+#include <ostream>
+#include <span>
 
 #include "Visitor.hpp"
 #include "Lox.hpp"
 #include "Types.hpp"
 #include "Environment.hpp"
+#include "InlineCache.hpp"
+#include "Jit.hpp"
+#include "Tracer.hpp"
+#include "TypeFeedback.hpp"
 
 // Forward declarations -------------------------------------------------------
 class Value;
 class Token;
-class Environment;
+class LoxFunction;
 
 namespace Stmt {
     class Stmt;
@@ -27,37 +33,123 @@ namespace Expr {
     using Exprs = std::vector<ExprPtr>;
 }
 
+namespace Closures {
+    struct Body;
+}
+
 using Stmt::Stmts, Stmt::StmtPtr, Expr::Exprs, Expr::ExprPtr;
 // ----------------------------------------------------------------------------
 
-class BreakLoop : public std::runtime_error {
-public:
-  BreakLoop() : std::runtime_error("") {}
-  ~BreakLoop() = default;
-};
-
-class Return : public std::runtime_error {
-public:
-  Value value;
-
-  Return(const Value& value) : std::runtime_error(""), value { value } {}
-  ~Return() = default;
+// How a statement finished. Return and break skip the rest of every
+// enclosing block until a function call or a loop consumes them.
+enum class Completion {
+  NORMAL,
+  RETURN,
+  BREAK,
+  // a return whose call is left for the function call to make
+  TAIL_CALL,
 };
 
-class Interpreter : public Visitor<Value> {
-  std::shared_ptr<Environment> environment;
+class Interpreter : public Visitor<Value>, public RootSource {
+  // compiled code runs on the same frames, upvalues and caches
+  friend class ClosureCompiler;
+
+  static constexpr int STACK_MAX = 1 << 16;
+
+  // locals of every running call, each frame sits on top of its caller's
+  std::vector<Value> stack;
+  Value* frame;
+  // first slot past the running frame
+  Value* stackTop;
+  // running function, nullptr at the top level
+  LoxFunction* closure { nullptr };
+  // upvalues still pointing into the stack, sorted by slot
+  std::vector<ObjUpvalue*> openUpvalues;
+  // values evaluated but not stored anywhere yet, like the left operand
+  // while the right one runs or arguments of a call in progress
+  std::vector<Value> temporaries;
   Lox& lox;
-  std::map<Expr::Expr*, int> locals {};
-
-  void checkNumberOperand(Token op, Value& val) const; 
-  void checkNumberOperands(Token op, Value& left, Value& right) const; 
+  // where the native stack was when the program started and how far
+  // calls may grow it, past that they overflow instead of crashing
+  uintptr_t nativeStackBase { 0 };
+  size_t nativeStackBudget;
+  Completion completion { Completion::NORMAL };
+  Value returnValue;
+  // what a TAIL_CALL calls once the returning frame is gone
+  struct TailCall {
+    Value callee;
+    // the object a method is called on, nil for other callees
+    Value receiver;
+    std::vector<Value> args;
+    // where errors of a native callee are reported
+    const Token* paren { nullptr };
+  } tailCall;
+  // compiles hot functions and loops, nullptr under --no-jit
+  std::unique_ptr<Jit> jit;
+  std::unique_ptr<Tracer> tracer;
+
+  // property access sites that ran, for --ic-stats
+  struct CacheSite {
+    const PropertyCache* cache;
+    const Token* name;
+    const char* kind;
+  };
+  std::vector<CacheSite> cacheSites;
+  size_t megamorphicSites { 0 };
+
+  // operator and property sites quickened at least once, for
+  // --dump-quickening
+  struct QuickenedSite {
+    const TypeFeedback* feedback;
+    const Token* token;
+    const char* kind;
+  };
+  std::vector<QuickenedSite> quickenedSites;
+
+  void quicken(TypeFeedback& feedback, const Token& token, const char* kind,
+      TypeFeedback::State state);
+  Value onNumbers(Expr::Binop* expr, Value left, Value right);
+  Value onNumber(const Token& op, Value right);
+  Value binop(const Token& op, Value left, Value right);
+  // one operator of a chain, once its left operand is known
+  Value operate(Expr::Binop* expr, Value left);
+  Value shortCircuit(Expr::Logical* expr, Value left);
+  Value unop(const Token& op, Value right);
+  void cacheMiss(PropertyCache& cache, const Token& name, const char* kind,
+      const PropertyCache::Entry& entry);
+  PropertyCache::Entry lookUpProperty(Expr::Get* expr, LoxInstance* instance);
+  Value getProperty(Expr::Get* expr, Value object);
+  Value setProperty(Expr::Set* expr, Value object, Value value);
+  LoxFunction* evaluateCall(Expr::Call* expr);
+  // pushes what `object.name(...)` calls, the object itself for a method
+  LoxFunction* pushCallee(Expr::Get* get, Value object);
+  void checkCall(Expr::Call* expr, Value callee, LoxFunction* method);
+  // calls what evaluateCall pushed from `base` on and pops it
+  Value finishCall(size_t base, LoxFunction* method, const Token& paren);
+  Completion saveTailCall(size_t base, LoxFunction* method,
+      const Token& paren);
+  bool stepCounter(Expr::Assign* expr, Value& result);
+  void enterFrame(LoxFunction* function, const Value* receiver,
+      std::span<const Value> args, Value* base);
+  Completion runBody(const Stmt::Function& declaration);
+  void recover(const RuntimeError& error, int slotCount);
+  // lowest address compiled code may grow the native stack to
+  uintptr_t nativeStackLimit() const;
+
+  void checkNumberOperand(const Token& op, Value val) const; 
   void reportDifferentTypesOperands() const; 
   bool isTruthy(Value val) const; 
   bool isEqual(Value left, Value right) const; 
   
-  Value lookUpVariable(Token name, Expr::Expr* expr);
+  Value lookUpVariable(const Token& name, const Expr::VarSlot& slot);
+  void define(const Expr::VarSlot& slot, Value value);
+  void assign(const Token& name, const Expr::VarSlot& slot, Value value);
+
+  ObjUpvalue* captureUpvalue(Value* local);
+  void closeUpvalues(Value* last);
+  std::vector<ObjUpvalue*> captureUpvalues(const Stmt::Function& declaration);
 public:
-  std::shared_ptr<Environment> globals;
+  Globals globals;
 
   virtual Value visitBinop(Expr::Binop* expr) override; 
   virtual Value visitUnop(Expr::Unop* expr) override; 
@@ -85,12 +177,24 @@ public:
   virtual Value visitThisExpr(Expr::This* expr) override;
 
   Interpreter(Lox& lox);
+  Interpreter(const Interpreter&) = delete;
+  ~Interpreter();
 
-  void execute(const StmtPtr& stmt); 
+  Completion execute(const StmtPtr& stmt); 
   Value evaluate(const ExprPtr& expr); 
-  void executeBlock(const Stmts& statements,
-      std::shared_ptr<Environment> env); 
-  void resolve(Expr::Expr* expr, int depth);
-
-  void interpret(const Stmts& program); 
+  Completion executeBlock(const Stmts& statements); 
+  // runs the function in a new frame, methods get `receiver` in slot zero
+  Value invoke(LoxFunction* function, const Value* receiver,
+      std::span<const Value> args);
+  Value takeReturnValue();
+  Heap& heap();
+  virtual void markRoots(Heap& heap) override;
+  void printCacheStats(std::ostream& out) const;
+  void printQuickening(std::ostream& out) const;
+  void printJitStats(std::ostream& out) const;
+  void printTraceStats(std::ostream& out) const;
+
+  void interpret(const Stmts& program, int slotCount); 
+  // runs the program as compiled by the ClosureCompiler
+  void interpret(const Closures::Body& program, int slotCount);
 };
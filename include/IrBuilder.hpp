@@ -0,0 +1,106 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "IR.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+
+class IrInterpreter;
+
+// Lowers a resolved program into SSA form. A local is tracked by its
+// frame slot: each block remembers the value last written to it and a
+// read the block can't answer looks through the predecessors, adding a
+// phi where several of them meet. Loop headers get their phis completed
+// once the back edge is known (Braun et al., "Simple and Efficient
+// Construction of Static Single Assignment Form").
+//
+// Slots a nested function captures hold a cell instead, made where the
+// variable is declared so every loop iteration gets its own.
+class IrBuilder : public Visitor<Value> {
+  struct FunctionState {
+    IR::Function* function;
+    IR::Block* block { nullptr };
+    // slots whose variables live in cells
+    std::set<int> cells {};
+    std::map<IR::Block*, std::map<int, IR::Instr*>> definitions {};
+    std::map<IR::Block*, std::map<int, IR::Instr*>> incompletePhis {};
+    std::set<IR::Block*> sealed {};
+    // phis of sealed blocks whose operands are still to be read
+    std::vector<std::pair<int, IR::Instr*>> unfilledPhis {};
+    // where a break jumps to, innermost loop last
+    std::vector<IR::Block*> loopExits {};
+  };
+
+  IrInterpreter& interpreter;
+  IR::Module* module { nullptr };
+  std::vector<FunctionState> functions;
+  // value of the expression lowered last
+  IR::Instr* result { nullptr };
+  int line { 0 };
+
+  FunctionState& current() { return functions.back(); }
+  Token here() const;
+
+  IR::Instr* emit(IR::Op op, const Token& token,
+      std::vector<IR::Instr*> operands = {});
+  IR::Instr* constant(Value value);
+  IR::Instr* newPhi(IR::Block* block);
+  IR::Block* newBlock();
+  void startBlock(IR::Block* block);
+  // code after a return or break goes into a block nothing jumps to
+  void startUnreachable();
+  void jump(IR::Block* target);
+  void branch(IR::Instr* condition, IR::Block* whenTrue,
+      IR::Block* whenFalse);
+  void seal(IR::Block* block);
+
+  void writeVariable(int slot, IR::Block* block, IR::Instr* value);
+  IR::Instr* readVariable(int slot, IR::Block* block);
+  IR::Instr* lookUp(int slot, IR::Block* block);
+  void fillPhis();
+
+  void defineLocal(int slot, IR::Instr* value);
+  IR::Instr* read(const Expr::VarSlot& slot, const Token& name);
+  void assign(const Expr::VarSlot& slot, const Token& name, IR::Instr* value);
+  void define(const Expr::VarSlot& slot, const Token& name, IR::Instr* value);
+  // a cell for a local declaration the declared value can refer to
+  IR::Instr* declareCell(const Expr::VarSlot& slot);
+
+  IR::Function* lowerFunction(Stmt::Function* stmt, bool isMethod);
+  IR::Instr* makeClosure(Stmt::Function* stmt, bool isMethod);
+  IR::Instr* lower(const Expr::ExprPtr& expr);
+  void lower(const Stmt::Stmts& statements);
+
+public:
+  IrBuilder(IrInterpreter& interpreter);
+
+  void lower(Stmt::Stmts& program, IR::Module& module);
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* varstmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
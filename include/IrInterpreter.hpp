@@ -0,0 +1,100 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Environment.hpp"
+#include "IR.hpp"
+#include "Lox.hpp"
+#include "LoxClass.hpp"
+#include "Types.hpp"
+
+class IrInterpreter;
+
+class IrClosure : public Callable {
+public:
+  IR::Function* function;
+  std::vector<ObjUpvalue*> cells;
+  IrInterpreter* interpreter;
+
+  IrClosure(IR::Function* function, IrInterpreter* interpreter);
+  virtual void trace(Heap& heap) override;
+  virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+class IrBoundMethod : public Callable {
+public:
+  Value receiver;
+  IrClosure* method;
+
+  IrBoundMethod(const Value& receiver, IrClosure* method);
+  virtual void trace(Heap& heap) override;
+  virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+// Instances are plain LoxInstances, the methods are IR closures
+class IrClass : public LoxClass {
+public:
+  std::map<std::string, IrClosure*> irMethods;
+
+  IrClass(const std::string& name, Heap& heap);
+  virtual void trace(Heap& heap) override;
+  IrClosure* findIrMethod(const std::string& name);
+};
+
+// Runs a Module. Each call gets a frame of registers on a shared stack,
+// one per instruction of the function, and a jump moves the phi
+// operands of the edge taken into the phis of the target block.
+class IrInterpreter : public RootSource {
+  // Like the VM's, both stacks live on the heap, start small and double
+  // while together they stay within Lox::stackBudget. A grown value stack
+  // moves, so a frame is found again by its offset after every call.
+  static constexpr int INITIAL_FRAMES = 64;
+  static constexpr int INITIAL_SLOTS = 4096;
+
+  Lox& lox;
+  std::vector<Value> stack;
+  Value* stackTop;
+  // running closures, innermost last
+  std::vector<IrClosure*> frames;
+  // phi values of the edge being taken
+  std::vector<Value> phiValues;
+  Globals globals;
+  // every call recurses on the native stack, callClosure stops before it
+  // runs out
+  uintptr_t nativeStackBase { 0 };
+  size_t nativeStackBudget;
+  // the call of the native running now, where what it calls back reports
+  // its errors
+  const Token* nativeCaller { nullptr };
+
+  Value execute(IrClosure* closure, Value* frame);
+  // copies the arguments of a CALL or INVOKE right above stackTop
+  void pushArguments(const IR::Instr* instr, Value* registers);
+  Value callValue(const Value& callee, int argCount, const Token& token);
+  Value callClosure(IrClosure* closure, bool withReceiver, int argCount,
+      const Token& token);
+  void checkArity(int expected, int argCount, const Token& token);
+  void growFrames(const Token& token);
+  // makes room for `slots` values above stackTop
+  void reserveStack(size_t slots, const Token& token);
+  // jumps from `from` to `to`, returns the first instruction to run
+  size_t enterBlock(IR::Block* from, IR::Block* to, Value* registers);
+
+public:
+  IrInterpreter(Lox& lox);
+  IrInterpreter(const IrInterpreter&) = delete;
+  ~IrInterpreter();
+
+  int globalSlot(const std::string& name);
+  Value callFromHost(const Value& callee, const std::vector<Value>& args);
+  void interpret(IR::Module& module);
+  virtual void markRoots(Heap& heap) override;
+};
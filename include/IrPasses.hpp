@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "PassManager.hpp"
+
+// Transforms over the SSA form, named as --ir-passes spells them.
+namespace IrPasses {
+
+// phis: drops phis whose operands are all the same value or the phi
+// itself, which building the IR leaves behind at every join
+class SimplifyPhis : public Pass {
+public:
+  const char* name() const override { return "phis"; }
+  bool run(IR::Function& function, AnalysisManager& analyses) override;
+};
+
+// fold: computes operations on constants and turns branches on a
+// constant into jumps
+class FoldConstants : public Pass {
+public:
+  const char* name() const override { return "fold"; }
+  bool run(IR::Function& function, AnalysisManager& analyses) override;
+};
+
+// cfg: removes unreachable blocks and merges a block into the one
+// before it when that is its only way in
+class SimplifyCfg : public Pass {
+public:
+  const char* name() const override { return "cfg"; }
+  bool run(IR::Function& function, AnalysisManager& analyses) override;
+};
+
+// gvn: an operation computed again where an identical one dominates it
+// uses the first result. Arithmetic that could fail qualifies too, the
+// dominating one would have failed first.
+class ValueNumbering : public Pass {
+public:
+  const char* name() const override { return "gvn"; }
+  bool run(IR::Function& function, AnalysisManager& analyses) override;
+};
+
+// dce: removes instructions that can't fail and whose value is unused
+class DeadCodeElimination : public Pass {
+public:
+  const char* name() const override { return "dce"; }
+  bool run(IR::Function& function, AnalysisManager& analyses) override;
+};
+
+// verify: checks every value is defined before all its uses, throwing
+// std::logic_error when not. Changes nothing.
+class Verify : public Pass {
+public:
+  const char* name() const override { return "verify"; }
+  bool run(IR::Function& function, AnalysisManager& analyses) override;
+};
+
+}
+
+// nullptr when there is no pass with that name
+std::unique_ptr<Pass> createPass(const std::string& name);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "Environment.hpp"
+#include "Types.hpp"
+
+class LoxFunction;
+
+// What compiled code gets in rdi
+struct JitContext {
+  // the interpreter's globals, which calls check their callee in
+  Value* globals;
+  // lowest address the native stack may grow to
+  uintptr_t stackLimit;
+  // a Jit::Bail, set by the code that bailed out
+  uint32_t bail;
+};
+
+// A function compiled to x86-64. Compiled callers call it through
+// `entry`, so functions calling each other can be compiled in any order.
+struct JitFunction {
+  // gets the arguments last one first, returns Jit::BAIL_OUT when the
+  // interpreter has to run the call instead
+  using Entry = uint64_t (*)(JitContext* context, const uint64_t* args);
+
+  std::string name;
+  int line;
+  Entry entry { nullptr };
+  // why it can't be compiled, empty when it was
+  std::string rejected;
+  // still being compiled, only compiled callers jump to it then
+  bool compiling { false };
+  size_t codeSize { 0 };
+  int hotAfter { 0 };
+  size_t entries { 0 };
+  // set once the code bailed out, from then on the interpreter runs it
+  uint32_t bail { 0 };
+};
+
+// Baseline method JIT for the tree-walker. A function that was called
+// `threshold` times is compiled to machine code if its body only uses
+// numbers, its own locals, operators, if, while and calls of top level
+// functions that qualify too. Such code has no side effects, so when it
+// meets anything it doesn't handle, an operand that isn't a number, an
+// integer that doesn't fit in a Value or a callee that was reassigned, it
+// bails out and the interpreter runs the call again from the start.
+class Jit {
+public:
+  enum Bail : uint32_t {
+    NONE,
+    OPERANDS,
+    CALLEE,
+    STACK,
+  };
+  // a quiet NaN no Value uses
+  static constexpr uint64_t BAIL_OUT = 0x7ffc000000000004;
+  static const uint64_t NIL_BITS;
+  static const uint64_t TRUE_BITS;
+  static const uint64_t FALSE_BITS;
+  // what a small integer has under INT_MASK
+  static const uint64_t INT_BITS;
+  static const uint64_t INT_MASK;
+
+  // what compiled code calls for anything but small integers, BAIL_OUT
+  // when the interpreter has to do it
+  static uint64_t binary(uint64_t op, uint64_t left, uint64_t right);
+  static uint64_t equal(uint64_t left, uint64_t right);
+  static uint64_t unary(uint64_t type, uint64_t operand);
+  static uint64_t truthy(uint64_t value);
+
+  Jit(Globals& globals, int threshold);
+  Jit(const Jit&) = delete;
+  ~Jit();
+
+  // runs `function` natively once it got hot, false when the
+  // interpreter has to
+  bool call(LoxFunction* function, std::span<const Value> args,
+      uintptr_t stackLimit, Value& result);
+  // compiles `function`, which is rejected when it can't be
+  JitFunction* compile(LoxFunction* function);
+  void markRoots(Heap& heap) const;
+  void printStats(std::ostream& out) const;
+
+private:
+  struct Mapping {
+    void* memory;
+    size_t size;
+  };
+
+  Globals& globals;
+  int threshold;
+  std::vector<std::unique_ptr<JitFunction>> functions;
+  std::vector<Mapping> mappings;
+  // callees compiled code compares globals against, an address that is
+  // freed could be reused by another function
+  std::vector<LoxFunction*> guarded;
+  // functions compiled along with the one that got hot
+  std::vector<JitFunction*> batch;
+  int compiling { 0 };
+  std::vector<uint64_t> arguments;
+  size_t bails { 0 };
+
+  bool install(JitFunction* function, const std::vector<uint8_t>& code);
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Environment.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+#include "X64Assembler.hpp"
+
+class Jit;
+class LoxFunction;
+
+// Emits x86-64 for the body of a function, see Jit for what qualifies.
+// Values stay NaN boxed: locals live in the native frame, an expression
+// leaves its value in rax and operands wait on the native stack. Small
+// integers are added, compared and so on inline, everything else calls
+// into Numbers, which bails out instead of allocating.
+//
+// The frame below the saved rbp holds rbx (the JitContext), r12 and r13
+// (the masks that tell small integers apart), r14 (BAIL_OUT) and then
+// the locals.
+class JitCompiler : public Visitor<Value> {
+  using Reg = X64Assembler::Reg;
+  using Label = X64Assembler::Label;
+
+  Jit& jit;
+  Globals& globals;
+  const Stmt::Function& declaration;
+  X64Assembler assembler;
+  // the first thing the body does that can't be compiled
+  std::string problem;
+  // values pushed on the native stack, odd ones need padding before a
+  // call to keep it aligned
+  int depth { 0 };
+  std::vector<Label*> loopEnds;
+  Label epilogue;
+  Label bailOperands;
+  Label bailCallee;
+  Label bailStack;
+
+  void reject(const std::string& why);
+  bool rejected() const;
+  int32_t localOffset(int slot) const;
+
+  void compile(const Expr::ExprPtr& expr);
+  void compile(const Stmt::StmtPtr& stmt);
+  void push();
+  void pop(Reg reg);
+  void callHelper(const void* helper, bool canBail);
+  // jumps to `otherwise` unless `reg` is a small integer, uses rdx
+  void checkSmallInt(Reg reg, Label& otherwise);
+  // jumps to `falsy` when rax isn't truthy, keeps rax
+  void branchIfFalsy(Label& falsy);
+  void boolFromAl();
+  void emitOperator(Expr::Binop* expr);
+
+public:
+  // callees this code compares globals against
+  std::vector<LoxFunction*> callees;
+
+  JitCompiler(Jit& jit, Globals& globals, const Stmt::Function& declaration);
+
+  // false when the body can't be compiled, see why()
+  bool compile();
+  const std::string& why() const;
+  const std::vector<uint8_t>& code() const;
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* varstmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "AstRewriter.hpp"
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Optimizes while loops, including the ones `for` is desugared into.
+//
+// Pure expressions whose operands the loop never changes are computed
+// once. The first iteration runs as written, so each such expression has
+// already been evaluated without an error when it is stored in a fresh
+// local, and the rest of the iterations run a copy of the loop reading
+// the local instead:
+//
+//   while(cond) { body; var t = expr; while(cond') body'; break; }
+//
+// Counters only ever updated by `i = i + constant` are marked so the
+// update adds the constant in place.
+class LoopOptimizer : public AstRewriter {
+  // what a loop may change, collected over its condition and body
+  struct Effects {
+    std::set<std::string> declared;
+    std::map<std::string, std::vector<Expr::Assign*>> assigns;
+    bool calls { false };
+    bool sets { false };
+    size_t size { 0 };
+
+    bool changes(const std::string& name) const {
+      return declared.contains(name) || assigns.contains(name);
+    }
+  };
+
+  // loops bigger than this, in nodes, are not copied
+  static constexpr size_t MAX_PEELED = 400;
+
+  // per function being optimized, whether it declares functions that
+  // could capture its locals
+  std::vector<bool> hasClosures;
+  int freshNames { 0 };
+  int hoisted { 0 };
+  int counters { 0 };
+  int peeled { 0 };
+
+  Effects effectsOf(Stmt::While* loop);
+  bool invariant(Expr::Expr* expr, const Effects& effects);
+  void collectInvariants(Expr::ExprPtr& expr, const Effects& effects,
+      std::map<std::string, Expr::ExprPtr>& invariants);
+  // false when the statement can leave the loop, then nothing after it is
+  // sure to run
+  bool collectInvariants(Stmt::Stmt* stmt, const Effects& effects,
+      std::map<std::string, Expr::ExprPtr>& invariants);
+  void markCounters(const Effects& effects);
+  void optimizeFunction(Stmt::Function* function);
+
+public:
+  void optimize(Stmt::Stmts& program);
+  void printSummary(std::ostream& out) const;
+
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Heap.hpp"
+#include "NativeFunctions.hpp"
 #include "Token.hpp"
 #include <string>
 #include <stdexcept>
@@ -12,18 +14,83 @@ class RuntimeError : public std::runtime_error {
     ~RuntimeError() = default;
 };
 
+// Raised by natives, which don't know where they were called from. The
+// engine that called the native reports it as a RuntimeError at the call.
+class NativeError : public std::runtime_error {
+  public:
+    NativeError(const std::string& message) : std::runtime_error(message) {}
+};
+
+// Backend used to execute a program once it passed the static checks
+enum class Engine {
+  TREE_WALKER,
+  // the tree-walker's runtime with the program compiled into closures
+  CLOSURES,
+  VM,
+  IR,
+};
+
 class Lox {
+  // smallest native stack a run gets, whatever the budget
+  static constexpr size_t MIN_NATIVE_STACK = 256 << 10;
+
 public:
   bool hadError { false };
   bool hadRuntimeError { false };
+  Engine engine { Engine::TREE_WALKER };
+  bool gcStats { false };
+  bool icStats { false };
+  bool dumpQuickening { false };
+  // compile hot functions to machine code under the tree-walker and
+  // --closures, after this many calls
+  bool jit { true };
+  int jitThreshold { 100 };
+  bool jitStats { false };
+  // record and compile while loops after this many iterations
+  bool trace { true };
+  int traceThreshold { 50 };
+  bool traceStats { false };
+  // -O level, 0 runs the program as it was parsed
+  int optLevel { 0 };
+  // biggest function body, in nodes, the inliner copies into a caller
+  size_t inlineBudget { 16 };
+  // most clones specialized for constant arguments per function
+  int specializeLimit { 4 };
+  // bytes the stacks of a run may grow to: the native stack it is parsed
+  // and run on, and the value and call stacks of the VM and the IR
+  size_t stackBudget { 64 << 20 };
+  // list every expression common subexpression elimination reused
+  bool dumpCse { false };
+  // IR passes to run, comma separated, the default pipeline under -O1
+  // when empty
+  std::string irPasses;
+  bool dumpIr { false };
+  bool timePasses { false };
+  // translates the program to C++ and builds an executable of it here
+  // instead of running it
+  std::string lox2cpp;
+  // results every memoize()d function keeps, and their counters
+  size_t memoCapacity { Native::Memoize::DEFAULT_CAPACITY };
+  bool memoStats { false };
+  std::deque<Native::MemoStats> memoized;
+  // reject memoize()d functions that print or assign non-local variables
+  bool checkPurity { false };
+  Heap heap;
 
   void runFile(std::string path);
   void runPrompt();
   void run(std::string source);
+  // run() on the thread with the native stack of the budget
+  void execute(const std::string& source);
+  // three quarters of that stack, the rest is for the frames above the
+  // deepest check
+  size_t nativeStackBudget() const;
   //void typeError(Token token, std::string message);
   void error(Token token, std::string message);
   void error(int line, std::string message);
   void report(Token token, std::string where, std::string message);
   void report(int line, std::string where, std::string message);
   void runtimeError(RuntimeError error);
+  // writes `source` next to `output` and compiles it against the runtime
+  bool buildExecutable(const std::string& source, const std::string& output);
 };
@@ -1,23 +1,35 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <string>
 
 #include "Types.hpp"
-#include "Interpreter.hpp"
+#include "Shape.hpp"
 
+class Heap;
 class LoxFunction;
-using FunPtr = std::shared_ptr<LoxFunction>;
 
+// Instances are made on the heap the class was made on, so calling a
+// class doesn't need the engine that runs the program
 class LoxClass : public Callable {
+protected:
+  Heap& heap;
+
 public:
   std::string name;
-  std::map<std::string, FunPtr> methods;
+  std::map<std::string, LoxFunction*> methods;
+  std::unique_ptr<Shape> rootShape;
+  // most fields any instance got so far, new ones reserve that many
+  uint32_t fieldCapacity { 0 };
 
-  LoxClass(const std::string& name, const std::map<std::string, FunPtr>& methods);
+  LoxClass(const std::string& name,
+      const std::map<std::string, LoxFunction*>& methods, Heap& heap);
 
-  FunPtr findMethod(const std::string& name);
+  virtual void trace(Heap& heap) override;
+  LoxFunction* findMethod(const std::string& name);
   virtual std::string toString() override;
+  virtual std::string label() override;
   virtual int arity() override;
   virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
 };
@@ -1,20 +1,38 @@
+#pragma once
+
 #include "Environment.hpp"
 #include "Stmt.hpp"
 #include "Types.hpp"
 
-class LoxFunction;
-using FunPtr = std::shared_ptr<LoxFunction>;
+class Heap;
+struct JitFunction;
 
 class LoxFunction : public Callable {
   std::shared_ptr<Stmt::Function> declaration;
-  std::shared_ptr<Environment> closure;
+  // methods take `this` in slot zero, bound ones carry their receiver
+  bool isMethod;
+  Value receiver;
 
 public:
+  // only what the body refers to, functions that capture nothing have
+  // no upvalues at all
+  std::vector<ObjUpvalue*> upvalues;
+  // calls so far, until the JIT compiles it
+  int calls { 0 };
+  // what the JIT made of it, nullptr until it got hot
+  JitFunction* native { nullptr };
+
   LoxFunction(std::shared_ptr<Stmt::Function> declaration,
-              std::shared_ptr<Environment> env);
+              std::vector<ObjUpvalue*> upvalues, bool isMethod = false,
+              Value receiver = Nil());
+  virtual void trace(Heap& heap) override;
   virtual std::string toString() override;
+  virtual std::string label() override;
   virtual int arity() override;
+  const Stmt::Function& getDeclaration() const;
+  // what a bound method passes in slot zero, nullptr for functions
+  const Value* boundReceiver() const;
   virtual Value call(Interpreter *interpreter,
                      std::vector<Value> args) override;
-  FunPtr bind(LoxInstance* instance);  
+  LoxFunction* bind(LoxInstance* instance, Heap& heap);
 };
@@ -1,17 +1,42 @@
 #pragma once
 
 #include <string>
-#include <map>
 
 #include "LoxClass.hpp"
+#include "Shape.hpp"
+
+class Heap;
+
+// Fields live in an array right behind the object, laid out as the shape
+// says. The array is sized by how many fields earlier instances of the
+// class ended up with and only moves out of line if it has to grow.
+class LoxInstance : public Obj {
+  friend class Heap;
+
+  Shape* shape;
+  Value* fields;
+  uint32_t capacity;
+
+  LoxInstance(LoxClass* klass, uint32_t capacity);
+  Value* inlineFields() { return reinterpret_cast<Value*>(this + 1); }
 
-class LoxInstance {
-  LoxClass* klass;
-  std::map<std::string, Value> fields;
 public:
-  LoxInstance(LoxClass* klass);
-  LoxInstance(const LoxInstance& other);
-  Value get(Token fieldName);
-  void set(Token fieldName, Value value);
+  static LoxInstance* create(LoxClass* klass, Heap& heap);
+  ~LoxInstance();
+  // allocated with room for the fields, see Heap::makeWithTail
+  static void operator delete(void* memory) { ::operator delete(memory); }
+
+  virtual void trace(Heap& heap) override;
+  Value* findField(const std::string& name);
+  void setField(const std::string& name, const Value& value, Heap& heap);
+  Shape* getShape() const { return shape; }
+  Value& fieldAt(int slot) { return fields[slot]; }
+  // appends a field, `next` has to be getShape()->withField(name)
+  void addField(Shape* next, Value value, Heap& heap);
+  LoxClass* getClass() const;
   std::string toString();
 };
+
+inline LoxInstance* Value::asInstance() const {
+  return static_cast<LoxInstance*>(asObj());
+}
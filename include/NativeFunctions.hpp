@@ -3,13 +3,76 @@
 #include "Types.hpp"
 
 #include <chrono>
+#include <deque>
+#include <list>
+#include <ostream>
+#include <unordered_map>
 
 namespace Native {
 class Clock : public Callable {
 public:
   Clock();
-  Clock(const std::shared_ptr<Clock>& other);
   virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+// Counters of one function memoize() wrapped. Whoever runs the program
+// keeps them, so they are still there once the wrapper was collected.
+struct MemoStats {
+  std::string function;
+  size_t hits { 0 };
+  size_t misses { 0 };
+  size_t evictions { 0 };
+  // calls with an argument that can't be part of a key
+  size_t uncached { 0 };
+};
+
+void printMemoStats(const std::deque<MemoStats>& stats, std::ostream& out);
+
+// memoize(fn) returns a Memoized fn, every one with its own cache of
+// `capacity` results
+class Memoize : public Callable {
+  Heap& heap;
+  size_t capacity;
+  std::deque<MemoStats>& stats;
+public:
+  static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+  Memoize(Heap& heap, size_t capacity, std::deque<MemoStats>& stats);
+  virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+// Calls the function it wraps once per list of arguments and answers
+// calls with the same arguments from a cache. Numbers, strings, booleans
+// and nil are hashed by value, calls with anything else always go to the
+// function. Only the least recently used results are dropped once the
+// cache is full.
+class Memoized : public Callable {
+  struct Entry {
+    std::string key;
+    Value result;
+  };
+
+  Heap& heap;
+  Value function;
+  size_t capacity;
+  MemoStats& stats;
+  // most recently used first
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+  // the arguments as bytes, false when one of them can't be a key
+  static bool makeKey(const std::vector<Value>& args, std::string& key);
+public:
+  Memoized(Heap& heap, Value function, size_t capacity, MemoStats& stats);
+  virtual void trace(Heap& heap) override;
+  virtual std::string toString() override;
+  virtual std::string label() override;
   virtual int arity() override;
   virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
 };
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "Token.hpp"
+#include "Types.hpp"
+
+class Heap;
+
+// Arithmetic on numbers, shared by every engine so they agree. Integers
+// stay integers as long as the result fits an int64, past that the
+// operation is done on doubles. Division always gives a double. The
+// bitwise operators only take integers, shifting left wraps around and
+// shift counts are 0 to 63.
+namespace Numbers {
+
+enum class Op : uint8_t {
+  ADD,
+  SUBTRACT,
+  MULTIPLY,
+  DIVIDE,
+  LESS,
+  LESS_EQUAL,
+  GREATER,
+  GREATER_EQUAL,
+  BIT_AND,
+  BIT_OR,
+  BIT_XOR,
+  SHIFT_LEFT,
+  SHIFT_RIGHT,
+};
+
+// nothing for == and !=, + maps to ADD for when both are numbers
+inline std::optional<Op> opOf(TokenType type) {
+  switch(type) {
+    case PLUS: return Op::ADD;
+    case MINUS: return Op::SUBTRACT;
+    case STAR: return Op::MULTIPLY;
+    case SLASH: return Op::DIVIDE;
+    case LESS: return Op::LESS;
+    case LESS_EQUAL: return Op::LESS_EQUAL;
+    case GREATER: return Op::GREATER;
+    case GREATER_EQUAL: return Op::GREATER_EQUAL;
+    case AMPERSAND: return Op::BIT_AND;
+    case PIPE: return Op::BIT_OR;
+    case CARET: return Op::BIT_XOR;
+    case LESS_LESS: return Op::SHIFT_LEFT;
+    case GREATER_GREATER: return Op::SHIFT_RIGHT;
+    default: return std::nullopt;
+  }
+}
+bool isBitwise(Op op);
+// whether `op` can run on these operands, the error to report otherwise
+bool accepts(Op op, Value left, Value right);
+const char* operandError(Op op, Value left, Value right);
+
+// Operands have to be accepted. Integers that don't fit in a Value are
+// allocated on `heap`, without one there is no result for them.
+std::optional<Value> binary(Op op, Value left, Value right, Heap* heap);
+inline Value binary(Op op, Value left, Value right, Heap& heap) {
+  return *binary(op, left, right, &heap);
+}
+// -x, x + 1 and x - 1 on a number, ~x on an integer
+std::optional<Value> negate(Value value, Heap* heap);
+std::optional<Value> add(Value value, int64_t delta, Heap* heap);
+std::optional<Value> complement(Value value, Heap* heap);
+
+// The common cases, numbers that are stored inline and a result that is
+// too, without a call. False when that isn't the case.
+inline bool quick(Op op, Value left, Value right, Value& result) {
+  if(left.isSmallInt() && right.isSmallInt()) {
+    int64_t a = left.asSmallInt(), b = right.asSmallInt();
+    // shifted to the top 48 bits an int64 overflows when the result
+    // doesn't fit
+    int64_t shifted;
+    switch(op) {
+      case Op::ADD:
+        if(__builtin_add_overflow(a << 16, b << 16, &shifted)) return false;
+        result = Value::smallInt(shifted >> 16);
+        return true;
+      case Op::SUBTRACT:
+        if(__builtin_sub_overflow(a << 16, b << 16, &shifted)) return false;
+        result = Value::smallInt(shifted >> 16);
+        return true;
+      case Op::MULTIPLY:
+        if(__builtin_mul_overflow(a, b, &a)) return false;
+        break;
+      case Op::DIVIDE:
+        result = Value(static_cast<double>(a) / static_cast<double>(b));
+        return true;
+      case Op::LESS: result = a < b; return true;
+      case Op::LESS_EQUAL: result = a <= b; return true;
+      case Op::GREATER: result = a > b; return true;
+      case Op::GREATER_EQUAL: result = a >= b; return true;
+      case Op::BIT_AND: result = Value::smallInt(a & b); return true;
+      case Op::BIT_OR: result = Value::smallInt(a | b); return true;
+      case Op::BIT_XOR: result = Value::smallInt(a ^ b); return true;
+      default: return false;
+    }
+    if(!Value::fitsSmallInt(a)) return false;
+    result = Value::smallInt(a);
+    return true;
+  }
+
+  if(!(left.isDouble() || left.isSmallInt())) return false;
+  if(!(right.isDouble() || right.isSmallInt())) return false;
+  double a = left.isDouble() ? left.asDouble() : left.asSmallInt();
+  double b = right.isDouble() ? right.asDouble() : right.asSmallInt();
+  switch(op) {
+    case Op::ADD: result = Value(a + b); return true;
+    case Op::SUBTRACT: result = Value(a - b); return true;
+    case Op::MULTIPLY: result = Value(a * b); return true;
+    case Op::DIVIDE: result = Value(a / b); return true;
+    case Op::LESS: result = a < b; return true;
+    case Op::LESS_EQUAL: result = a <= b; return true;
+    case Op::GREATER: result = a > b; return true;
+    case Op::GREATER_EQUAL: result = a >= b; return true;
+    // the bitwise operators report doubles
+    default: return false;
+  }
+}
+
+}
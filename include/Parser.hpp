@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <vector>
@@ -11,7 +12,6 @@
 // Forward declarations
 class Value;
 class Token;
-class Environment;
 class Callable;
 
 /*namespace Stmt {
@@ -35,9 +35,18 @@ public:
 };
 
 class Parser {
+  // a level of nesting, a syntax error once the parser took its share of
+  // the native stack
+  class Nesting {
+  public:
+    Nesting(Parser& parser);
+  };
+
   Lox &lox;
   Tokens tokens;
   int current;
+  uintptr_t nativeStackBase { 0 };
+  size_t nativeStackBudget;
 
   ExprPtr expression();
   ExprPtr orExpr();
@@ -45,10 +54,15 @@ class Parser {
   ExprPtr assignment();
   ExprPtr equality();
   ExprPtr comparison();
+  ExprPtr bitwiseOr();
+  ExprPtr bitwiseXor();
+  ExprPtr bitwiseAnd();
+  ExprPtr shift();
   ExprPtr term();
   ExprPtr factor();
   ExprPtr unary();
   ExprPtr call();
+  ExprPtr suffix(ExprPtr expr);
   ExprPtr finishCall(ExprPtr callee);
   ExprPtr primary();
 
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "Dominators.hpp"
+#include "IR.hpp"
+
+// How often a pass or an analysis ran and for how long, for --time-passes
+class PassTimings {
+public:
+  struct Entry {
+    std::string name;
+    bool analysis;
+    size_t runs { 0 };
+    // functions the pass changed
+    size_t changed { 0 };
+    std::chrono::duration<double, std::milli> time { 0 };
+  };
+
+  Entry& entry(const std::string& name, bool analysis);
+  void print(std::ostream& out) const;
+
+private:
+  // in the order they first ran
+  std::vector<Entry> entries;
+};
+
+// Computes analyses on demand and keeps them until a pass changes the
+// function they were computed for
+class AnalysisManager {
+  PassTimings& timings;
+  std::map<const IR::Function*, std::unique_ptr<DominatorTree>> dominators;
+
+public:
+  AnalysisManager(PassTimings& timings);
+
+  const DominatorTree& dominatorsOf(const IR::Function& function);
+  void invalidate(const IR::Function& function);
+};
+
+class Pass {
+public:
+  virtual ~Pass() = default;
+  virtual const char* name() const = 0;
+  // true when the function changed
+  virtual bool run(IR::Function& function, AnalysisManager& analyses) = 0;
+};
+
+// Runs a list of passes over every function of a module, in order
+class PassManager {
+  std::vector<std::unique_ptr<Pass>> passes;
+  PassTimings timings;
+
+public:
+  static constexpr const char* DEFAULT_PIPELINE =
+    "phis,fold,cfg,phis,gvn,dce";
+
+  void add(std::unique_ptr<Pass> pass);
+  // comma separated pass names, false with `error` set when one is unknown
+  bool addPipeline(const std::string& pipeline, std::string& error);
+  void run(IR::Module& module);
+  void printTimings(std::ostream& out) const { timings.print(out); }
+};
@@ -9,7 +9,24 @@
 
 
 class Resolver : public Visitor<Value> {
-  using Scope = std::map<std::string, bool>;
+  struct Local {
+    bool defined;
+    int slot;
+    bool captured { false };
+    // the declaration, when it is a function
+    Stmt::Function* function { nullptr };
+  };
+  using Scope = std::map<std::string, Local>;
+
+  // one per function being resolved, the script itself is the first
+  struct FunctionScope {
+    // nullptr for the script
+    Stmt::Function* function;
+    // its outermost scope in `scopes`
+    size_t firstScope;
+    int nextSlot { 0 };
+    int slotCount { 0 };
+  };
 
   enum class FunctionType {
     NONE,
@@ -25,27 +42,50 @@ class Resolver : public Visitor<Value> {
   Interpreter& interpreter;
   Lox* lox;
   std::vector<Scope> scopes;
+  std::vector<FunctionScope> functions;
 
   FunctionType currentFunction { FunctionType::NONE };
   ClassType currentClass { ClassType::NONE };
   bool inLoop;
 
-  void resolveLocal(Expr::Expr* expr, Token name);
+  // For --check-purity: why a function isn't pure, the first thing found,
+  // and the functions passed to memoize(). Globals are looked up by name
+  // once the whole program was resolved, they may be declared after the
+  // call.
+  struct Memoized {
+    Token name;
+    // nullptr for a global
+    Stmt::Function* function;
+  };
+  std::map<Stmt::Function*, std::string> impurities;
+  std::map<std::string, Stmt::Function*> globalFunctions;
+  std::vector<Memoized> memoized;
+
+  void resolveLocal(Expr::VarSlot& slot, const Token& name);
+  Local* findLocal(size_t function, const std::string& name);
+  int resolveUpvalue(size_t function, const std::string& name);
+  int addUpvalue(size_t function, bool isLocal, int index);
   void resolveFunction(Stmt::Function* function,
       FunctionType type);
 
   void beginScope();
   void endScope();
 
-  void declare(Token name);
+  Expr::VarSlot declare(Token name);
   void define(Token name);
 
+  void markImpure(const std::string& reason);
+  void noteMemoized(Expr::Call* expr);
+  void checkPurity();
+
 public:
   Resolver(Interpreter& interpreter, Lox* lox);
 
   void resolve(Stmt::StmtPtr stmt);
   void resolve(Expr::ExprPtr expr);
   void resolve(Stmt::Stmts statements);
+  // frame size the top level code needs for locals of its blocks
+  int scriptSlotCount() const;
 
   virtual Value visitBinop(Expr::Binop* expr) override; 
   virtual Value visitUnop(Expr::Unop* expr) override; 
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Environment.hpp"
+#include "Heap.hpp"
+#include "Lox.hpp"
+#include "LoxClass.hpp"
+#include "LoxInstance.hpp"
+#include "Numbers.hpp"
+
+class Runtime;
+
+// Function of a program the CppTranslator turned into C++. Its code
+// gets the frame the call runs in: `this` for a method, the parameters,
+// then the locals and the temporaries of its expressions.
+class AotFunction : public Callable {
+public:
+  using Code = Value (*)(Runtime& runtime, AotFunction* self, Value* frame);
+
+  Runtime& runtime;
+  Code code;
+  std::string name;
+  int params;
+  // slots the code uses, parameters and `this` included
+  int frameSize;
+  int line;
+  bool isMethod;
+  // what a bound method passes as `this`, nil for unbound ones
+  Value receiver;
+  std::vector<ObjUpvalue*> upvalues;
+
+  AotFunction(Runtime& runtime, Code code, std::string name, int params,
+      int frameSize, int line, bool isMethod,
+      std::vector<ObjUpvalue*> upvalues, Value receiver = Nil());
+  virtual void trace(Heap& heap) override;
+  virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+// Instances are plain LoxInstances, the methods are translated functions
+class AotClass : public LoxClass {
+public:
+  std::map<std::string, AotFunction*> aotMethods;
+
+  AotClass(const std::string& name, Heap& heap);
+  virtual void trace(Heap& heap) override;
+  AotFunction* findAotMethod(const std::string& name);
+};
+
+// What translated programs run on: the heap, the globals, a stack of
+// frames and the operations too big to be spelled out at every use.
+// Everything a program computes is stored in a frame slot before
+// anything else runs, so the stack is all the collector has to look at.
+// Errors are thrown as RuntimeErrors and reported like the interpreter
+// reports them.
+class Runtime : public RootSource {
+public:
+  static constexpr int STACK_MAX = 1 << 20;
+
+  // Where a property access remembers the last shape it saw
+  struct Site {
+    const std::string name;
+    uint64_t shapeId { UINT64_MAX };
+    // field slot, -1 for a method
+    int slot { -1 };
+    AotFunction* method { nullptr };
+    // shape a set moves the instance to, when it adds the field
+    Shape* transition { nullptr };
+  };
+
+  // Variable a function captures, like Stmt::Upvalue
+  struct Capture {
+    bool isLocal;
+    int index;
+  };
+
+  Heap heap;
+  Globals globals;
+  std::deque<Native::MemoStats> memoized;
+
+  Runtime();
+  Runtime(const Runtime&) = delete;
+  ~Runtime();
+
+  // runs the top level of the program, returns the exit status
+  int run(AotFunction::Code script, int frameSize);
+  virtual void markRoots(Heap& heap) override;
+  [[noreturn]] void fail(int line, const std::string& message);
+
+  // kept alive for as long as the program runs
+  Value string(std::string chars);
+  Value integer(int64_t value);
+
+  Value global(int slot, int line) {
+    if(globals.isDefined(slot)) return globals.at(slot);
+    undefined(slot, line);
+  }
+  void assignGlobal(int slot, Value value, int line) {
+    if(!globals.isDefined(slot)) undefined(slot, line);
+    globals.at(slot) = value;
+  }
+
+  Value function(AotFunction::Code code, const char* name, int params,
+      int frameSize, int line, bool isMethod, AotFunction* enclosing,
+      Value* frame, std::initializer_list<Capture> captures);
+  Value makeClass(const char* name);
+  void addMethod(Value klass, Value method);
+  void closeUpvalues(Value* last);
+
+  // `base` holds the callee and then the arguments, the result is left
+  // for the caller to store
+  Value call(Value* base, int argc, int line);
+  // Looks up what `object.name(...)` calls, before the arguments are
+  // evaluated. `base + 1` holds the object, a method ends up in `base`
+  // with the object staying behind it as `this`, anything else is moved
+  // to `base + 1` as a plain callee.
+  void lookUpCallee(Value* base, Site& site, int line);
+  Value invoke(Value* base, int argc, int line);
+  // the same calls in tail position, made once `frame` returned
+  Value tailCall(Value* frame, Value* base, int argc, int line);
+  Value tailInvoke(Value* frame, Value* base, int argc, int line);
+  Value callFromHost(Value callee, const std::vector<Value>& args);
+
+  Value get(Value object, Site& site, int line);
+  void checkFields(Value object, int line) {
+    if(!object.isInstance()) fail(line, "Only instances have fields.");
+  }
+  void set(Value object, Site& site, Value value);
+
+  // Operands the type checker proved to be numbers, strings or booleans.
+  // Their tags are checked all the same, what it proved about a global
+  // only holds for the types it was declared with.
+  Value numbers(Numbers::Op op, Value left, Value right, int line) {
+    Value result;
+    if(Numbers::quick(op, left, right, result)) return result;
+    return slowNumbers(op, left, right, line);
+  }
+  // a comparison of proven numbers as a plain bool
+  bool test(Numbers::Op op, Value left, Value right, int line) {
+    if(left.isSmallInt() && right.isSmallInt()) {
+      int64_t a = left.asSmallInt(), b = right.asSmallInt();
+      switch(op) {
+        case Numbers::Op::LESS: return a < b;
+        case Numbers::Op::LESS_EQUAL: return a <= b;
+        case Numbers::Op::GREATER: return a > b;
+        default: return a >= b;
+      }
+    }
+    if(!left.isNumber() || !right.isNumber()) {
+      fail(line, Numbers::operandError(op, left, right));
+    }
+    return Numbers::binary(op, left, right, heap).asBool();
+  }
+  Value number(TokenType op, Value operand, int line);
+  Value concat(Value left, Value right, int line);
+  // Operators on anything, with the interpreter's checks. Numbers stored
+  // in the Value take the same shortcut as proven ones.
+  Value binary(TokenType op, Value left, Value right, int line) {
+    if(std::optional<Numbers::Op> arithmetic = Numbers::opOf(op)) {
+      Value result;
+      if(Numbers::quick(*arithmetic, left, right, result)) return result;
+    }
+    return slowBinary(op, left, right, line);
+  }
+  Value unary(TokenType op, Value operand, int line);
+  void print(Value value);
+
+private:
+  std::vector<Value> stack;
+  // first slot no frame uses, the collector marks everything below
+  Value* top;
+  // upvalues still pointing into the stack, sorted by slot
+  std::vector<ObjUpvalue*> openUpvalues;
+  uintptr_t nativeStackBase { 0 };
+  size_t nativeStackBudget;
+  // set by tailCall for the call that made the returning frame
+  bool tailCalled { false };
+  int tailArgc { 0 };
+  bool tailShifted { false };
+  int tailLine { 0 };
+
+  [[noreturn]] void undefined(int slot, int line);
+  Value slowNumbers(Numbers::Op op, Value left, Value right, int line);
+  Value slowBinary(TokenType op, Value left, Value right, int line);
+  ObjUpvalue* captureUpvalue(Value* local);
+  void checkCall(Value callee, int argc, int line);
+  // `shifted` when `this` already is in base[1] and the arguments after it
+  Value finishCall(Value* base, int argc, bool shifted, int line);
+  Value enter(AotFunction* function, Value* frame, int count);
+  void prepareTailCall(Value* frame, Value* base, int argc, bool shifted,
+      int line);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+class LoxClass;
+
+// Layout of an instance's fields. Instances that got the same fields in
+// the same order share a shape, adding a field moves an instance to a
+// child shape. Every shape belongs to the class whose root it grew from.
+class Shape {
+  std::unordered_map<std::string, int> slots;
+  std::map<std::string, std::unique_ptr<Shape>> transitions;
+
+  Shape(Shape* parent, const std::string& name);
+
+public:
+  LoxClass* const klass;
+  Shape* const parent;
+  const int fieldCount;
+  // never reused, unlike the address of a shape whose class was collected
+  const uint64_t id;
+
+  // empty layout every instance of the class starts with
+  Shape(LoxClass* klass);
+  Shape(const Shape&) = delete;
+
+  // -1 when the shape has no such field
+  int slotOf(const std::string& name) const;
+  // shape with one more field at the end, created on first use
+  Shape* withField(const std::string& name);
+};
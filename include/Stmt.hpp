@@ -8,6 +8,12 @@
 
 using Expr::ExprPtr;
 
+namespace Closures {
+struct Body;
+}
+
+struct LoopTrace;
+
 namespace Stmt {
 
 class Stmt {
@@ -20,11 +26,19 @@ class Stmt {
 class Function;
 using Methods = std::vector<std::shared_ptr<Function>>;
 
+// Variable a function captures, either a local of the function around it
+// or one of that function's own upvalues
+struct Upvalue {
+  bool isLocal;
+  int index;
+};
+
 class Class : public Stmt {
 public:
   Token name;
   std::unique_ptr<Expr::Variable> superclass;
   Methods methods;
+  ::Expr::VarSlot slot;
 
   Class(Token name, const Methods& methods);
   virtual Value accept(Visitor<Value>* visitor) override; 
@@ -39,6 +53,9 @@ class Return : public Stmt {
 public:
   Token keyword;
   ExprPtr value;
+  // set by the resolver for `return f(...)` in a function, the call can
+  // reuse the returning function's frame
+  bool tailCall { false };
 
   Return(const Token& keyword, const ExprPtr& value);
   virtual Value accept(Visitor<Value>* visitor) override; 
@@ -50,6 +67,13 @@ public:
   Token name;
   Tokens args;
   Stmts body;
+  ::Expr::VarSlot slot;
+  // size of the frame: parameters and the most locals alive at once
+  int slotCount { 0 };
+  std::vector<Upvalue> upvalues;
+  // the body compiled by the ClosureCompiler, run instead of the
+  // statements when set
+  std::shared_ptr<Closures::Body> compiled;
 
   Function(Token name, const Tokens& args, const Stmts& body);
   Function(const Function& other);
@@ -70,6 +94,10 @@ public:
   ExprPtr condition;
   std::shared_ptr<Stmt> body;
   int line;
+  // iterations counted towards the Tracer's threshold and what it
+  // recorded, owned by the Tracer
+  int hotness { 0 };
+  LoopTrace* trace { nullptr };
 
   While(std::shared_ptr<Expr::Expr> condition, std::shared_ptr<Stmt> body);
   virtual Value accept(Visitor<Value>* visitor) override; 
@@ -92,6 +120,10 @@ public:
 class Block : public Stmt {
 public:
   Stmts statements;
+  // first frame slot of the block's locals, which have to be closed on
+  // exit when a closure captured one of them
+  int firstSlot { 0 };
+  bool closesUpvalues { false };
 
   Block();
   Block(const Stmts& otherStatements);
@@ -128,6 +160,7 @@ class Var : public Stmt {
 public:
   ExprPtr initializer;
   Token name;
+  ::Expr::VarSlot slot;
 
   Var(ExprPtr expr, Token name);
   virtual Value accept(Visitor<Value>* visitor) override; 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "AstRewriter.hpp"
+
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Common subexpression elimination over the straight line statements of a
+// block or function body. A pure expression computed a second time while
+// nothing could have changed its operands reads the first result instead.
+// The first occurrence becomes an assignment to a fresh local, declared
+// without a value before its statement, so it is still evaluated exactly
+// where it was:
+//
+//   print a.b * c + a.b * c;  =>  var cse$1; print (cse$1 = a.b * c) + cse$1;
+//
+// Assignments forget what reads the variable, sets forget reads of the
+// property and calls forget property reads and anything but locals no
+// closure sees. Control flow ends the run of statements.
+class SubexpressionEliminator : public AstRewriter {
+  struct Available {
+    // slot holding the first occurrence until it is turned into an assignment
+    Expr::ExprPtr* first;
+    // statement of the current block the first occurrence is in
+    size_t statement;
+    std::set<std::string> variables;
+    std::set<std::string> properties;
+    // only reads locals no closure sees, so calls can't change it
+    bool survivesCalls;
+    // name of the local once the first occurrence assigns it
+    std::string local;
+  };
+
+  struct Rewrite {
+    int line;
+    std::string expr;
+    std::string local;
+  };
+
+  std::map<std::string, Available> available;
+  // statements of the current block that need a local declared before them
+  std::map<size_t, std::vector<Token>> declarations;
+  size_t statement { 0 };
+  std::vector<bool> hasClosures;
+  int freshNames { 0 };
+  int reused { 0 };
+  std::vector<Rewrite> rewrites;
+
+  void eliminate(Stmt::Stmts& statements);
+  void eliminateFunction(Stmt::Function* function);
+  void walk(Expr::ExprPtr& expr, bool conditional);
+  void walkOperands(Expr::Expr* node, bool conditional);
+  void reuse(Expr::ExprPtr& expr, Available& entry, const std::string& key);
+  void forgetVariable(const std::string& name);
+  void forgetProperty(const std::string& name);
+  void forgetAfterCall();
+
+public:
+  void optimize(Stmt::Stmts& program);
+  // every reuse with `dump`, otherwise only how many
+  void printSummary(std::ostream& out, bool dump) const;
+
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+};
@@ -10,12 +10,14 @@ enum TokenType {
   // Single-character tokens.
   LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE,
   COMMA, DOT, MINUS, PLUS, SEMICOLON, SLASH, STAR,
+  AMPERSAND, PIPE, CARET, TILDE,
 
   // One or two character tokens.
   BANG, BANG_EQUAL,
   EQUAL, EQUAL_EQUAL,
   GREATER, GREATER_EQUAL,
   LESS, LESS_EQUAL,
+  LESS_LESS, GREATER_GREATER,
   PLUSPLUS, MINUSMINUS,
 
   // Literals.
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "TraceRecorder.hpp"
+#include "X64Assembler.hpp"
+
+// Emits x86-64 for a RecordedTrace: the iteration runs over and over in
+// a loop of its own until an instruction exits, and returns the number
+// of that exit, -1 when the variables no longer have the types it was
+// compiled for.
+//
+// Registers live in the native frame. The variables are loaded into
+// them on entry and stored back at the end of every iteration, so an exit
+// in the middle of one leaves the interpreter the variables as they were
+// before it and the interpreter runs that iteration again. Variables
+// that hold small integers all the way around the loop are checked once
+// on entry, the operations on them don't check them again.
+class TraceCompiler {
+  using Reg = X64Assembler::Reg;
+  using Label = X64Assembler::Label;
+
+  const RecordedTrace& trace;
+  X64Assembler assembler;
+  std::vector<Label> exits;
+  Label entryExit;
+  Label epilogue;
+  // registers known to hold a small integer at this point of the trace
+  std::vector<bool> known;
+
+  int32_t registerOffset(int reg) const;
+  void load(Reg dst, int reg);
+  void store(int reg, Reg src);
+  // rcx at the slot of a variable's home
+  void home(const RecordedTrace::Variable& variable);
+  std::vector<bool> integerVariables() const;
+  bool producesInteger(const TraceOp& op,
+      const std::vector<bool>& integers) const;
+  // how often each register is read
+  std::vector<int> uses() const;
+
+  void callHelper(const void* helper);
+  void checkSmallInt(Reg reg, Label& otherwise);
+  // jumps to `target` when rax is as truthy as `when`
+  void branchOnTruth(bool when, Label& target);
+  void boolFromAl();
+
+  void emitIntBinary(const TraceOp& op, const TraceOp* guard);
+  void emitEqual(const TraceOp& op);
+  void emitCall(const TraceOp& op);
+
+public:
+  TraceCompiler(const RecordedTrace& trace);
+
+  const std::vector<uint8_t>& compile();
+};
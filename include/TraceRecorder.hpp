@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Environment.hpp"
+#include "Numbers.hpp"
+#include "Stmt.hpp"
+#include "Visitor.hpp"
+
+class Jit;
+class LoxFunction;
+struct JitFunction;
+
+// One instruction of a recorded trace. Operands and results are
+// registers, some of which stand for the variables the loop uses. An
+// instruction with an `exit` leaves the trace there when what
+// it was recorded for doesn't hold any more.
+struct TraceOp {
+  enum Kind : uint8_t {
+    CONSTANT,
+    MOVE,
+    // small integers, exits when an operand isn't one or the result
+    // doesn't fit
+    INT_BINARY,
+    // numbers through Numbers, exits when it would need the heap
+    BINARY,
+    EQUAL,
+    UNARY,
+    NOT,
+    // exits unless `a` is as truthy as `expected`
+    GUARD,
+    // a compiled function, exits when the global it was read from holds
+    // something else or the call bailed out
+    CALL,
+  };
+
+  Kind kind;
+  int dst { -1 };
+  int a { -1 };
+  int b { -1 };
+  Numbers::Op op { Numbers::Op::ADD };
+  // UNARY's operator, BANG_EQUAL for a negated EQUAL
+  TokenType token { EQUAL_EQUAL };
+  bool expected { true };
+  // EQUAL that saw two small integers
+  bool integers { false };
+  uint64_t bits { 0 };
+  std::vector<int> args;
+  int global { -1 };
+  LoxFunction* function { nullptr };
+  JitFunction* target { nullptr };
+  int exit { -1 };
+};
+
+// One iteration of a loop as it ran, starting with its condition
+struct RecordedTrace {
+  // a local or global the loop uses, which lives in `reg` while the
+  // trace runs
+  struct Variable {
+    Expr::VarSlot slot;
+    int reg;
+    // what it held when recording started
+    Value entry;
+    bool written;
+  };
+
+  std::vector<Variable> variables;
+  int registers { 0 };
+  std::vector<TraceOp> ops;
+  // line of every exit
+  std::vector<int> exitLines;
+  // the exit taken when the condition no longer holds
+  int loopExit { -1 };
+};
+
+// Records a loop iteration by running it on the side: it works out the
+// values of the iteration without storing any of them, follows the
+// branches they take and notes every operation as a TraceOp with guards
+// for the types and branches it saw. Anything a trace can't do, like
+// printing, allocating or touching objects, aborts the recording.
+class TraceRecorder : public Visitor<Value> {
+  Jit* jit;
+  Globals& globals;
+  Value* frame;
+  uintptr_t stackLimit;
+  RecordedTrace trace;
+  // what every register holds in the iteration being recorded
+  std::vector<Value> values;
+  // register of the last expression
+  int result { -1 };
+  std::string problem;
+
+  void abort(const std::string& why);
+  bool aborted() const;
+  // evaluates `expr` into `result` and returns its value
+  Value record(const Expr::ExprPtr& expr);
+  void record(const Stmt::StmtPtr& stmt);
+  Value operate(Expr::Binop* expr, Value left);
+  int newRegister(Value value);
+  int variable(const Token& name, const Expr::VarSlot& slot);
+  void assign(int reg, int source, Value value);
+  int keep(int reg, Value value, size_t from);
+  int exit(int line);
+  TraceOp& emit(TraceOp::Kind kind, int dst);
+  void guard(int reg, bool expected, int line);
+
+public:
+  // records with the locals of `frame`, calls compiled functions through
+  // `jit` when there is one
+  TraceRecorder(Jit* jit, Globals& globals, Value* frame,
+      uintptr_t stackLimit);
+
+  // false when it aborted, see why()
+  bool record(Stmt::While& loop);
+  const std::string& why() const;
+  const RecordedTrace& recorded() const;
+
+  virtual Value visitBinop(Expr::Binop* expr) override;
+  virtual Value visitUnop(Expr::Unop* expr) override;
+  virtual Value visitGrouping(Expr::Grouping* expr) override;
+  virtual Value visitLiteralExpr(Expr::Literal* expr) override;
+
+  virtual Value visitExprStmt(Stmt::Expr* exprstmt) override;
+  virtual Value visitPrintStmt(Stmt::Print* varstmt) override;
+  virtual Value visitVarStmt(Stmt::Var* stmt) override;
+
+  virtual Value visitVariableExpr(Expr::Variable* var) override;
+  virtual Value visitAssign(Expr::Assign* expr) override;
+  virtual Value visitBlockStmt(Stmt::Block* stmt) override;
+  virtual Value visitIfStmt(Stmt::If* stmt) override;
+  virtual Value visitLogical(Expr::Logical* expr) override;
+  virtual Value visitWhileStmt(Stmt::While* stmt) override;
+  virtual Value visitBreakStmt(Stmt::Break* stmt) override;
+
+  virtual Value visitClassStmt(Stmt::Class* stmt) override;
+  virtual Value visitCall(Expr::Call* expr) override;
+  virtual Value visitFunctionStmt(Stmt::Function* stmt) override;
+  virtual Value visitReturnStmt(Stmt::Return* stmt) override;
+  virtual Value visitGetExpr(Expr::Get* expr) override;
+  virtual Value visitSetExpr(Expr::Set* expr) override;
+  virtual Value visitThisExpr(Expr::This* expr) override;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Environment.hpp"
+#include "Jit.hpp"
+#include "Stmt.hpp"
+
+// What trace code gets in rdi, starts with what compiled functions it
+// calls get
+struct TraceContext {
+  JitContext jit;
+  // the running function's locals
+  Value* frame;
+  // iterations it ran before it exited
+  uint64_t iterations;
+};
+
+// A loop's trace and what happened to it, for --trace-stats
+struct LoopTrace {
+  // returns the exit it took, -1 when the types of the variables were
+  // not the recorded ones
+  using Entry = int64_t (*)(TraceContext* context);
+
+  int line;
+  Entry entry { nullptr };
+  size_t ops { 0 };
+  size_t codeSize { 0 };
+  // iterations before it was first recorded
+  size_t hotAfter { 0 };
+  int attempts { 0 };
+  // recorded too often, the interpreter runs it from now on
+  bool blacklisted { false };
+  // why recordings aborted and how often
+  std::vector<std::pair<std::string, int>> aborts;
+  size_t entries { 0 };
+  size_t iterations { 0 };
+  std::vector<int> exitLines;
+  std::vector<size_t> exits;
+  size_t entryExits { 0 };
+  int loopExit { -1 };
+  // entries in a row that left before finishing an iteration
+  int stuck { 0 };
+  std::vector<LoxFunction*> callees;
+};
+
+// Tracing JIT for while loops. Every loop counts its iterations, once it
+// ran `threshold` of them the next one is recorded with a TraceRecorder
+// and compiled with a TraceCompiler. From then on the interpreter enters
+// the trace at the top of every iteration and continues after it exits.
+// A recording that aborts is retried later, a loop whose recordings keep
+// aborting is left to the interpreter. A trace that keeps exiting right
+// away is thrown out to be recorded again, the loop may take another
+// path by now.
+class Tracer {
+public:
+  static constexpr int MAX_ATTEMPTS = 3;
+  static constexpr int MAX_STUCK = 16;
+
+  // calls compiled functions through `jit` when there is one
+  Tracer(Globals& globals, Jit* jit, int threshold);
+  Tracer(const Tracer&) = delete;
+  ~Tracer();
+
+  // called at the top of every iteration of `loop`, may run any number
+  // of them
+  void loopHeader(Stmt::While& loop, Value* frame, uintptr_t stackLimit);
+  void markRoots(Heap& heap) const;
+  void printStats(std::ostream& out) const;
+
+private:
+  struct Mapping {
+    void* memory;
+    size_t size;
+  };
+
+  Globals& globals;
+  Jit* jit;
+  int threshold;
+  std::vector<std::unique_ptr<LoopTrace>> traces;
+  std::vector<Mapping> mappings;
+  size_t aborts { 0 };
+
+  void record(Stmt::While& loop, Value* frame, uintptr_t stackLimit);
+  void run(LoopTrace& trace, Value* frame, uintptr_t stackLimit);
+  void abort(LoopTrace& trace, const std::string& why);
+  bool install(LoopTrace& trace, const std::vector<uint8_t>& code);
+};
@@ -7,15 +7,49 @@
 #include "Visitor.hpp"
 
 #include <map>
+#include <set>
+#include <string>
 #include <vector>
 #include <optional>
 
 
+// Checks the types of a program and annotates every expression with the
+// type it proved, Type::ANY where it can't know before running. Parameters,
+// calls and fields are ANY. A local only keeps the type of its initializer
+// as long as it is never assigned an ANY. Globals are checked against the
+// type they were declared with, but anything computed from one is
+// annotated ANY, code checked in another run can assign them.
 class TypeChecker : public Visitor<Type> {
-  using Scope = std::map<std::string, Type>;
+  struct Binding {
+    Type type;
+    const Token* declaration;
+    // false when it may hold something computed from a global
+    bool proven { true };
+  };
+  using Scope = std::map<std::string, Binding>;
 
   Lox& lox;
   std::vector<Scope> scopes {};
+  // walks before the last one only look for variables to demote to ANY
+  bool scanning { false };
+  std::set<const Token*> demoted;
+  std::set<const Token*> unprovenLocals;
+  // globals assigned before they were declared, by functions checked
+  // earlier
+  std::set<std::string> demotedGlobals;
+  // set while checking an expression computed from a global, what it
+  // proved holds for the declared types only
+  bool unproven { false };
+
+  void error(const Token& token, const std::string& message);
+  void error(int line, const std::string& message);
+  void declare(const Token& name, Type type, bool proven = true);
+  const Binding* lookUp(const Token& name);
+  void checkFunction(Stmt::Function* stmt);
+  void walk(const Stmt::Stmts& program);
+  // what one operator of a chain gives for the types of its operands
+  Type binopType(Expr::Binop* expr, Type typeLeft, Type typeRight);
+  Type logicalType(Expr::Logical* expr, Type typeLeft, Type typeRight);
 public:
   TypeChecker(Lox& lox); 
   ~TypeChecker();
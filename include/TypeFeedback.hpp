@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What an operator or property access site of the tree-walker saw. The
+// first run quickens the site into a variant for the types it got, like
+// numbers for `a + b` or the slot of a field for `a.b`, which only checks
+// a guard before doing the work. A failed guard runs the generic code and
+// quickens the site again for what it saw this time. A site that keeps
+// changing is polymorphic and stays generic after MAX_QUICKENINGS.
+class TypeFeedback {
+public:
+  static constexpr int MAX_QUICKENINGS = 4;
+
+  enum State : uint8_t {
+    UNINITIALIZED,
+    // both small integers
+    INTEGERS,
+    NUMBERS,
+    STRINGS,
+    BOOLEAN,
+    // a field of instances with one shape
+    FIELD,
+    GENERIC,
+  };
+
+  State state { UNINITIALIZED };
+  int quickenings { 0 };
+  // what a FIELD site reads
+  uint64_t shapeId { 0 };
+  int slot { -1 };
+
+  size_t hits { 0 };
+  // guards that failed
+  size_t misses { 0 };
+
+  // GENERIC when no variant fits the types seen
+  void quicken(State next) {
+    if(state == GENERIC) return;
+    state = ++quickenings > MAX_QUICKENINGS ? GENERIC : next;
+  }
+
+  static const char* nameOf(State state) {
+    switch(state) {
+      case UNINITIALIZED: return "uninitialized";
+      case INTEGERS: return "integers";
+      case NUMBERS: return "numbers";
+      case STRINGS: return "strings";
+      case BOOLEAN: return "boolean";
+      case FIELD: return "field";
+      case GENERIC: return "generic";
+    }
+    return "?";
+  }
+};
@@ -1,7 +1,8 @@
 #pragma once
 
 
-#include <variant>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <memory>
@@ -14,6 +15,9 @@ enum class Type {
   NUMBER,
   STRING,
   FUNCTION,
+  INSTANCE,
+  // not known before running
+  ANY,
 };
 
 inline std::string typeToString(Type type) {
@@ -23,8 +27,9 @@ inline std::string typeToString(Type type) {
     case Type::NUMBER: return "Number";
     case Type::STRING: return "String";
     case Type::FUNCTION: return "Function";
+    case Type::INSTANCE: return "Instance";
+    case Type::ANY: return "Any";
     //case Type::CLASS: return "class";
-    //case Type::INSTANCE: return "instance";
     default: return "Unknown Type!";
   }
 }
@@ -33,68 +38,177 @@ inline std::string typeToString(Type type) {
 class Interpreter;
 class Value;
 class LoxInstance;
+class Heap;
 class Token;
 using Tokens = std::vector<Token>;
 
 // Used for representing NULL value in my language
 class Nil {public: Nil() {} };
 
-class Callable {
+// Kinds of heap objects a Value can point to
+enum class ObjType : uint8_t {
+  STRING,
+  INTEGER,
+  INSTANCE,
+  FUNCTION,
+  CLASS,
+  NATIVE,
+  UPVALUE,
+  VM_CLOSURE,
+  VM_BOUND_METHOD,
+  IR_CLOSURE,
+  IR_BOUND_METHOD,
+  AOT_FUNCTION,
+};
+
+// Base of everything allocated on the Heap
+class Obj {
+public:
+  const ObjType type;
+  bool marked { false };
+  // bytes charged to the heap for this object
+  uint32_t size { 0 };
+  Obj* next { nullptr };
+
+  Obj(ObjType type) : type { type } {}
+  virtual ~Obj() = default;
+  // marks every object this one references
+  virtual void trace(Heap& heap) {}
+};
+
+class ObjString : public Obj {
+public:
+  std::string chars;
+
+  ObjString(std::string chars)
+    : Obj(ObjType::STRING), chars { std::move(chars) } {}
+};
+
+// integer too big for the payload of a Value
+class ObjInteger : public Obj {
+public:
+  const int64_t value;
+
+  ObjInteger(int64_t value) : Obj(ObjType::INTEGER), value { value } {}
+};
+
+class Callable : public Obj {
 public:
+  Callable(ObjType type) : Obj(type) {}
   virtual int arity() = 0;
   virtual Value call(Interpreter* interpreter, std::vector<Value> args) = 0;
   virtual std::string toString() = 0;
-  virtual ~Callable() = default;
+  // what stats call it, the name it was declared with where it has one
+  virtual std::string label() { return toString(); }
 };
 
-// Values used in my language
+// Values used in my language. NaN boxed: doubles are stored as they are,
+// nil and booleans are quiet NaNs with a tag in the low bits and objects
+// are quiet NaNs with the sign bit set and the pointer in the payload.
+// Integers that fit in 48 bits are quiet NaNs with INT_TAG set and the
+// integer in the payload, bigger ones point to an ObjInteger.
 class Value {
+  static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+  static constexpr uint64_t QNAN = 0x7ffc000000000000;
+  static constexpr uint64_t TAG_NIL = 1;
+  static constexpr uint64_t TAG_FALSE = 2;
+  static constexpr uint64_t TAG_TRUE = 3;
+  static constexpr uint64_t NIL_BITS = QNAN | TAG_NIL;
+  static constexpr uint64_t FALSE_BITS = QNAN | TAG_FALSE;
+  static constexpr uint64_t TRUE_BITS = QNAN | TAG_TRUE;
+  static constexpr uint64_t OBJ_BITS = SIGN_BIT | QNAN;
+  static constexpr uint64_t INT_TAG = 0x0001000000000000;
+  static constexpr uint64_t INT_BITS = QNAN | INT_TAG;
+  static constexpr uint64_t PAYLOAD = 0x0000ffffffffffff;
+
+  uint64_t bits;
+
+  bool isObjType(ObjType type) const {
+    return isObj() && asObj()->type == type;
+  }
+
 public:
-  std::variant<
-    float, 
-    bool, 
-    std::string, 
-    Nil, 
-    std::shared_ptr<Callable>,
-    std::shared_ptr<LoxInstance>
-  > value;
-
-  Value();
-  Value(const Value& other);
-
-  template <typename T>
-  Value& operator=(const T& val) {
-    value = val;
-    return *this;
+  Value() : bits { NIL_BITS } {}
+  Value(Nil) : bits { NIL_BITS } {}
+  Value(bool b) : bits { b ? TRUE_BITS : FALSE_BITS } {}
+  Value(double number) { std::memcpy(&bits, &number, sizeof(double)); }
+  Value(Obj* obj)
+    : bits { OBJ_BITS | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(obj)) } {}
+  // would silently pick the bool constructor
+  Value(const char*) = delete;
+
+  static constexpr int64_t SMALL_INT_MIN = -(int64_t(1) << 47);
+  static constexpr int64_t SMALL_INT_MAX = (int64_t(1) << 47) - 1;
+  static bool fitsSmallInt(int64_t i) {
+    return i >= SMALL_INT_MIN && i <= SMALL_INT_MAX;
+  }
+  // only for integers that fit, Heap::makeInteger boxes the others
+  static Value smallInt(int64_t i) {
+    Value value;
+    value.bits = INT_BITS | (static_cast<uint64_t>(i) & PAYLOAD);
+    return value;
   }
 
-  template <typename T>
-  Value(const T& val)
-  {
-    value = val;
+  bool isNil() const { return bits == NIL_BITS; }
+  bool isBool() const { return (bits | 1) == TRUE_BITS; }
+  bool isDouble() const { return (bits & QNAN) != QNAN; }
+  bool isSmallInt() const { return (bits & (OBJ_BITS | INT_TAG)) == INT_BITS; }
+  bool isInt() const { return isSmallInt() || isObjType(ObjType::INTEGER); }
+  bool isNumber() const { return isDouble() || isInt(); }
+  bool isObj() const { return (bits & OBJ_BITS) == OBJ_BITS; }
+  bool isString() const { return isObjType(ObjType::STRING); }
+  bool isInstance() const { return isObjType(ObjType::INSTANCE); }
+  bool isCallable() const {
+    return isObj() && !isString() && !isInstance()
+      && !isObjType(ObjType::INTEGER);
   }
 
-  template <typename T>
-  T get() const;
+  bool asBool() const { return bits == TRUE_BITS; }
+  double asDouble() const {
+    double number;
+    std::memcpy(&number, &bits, sizeof(double));
+    return number;
+  }
+  int64_t asSmallInt() const {
+    // shifted up and back to extend the sign
+    return static_cast<int64_t>(bits << 16) >> 16;
+  }
+  int64_t asInt() const {
+    if(isSmallInt()) return asSmallInt();
+    return static_cast<ObjInteger*>(asObj())->value;
+  }
+  // any number as a double, integers converted
+  double asNumber() const {
+    return isDouble() ? asDouble() : static_cast<double>(asInt());
+  }
+  Obj* asObj() const {
+    return reinterpret_cast<Obj*>(static_cast<uintptr_t>(bits & ~OBJ_BITS));
+  }
+  ObjString* asString() const { return static_cast<ObjString*>(asObj()); }
+  Callable* asCallable() const { return static_cast<Callable*>(asObj()); }
+  // defined in LoxInstance.hpp
+  LoxInstance* asInstance() const;
 
-  std::string toString() const; 
+  std::string toString() const;
+
+  bool isTruthy() const;
+  bool isEqual(const Value& other) const;
 
   Type getType() const;
   bool isType(Type type) const;
   std::string getTypeName() const;
 };
 
+static_assert(sizeof(Value) == 8);
+
 struct Literal {
   Value value;
 
-  Literal(float v);
+  Literal(double v);
   Literal(bool v);
-  Literal(const std::string& v);
+  Literal(ObjString* v);
   Literal(Nil v);
-  Literal(std::shared_ptr<Callable> cal);
-  template <typename T>
-  T get() const; 
-  std::string toString() const; 
+  Literal(Value v);
+  std::string toString() const;
 };
 using LiteralPtr = std::shared_ptr<Literal>;
-
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Chunk.hpp"
+#include "Environment.hpp"
+#include "Lox.hpp"
+#include "LoxClass.hpp"
+#include "Stmt.hpp"
+#include "Types.hpp"
+
+class VM;
+
+// Captured variable, points into the VM stack while the declaring frame
+// is alive and owns the value after it returned
+class VMUpvalue {
+public:
+  Value* location;
+  Value closed;
+
+  VMUpvalue(Value* slot);
+};
+
+class VMClosure : public Callable {
+public:
+  std::shared_ptr<VMFunction> function;
+  std::vector<std::shared_ptr<VMUpvalue>> upvalues;
+  VM* vm;
+
+  VMClosure(std::shared_ptr<VMFunction> function, VM* vm);
+  virtual void trace(Heap& heap) override;
+  virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+class VMBoundMethod : public Callable {
+public:
+  Value receiver;
+  VMClosure* method;
+
+  VMBoundMethod(const Value& receiver, VMClosure* method);
+  virtual void trace(Heap& heap) override;
+  virtual std::string toString() override;
+  virtual std::string label() override;
+  virtual int arity() override;
+  virtual Value call(Interpreter* interpreter, std::vector<Value> args) override;
+};
+
+// Instances created by the VM are plain LoxInstances, only the method
+// table holds compiled closures instead of tree-walker functions
+class VMClass : public LoxClass {
+public:
+  std::map<std::string, VMClosure*> vmMethods;
+
+  VMClass(const std::string& name, Heap& heap);
+  virtual void trace(Heap& heap) override;
+  VMClosure* findVMMethod(const std::string& name);
+};
+
+// Stack based virtual machine executing chunks produced by the Compiler
+class VM : public RootSource {
+  struct CallFrame {
+    VMClosure* closure;
+    uint8_t* ip;
+    // first local slot of the frame
+    Value* slots;
+    // everything from here up is discarded on return
+    Value* base;
+  };
+
+  // Both stacks live on the heap and start small. Each doubles when a
+  // call could run out of room in it, as long as both together stay
+  // within Lox::stackBudget, so recursion is bounded by memory and not
+  // by the native stack.
+  static constexpr int INITIAL_FRAMES = 64;
+  static constexpr int INITIAL_SLOTS = 4096;
+  // room a frame gets for its locals and temporaries
+  static constexpr int FRAME_SLOTS = 256;
+
+  Lox& lox;
+
+  std::vector<Value> stack;
+  Value* stackTop;
+  std::vector<CallFrame> frames;
+  int frameCount { 0 };
+  // sorted by stack slot, the innermost upvalue is at the back
+  std::vector<std::shared_ptr<VMUpvalue>> openUpvalues;
+
+  Globals globals;
+  // natives calling back into the program, like memoize()d functions,
+  // recurse on the native stack, callFromHost stops them before it runs out
+  uintptr_t nativeStackBase { 0 };
+  size_t nativeStackBudget;
+
+  void push(Value value);
+  Value pop();
+  void resetStack();
+  RuntimeError error(const std::string& message);
+
+  void callValue(const Value& callee, int argCount);
+  void callClosure(VMClosure* closure, int argCount, Value* base);
+  void growFrames();
+  void growStack();
+  void checkArity(int expected, int argCount);
+  std::shared_ptr<VMUpvalue> captureUpvalue(Value* local);
+  void closeUpvalues(Value* last);
+  void defineNative(const std::string& name, Callable* fn);
+
+  void run(int exitFrame);
+
+public:
+  VM(Lox& lox);
+  VM(const VM&) = delete;
+  ~VM();
+
+  int globalSlot(const std::string& name);
+  Value callFromHost(const Value& callee, const std::vector<Value>& args);
+  void interpret(const Stmt::Stmts& program);
+  virtual void markRoots(Heap& heap) override;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Encodes the few x86-64 instructions the JIT emits. Memory operands are
+// always a base register plus a 32 bit displacement and jumps always take
+// 32 bit offsets, patched once their label is bound.
+class X64Assembler {
+public:
+  enum Reg : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+  };
+
+  enum Cond : uint8_t {
+    OVERFLOW = 0x0,
+    BELOW = 0x2,
+    EQUAL = 0x4,
+    NOT_EQUAL = 0x5,
+    LESS = 0xc,
+    GREATER_EQUAL = 0xd,
+    LESS_EQUAL = 0xe,
+    GREATER = 0xf,
+  };
+
+  // the /r opcode of `op r/m64, r64`, AND and OR double as their /digit
+  // in aluImm
+  enum Alu : uint8_t {
+    ADD = 0x01,
+    OR = 0x09,
+    AND = 0x21,
+    SUB = 0x29,
+    XOR = 0x31,
+    CMP = 0x39,
+  };
+
+  struct Label {
+    // -1 until bound
+    int position { -1 };
+    // offsets of the rel32 fields jumping here
+    std::vector<size_t> uses;
+  };
+
+  std::vector<uint8_t> code;
+
+  void movImm(Reg dst, uint64_t imm);
+  void mov(Reg dst, Reg src);
+  void load(Reg dst, Reg base, int32_t disp);
+  void store(Reg base, int32_t disp, Reg src);
+  void storeImm32(Reg base, int32_t disp, uint32_t imm);
+  void lea(Reg dst, Reg base, int32_t disp);
+  void push(Reg reg);
+  void pop(Reg reg);
+
+  void alu(Alu op, Reg dst, Reg src);
+  void aluImm(Alu op, Reg dst, int32_t imm);
+  // cmp reg, [base + disp]
+  void cmpMem(Reg reg, Reg base, int32_t disp);
+  void test(Reg dst, Reg src);
+  void imul(Reg dst, Reg src);
+  void shl(Reg reg, uint8_t count);
+  void shr(Reg reg, uint8_t count);
+  void sar(Reg reg, uint8_t count);
+  // al = cond, the rest of rax cleared
+  void setAl(Cond cond);
+
+  void call(Reg target);
+  // call [base]
+  void callIndirect(Reg base);
+  void ret();
+  void jmp(Label& label);
+  void jcc(Cond cond, Label& label);
+  void bind(Label& label);
+
+private:
+  void rex(uint8_t reg, uint8_t base);
+  void modrm(uint8_t mod, uint8_t reg, uint8_t rm);
+  void memory(uint8_t reg, Reg base, int32_t disp);
+  void emit32(uint32_t value);
+  void jumpTo(Label& label);
+};
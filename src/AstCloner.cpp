@@ -0,0 +1,128 @@
+#include "../include/AstCloner.hpp"
+
+Expr::ExprPtr AstCloner::clone(Expr::ExprPtr expr) {
+  rewrite(expr);
+  return expr;
+}
+
+Stmt::StmtPtr AstCloner::clone(Stmt::StmtPtr stmt) {
+  rewrite(stmt);
+  return stmt;
+}
+
+std::shared_ptr<Stmt::Function> AstCloner::clone(
+    const Stmt::Function& function) {
+  auto copy = std::make_shared<Stmt::Function>(function);
+  rewriteFunction(copy.get());
+  return copy;
+}
+
+Value AstCloner::visitBinop(Expr::Binop* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitBinop(node); });
+  return Nil();
+}
+
+Value AstCloner::visitUnop(Expr::Unop* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitUnop(node); });
+  return Nil();
+}
+
+Value AstCloner::visitGrouping(Expr::Grouping* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitGrouping(node); });
+  return Nil();
+}
+
+Value AstCloner::visitLiteralExpr(Expr::Literal* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitLiteralExpr(node); });
+  return Nil();
+}
+
+Value AstCloner::visitLogical(Expr::Logical* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitLogical(node); });
+  return Nil();
+}
+
+Value AstCloner::visitVariableExpr(Expr::Variable* var) {
+  copyExpr(var, [this](auto* node) { AstRewriter::visitVariableExpr(node); });
+  return Nil();
+}
+
+Value AstCloner::visitAssign(Expr::Assign* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitAssign(node); });
+  return Nil();
+}
+
+Value AstCloner::visitCall(Expr::Call* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitCall(node); });
+  return Nil();
+}
+
+Value AstCloner::visitGetExpr(Expr::Get* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitGetExpr(node); });
+  return Nil();
+}
+
+Value AstCloner::visitSetExpr(Expr::Set* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitSetExpr(node); });
+  return Nil();
+}
+
+Value AstCloner::visitThisExpr(Expr::This* expr) {
+  copyExpr(expr, [this](auto* node) { AstRewriter::visitThisExpr(node); });
+  return Nil();
+}
+
+Value AstCloner::visitExprStmt(Stmt::Expr* exprstmt) {
+  copyStmt(exprstmt, [this](auto* node) { AstRewriter::visitExprStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitPrintStmt(Stmt::Print* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitPrintStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitBlockStmt(Stmt::Block* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitBlockStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitIfStmt(Stmt::If* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitIfStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitWhileStmt(Stmt::While* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitWhileStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitBreakStmt(Stmt::Break* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitBreakStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitVarStmt(Stmt::Var* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitVarStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitFunctionStmt(Stmt::Function* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitFunctionStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitReturnStmt(Stmt::Return* stmt) {
+  copyStmt(stmt, [this](auto* node) { AstRewriter::visitReturnStmt(node); });
+  return Nil();
+}
+
+Value AstCloner::visitClassStmt(Stmt::Class* stmt) {
+  // it owns its superclass so it is put together again from its parts
+  Stmt::Methods methods;
+  for(const auto& method: stmt->methods) methods.push_back(clone(*method));
+  auto node = std::make_shared<Stmt::Class>(stmt->name, methods);
+  node->slot = stmt->slot;
+  stmtReplacement = node;
+  return Nil();
+}
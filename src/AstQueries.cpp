@@ -0,0 +1,96 @@
+#include "../include/AstQueries.hpp"
+#include "../include/AstRewriter.hpp"
+
+#include <cstdio>
+
+namespace {
+
+// Whether a function declares functions or classes that could capture
+// its locals. Declarations at the top level of the script capture none.
+class ClosureScan : public AstRewriter {
+  bool topLevel;
+  int depth { 0 };
+
+public:
+  bool found { false };
+
+  ClosureScan(bool topLevel) : topLevel { topLevel } {}
+
+  Value visitBlockStmt(Stmt::Block* stmt) override {
+    depth++;
+    AstRewriter::visitBlockStmt(stmt);
+    depth--;
+    return Nil();
+  }
+
+  Value visitFunctionStmt(Stmt::Function* stmt) override {
+    if(!topLevel || depth > 0) found = true;
+    return Nil();
+  }
+
+  Value visitClassStmt(Stmt::Class* stmt) override {
+    if(!topLevel || depth > 0) found = true;
+    return Nil();
+  }
+};
+
+std::string keyOf(Expr::Expr* expr, size_t& budget) {
+  if(budget == 0) return "";
+  budget--;
+  if(auto* literal = dynamic_cast<Expr::Literal*>(expr)) {
+    return literalSpelling(literal->value->value);
+  }
+  if(auto* var = dynamic_cast<Expr::Variable*>(expr)) {
+    return var->name.lexeme;
+  }
+  if(dynamic_cast<Expr::This*>(expr)) return "this";
+  if(auto* grouping = dynamic_cast<Expr::Grouping*>(expr)) {
+    return keyOf(grouping->expr.get(), budget);
+  }
+  if(auto* unop = dynamic_cast<Expr::Unop*>(expr)) {
+    std::string operand = keyOf(unop->expr.get(), budget);
+    if(operand.empty()) return "";
+    return "(" + unop->op.lexeme + " " + operand + ")";
+  }
+  std::string left, right, op;
+  if(auto* binop = dynamic_cast<Expr::Binop*>(expr)) {
+    left = keyOf(binop->left.get(), budget);
+    right = keyOf(binop->right.get(), budget);
+    op = binop->op.lexeme;
+  } else if(auto* logical = dynamic_cast<Expr::Logical*>(expr)) {
+    left = keyOf(logical->left.get(), budget);
+    right = keyOf(logical->right.get(), budget);
+    op = logical->op.lexeme;
+  } else if(auto* get = dynamic_cast<Expr::Get*>(expr)) {
+    left = keyOf(get->object.get(), budget);
+    if(left.empty()) return "";
+    return "(. " + left + " " + get->name.lexeme + ")";
+  }
+  if(left.empty() || right.empty()) return "";
+  return "(" + op + " " + left + " " + right + ")";
+}
+
+}
+
+std::string pureKey(Expr::Expr* expr) {
+  size_t budget = MAX_KEYED;
+  return keyOf(expr, budget);
+}
+
+std::string literalSpelling(const Value& value) {
+  if(value.isString()) return "\"" + value.asString()->chars + "\"";
+  if(value.isBool()) return value.asBool() ? "true" : "false";
+  if(!value.isDouble()) return value.toString();
+  // print rounds to six places and 1.0 like 1
+  char digits[32];
+  snprintf(digits, sizeof digits, "%.17g", value.asDouble());
+  std::string spelling = digits;
+  if(spelling.find_first_of(".en") == std::string::npos) spelling += ".0";
+  return spelling;
+}
+
+bool declaresClosures(Stmt::Stmts& body, bool topLevel) {
+  ClosureScan scan(topLevel);
+  scan.rewrite(body);
+  return scan.found;
+}
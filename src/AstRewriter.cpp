@@ -0,0 +1,206 @@
+#include "../include/AstRewriter.hpp"
+
+#include <utility>
+
+namespace {
+
+Expr::ExprPtr* leftOperand(Expr::Expr* expr) {
+  if(auto* binop = dynamic_cast<Expr::Binop*>(expr)) return &binop->left;
+  if(auto* logical = dynamic_cast<Expr::Logical*>(expr)) return &logical->left;
+  return nullptr;
+}
+
+}
+
+void AstRewriter::rewrite(Expr::ExprPtr& expr) {
+  if(!expr) return;
+  if(expr.get() == rewrittenLeft) {
+    expr = std::move(leftRewrite);
+    rewrittenLeft = nullptr;
+    return;
+  }
+  Expr::Expr* outerLeft = std::exchange(rewrittenLeft, nullptr);
+  Expr::ExprPtr outerRewrite = std::move(leftRewrite);
+
+  // a chain like a + b - c is visited from its innermost operator out, the
+  // visit of an operator gets its left operand rewritten already instead of
+  // recursing into it
+  std::vector<Expr::ExprPtr> chain { expr };
+  while(Expr::ExprPtr* left = leftOperand(chain.back().get())) {
+    chain.push_back(*left);
+  }
+  Expr::ExprPtr rewritten;
+  for(size_t i = chain.size(); i-- > 0;) {
+    if(rewritten) rewrittenLeft = chain[i + 1].get();
+    leftRewrite = std::move(rewritten);
+    rewritten = chain[i];
+    nodes++;
+    rewritten->accept(this);
+    if(exprReplacement) rewritten = std::move(exprReplacement);
+    exprReplacement = nullptr;
+    // not every visit rewrites the left operand
+    rewrittenLeft = nullptr;
+    leftRewrite = nullptr;
+  }
+  expr = std::move(rewritten);
+
+  rewrittenLeft = outerLeft;
+  leftRewrite = std::move(outerRewrite);
+}
+
+void AstRewriter::rewrite(Stmt::StmtPtr& stmt) {
+  if(!stmt) return;
+  nodes++;
+  stmt->accept(this);
+  if(removeStmt) {
+    stmt = std::make_shared<Stmt::Block>();
+  } else if(stmtReplacement) {
+    stmt = std::move(stmtReplacement);
+  }
+  if(!insertBefore.empty()) {
+    insertBefore.push_back(stmt);
+    stmt = std::make_shared<Stmt::Block>(insertBefore);
+    insertBefore.clear();
+  }
+  stmtReplacement = nullptr;
+  removeStmt = false;
+}
+
+void AstRewriter::rewrite(Stmt::Stmts& statements) {
+  for(size_t i = 0; i < statements.size();) {
+    nodes++;
+    statements[i]->accept(this);
+    if(!insertBefore.empty()) {
+      statements.insert(statements.begin() + i,
+          insertBefore.begin(), insertBefore.end());
+      i += insertBefore.size();
+      insertBefore.clear();
+    }
+    if(removeStmt) {
+      statements.erase(statements.begin() + i);
+    } else {
+      if(stmtReplacement) statements[i] = std::move(stmtReplacement);
+      i++;
+    }
+    stmtReplacement = nullptr;
+    removeStmt = false;
+  }
+}
+
+void AstRewriter::rewriteFunction(Stmt::Function* function) {
+  rewrite(function->body);
+}
+
+Value AstRewriter::visitBinop(Expr::Binop* expr) {
+  rewrite(expr->left);
+  rewrite(expr->right);
+  return Nil();
+}
+
+Value AstRewriter::visitUnop(Expr::Unop* expr) {
+  rewrite(expr->expr);
+  return Nil();
+}
+
+Value AstRewriter::visitGrouping(Expr::Grouping* expr) {
+  rewrite(expr->expr);
+  return Nil();
+}
+
+Value AstRewriter::visitLiteralExpr(Expr::Literal* expr) {
+  return Nil();
+}
+
+Value AstRewriter::visitLogical(Expr::Logical* expr) {
+  rewrite(expr->left);
+  rewrite(expr->right);
+  return Nil();
+}
+
+Value AstRewriter::visitExprStmt(Stmt::Expr* exprstmt) {
+  rewrite(exprstmt->expr);
+  return Nil();
+}
+
+Value AstRewriter::visitPrintStmt(Stmt::Print* stmt) {
+  rewrite(stmt->expr);
+  return Nil();
+}
+
+Value AstRewriter::visitBlockStmt(Stmt::Block* stmt) {
+  rewrite(stmt->statements);
+  return Nil();
+}
+
+Value AstRewriter::visitIfStmt(Stmt::If* stmt) {
+  rewrite(stmt->condition);
+  rewrite(stmt->thenBranch);
+  rewrite(stmt->elseBranch);
+  return Nil();
+}
+
+Value AstRewriter::visitWhileStmt(Stmt::While* stmt) {
+  rewrite(stmt->condition);
+  rewrite(stmt->body);
+  return Nil();
+}
+
+Value AstRewriter::visitBreakStmt(Stmt::Break* stmt) {
+  return Nil();
+}
+
+Value AstRewriter::visitVariableExpr(Expr::Variable* var) {
+  return Nil();
+}
+
+Value AstRewriter::visitAssign(Expr::Assign* expr) {
+  rewrite(expr->value);
+  return Nil();
+}
+
+Value AstRewriter::visitVarStmt(Stmt::Var* stmt) {
+  rewrite(stmt->initializer);
+  return Nil();
+}
+
+Value AstRewriter::visitClassStmt(Stmt::Class* stmt) {
+  for(auto& method: stmt->methods) {
+    rewriteFunction(method.get());
+  }
+  return Nil();
+}
+
+Value AstRewriter::visitFunctionStmt(Stmt::Function* stmt) {
+  rewriteFunction(stmt);
+  return Nil();
+}
+
+Value AstRewriter::visitReturnStmt(Stmt::Return* stmt) {
+  rewrite(stmt->value);
+  return Nil();
+}
+
+Value AstRewriter::visitCall(Expr::Call* expr) {
+  rewrite(expr->callee);
+  // the callee may have been replaced
+  expr->property = dynamic_cast<Expr::Get*>(expr->callee.get());
+  for(auto& arg: expr->arguments) {
+    rewrite(arg);
+  }
+  return Nil();
+}
+
+Value AstRewriter::visitGetExpr(Expr::Get* expr) {
+  rewrite(expr->object);
+  return Nil();
+}
+
+Value AstRewriter::visitSetExpr(Expr::Set* expr) {
+  rewrite(expr->object);
+  rewrite(expr->value);
+  return Nil();
+}
+
+Value AstRewriter::visitThisExpr(Expr::This* expr) {
+  return Nil();
+}
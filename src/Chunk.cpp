@@ -0,0 +1,35 @@
+#include "../include/Chunk.hpp"
+
+void Chunk::write(uint8_t byte, int line) {
+  if(lines.empty() || lines.back().line != line) {
+    lines.push_back({ static_cast<int>(code.size()), line });
+  }
+  code.push_back(byte);
+}
+
+int Chunk::addConstant(const Value& value) {
+  constants.push_back(value);
+  return constants.size() - 1;
+}
+
+int Chunk::addFunction(std::shared_ptr<VMFunction> function) {
+  functions.push_back(std::move(function));
+  return functions.size() - 1;
+}
+
+int Chunk::getLine(int offset) const {
+  // binary search for the last run starting at or before offset
+  int lo = 0, hi = lines.size() - 1, line = 0;
+  while(lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if(lines[mid].offset <= offset) {
+      line = lines[mid].line;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return line;
+}
+
+VMFunction::VMFunction(const std::string& name) : name { name } {}
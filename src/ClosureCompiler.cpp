@@ -0,0 +1,710 @@
+#include "../include/ClosureCompiler.hpp"
+#include "../include/LoxFunction.hpp"
+#include "../include/Numbers.hpp"
+
+#include <iostream>
+
+using Closures::ExprCode, Closures::StmtCode;
+
+struct ClosureCompiler::Nodes {
+  // a node running Node::eval, which the compiler inlines into `run`
+  template <typename Node>
+  struct ExprOf : Closures::ExprNode {
+    ExprOf() : ExprNode([](const ExprNode* node, Interpreter& in) {
+      return static_cast<const Node*>(node)->eval(in);
+    }) {}
+  };
+
+  template <typename Node>
+  struct StmtOf : Closures::StmtNode {
+    StmtOf() : StmtNode([](const StmtNode* node, Interpreter& in) {
+      return static_cast<const Node*>(node)->eval(in);
+    }) {}
+  };
+
+  // Expressions --------------------------------------------------------------
+
+  struct Constant : ExprOf<Constant> {
+    Value value;
+    Constant(Value value) : value { value } { allocates = false; }
+    Value eval(Interpreter& in) const { return value; }
+  };
+
+  struct Local : ExprOf<Local> {
+    int slot;
+    Local(int slot) : slot { slot } { allocates = false; }
+    Value eval(Interpreter& in) const { return in.frame[slot]; }
+  };
+
+  struct Upvalue : ExprOf<Upvalue> {
+    int slot;
+    Upvalue(int slot) : slot { slot } { allocates = false; }
+    Value eval(Interpreter& in) const {
+      return *in.closure->upvalues[slot]->location;
+    }
+  };
+
+  struct Global : ExprOf<Global> {
+    int slot;
+    Token name;
+    Global(int slot, Token name) : slot { slot }, name { name } {
+      allocates = false;
+    }
+    Value eval(Interpreter& in) const {
+      if(in.globals.isDefined(slot)) return in.globals.at(slot);
+      return in.globals.get(slot, name);
+    }
+  };
+
+  struct SetLocal : ExprOf<SetLocal> {
+    int slot;
+    ExprCode value;
+    SetLocal(int slot, ExprCode value)
+      : slot { slot }, value { std::move(value) } {}
+    Value eval(Interpreter& in) const {
+      return in.frame[slot] = (*value)(in);
+    }
+  };
+
+  struct SetUpvalue : ExprOf<SetUpvalue> {
+    int slot;
+    ExprCode value;
+    SetUpvalue(int slot, ExprCode value)
+      : slot { slot }, value { std::move(value) } {}
+    Value eval(Interpreter& in) const {
+      Value result = (*value)(in);
+      return *in.closure->upvalues[slot]->location = result;
+    }
+  };
+
+  struct SetGlobal : ExprOf<SetGlobal> {
+    int slot;
+    Token name;
+    ExprCode value;
+    SetGlobal(int slot, Token name, ExprCode value)
+      : slot { slot }, name { name }, value { std::move(value) } {}
+    Value eval(Interpreter& in) const {
+      Value result = (*value)(in);
+      in.globals.assign(slot, name, result);
+      return result;
+    }
+  };
+
+  // a counter of a loop, `name = name + step`
+  struct Step : ExprOf<Step> {
+    Expr::Assign* assign;
+    ExprCode value;
+    Step(Expr::Assign* assign, ExprCode value)
+      : assign { assign }, value { std::move(value) } {}
+    Value eval(Interpreter& in) const {
+      Value result;
+      if(in.stepCounter(assign, result)) return result;
+      result = (*value)(in);
+      in.assign(assign->name, assign->slot, result);
+      return result;
+    }
+  };
+
+  // the left operand stays a root while the right one allocates
+  struct Operands {
+    ExprCode left;
+    ExprCode right;
+    Token token;
+
+    std::pair<Value, Value> eval(Interpreter& in) const {
+      Value l = (*left)(in);
+      if(!right->allocates) return { l, (*right)(in) };
+      in.temporaries.push_back(l);
+      Value r = (*right)(in);
+      in.temporaries.pop_back();
+      return { l, r };
+    }
+  };
+
+  template <Numbers::Op op>
+  struct Arithmetic : ExprOf<Arithmetic<op>>, Operands {
+    Arithmetic(Operands operands) : Operands { std::move(operands) } {}
+    Value eval(Interpreter& in) const {
+      auto [left, right] = Operands::eval(in);
+      Value result;
+      if(Numbers::quick(op, left, right, result)) return result;
+      // strings, integers that don't fit inline and the errors
+      return in.binop(token, left, right);
+    }
+  };
+
+  template <bool negated>
+  struct Equal : ExprOf<Equal<negated>>, Operands {
+    Equal(Operands operands) : Operands { std::move(operands) } {}
+    Value eval(Interpreter& in) const {
+      auto [left, right] = Operands::eval(in);
+      return left.isEqual(right) != negated;
+    }
+  };
+
+  // proven to be two strings by the type checker, the tags are checked
+  // all the same
+  struct Concatenate : ExprOf<Concatenate>, Operands {
+    Concatenate(Operands operands) : Operands { std::move(operands) } {}
+    Value eval(Interpreter& in) const {
+      auto [left, right] = Operands::eval(in);
+      if(!left.isString() || !right.isString()) {
+        return in.binop(token, left, right);
+      }
+      return in.heap().makeString(
+          left.asString()->chars + right.asString()->chars);
+    }
+  };
+
+  template <TokenType type>
+  struct Unary : ExprOf<Unary<type>> {
+    ExprCode operand;
+    Token op;
+    Unary(ExprCode operand, Token op)
+      : operand { std::move(operand) }, op { op } {}
+    Value eval(Interpreter& in) const {
+      Value right = (*operand)(in);
+      if constexpr(type == BANG) {
+        return !right.isTruthy();
+      } else {
+        if(!right.isNumber()) return in.unop(op, right);
+        Heap* heap = &in.heap();
+        if constexpr(type == MINUS) return *Numbers::negate(right, heap);
+        if constexpr(type == PLUSPLUS) return *Numbers::add(right, 1, heap);
+        if constexpr(type == MINUSMINUS) return *Numbers::add(right, -1, heap);
+        // ~ reports doubles
+        return in.onNumber(op, right);
+      }
+    }
+  };
+
+  template <bool isOr>
+  struct Logical : ExprOf<Logical<isOr>> {
+    ExprCode left;
+    ExprCode right;
+    Logical(ExprCode left, ExprCode right)
+      : left { std::move(left) }, right { std::move(right) } {}
+    Value eval(Interpreter& in) const {
+      Value value = (*left)(in);
+      if(value.isTruthy() == isOr) return value;
+      return (*right)(in);
+    }
+  };
+
+  // the left operand of an operator in a Chain, what the operator before
+  // it computed. Operators read their left operand first, so a call in the
+  // right one running the same chain again can't overwrite it too early.
+  struct Carried : ExprOf<Carried> {
+    mutable Value value;
+    Carried() { allocates = false; }
+    Value eval(Interpreter& in) const { return value; }
+  };
+
+  // a chain like a + b - c, run in a loop from the innermost operator out
+  // instead of recursing into the left operands
+  struct Chain : ExprOf<Chain> {
+    ExprCode first;
+    std::vector<ExprCode> operators;
+    std::vector<const Carried*> carried;
+    Chain(ExprCode first) : first { std::move(first) } {}
+    Value eval(Interpreter& in) const {
+      Value value = (*first)(in);
+      for(size_t i = 0; i < operators.size(); i++) {
+        carried[i]->value = value;
+        value = (*operators[i])(in);
+      }
+      return value;
+    }
+  };
+
+  // what a call evaluates before it calls, shared with tail calls
+  struct CallSite {
+    Expr::Call* call;
+    // the object when the callee is a property
+    ExprCode callee;
+    std::vector<ExprCode> arguments;
+
+    LoxFunction* push(Interpreter& in) const {
+      size_t base = in.temporaries.size();
+      LoxFunction* method = nullptr;
+      if(call->property) {
+        method = in.pushCallee(call->property, (*callee)(in));
+      } else {
+        in.temporaries.push_back((*callee)(in));
+      }
+      for(const auto& argument: arguments) {
+        in.temporaries.push_back((*argument)(in));
+      }
+      in.checkCall(call, in.temporaries[base], method);
+      return method;
+    }
+  };
+
+  struct Call : ExprOf<Call> {
+    CallSite site;
+    Call(CallSite site) : site { std::move(site) } {}
+    Value eval(Interpreter& in) const {
+      size_t base = in.temporaries.size();
+      LoxFunction* method = site.push(in);
+      return in.finishCall(base, method, site.call->paren);
+    }
+  };
+
+  struct Get : ExprOf<Get> {
+    Expr::Get* get;
+    ExprCode object;
+    Get(Expr::Get* get, ExprCode object)
+      : get { get }, object { std::move(object) } {}
+    Value eval(Interpreter& in) const {
+      return in.getProperty(get, (*object)(in));
+    }
+  };
+
+  struct Set : ExprOf<Set> {
+    Expr::Set* set;
+    ExprCode object;
+    ExprCode value;
+    Set(Expr::Set* set, ExprCode object, ExprCode value)
+      : set { set }, object { std::move(object) }, value { std::move(value) } {}
+    Value eval(Interpreter& in) const {
+      Value instance = (*object)(in);
+      if(!instance.isInstance()) {
+        throw RuntimeError(set->name, "Only instances have fields.");
+      }
+      in.temporaries.push_back(instance);
+      Value result = (*value)(in);
+      in.temporaries.pop_back();
+      return in.setProperty(set, instance, result);
+    }
+  };
+
+  // Statements ---------------------------------------------------------------
+
+  struct Evaluate : StmtOf<Evaluate> {
+    ExprCode expr;
+    Evaluate(ExprCode expr) : expr { std::move(expr) } {}
+    Completion eval(Interpreter& in) const {
+      (*expr)(in);
+      return Completion::NORMAL;
+    }
+  };
+
+  struct Print : StmtOf<Print> {
+    ExprCode expr;
+    Print(ExprCode expr) : expr { std::move(expr) } {}
+    Completion eval(Interpreter& in) const {
+      std::cout << (*expr)(in).toString() << std::endl;
+      return Completion::NORMAL;
+    }
+  };
+
+  struct Define : StmtOf<Define> {
+    Expr::VarSlot slot;
+    // nullptr declares nil
+    ExprCode initializer;
+    Define(Expr::VarSlot slot, ExprCode initializer)
+      : slot { slot }, initializer { std::move(initializer) } {}
+    Completion eval(Interpreter& in) const {
+      in.define(slot, initializer ? (*initializer)(in) : Value());
+      return Completion::NORMAL;
+    }
+  };
+
+  struct Block : StmtOf<Block> {
+    Closures::Body body;
+    // first slot of the locals a closure captured, -1 when none was
+    int closesFrom;
+    Block(Closures::Body body, int closesFrom)
+      : body { std::move(body) }, closesFrom { closesFrom } {}
+    Completion eval(Interpreter& in) const {
+      Completion completion = body.run(in);
+      if(closesFrom >= 0) in.closeUpvalues(in.frame + closesFrom);
+      return completion;
+    }
+  };
+
+  struct If : StmtOf<If> {
+    ExprCode condition;
+    StmtCode thenBranch;
+    // nullptr without an else
+    StmtCode elseBranch;
+    If(ExprCode condition, StmtCode thenBranch, StmtCode elseBranch)
+      : condition { std::move(condition) },
+      thenBranch { std::move(thenBranch) },
+      elseBranch { std::move(elseBranch) } {}
+    Completion eval(Interpreter& in) const {
+      if((*condition)(in).isTruthy()) return (*thenBranch)(in);
+      if(elseBranch) return (*elseBranch)(in);
+      return Completion::NORMAL;
+    }
+  };
+
+  struct While : StmtOf<While> {
+    ExprCode condition;
+    StmtCode body;
+    // what the tracer counts iterations of
+    Stmt::While& loop;
+    While(ExprCode condition, StmtCode body, Stmt::While& loop)
+      : condition { std::move(condition) }, body { std::move(body) },
+        loop { loop } {}
+    Completion eval(Interpreter& in) const {
+      while(true) {
+        if(in.tracer) {
+          in.tracer->loopHeader(loop, in.frame, in.nativeStackLimit());
+        }
+        if(!(*condition)(in).isTruthy()) break;
+        Completion completion = (*body)(in);
+        if(completion == Completion::BREAK) break;
+        // a return keeps unwinding up to the function call
+        if(completion != Completion::NORMAL) return completion;
+      }
+      return Completion::NORMAL;
+    }
+  };
+
+  struct Break : StmtOf<Break> {
+    Completion eval(Interpreter& in) const { return Completion::BREAK; }
+  };
+
+  struct Return : StmtOf<Return> {
+    // nullptr returns nil
+    ExprCode value;
+    Return(ExprCode value) : value { std::move(value) } {}
+    Completion eval(Interpreter& in) const {
+      in.returnValue = value ? (*value)(in) : Value();
+      return Completion::RETURN;
+    }
+  };
+
+  struct TailCall : StmtOf<TailCall> {
+    CallSite site;
+    TailCall(CallSite site) : site { std::move(site) } {}
+    Completion eval(Interpreter& in) const {
+      size_t base = in.temporaries.size();
+      LoxFunction* method = site.push(in);
+      return in.saveTailCall(base, method, site.call->paren);
+    }
+  };
+
+  struct Function : StmtOf<Function> {
+    std::shared_ptr<Stmt::Function> declaration;
+    Function(std::shared_ptr<Stmt::Function> declaration)
+      : declaration { std::move(declaration) } {}
+    Completion eval(Interpreter& in) const {
+      Callable* function = in.heap().make<LoxFunction>(declaration,
+          in.captureUpvalues(*declaration));
+      in.define(declaration->slot, Value(function));
+      return Completion::NORMAL;
+    }
+  };
+
+  struct Class : StmtOf<Class> {
+    Stmt::Class* declaration;
+    Class(Stmt::Class* declaration) : declaration { declaration } {}
+    Completion eval(Interpreter& in) const {
+      in.visitClassStmt(declaration);
+      return Completion::NORMAL;
+    }
+  };
+
+  // Arithmetic<op> for an operator only known when compiling
+  static ExprCode arithmetic(Numbers::Op op, Operands operands) {
+    using enum Numbers::Op;
+    switch(op) {
+      case ADD: return std::make_unique<Arithmetic<ADD>>(std::move(operands));
+      case SUBTRACT:
+        return std::make_unique<Arithmetic<SUBTRACT>>(std::move(operands));
+      case MULTIPLY:
+        return std::make_unique<Arithmetic<MULTIPLY>>(std::move(operands));
+      case DIVIDE:
+        return std::make_unique<Arithmetic<DIVIDE>>(std::move(operands));
+      case LESS: return std::make_unique<Arithmetic<LESS>>(std::move(operands));
+      case LESS_EQUAL:
+        return std::make_unique<Arithmetic<LESS_EQUAL>>(std::move(operands));
+      case GREATER:
+        return std::make_unique<Arithmetic<GREATER>>(std::move(operands));
+      case GREATER_EQUAL:
+        return std::make_unique<Arithmetic<GREATER_EQUAL>>(std::move(operands));
+      case BIT_AND:
+        return std::make_unique<Arithmetic<BIT_AND>>(std::move(operands));
+      case BIT_OR:
+        return std::make_unique<Arithmetic<BIT_OR>>(std::move(operands));
+      case BIT_XOR:
+        return std::make_unique<Arithmetic<BIT_XOR>>(std::move(operands));
+      case SHIFT_LEFT:
+        return std::make_unique<Arithmetic<SHIFT_LEFT>>(std::move(operands));
+      case SHIFT_RIGHT:
+        return std::make_unique<Arithmetic<SHIFT_RIGHT>>(std::move(operands));
+    }
+    return nullptr;
+  }
+
+  static CallSite callSite(ClosureCompiler& compiler, Expr::Call* call) {
+    CallSite site { call, compiler.compile(call->property
+        ? call->property->object : call->callee), {} };
+    for(const auto& argument: call->arguments) {
+      site.arguments.push_back(compiler.compile(argument));
+    }
+    return site;
+  }
+};
+
+Closures::Body ClosureCompiler::compile(const Stmts& program) {
+  return compileAll(program);
+}
+
+ExprCode ClosureCompiler::compile(const ExprPtr& expr) {
+  expr->accept(this);
+  return std::move(compiledExpr);
+}
+
+StmtCode ClosureCompiler::compile(const StmtPtr& stmt) {
+  compiling = stmt;
+  stmt->accept(this);
+  return std::move(compiledStmt);
+}
+
+Closures::Body ClosureCompiler::compileAll(const Stmts& statements) {
+  Closures::Body body;
+  for(const auto& stmt: statements) body.statements.push_back(compile(stmt));
+  return body;
+}
+
+void ClosureCompiler::compileFunction(Stmt::Function& function) {
+  function.compiled =
+    std::make_shared<Closures::Body>(compileAll(function.body));
+}
+
+// Expressions ----------------------------------------------------------------
+
+Value ClosureCompiler::visitBinop(Expr::Binop* expr) {
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  if(chain.size() == 1) {
+    compiledExpr = compileOperator(expr, compile(expr->left));
+    return Nil();
+  }
+  auto node = std::make_unique<Nodes::Chain>(compile(chain.front()->left));
+  for(Expr::Binop* binop: chain) {
+    auto carried = std::make_unique<Nodes::Carried>();
+    node->carried.push_back(carried.get());
+    node->operators.push_back(compileOperator(binop, std::move(carried)));
+  }
+  compiledExpr = std::move(node);
+  return Nil();
+}
+
+ExprCode ClosureCompiler::compileOperator(Expr::Binop* expr, ExprCode left) {
+  Nodes::Operands operands {
+    std::move(left), compile(expr->right), expr->op
+  };
+  if(expr->op.type == EQUAL_EQUAL) {
+    return std::make_unique<Nodes::Equal<false>>(std::move(operands));
+  } else if(expr->op.type == BANG_EQUAL) {
+    return std::make_unique<Nodes::Equal<true>>(std::move(operands));
+  } else if(expr->op.type == PLUS && expr->left->type == Type::STRING
+      && expr->right->type == Type::STRING) {
+    return std::make_unique<Nodes::Concatenate>(std::move(operands));
+  }
+  return Nodes::arithmetic(*expr->arithmetic, std::move(operands));
+}
+
+Value ClosureCompiler::visitUnop(Expr::Unop* expr) {
+  ExprCode operand = compile(expr->expr);
+  switch(expr->op.type) {
+    case BANG:
+      compiledExpr =
+        std::make_unique<Nodes::Unary<BANG>>(std::move(operand), expr->op);
+      break;
+    case MINUS:
+      compiledExpr =
+        std::make_unique<Nodes::Unary<MINUS>>(std::move(operand), expr->op);
+      break;
+    case PLUSPLUS:
+      compiledExpr =
+        std::make_unique<Nodes::Unary<PLUSPLUS>>(std::move(operand), expr->op);
+      break;
+    case MINUSMINUS:
+      compiledExpr = std::make_unique<Nodes::Unary<MINUSMINUS>>(
+          std::move(operand), expr->op);
+      break;
+    default:
+      compiledExpr =
+        std::make_unique<Nodes::Unary<TILDE>>(std::move(operand), expr->op);
+  }
+  return Nil();
+}
+
+Value ClosureCompiler::visitGrouping(Expr::Grouping* expr) {
+  compiledExpr = compile(expr->expr);
+  return Nil();
+}
+
+Value ClosureCompiler::visitLiteralExpr(Expr::Literal* expr) {
+  compiledExpr = std::make_unique<Nodes::Constant>(expr->value->value);
+  return Nil();
+}
+
+Value ClosureCompiler::visitVariableExpr(Expr::Variable* expr) {
+  switch(expr->slot.kind) {
+    case Expr::VarSlot::LOCAL:
+      compiledExpr = std::make_unique<Nodes::Local>(expr->slot.slot);
+      break;
+    case Expr::VarSlot::UPVALUE:
+      compiledExpr = std::make_unique<Nodes::Upvalue>(expr->slot.slot);
+      break;
+    default:
+      compiledExpr =
+        std::make_unique<Nodes::Global>(expr->slot.slot, expr->name);
+  }
+  return Nil();
+}
+
+Value ClosureCompiler::visitThisExpr(Expr::This* expr) {
+  if(expr->slot.kind == Expr::VarSlot::LOCAL) {
+    compiledExpr = std::make_unique<Nodes::Local>(expr->slot.slot);
+  } else {
+    compiledExpr = std::make_unique<Nodes::Upvalue>(expr->slot.slot);
+  }
+  return Nil();
+}
+
+Value ClosureCompiler::visitAssign(Expr::Assign* expr) {
+  ExprCode value = compile(expr->value);
+  int slot = expr->slot.slot;
+  if(!expr->step.isNil()) {
+    compiledExpr = std::make_unique<Nodes::Step>(expr, std::move(value));
+    return Nil();
+  }
+  switch(expr->slot.kind) {
+    case Expr::VarSlot::LOCAL:
+      compiledExpr = std::make_unique<Nodes::SetLocal>(slot, std::move(value));
+      break;
+    case Expr::VarSlot::UPVALUE:
+      compiledExpr =
+        std::make_unique<Nodes::SetUpvalue>(slot, std::move(value));
+      break;
+    default:
+      compiledExpr =
+        std::make_unique<Nodes::SetGlobal>(slot, expr->name, std::move(value));
+  }
+  return Nil();
+}
+
+Value ClosureCompiler::visitLogical(Expr::Logical* expr) {
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  if(chain.size() == 1) {
+    compiledExpr = compileShortCircuit(expr, compile(expr->left));
+    return Nil();
+  }
+  auto node = std::make_unique<Nodes::Chain>(compile(chain.front()->left));
+  for(Expr::Logical* logical: chain) {
+    auto carried = std::make_unique<Nodes::Carried>();
+    node->carried.push_back(carried.get());
+    node->operators.push_back(
+        compileShortCircuit(logical, std::move(carried)));
+  }
+  compiledExpr = std::move(node);
+  return Nil();
+}
+
+ExprCode ClosureCompiler::compileShortCircuit(Expr::Logical* expr,
+    ExprCode left) {
+  ExprCode right = compile(expr->right);
+  if(expr->op.type == OR) {
+    return std::make_unique<Nodes::Logical<true>>(std::move(left),
+        std::move(right));
+  }
+  return std::make_unique<Nodes::Logical<false>>(std::move(left),
+      std::move(right));
+}
+
+Value ClosureCompiler::visitCall(Expr::Call* expr) {
+  compiledExpr = std::make_unique<Nodes::Call>(Nodes::callSite(*this, expr));
+  return Nil();
+}
+
+Value ClosureCompiler::visitGetExpr(Expr::Get* expr) {
+  compiledExpr = std::make_unique<Nodes::Get>(expr, compile(expr->object));
+  return Nil();
+}
+
+Value ClosureCompiler::visitSetExpr(Expr::Set* expr) {
+  ExprCode object = compile(expr->object);
+  compiledExpr = std::make_unique<Nodes::Set>(expr, std::move(object),
+      compile(expr->value));
+  return Nil();
+}
+
+// Statements -----------------------------------------------------------------
+
+Value ClosureCompiler::visitExprStmt(Stmt::Expr* stmt) {
+  compiledStmt = std::make_unique<Nodes::Evaluate>(compile(stmt->expr));
+  return Nil();
+}
+
+Value ClosureCompiler::visitPrintStmt(Stmt::Print* stmt) {
+  compiledStmt = std::make_unique<Nodes::Print>(compile(stmt->expr));
+  return Nil();
+}
+
+Value ClosureCompiler::visitVarStmt(Stmt::Var* stmt) {
+  ExprCode initializer;
+  if(stmt->initializer) initializer = compile(stmt->initializer);
+  compiledStmt =
+    std::make_unique<Nodes::Define>(stmt->slot, std::move(initializer));
+  return Nil();
+}
+
+Value ClosureCompiler::visitBlockStmt(Stmt::Block* stmt) {
+  compiledStmt = std::make_unique<Nodes::Block>(compileAll(stmt->statements),
+      stmt->closesUpvalues ? stmt->firstSlot : -1);
+  return Nil();
+}
+
+Value ClosureCompiler::visitIfStmt(Stmt::If* stmt) {
+  ExprCode condition = compile(stmt->condition);
+  StmtCode thenBranch = compile(stmt->thenBranch);
+  StmtCode elseBranch;
+  if(stmt->elseBranch) elseBranch = compile(stmt->elseBranch);
+  compiledStmt = std::make_unique<Nodes::If>(std::move(condition),
+      std::move(thenBranch), std::move(elseBranch));
+  return Nil();
+}
+
+Value ClosureCompiler::visitWhileStmt(Stmt::While* stmt) {
+  ExprCode condition = compile(stmt->condition);
+  compiledStmt = std::make_unique<Nodes::While>(std::move(condition),
+      compile(stmt->body), *stmt);
+  return Nil();
+}
+
+Value ClosureCompiler::visitBreakStmt(Stmt::Break* stmt) {
+  compiledStmt = std::make_unique<Nodes::Break>();
+  return Nil();
+}
+
+Value ClosureCompiler::visitReturnStmt(Stmt::Return* stmt) {
+  if(stmt->tailCall) {
+    auto* call = static_cast<Expr::Call*>(stmt->value.get());
+    compiledStmt =
+      std::make_unique<Nodes::TailCall>(Nodes::callSite(*this, call));
+    return Nil();
+  }
+  ExprCode value;
+  if(stmt->value) value = compile(stmt->value);
+  compiledStmt = std::make_unique<Nodes::Return>(std::move(value));
+  return Nil();
+}
+
+Value ClosureCompiler::visitFunctionStmt(Stmt::Function* stmt) {
+  auto declaration = std::static_pointer_cast<Stmt::Function>(compiling);
+  compileFunction(*stmt);
+  compiledStmt = std::make_unique<Nodes::Function>(declaration);
+  return Nil();
+}
+
+Value ClosureCompiler::visitClassStmt(Stmt::Class* stmt) {
+  for(auto& method: stmt->methods) compileFunction(*method);
+  compiledStmt = std::make_unique<Nodes::Class>(stmt);
+  return Nil();
+}
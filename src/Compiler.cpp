@@ -0,0 +1,515 @@
+#include "../include/Compiler.hpp"
+#include "../include/VM.hpp"
+
+#include <limits>
+
+Compiler::FunctionState::FunctionState(FunctionState* enclosing,
+    FunctionType type, const std::string& name)
+  : enclosing { enclosing }, function { std::make_shared<VMFunction>(name) },
+  type { type }
+{
+  // slot zero holds the callee, or the receiver inside of methods
+  locals.push_back({ type == FunctionType::METHOD ? "this" : "", 0, false });
+}
+
+Compiler::Compiler(Lox& lox, VM& vm) : lox { lox }, vm { vm } {}
+
+std::shared_ptr<VMFunction> Compiler::compile(const Stmt::Stmts& program) {
+  FunctionState script(nullptr, FunctionType::SCRIPT, "script");
+  current = &script;
+  for(const auto& stmt: program) {
+    compile(stmt);
+  }
+  emitReturn();
+  current = nullptr;
+  return script.function;
+}
+
+void Compiler::compile(const Expr::ExprPtr& expr) {
+  expr->accept(this);
+}
+
+void Compiler::compile(const Stmt::StmtPtr& stmt) {
+  stmt->accept(this);
+}
+
+// Emitting bytecode ----------------------------------------------------------
+
+Chunk& Compiler::chunk() {
+  return current->function->chunk;
+}
+
+void Compiler::emitByte(uint8_t byte) {
+  chunk().write(byte, line);
+}
+
+void Compiler::emitBytes(uint8_t first, uint8_t second) {
+  emitByte(first);
+  emitByte(second);
+}
+
+void Compiler::emitShort(uint16_t value) {
+  emitByte((value >> 8) & 0xff);
+  emitByte(value & 0xff);
+}
+
+void Compiler::emitOp(OpCode op, uint16_t operand) {
+  emitByte(op);
+  emitShort(operand);
+}
+
+int Compiler::emitJump(OpCode op) {
+  emitByte(op);
+  emitShort(0xffff);
+  return chunk().code.size() - 2;
+}
+
+void Compiler::patchJump(int offset) {
+  int jump = chunk().code.size() - offset - 2;
+  if(jump > std::numeric_limits<uint16_t>::max()) {
+    lox.error(line, "Too much code to jump over.");
+  }
+  chunk().code[offset] = (jump >> 8) & 0xff;
+  chunk().code[offset + 1] = jump & 0xff;
+}
+
+void Compiler::emitLoop(int loopStart) {
+  emitByte(OP_LOOP);
+  int offset = chunk().code.size() - loopStart + 2;
+  if(offset > std::numeric_limits<uint16_t>::max()) {
+    lox.error(line, "Loop body too large.");
+  }
+  emitShort(offset);
+}
+
+void Compiler::emitReturn() {
+  emitByte(OP_NIL);
+  emitByte(OP_RETURN);
+}
+
+uint16_t Compiler::makeConstant(const Value& value) {
+  int constant = chunk().addConstant(value);
+  if(constant > std::numeric_limits<uint16_t>::max()) {
+    lox.error(line, "Too many constants in one chunk.");
+    return 0;
+  }
+  return constant;
+}
+
+uint16_t Compiler::identifierConstant(const std::string& name) {
+  auto& identifiers = current->identifiers;
+  if(identifiers.contains(name)) return identifiers[name];
+  ObjString* string = lox.heap.makeString(name);
+  lox.heap.pin(string);
+  uint16_t constant = makeConstant(string);
+  identifiers.insert({name, constant});
+  return constant;
+}
+
+// Scopes and variables -------------------------------------------------------
+
+void Compiler::beginScope() {
+  current->scopeDepth++;
+}
+
+void Compiler::endScope() {
+  discardLocals(current->scopeDepth - 1);
+  current->scopeDepth--;
+  auto& locals = current->locals;
+  while(!locals.empty() && locals.back().depth > current->scopeDepth) {
+    locals.pop_back();
+  }
+}
+
+// emits code dropping every local deeper than depth, without forgetting them
+void Compiler::discardLocals(int depth) {
+  auto& locals = current->locals;
+  for(int i = locals.size() - 1; i >= 0 && locals[i].depth > depth; i--) {
+    emitByte(locals[i].isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+  }
+}
+
+void Compiler::addLocal(const std::string& name) {
+  if(current->locals.size() > std::numeric_limits<uint8_t>::max()) {
+    lox.error(line, "Too many local variables in function.");
+    return;
+  }
+  current->locals.push_back({ name, -1, false });
+}
+
+void Compiler::markInitialized() {
+  if(current->scopeDepth == 0) return;
+  current->locals.back().depth = current->scopeDepth;
+}
+
+void Compiler::declareVariable(const Token& name) {
+  if(current->scopeDepth == 0) return;
+  addLocal(name.lexeme);
+}
+
+void Compiler::defineVariable(const Token& name) {
+  if(current->scopeDepth > 0) {
+    markInitialized();
+    return;
+  }
+  emitOp(OP_DEFINE_GLOBAL, vm.globalSlot(name.lexeme));
+}
+
+int Compiler::resolveLocal(FunctionState* state, const std::string& name) {
+  for(int i = state->locals.size() - 1; i >= 0; i--) {
+    if(state->locals[i].name == name && state->locals[i].depth != -1) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Compiler::addUpvalue(FunctionState* state, uint8_t index, bool isLocal) {
+  auto& upvalues = state->upvalues;
+  for(size_t i = 0; i < upvalues.size(); i++) {
+    if(upvalues[i].index == index && upvalues[i].isLocal == isLocal) {
+      return i;
+    }
+  }
+  if(upvalues.size() > std::numeric_limits<uint8_t>::max()) {
+    lox.error(line, "Too many closure variables in function.");
+    return 0;
+  }
+  upvalues.push_back({ index, isLocal });
+  state->function->upvalueCount = upvalues.size();
+  return upvalues.size() - 1;
+}
+
+int Compiler::resolveUpvalue(FunctionState* state, const std::string& name) {
+  if(!state->enclosing) return -1;
+
+  int local = resolveLocal(state->enclosing, name);
+  if(local != -1) {
+    state->enclosing->locals[local].isCaptured = true;
+    return addUpvalue(state, local, true);
+  }
+
+  int upvalue = resolveUpvalue(state->enclosing, name);
+  if(upvalue != -1) {
+    return addUpvalue(state, upvalue, false);
+  }
+  return -1;
+}
+
+void Compiler::namedVariable(const Token& name, bool assign) {
+  line = name.line;
+  int arg = resolveLocal(current, name.lexeme);
+  if(arg != -1) {
+    emitBytes(assign ? OP_SET_LOCAL : OP_GET_LOCAL, arg);
+    return;
+  }
+  arg = resolveUpvalue(current, name.lexeme);
+  if(arg != -1) {
+    emitBytes(assign ? OP_SET_UPVALUE : OP_GET_UPVALUE, arg);
+    return;
+  }
+  emitOp(assign ? OP_SET_GLOBAL : OP_GET_GLOBAL, vm.globalSlot(name.lexeme));
+}
+
+void Compiler::function(Stmt::Function* stmt, FunctionType type) {
+  FunctionState state(current, type, stmt->name.lexeme);
+  current = &state;
+  beginScope();
+
+  state.function->arity = stmt->args.size();
+  for(const auto& param: stmt->args) {
+    addLocal(param.lexeme);
+    markInitialized();
+  }
+  for(const auto& bodyStmt: stmt->body) {
+    compile(bodyStmt);
+  }
+  emitReturn();
+
+  current = state.enclosing;
+  line = stmt->name.line;
+  emitOp(OP_CLOSURE, chunk().addFunction(state.function));
+  for(const auto& upvalue: state.upvalues) {
+    emitBytes(upvalue.isLocal ? 1 : 0, upvalue.index);
+  }
+}
+
+// Expressions ----------------------------------------------------------------
+
+Value Compiler::visitBinop(Expr::Binop* expr) {
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  compile(chain.front()->left);
+  for(Expr::Binop* binop: chain) {
+    compile(binop->right);
+    emitOperator(binop);
+  }
+  return Nil();
+}
+
+// the operands are on the stack
+void Compiler::emitOperator(Expr::Binop* expr) {
+  line = expr->op.line;
+  switch(expr->op.type) {
+    case EQUAL_EQUAL: emitByte(OP_EQUAL); break;
+    case BANG_EQUAL: emitByte(OP_NOT_EQUAL); break;
+    case GREATER: emitByte(OP_GREATER); break;
+    case GREATER_EQUAL: emitByte(OP_GREATER_EQUAL); break;
+    case LESS: emitByte(OP_LESS); break;
+    case LESS_EQUAL: emitByte(OP_LESS_EQUAL); break;
+    case MINUS: emitByte(OP_SUBTRACT); break;
+    case SLASH: emitByte(OP_DIVIDE); break;
+    case STAR: emitByte(OP_MULTIPLY); break;
+    case PLUS: emitByte(OP_ADD); break;
+    case AMPERSAND: emitByte(OP_BIT_AND); break;
+    case PIPE: emitByte(OP_BIT_OR); break;
+    case CARET: emitByte(OP_BIT_XOR); break;
+    case LESS_LESS: emitByte(OP_SHIFT_LEFT); break;
+    case GREATER_GREATER: emitByte(OP_SHIFT_RIGHT); break;
+    default:
+      // unknown operators evaluate to nil, like in the interpreter
+      emitBytes(OP_POP, OP_POP);
+      emitByte(OP_NIL);
+      break;
+  }
+}
+
+Value Compiler::visitUnop(Expr::Unop* expr) {
+  compile(expr->expr);
+  line = expr->op.line;
+  switch(expr->op.type) {
+    case BANG: emitByte(OP_NOT); break;
+    case MINUS: emitByte(OP_NEGATE); break;
+    case PLUSPLUS: emitByte(OP_INCREMENT); break;
+    case MINUSMINUS: emitByte(OP_DECREMENT); break;
+    case TILDE: emitByte(OP_BIT_NOT); break;
+    default:
+      emitByte(OP_POP);
+      emitByte(OP_NIL);
+      break;
+  }
+  return Nil();
+}
+
+Value Compiler::visitGrouping(Expr::Grouping* expr) {
+  compile(expr->expr);
+  return Nil();
+}
+
+Value Compiler::visitLiteralExpr(Expr::Literal* expr) {
+  const Value& value = expr->value->value;
+  if(value.isNil()) {
+    emitByte(OP_NIL);
+  } else if(value.isBool()) {
+    emitByte(value.asBool() ? OP_TRUE : OP_FALSE);
+  } else {
+    emitOp(OP_CONSTANT, makeConstant(value));
+  }
+  return Nil();
+}
+
+Value Compiler::visitVariableExpr(Expr::Variable* var) {
+  namedVariable(var->name, false);
+  return Nil();
+}
+
+Value Compiler::visitAssign(Expr::Assign* expr) {
+  compile(expr->value);
+  namedVariable(expr->name, true);
+  return Nil();
+}
+
+Value Compiler::visitLogical(Expr::Logical* expr) {
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  compile(chain.front()->left);
+  for(Expr::Logical* logical: chain) emitShortCircuit(logical);
+  return Nil();
+}
+
+// the left operand is on the stack
+void Compiler::emitShortCircuit(Expr::Logical* expr) {
+  line = expr->op.line;
+  if(expr->op.type == OR) {
+    int elseJump = emitJump(OP_JUMP_IF_FALSE);
+    int endJump = emitJump(OP_JUMP);
+    patchJump(elseJump);
+    emitByte(OP_POP);
+    compile(expr->right);
+    patchJump(endJump);
+  } else {
+    int endJump = emitJump(OP_JUMP_IF_FALSE);
+    emitByte(OP_POP);
+    compile(expr->right);
+    patchJump(endJump);
+  }
+}
+
+Value Compiler::visitCall(Expr::Call* expr) {
+  // obj.method(...) looks the method up without creating a bound method
+  if(auto get = dynamic_cast<Expr::Get*>(expr->callee.get())) {
+    compile(get->object);
+    line = get->name.line;
+    emitOp(OP_GET_METHOD, identifierConstant(get->name.lexeme));
+    for(const auto& arg: expr->arguments) {
+      compile(arg);
+    }
+    line = expr->paren.line;
+    emitBytes(OP_CALL_METHOD, expr->arguments.size());
+    return Nil();
+  }
+
+  compile(expr->callee);
+  for(const auto& arg: expr->arguments) {
+    compile(arg);
+  }
+  line = expr->paren.line;
+  emitBytes(OP_CALL, expr->arguments.size());
+  return Nil();
+}
+
+Value Compiler::visitGetExpr(Expr::Get* expr) {
+  compile(expr->object);
+  line = expr->name.line;
+  emitOp(OP_GET_PROPERTY, identifierConstant(expr->name.lexeme));
+  return Nil();
+}
+
+Value Compiler::visitSetExpr(Expr::Set* expr) {
+  compile(expr->object);
+  compile(expr->value);
+  line = expr->name.line;
+  emitOp(OP_SET_PROPERTY, identifierConstant(expr->name.lexeme));
+  return Nil();
+}
+
+Value Compiler::visitThisExpr(Expr::This* expr) {
+  namedVariable(expr->keyword, false);
+  return Nil();
+}
+
+// Statements -----------------------------------------------------------------
+
+Value Compiler::visitExprStmt(Stmt::Expr* exprstmt) {
+  compile(exprstmt->expr);
+  emitByte(OP_POP);
+  return Nil();
+}
+
+Value Compiler::visitPrintStmt(Stmt::Print* stmt) {
+  compile(stmt->expr);
+  emitByte(OP_PRINT);
+  return Nil();
+}
+
+Value Compiler::visitVarStmt(Stmt::Var* stmt) {
+  line = stmt->name.line;
+  declareVariable(stmt->name);
+  if(stmt->initializer) {
+    compile(stmt->initializer);
+  } else {
+    emitByte(OP_NIL);
+  }
+  line = stmt->name.line;
+  defineVariable(stmt->name);
+  return Nil();
+}
+
+Value Compiler::visitBlockStmt(Stmt::Block* stmt) {
+  beginScope();
+  for(const auto& statement: stmt->statements) {
+    compile(statement);
+  }
+  endScope();
+  return Nil();
+}
+
+Value Compiler::visitIfStmt(Stmt::If* stmt) {
+  compile(stmt->condition);
+  int thenJump = emitJump(OP_JUMP_IF_FALSE);
+  emitByte(OP_POP);
+  compile(stmt->thenBranch);
+  int elseJump = emitJump(OP_JUMP);
+  patchJump(thenJump);
+  emitByte(OP_POP);
+  if(stmt->elseBranch) compile(stmt->elseBranch);
+  patchJump(elseJump);
+  return Nil();
+}
+
+Value Compiler::visitWhileStmt(Stmt::While* stmt) {
+  int loopStart = chunk().code.size();
+  compile(stmt->condition);
+  int exitJump = emitJump(OP_JUMP_IF_FALSE);
+  emitByte(OP_POP);
+
+  current->loops.push_back({ current->scopeDepth, {} });
+  compile(stmt->body);
+  emitLoop(loopStart);
+  Loop loop = std::move(current->loops.back());
+  current->loops.pop_back();
+
+  patchJump(exitJump);
+  emitByte(OP_POP);
+  // break lands after the condition was already popped
+  for(int jump: loop.breakJumps) {
+    patchJump(jump);
+  }
+  return Nil();
+}
+
+Value Compiler::visitBreakStmt(Stmt::Break* stmt) {
+  line = stmt->keyword.line;
+  if(current->loops.empty()) {
+    lox.error(stmt->keyword, "'break' statement outside of a loop.");
+    return Nil();
+  }
+  Loop& loop = current->loops.back();
+  discardLocals(loop.scopeDepth);
+  loop.breakJumps.push_back(emitJump(OP_JUMP));
+  return Nil();
+}
+
+Value Compiler::visitFunctionStmt(Stmt::Function* stmt) {
+  declareVariable(stmt->name);
+  markInitialized();
+  function(stmt, FunctionType::FUNCTION);
+  defineVariable(stmt->name);
+  return Nil();
+}
+
+Value Compiler::visitReturnStmt(Stmt::Return* stmt) {
+  line = stmt->keyword.line;
+  if(stmt->value) {
+    compile(stmt->value);
+  } else {
+    emitByte(OP_NIL);
+  }
+  emitByte(OP_RETURN);
+  return Nil();
+}
+
+Value Compiler::visitClassStmt(Stmt::Class* stmt) {
+  line = stmt->name.line;
+  uint16_t name = identifierConstant(stmt->name.lexeme);
+
+  // same order as the interpreter: the name is bound before the class
+  // exists, so methods can refer to it
+  if(current->scopeDepth > 0) {
+    declareVariable(stmt->name);
+    markInitialized();
+    emitOp(OP_CLASS, name);
+    namedVariable(stmt->name, false);
+  } else {
+    emitByte(OP_NIL);
+    defineVariable(stmt->name);
+    emitOp(OP_CLASS, name);
+    namedVariable(stmt->name, true);
+  }
+
+  for(const auto& method: stmt->methods) {
+    function(method.get(), FunctionType::METHOD);
+    line = method->name.line;
+    emitOp(OP_METHOD, identifierConstant(method->name.lexeme));
+  }
+  emitByte(OP_POP);
+  return Nil();
+}
@@ -0,0 +1,209 @@
+#include "../include/ConstantFolder.hpp"
+#include "../include/Numbers.hpp"
+
+ConstantFolder::ConstantFolder(Lox& lox) : lox { lox } {}
+
+void ConstantFolder::fold(Stmt::Stmts& program) {
+  scanning = true;
+  rewrite(program);
+  nodesBefore = nodes;
+
+  scanning = false;
+  rewrite(program);
+
+  AstRewriter counter;
+  counter.rewrite(program);
+  nodesAfter = counter.nodeCount();
+}
+
+void ConstantFolder::printSummary(std::ostream& out) const {
+  out << "[opt] constant folding: " << nodesBefore - nodesAfter
+    << " nodes removed (" << nodesBefore << " -> " << nodesAfter << "), "
+    << folded << " folded, " << propagated << " propagated, "
+    << droppedBranches << " branches dropped\n";
+}
+
+void ConstantFolder::declare(const Token& name, Stmt::Var* var) {
+  // top level names are globals
+  if(scopes.empty()) return;
+  scopes.back()[name.lexeme] = var;
+}
+
+Stmt::Var* ConstantFolder::lookUp(const Token& name) {
+  for(auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+    auto it = scope->find(name.lexeme);
+    if(it != scope->end()) return it->second;
+  }
+  return nullptr;
+}
+
+void ConstantFolder::replaceWith(Value value) {
+  // strings and big integers live as long as the literal holding them
+  if(value.isObj()) lox.heap.pin(value.asObj());
+  exprReplacement = std::make_shared<Expr::Literal>(
+      std::make_shared<Literal>(value));
+  folded++;
+}
+
+static Expr::Literal* asLiteral(const Expr::ExprPtr& expr) {
+  return dynamic_cast<Expr::Literal*>(expr.get());
+}
+
+bool ConstantFolder::foldBinop(Expr::Binop* expr, Value left, Value right) {
+  switch(expr->op.type) {
+    case EQUAL_EQUAL: replaceWith(left.isEqual(right)); return true;
+    case BANG_EQUAL: replaceWith(!left.isEqual(right)); return true;
+    case PLUS:
+      if(left.isString() && right.isString()) {
+        ObjString* string = lox.heap.makeString(
+            left.asString()->chars + right.asString()->chars);
+        replaceWith(string);
+        return true;
+      }
+      break;
+    default: break;
+  }
+  // anything else needs numbers, the error is left for run time
+  std::optional<Numbers::Op> arithmetic = Numbers::opOf(expr->op.type);
+  if(!arithmetic || !Numbers::accepts(*arithmetic, left, right)) return false;
+  replaceWith(Numbers::binary(*arithmetic, left, right, lox.heap));
+  return true;
+}
+
+Value ConstantFolder::visitBinop(Expr::Binop* expr) {
+  AstRewriter::visitBinop(expr);
+  if(scanning) return Nil();
+  Expr::Literal* left = asLiteral(expr->left);
+  Expr::Literal* right = asLiteral(expr->right);
+  if(left && right) foldBinop(expr, left->value->value, right->value->value);
+  return Nil();
+}
+
+Value ConstantFolder::visitUnop(Expr::Unop* expr) {
+  AstRewriter::visitUnop(expr);
+  if(scanning) return Nil();
+  Expr::Literal* operand = asLiteral(expr->expr);
+  if(!operand) return Nil();
+  Value value = operand->value->value;
+  if(expr->op.type == BANG) {
+    replaceWith(!value.isTruthy());
+  } else if(value.isNumber()) {
+    switch(expr->op.type) {
+      case MINUS: replaceWith(*Numbers::negate(value, &lox.heap)); break;
+      // ++ and -- don't assign, they only add or subtract one
+      case PLUSPLUS: replaceWith(*Numbers::add(value, 1, &lox.heap)); break;
+      case MINUSMINUS: replaceWith(*Numbers::add(value, -1, &lox.heap)); break;
+      case TILDE:
+        if(value.isInt()) replaceWith(*Numbers::complement(value, &lox.heap));
+        break;
+      default: break;
+    }
+  }
+  return Nil();
+}
+
+Value ConstantFolder::visitGrouping(Expr::Grouping* expr) {
+  AstRewriter::visitGrouping(expr);
+  if(scanning) return Nil();
+  exprReplacement = expr->expr;
+  folded++;
+  return Nil();
+}
+
+Value ConstantFolder::visitLogical(Expr::Logical* expr) {
+  AstRewriter::visitLogical(expr);
+  if(scanning) return Nil();
+  Expr::Literal* left = asLiteral(expr->left);
+  if(!left) return Nil();
+  bool truthy = left->value->value.isTruthy();
+  // the left operand decides when `or` gets a truthy or `and` a falsy one
+  bool shortCircuits = expr->op.type == OR ? truthy : !truthy;
+  exprReplacement = shortCircuits ? expr->left : expr->right;
+  folded++;
+  return Nil();
+}
+
+Value ConstantFolder::visitBlockStmt(Stmt::Block* stmt) {
+  scopes.push_back({});
+  AstRewriter::visitBlockStmt(stmt);
+  scopes.pop_back();
+  return Nil();
+}
+
+Value ConstantFolder::visitIfStmt(Stmt::If* stmt) {
+  AstRewriter::visitIfStmt(stmt);
+  if(scanning) return Nil();
+  Expr::Literal* condition = asLiteral(stmt->condition);
+  if(!condition) return Nil();
+  if(condition->value->value.isTruthy()) {
+    stmtReplacement = stmt->thenBranch;
+  } else if(stmt->elseBranch) {
+    stmtReplacement = stmt->elseBranch;
+  } else {
+    removeStmt = true;
+  }
+  droppedBranches++;
+  return Nil();
+}
+
+Value ConstantFolder::visitWhileStmt(Stmt::While* stmt) {
+  AstRewriter::visitWhileStmt(stmt);
+  if(scanning) return Nil();
+  Expr::Literal* condition = asLiteral(stmt->condition);
+  if(condition && !condition->value->value.isTruthy()) {
+    removeStmt = true;
+    droppedBranches++;
+  }
+  return Nil();
+}
+
+Value ConstantFolder::visitVariableExpr(Expr::Variable* var) {
+  if(scanning) return Nil();
+  Stmt::Var* declaration = lookUp(var->name);
+  auto constant = constants.find(declaration);
+  if(declaration && constant != constants.end()) {
+    exprReplacement = std::make_shared<Expr::Literal>(constant->second);
+    propagated++;
+  }
+  return Nil();
+}
+
+Value ConstantFolder::visitAssign(Expr::Assign* expr) {
+  AstRewriter::visitAssign(expr);
+  if(!scanning) return Nil();
+  if(Stmt::Var* declaration = lookUp(expr->name)) {
+    reassigned.insert(declaration);
+  }
+  return Nil();
+}
+
+Value ConstantFolder::visitVarStmt(Stmt::Var* stmt) {
+  AstRewriter::visitVarStmt(stmt);
+  declare(stmt->name, stmt);
+  if(scanning || scopes.empty()) return Nil();
+  Expr::Literal* initializer = asLiteral(stmt->initializer);
+  if(initializer && !reassigned.contains(stmt)) {
+    constants[stmt] = initializer->value;
+  }
+  return Nil();
+}
+
+Value ConstantFolder::visitClassStmt(Stmt::Class* stmt) {
+  declare(stmt->name);
+  for(auto& method: stmt->methods) {
+    scopes.push_back({});
+    for(const auto& param: method->args) declare(param);
+    rewriteFunction(method.get());
+    scopes.pop_back();
+  }
+  return Nil();
+}
+
+Value ConstantFolder::visitFunctionStmt(Stmt::Function* stmt) {
+  declare(stmt->name);
+  scopes.push_back({});
+  for(const auto& param: stmt->args) declare(param);
+  rewriteFunction(stmt);
+  scopes.pop_back();
+  return Nil();
+}
@@ -0,0 +1,570 @@
+#include "../include/CppTranslator.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+const char* opName(Numbers::Op op) {
+  switch(op) {
+    case Numbers::Op::ADD: return "ADD";
+    case Numbers::Op::SUBTRACT: return "SUBTRACT";
+    case Numbers::Op::MULTIPLY: return "MULTIPLY";
+    case Numbers::Op::DIVIDE: return "DIVIDE";
+    case Numbers::Op::LESS: return "LESS";
+    case Numbers::Op::LESS_EQUAL: return "LESS_EQUAL";
+    case Numbers::Op::GREATER: return "GREATER";
+    case Numbers::Op::GREATER_EQUAL: return "GREATER_EQUAL";
+    case Numbers::Op::BIT_AND: return "BIT_AND";
+    case Numbers::Op::BIT_OR: return "BIT_OR";
+    case Numbers::Op::BIT_XOR: return "BIT_XOR";
+    case Numbers::Op::SHIFT_LEFT: return "SHIFT_LEFT";
+    case Numbers::Op::SHIFT_RIGHT: return "SHIFT_RIGHT";
+  }
+  return "";
+}
+
+// the enumerator, tokenTypeToString spells some of them as they are written
+std::string tokenName(TokenType type) {
+  switch(type) {
+    case PLUSPLUS: return "PLUSPLUS";
+    case MINUSMINUS: return "MINUSMINUS";
+    default: return tokenTypeToString(type);
+  }
+}
+
+bool isComparison(Numbers::Op op) {
+  return op == Numbers::Op::LESS || op == Numbers::Op::LESS_EQUAL
+    || op == Numbers::Op::GREATER || op == Numbers::Op::GREATER_EQUAL;
+}
+
+std::string numbersOp(Numbers::Op op) {
+  return std::string("Numbers::Op::") + opName(op);
+}
+
+// octal escapes, a hex one would swallow the digits after it
+std::string quote(const std::string& chars) {
+  std::string quoted = "\"";
+  for(unsigned char c: chars) {
+    // `?` too, "??/" would be a trigraph
+    if(c == '"' || c == '\\' || c == '?') {
+      quoted += '\\';
+      quoted += c;
+    } else if(c == '\n') {
+      quoted += "\\n";
+    } else if(c < 32 || c >= 127) {
+      char escape[5];
+      std::snprintf(escape, sizeof(escape), "\\%03o", c);
+      quoted += escape;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string identifier(const std::string& name) {
+  std::string id;
+  for(char c: name) id += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  return id;
+}
+
+}
+
+CppTranslator::CppTranslator(Globals& globals) : globals { globals } {}
+
+std::string CppTranslator::translate(const Stmt::Stmts& program,
+    int slotCount) {
+  functions.push_back({ "script", {}, 1, slotCount, slotCount, slotCount });
+  translate(program);
+  emit("return Value();");
+  FunctionState script = std::move(functions.back());
+  functions.pop_back();
+
+  std::ostringstream out;
+  out << "// translated by lox2cpp\n"
+      << "#include \"Runtime.hpp\"\n\n"
+      << "#include <bit>\n\n"
+      << "static Value constants[" << std::max<size_t>(constants.size(), 1)
+      << "];\n";
+  if(!sites.empty()) {
+    out << "static Runtime::Site sites[] = {\n";
+    for(const std::string& name: sites) out << "  { " << quote(name) << " },\n";
+    out << "};\n";
+  }
+  out << "\n";
+  for(const std::string& definition: definitions) out << definition << "\n";
+  out << "static Value script(Runtime& rt, AotFunction* self, Value* frame) {\n"
+      << script.code << "}\n\n"
+      << "int main() {\n"
+      << "  Runtime rt;\n";
+  // the same slots the resolver gave the globals
+  for(int slot = 0; slot < globals.size(); slot++) {
+    out << "  rt.globals.slotFor(" << quote(globals.nameOf(slot)) << ");\n";
+  }
+  for(size_t i = 0; i < constants.size(); i++) {
+    out << "  constants[" << i << "] = " << constants[i] << ";\n";
+  }
+  out << "  return rt.run(script, " << script.frameSize << ");\n"
+      << "}\n";
+  return out.str();
+}
+
+void CppTranslator::translate(const Stmt::Stmts& statements) {
+  for(const auto& stmt: statements) stmt->accept(this);
+}
+
+void CppTranslator::emit(const std::string& code) {
+  current().code += std::string(current().indent * 2, ' ') + code + "\n";
+}
+
+// no temporary outlives the statement it was made for
+void CppTranslator::resetTemps() {
+  current().nextTemp = current().slotCount;
+}
+
+std::string CppTranslator::temp() {
+  return slot(temps(1));
+}
+
+int CppTranslator::temps(int count) {
+  FunctionState& function = current();
+  int first = function.nextTemp;
+  function.nextTemp += count;
+  function.frameSize = std::max(function.frameSize, function.nextTemp);
+  return first;
+}
+
+std::string CppTranslator::slot(int index) const {
+  return "frame[" + std::to_string(index) + "]";
+}
+
+CppTranslator::Held CppTranslator::hold(const std::string& operand) {
+  return { operand, current().code.size(), isVariable ? temps(1) : -1 };
+}
+
+std::string CppTranslator::release(const Held& held) {
+  FunctionState& function = current();
+  if(held.temp < 0 || function.code.size() == held.mark) return held.operand;
+  std::string copy = slot(held.temp);
+  function.code.insert(held.mark, std::string(function.indent * 2, ' ')
+      + copy + " = " + held.operand + ";\n");
+  return copy;
+}
+
+std::string CppTranslator::constant(Value value) {
+  if(value.isNil()) return "Value()";
+  if(value.isBool()) return value.asBool() ? "Value(true)" : "Value(false)";
+  if(value.isSmallInt()) {
+    return "Value::smallInt(" + std::to_string(value.asSmallInt()) + ")";
+  }
+  if(value.isDouble()) {
+    double number = value.asDouble();
+    if(!std::isfinite(number)) {
+      return "Value(std::bit_cast<double>(UINT64_C("
+        + std::to_string(std::bit_cast<uint64_t>(number)) + ")))";
+    }
+    char hex[64];
+    std::snprintf(hex, sizeof(hex), "%a", number);
+    return std::string("Value(") + hex + ")";
+  }
+
+  std::string init;
+  if(value.isInt()) {
+    int64_t integer = value.asInt();
+    init = integer == INT64_MIN ? "rt.integer(INT64_MIN)"
+      : "rt.integer(INT64_C(" + std::to_string(integer) + "))";
+  } else {
+    const std::string& chars = value.asString()->chars;
+    auto it = stringConstants.find(chars);
+    if(it != stringConstants.end()) {
+      return "constants[" + std::to_string(it->second) + "]";
+    }
+    stringConstants.insert({ chars, static_cast<int>(constants.size()) });
+    init = "rt.string(std::string(" + quote(chars) + ", "
+      + std::to_string(chars.size()) + "))";
+  }
+  constants.push_back(init);
+  return "constants[" + std::to_string(constants.size() - 1) + "]";
+}
+
+int CppTranslator::site(const std::string& name) {
+  sites.push_back(name);
+  return sites.size() - 1;
+}
+
+std::string CppTranslator::operand(const Expr::ExprPtr& expr) {
+  expr->accept(this);
+  return result;
+}
+
+std::string CppTranslator::condition(const Expr::ExprPtr& expr) {
+  Expr::Expr* inner = expr.get();
+  while(auto* grouping = dynamic_cast<Expr::Grouping*>(inner)) {
+    inner = grouping->expr.get();
+  }
+  auto* binop = dynamic_cast<Expr::Binop*>(inner);
+  if(binop && binop->arithmetic && isComparison(*binop->arithmetic)
+      && binop->left->type == Type::NUMBER
+      && binop->right->type == Type::NUMBER) {
+    Held left = hold(operand(binop->left));
+    std::string right = operand(binop->right);
+    return "rt.test(" + numbersOp(*binop->arithmetic) + ", " + release(left)
+      + ", " + right + ", " + std::to_string(binop->op.line) + ")";
+  }
+  return operand(expr) + ".isTruthy()";
+}
+
+std::string CppTranslator::variable(const Expr::VarSlot& slot,
+    const Token& name) {
+  isVariable = true;
+  switch(slot.kind) {
+    case Expr::VarSlot::LOCAL: return this->slot(slot.slot);
+    case Expr::VarSlot::UPVALUE:
+      return "(*self->upvalues[" + std::to_string(slot.slot) + "]->location)";
+    default: break;
+  }
+  // reading a global may fail, so it happens right here
+  std::string value = temp();
+  emit(value + " = rt.global(" + std::to_string(slot.slot) + ", "
+      + std::to_string(name.line) + ");");
+  isVariable = false;
+  return value;
+}
+
+void CppTranslator::assign(const Expr::VarSlot& slot, const Token& name,
+    const std::string& value) {
+  switch(slot.kind) {
+    case Expr::VarSlot::LOCAL:
+    case Expr::VarSlot::UPVALUE: {
+      std::string target = variable(slot, name);
+      if(target != value) emit(target + " = " + value + ";");
+      break;
+    }
+    default:
+      emit("rt.assignGlobal(" + std::to_string(slot.slot) + ", " + value + ", "
+          + std::to_string(name.line) + ");");
+  }
+}
+
+void CppTranslator::define(const Expr::VarSlot& slot,
+    const std::string& value) {
+  if(slot.isGlobal()) {
+    emit("rt.globals.define(" + std::to_string(slot.slot) + ", " + value
+        + ");");
+  } else if(this->slot(slot.slot) != value) {
+    emit(this->slot(slot.slot) + " = " + value + ";");
+  }
+}
+
+Value CppTranslator::visitBinop(Expr::Binop* expr) {
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  std::string left = operand(chain.front()->left);
+  for(Expr::Binop* binop: chain) left = operate(binop, left);
+  return Nil();
+}
+
+std::string CppTranslator::operate(Expr::Binop* expr,
+    const std::string& leftOperand) {
+  Held held = hold(leftOperand);
+  std::string right = operand(expr->right);
+  std::string left = release(held);
+
+  std::string value;
+  std::string line = std::to_string(expr->op.line);
+  Type type = expr->left->type;
+  if(type == expr->right->type && type == Type::NUMBER) {
+    if(!expr->arithmetic) {
+      value = std::string(expr->op.type == EQUAL_EQUAL ? "" : "!")
+        + left + ".isEqual(" + right + ")";
+      value = "Value(" + value + ")";
+    } else if(isComparison(*expr->arithmetic)) {
+      value = "Value(rt.test(" + numbersOp(*expr->arithmetic) + ", " + left
+        + ", " + right + ", " + line + "))";
+    } else {
+      value = "rt.numbers(" + numbersOp(*expr->arithmetic) + ", " + left
+        + ", " + right + ", " + line + ")";
+    }
+  } else if(type == expr->right->type && type == Type::STRING
+      && expr->op.type == PLUS) {
+    value = "rt.concat(" + left + ", " + right + ", " + line + ")";
+  } else {
+    value = "rt.binary(" + tokenName(expr->op.type) + ", " + left
+      + ", " + right + ", " + line + ")";
+  }
+  result = temp();
+  isVariable = false;
+  emit(result + " = " + value + ";");
+  return result;
+}
+
+Value CppTranslator::visitUnop(Expr::Unop* expr) {
+  std::string right = operand(expr->expr);
+  std::string op = tokenName(expr->op.type);
+  std::string line = std::to_string(expr->op.line);
+  std::string value;
+  if(expr->expr->type == Type::NUMBER && expr->op.type != BANG) {
+    value = "rt.number(" + op + ", " + right + ", " + line + ")";
+  } else {
+    value = "rt.unary(" + op + ", " + right + ", " + line + ")";
+  }
+  result = temp();
+  isVariable = false;
+  emit(result + " = " + value + ";");
+  return Nil();
+}
+
+Value CppTranslator::visitGrouping(Expr::Grouping* expr) {
+  expr->expr->accept(this);
+  return Nil();
+}
+
+Value CppTranslator::visitLiteralExpr(Expr::Literal* expr) {
+  result = constant(expr->value->value);
+  isVariable = false;
+  return Nil();
+}
+
+Value CppTranslator::visitLogical(Expr::Logical* expr) {
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  std::string left = operand(chain.front()->left);
+  std::string value = temp();
+  emit(value + " = " + left + ";");
+  for(Expr::Logical* logical: chain) {
+    std::string test = value + ".isTruthy()";
+    emit(logical->op.type == OR
+        ? "if(!" + test + ") {" : "if(" + test + ") {");
+    current().indent++;
+    std::string right = operand(logical->right);
+    if(right != value) emit(value + " = " + right + ";");
+    current().indent--;
+    emit("}");
+  }
+  result = value;
+  isVariable = false;
+  return Nil();
+}
+
+Value CppTranslator::visitVariableExpr(Expr::Variable* expr) {
+  result = variable(expr->slot, expr->name);
+  return Nil();
+}
+
+Value CppTranslator::visitThisExpr(Expr::This* expr) {
+  result = variable(expr->slot, expr->keyword);
+  return Nil();
+}
+
+Value CppTranslator::visitAssign(Expr::Assign* expr) {
+  std::string value = operand(expr->value);
+  bool variable = isVariable;
+  assign(expr->slot, expr->name, value);
+  if(!expr->slot.isGlobal()) {
+    result = this->variable(expr->slot, expr->name);
+  } else {
+    result = value;
+    isVariable = variable;
+  }
+  return Nil();
+}
+
+// the callee goes into the first temporary and the arguments after it,
+// a method called on an object gets the object in between
+int CppTranslator::setUpCall(Expr::Call* expr) {
+  int argc = expr->arguments.size();
+  int base;
+  int first;
+  if(expr->property) {
+    base = temps(argc + 2);
+    first = base + 2;
+    std::string object = operand(expr->property->object);
+    emit(slot(base + 1) + " = " + object + ";");
+    emit("rt.lookUpCallee(&" + slot(base) + ", sites["
+        + std::to_string(site(expr->property->name.lexeme)) + "], "
+        + std::to_string(expr->property->name.line) + ");");
+  } else {
+    base = temps(argc + 1);
+    first = base + 1;
+    std::string callee = operand(expr->callee);
+    emit(slot(base) + " = " + callee + ";");
+  }
+  for(int i = 0; i < argc; i++) {
+    std::string arg = operand(expr->arguments[i]);
+    if(arg != slot(first + i)) emit(slot(first + i) + " = " + arg + ";");
+  }
+  return base;
+}
+
+Value CppTranslator::visitCall(Expr::Call* expr) {
+  int base = setUpCall(expr);
+  result = slot(base);
+  isVariable = false;
+  emit(result + " = rt." + (expr->property ? "invoke" : "call") + "(&"
+      + result + ", " + std::to_string(expr->arguments.size()) + ", "
+      + std::to_string(expr->paren.line) + ");");
+  return Nil();
+}
+
+Value CppTranslator::visitGetExpr(Expr::Get* expr) {
+  std::string object = operand(expr->object);
+  result = temp();
+  isVariable = false;
+  emit(result + " = rt.get(" + object + ", sites["
+      + std::to_string(site(expr->name.lexeme)) + "], "
+      + std::to_string(expr->name.line) + ");");
+  return Nil();
+}
+
+Value CppTranslator::visitSetExpr(Expr::Set* expr) {
+  std::string object = operand(expr->object);
+  emit("rt.checkFields(" + object + ", " + std::to_string(expr->name.line)
+      + ");");
+  Held held = hold(object);
+  std::string value = operand(expr->value);
+  bool variable = isVariable;
+  emit("rt.set(" + release(held) + ", sites["
+      + std::to_string(site(expr->name.lexeme)) + "], " + value + ");");
+  result = value;
+  isVariable = variable;
+  return Nil();
+}
+
+Value CppTranslator::visitExprStmt(Stmt::Expr* stmt) {
+  resetTemps();
+  operand(stmt->expr);
+  return Nil();
+}
+
+Value CppTranslator::visitPrintStmt(Stmt::Print* stmt) {
+  resetTemps();
+  emit("rt.print(" + operand(stmt->expr) + ");");
+  return Nil();
+}
+
+Value CppTranslator::visitVarStmt(Stmt::Var* stmt) {
+  resetTemps();
+  std::string value = stmt->initializer ? operand(stmt->initializer)
+    : "Value()";
+  define(stmt->slot, value);
+  return Nil();
+}
+
+Value CppTranslator::visitBlockStmt(Stmt::Block* stmt) {
+  if(!stmt->closesUpvalues) {
+    translate(stmt->statements);
+    return Nil();
+  }
+  current().closingBlocks.push_back(stmt->firstSlot);
+  translate(stmt->statements);
+  current().closingBlocks.pop_back();
+  emit("rt.closeUpvalues(frame + " + std::to_string(stmt->firstSlot) + ");");
+  return Nil();
+}
+
+Value CppTranslator::visitIfStmt(Stmt::If* stmt) {
+  resetTemps();
+  emit("if(" + condition(stmt->condition) + ") {");
+  current().indent++;
+  stmt->thenBranch->accept(this);
+  current().indent--;
+  if(stmt->elseBranch) {
+    emit("} else {");
+    current().indent++;
+    stmt->elseBranch->accept(this);
+    current().indent--;
+  }
+  emit("}");
+  return Nil();
+}
+
+Value CppTranslator::visitWhileStmt(Stmt::While* stmt) {
+  emit("while(true) {");
+  current().indent++;
+  resetTemps();
+  emit("if(!" + condition(stmt->condition) + ") break;");
+  current().loops.push_back(current().closingBlocks.size());
+  stmt->body->accept(this);
+  current().loops.pop_back();
+  current().indent--;
+  emit("}");
+  return Nil();
+}
+
+// blocks a break leaves don't get to close their upvalues themselves
+Value CppTranslator::visitBreakStmt(Stmt::Break* stmt) {
+  FunctionState& function = current();
+  size_t outermost = function.loops.back();
+  if(outermost < function.closingBlocks.size()) {
+    emit("rt.closeUpvalues(frame + "
+        + std::to_string(function.closingBlocks[outermost]) + ");");
+  }
+  emit("break;");
+  return Nil();
+}
+
+Value CppTranslator::visitReturnStmt(Stmt::Return* stmt) {
+  resetTemps();
+  if(stmt->tailCall) {
+    auto* call = static_cast<Expr::Call*>(stmt->value.get());
+    int base = setUpCall(call);
+    emit(std::string("return rt.") + (call->property ? "tailInvoke" : "tailCall")
+        + "(frame, &" + slot(base) + ", "
+        + std::to_string(call->arguments.size()) + ", "
+        + std::to_string(call->paren.line) + ");");
+    return Nil();
+  }
+  std::string value = stmt->value ? operand(stmt->value) : "Value()";
+  emit("return " + value + ";");
+  return Nil();
+}
+
+Value CppTranslator::visitFunctionStmt(Stmt::Function* stmt) {
+  resetTemps();
+  define(stmt->slot, makeFunction(stmt, false));
+  return Nil();
+}
+
+Value CppTranslator::visitClassStmt(Stmt::Class* stmt) {
+  resetTemps();
+  define(stmt->slot, "Value()");
+  // the class is stored before its methods are made so it is reachable
+  // while they are being allocated
+  std::string klass = temp();
+  emit(klass + " = rt.makeClass(" + quote(stmt->name.lexeme) + ");");
+  assign(stmt->slot, stmt->name, klass);
+  for(auto& method: stmt->methods) {
+    emit("rt.addMethod(" + klass + ", " + makeFunction(method.get(), true)
+        + ");");
+  }
+  return Nil();
+}
+
+// translates the body into a C++ function of its own, returns how the
+// running code makes a closure of it
+std::string CppTranslator::makeFunction(Stmt::Function* stmt, bool isMethod) {
+  std::string name = "lox_" + identifier(stmt->name.lexeme) + "_"
+    + std::to_string(functionCount++);
+  functions.push_back({ name, {}, 1, stmt->slotCount, stmt->slotCount,
+      stmt->slotCount });
+  translate(stmt->body);
+  emit("return Value();");
+  FunctionState function = std::move(functions.back());
+  functions.pop_back();
+  definitions.push_back("static Value " + name
+      + "(Runtime& rt, AotFunction* self, Value* frame) {\n" + function.code
+      + "}\n");
+
+  std::string captures;
+  for(const auto& upvalue: stmt->upvalues) {
+    if(!captures.empty()) captures += ", ";
+    captures += std::string("{ ") + (upvalue.isLocal ? "true" : "false")
+      + ", " + std::to_string(upvalue.index) + " }";
+  }
+  return "rt.function(" + name + ", " + quote(stmt->name.lexeme) + ", "
+    + std::to_string(stmt->args.size()) + ", "
+    + std::to_string(function.frameSize) + ", "
+    + std::to_string(stmt->name.line) + ", "
+    + (isMethod ? "true" : "false") + ", self, frame, { " + captures + " })";
+}
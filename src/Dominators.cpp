@@ -0,0 +1,84 @@
+#include "../include/Dominators.hpp"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+
+DominatorTree::DominatorTree(const IR::Function& function) {
+  // postorder without recursion, long programs make deep graphs
+  std::set<const IR::Block*> visited;
+  std::vector<std::pair<IR::Block*, size_t>> stack;
+  stack.push_back({ function.entry(), 0 });
+  visited.insert(function.entry());
+  while(!stack.empty()) {
+    auto& [block, next] = stack.back();
+    std::vector<IR::Block*> successors = block->successors();
+    if(next < successors.size()) {
+      IR::Block* successor = successors[next++];
+      if(visited.insert(successor).second) stack.push_back({ successor, 0 });
+    } else {
+      order.push_back(block);
+      stack.pop_back();
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  for(size_t i = 0; i < order.size(); i++) orderIndex[order[i]] = i;
+
+  IR::Block* entry = function.entry();
+  idoms[entry] = entry;
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(size_t i = 1; i < order.size(); i++) {
+      IR::Block* block = order[i];
+      IR::Block* idom = nullptr;
+      for(IR::Block* pred: block->preds) {
+        // unreachable or not processed yet
+        if(!idoms.contains(pred)) continue;
+        idom = idom ? intersect(pred, idom) : pred;
+      }
+      auto known = idoms.find(block);
+      if(known == idoms.end() || known->second != idom) {
+        idoms[block] = idom;
+        changed = true;
+      }
+    }
+  }
+
+  idoms[entry] = nullptr;
+  for(IR::Block* block: order) {
+    if(block != entry) children[idoms[block]].push_back(block);
+  }
+}
+
+IR::Block* DominatorTree::intersect(IR::Block* a, IR::Block* b) const {
+  while(a != b) {
+    while(orderIndex.at(a) > orderIndex.at(b)) a = idoms.at(a);
+    while(orderIndex.at(b) > orderIndex.at(a)) b = idoms.at(b);
+  }
+  return a;
+}
+
+bool DominatorTree::isReachable(const IR::Block* block) const {
+  return orderIndex.contains(block);
+}
+
+IR::Block* DominatorTree::idom(const IR::Block* block) const {
+  auto it = idoms.find(block);
+  return it == idoms.end() ? nullptr : it->second;
+}
+
+bool DominatorTree::dominates(const IR::Block* a, const IR::Block* b) const {
+  if(!isReachable(b)) return true;
+  if(!isReachable(a)) return false;
+  // idoms always come earlier in reverse postorder
+  while(b && orderIndex.at(b) > orderIndex.at(a)) b = idom(b);
+  return b == a;
+}
+
+const std::vector<IR::Block*>& DominatorTree::childrenOf(
+    const IR::Block* block) const {
+  static const std::vector<IR::Block*> none;
+  auto it = children.find(block);
+  return it == children.end() ? none : it->second;
+}
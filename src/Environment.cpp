@@ -1,4 +1,5 @@
 #include "../include/Environment.hpp"
+#include "../include/Heap.hpp"
 #include "../include/Lox.hpp"
 
 #include <iostream>
@@ -11,59 +12,46 @@
   #define DEBPRINT(x)
 #endif
 
-Environment::Environment(std::shared_ptr<Environment> enclosing) 
-  : values {}, enclosing(std::move(enclosing)) {}
+ObjUpvalue::ObjUpvalue(Value* slot)
+  : Obj(ObjType::UPVALUE), location { slot } {}
 
-Environment::Environment() : enclosing(nullptr) { }
-
-void Environment::define(std::string name, Value value) {
-  //values[name] = value;
-  values.insert({name, value});
+void ObjUpvalue::trace(Heap& heap) {
+  // an open upvalue points into the stack, which is marked anyway
+  heap.markValue(closed);
 }
 
-Value Environment::get(const Token& name) const {
-  if(values.contains(name.lexeme)) {
-    return values.at(name.lexeme);
-  }
-  if(enclosing) return enclosing->get(name);
-  throw RuntimeError(name, "Undefined variable '" + name.lexeme + "'."); 
+int Globals::slotFor(const std::string& name) {
+  auto it = slots.find(name);
+  if(it != slots.end()) return it->second;
+  int slot = values.size();
+  slots.insert({name, slot});
+  names.push_back(name);
+  values.push_back(Nil());
+  defined.push_back(false);
+  return slot;
 }
 
-Value Environment::getAt(int distance, const std::string& name) {
-  return ancestor(distance)->values.at(name);
+void Globals::define(int slot, Value value) {
+  // redefining a global keeps the first value
+  if(defined[slot]) return;
+  values[slot] = std::move(value);
+  defined[slot] = true;
 }
 
-Environment* Environment::ancestor(int distance) {
-  Environment* env = this;
-
-  for(int i = 0; i < distance; i++) {
-    env = &*env->enclosing;
-  }
-
-  return env;
+Value Globals::get(int slot, const Token& name) const {
+  if(defined[slot]) return values[slot];
+  throw RuntimeError(name, "Undefined variable '" + name.lexeme + "'."); 
 }
 
-void Environment::assign(Token name, Value value) {
-  if(values.contains(name.lexeme)) {
-    values[name.lexeme] = value;
-    return;
-  }
-  if(enclosing) {
-    enclosing->assign(name, value);
+void Globals::assign(int slot, const Token& name, Value value) {
+  if(defined[slot]) {
+    values[slot] = std::move(value);
     return;
   }
   throw RuntimeError(name, "Undefined variable '" + name.lexeme + "'.");
 }
 
-void Environment::assignAt(int distance, Token name, Value value) {
-  ancestor(distance)->values[name.lexeme] = value;
+void Globals::mark(Heap& heap) const {
+  for(const Value& value: values) heap.markValue(value);
 }
 
-TemporaryEnv::TemporaryEnv(std::shared_ptr<Environment>& currentEnv,
-    std::shared_ptr<Environment> newEnv)
-  : env{ currentEnv }, prevEnv{ currentEnv } {
-    env = newEnv;
-  }
-TemporaryEnv::~TemporaryEnv() {
-  env = prevEnv;
-}
@@ -1,6 +1,7 @@
 #include "../include/Expr.hpp"
 #include "../include/Visitor.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 // this is Literal from types, used for representing literals in language
@@ -8,15 +9,13 @@
 using LiteralType = Literal;
 
 Expr::Literal::Literal(LiteralPtr value) 
-  : value { std::move(value) } {}
+  : value { std::move(value) } { type = this->value->value.getType(); }
 Expr::Literal::Literal(bool b) 
-  : value { std::make_shared<LiteralType>(b) } {}
-Expr::Literal::Literal(float f) 
-  : value { std::make_shared<LiteralType>(f) } {}
-Expr::Literal::Literal(std::string s) 
-  : value { std::make_shared<LiteralType>(s) } {}
+  : value { std::make_shared<LiteralType>(b) } { type = Type::BOOLEAN; }
+Expr::Literal::Literal(double d) 
+  : value { std::make_shared<LiteralType>(d) } { type = Type::NUMBER; }
 Expr::Literal::Literal(Nil s) 
-  : value { std::make_shared<LiteralType>(s) } {}
+  : value { std::make_shared<LiteralType>(s) } { type = Type::NIL; }
 
 Value Expr::Literal::accept(Visitor<Value>* visitor) {
   if(!visitor) return Nil();
@@ -30,6 +29,40 @@ Type Expr::Literal::accept(Visitor<Type>* visitor) {
 
 using namespace Expr;
 
+namespace {
+
+template <typename Node>
+std::vector<Node*> chainOf(Node* expr) {
+  std::vector<Node*> chain { expr };
+  while(auto* left = dynamic_cast<Node*>(chain.back()->left.get())) {
+    chain.push_back(left);
+  }
+  std::reverse(chain.begin(), chain.end());
+  return chain;
+}
+
+// Destroying the left operand would recurse once per link of the chain,
+// the links only this node holds are taken apart here instead
+template <typename Node>
+void releaseChain(Node* expr) {
+  ExprPtr next = std::move(expr->left);
+  while(next.use_count() == 1) {
+    auto* link = dynamic_cast<Node*>(next.get());
+    if(!link) break;
+    next = std::move(link->left);
+  }
+}
+
+}
+
+std::vector<Binop*> Expr::leftChain(Binop* expr) {
+  return chainOf(expr);
+}
+
+std::vector<Logical*> Expr::leftChain(Logical* expr) {
+  return chainOf(expr);
+}
+
 This::This(Token keyword) : keyword{keyword} {}
 
 Value This::accept(Visitor<Value>* visitor) {
@@ -44,7 +77,8 @@ Type This::accept(Visitor<Type>* visitor) {
 
 Call::Call(std::shared_ptr<Expr> callee, Token paren,
     const std::vector<std::shared_ptr<Expr>>& arguments)
-  : callee{callee}, paren{paren}, arguments{arguments} {}
+  : callee{callee}, paren{paren}, arguments{arguments},
+    property{dynamic_cast<Get*>(callee.get())} {}
 
 Value Call::accept(Visitor<Value>* visitor) {
   if(!visitor) return Nil();
@@ -86,6 +120,10 @@ Logical::Logical(std::shared_ptr<Expr> left,
     std::shared_ptr<Expr> right)
   : left { std::move(left) }, op { op }, right { std::move(right) }
   {}
+Logical::~Logical() {
+  releaseChain(this);
+}
+
 Value Logical::accept(Visitor<Value>* visitor) {
   if(!visitor) return Nil();
   return visitor->visitLogical(this);
@@ -100,7 +138,8 @@ Assign::Assign(Token name, std::shared_ptr<Expr> expr)
   : name { name }, value { std::move(expr) } { }
 
 Assign::Assign(const Assign& other)
-  : name { other.name }, value { std::move(other.value) } {}
+  : name { other.name }, value { std::move(other.value) }, slot { other.slot },
+    step { other.step } {}
 
 Value Assign::accept(Visitor<Value>* visitor) {
   if(!visitor) return Nil();
@@ -113,7 +152,8 @@ Type Assign::accept(Visitor<Type>* visitor) {
 }
 
 Variable::Variable(Token name) : name { name } {}
-Variable::Variable(const Variable& other) : name { other.name } {}
+Variable::Variable(const Variable& other)
+  : name { other.name }, slot { other.slot } {}
 Value Variable::accept(Visitor<Value>* visitor) {
   if(!visitor) return Nil();
   return visitor->visitVariableExpr(this);
@@ -125,8 +165,13 @@ Type Variable::accept(Visitor<Type>* visitor) {
 }
 
 Binop::Binop(std::shared_ptr<Expr> left, Token op, std::shared_ptr<Expr> right)
-  : left { std::move(left) }, right { std::move(right) }, op { op }
+  : left { std::move(left) }, right { std::move(right) }, op { op },
+    arithmetic { Numbers::opOf(op.type) }
   { }
+Binop::~Binop() {
+  releaseChain(this);
+}
+
 Value Binop::accept(Visitor<Value>* visitor) {
   if(!visitor) return Nil();
   return visitor->visitBinop(this);
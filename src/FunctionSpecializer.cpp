@@ -0,0 +1,246 @@
+#include "../include/FunctionSpecializer.hpp"
+#include "../include/AstCloner.hpp"
+#include "../include/AstQueries.hpp"
+#include "../include/ConstantFolder.hpp"
+
+#include <algorithm>
+
+namespace {
+
+// Top level functions and how often the names of globals are declared
+// and assigned
+class Declarations : public AstRewriter {
+  int depth { 0 };
+
+public:
+  std::map<std::string, int> counts;
+  std::set<std::string> assigned;
+  std::vector<Stmt::Function*> functions;
+
+  Value visitBlockStmt(Stmt::Block* stmt) override {
+    depth++;
+    AstRewriter::visitBlockStmt(stmt);
+    depth--;
+    return Nil();
+  }
+
+  Value visitVarStmt(Stmt::Var* stmt) override {
+    if(depth == 0) counts[stmt->name.lexeme]++;
+    return AstRewriter::visitVarStmt(stmt);
+  }
+
+  Value visitClassStmt(Stmt::Class* stmt) override {
+    if(depth == 0) counts[stmt->name.lexeme]++;
+    depth++;
+    AstRewriter::visitClassStmt(stmt);
+    depth--;
+    return Nil();
+  }
+
+  Value visitFunctionStmt(Stmt::Function* stmt) override {
+    if(depth == 0) {
+      counts[stmt->name.lexeme]++;
+      functions.push_back(stmt);
+    }
+    depth++;
+    AstRewriter::visitFunctionStmt(stmt);
+    depth--;
+    return Nil();
+  }
+
+  Value visitAssign(Expr::Assign* expr) override {
+    AstRewriter::visitAssign(expr);
+    if(expr->slot.isGlobal()) assigned.insert(expr->name.lexeme);
+    return Nil();
+  }
+};
+
+Expr::Literal* asLiteral(const Expr::ExprPtr& expr) {
+  return dynamic_cast<Expr::Literal*>(expr.get());
+}
+
+}
+
+FunctionSpecializer::FunctionSpecializer(Lox& lox, int limit)
+  : lox { lox }, limit { limit } {}
+
+void FunctionSpecializer::specialize(Stmt::Stmts& program) {
+  collect(program);
+  rewrite(program);
+
+  for(const auto& [function, clone]: clones) {
+    auto original = std::find_if(program.begin(), program.end(),
+        [function](const Stmt::StmtPtr& stmt) {
+          return stmt.get() == function;
+        });
+    // declared along with the original, so both exist from the same point
+    program.insert(original + 1, clone);
+  }
+}
+
+void FunctionSpecializer::printSummary(std::ostream& out) const {
+  for(const auto& site: sites) {
+    out << "[opt] specialized " << site.function << site.signature << " as "
+      << site.clone << " at line " << site.line << "\n";
+  }
+  out << "[opt] specialization: " << sites.size() << " call sites use "
+    << clones.size() << " clones, " << droppedBranches
+    << " branches dropped, " << capped << " calls over the limit\n";
+}
+
+void FunctionSpecializer::collect(Stmt::Stmts& program) {
+  Declarations declarations;
+  declarations.rewrite(program);
+
+  for(Stmt::Function* function: declarations.functions) {
+    Candidate& candidate = candidates[function->name.lexeme];
+    candidate.function = function;
+    candidate.declarations = declarations.counts[function->name.lexeme];
+    candidate.assigned = declarations.assigned.contains(function->name.lexeme);
+    AstRewriter counter;
+    counter.rewrite(function->body);
+    candidate.size = counter.nodeCount();
+  }
+}
+
+FunctionSpecializer::Candidate* FunctionSpecializer::specializableCall(
+    Expr::Call* call) {
+  auto* callee = dynamic_cast<Expr::Variable*>(call->callee.get());
+  if(!callee || !callee->slot.isGlobal()) return nullptr;
+  auto it = candidates.find(callee->name.lexeme);
+  if(it == candidates.end()) return nullptr;
+  Candidate& candidate = it->second;
+  if(candidate.declarations != 1 || candidate.assigned) return nullptr;
+  if(candidate.size > MAX_CLONED) return nullptr;
+  // a wrong argument count stays a run time error
+  if(call->arguments.size() != candidate.function->args.size()) return nullptr;
+  // top level code before the declaration can't call it yet
+  if(functionDepth == 0 && !candidate.declared) return nullptr;
+  for(const auto& argument: call->arguments) {
+    if(asLiteral(argument)) return &candidate;
+  }
+  return nullptr;
+}
+
+std::string FunctionSpecializer::signatureOf(Expr::Call* call) {
+  std::string signature;
+  for(const auto& argument: call->arguments) {
+    Expr::Literal* literal = asLiteral(argument);
+    signature += (signature.empty() ? "(" : ", ")
+      + (literal ? literalSpelling(literal->value->value) : "_");
+  }
+  return signature + ")";
+}
+
+FunctionSpecializer::Variant& FunctionSpecializer::variantFor(
+    Candidate& candidate, Expr::Call* call) {
+  std::string signature = signatureOf(call);
+  auto known = candidate.variants.find(signature);
+  if(known != candidate.variants.end()) return known->second;
+
+  static Variant none;
+  if(candidate.clones >= limit) {
+    capped++;
+    return none;
+  }
+
+  // '$' can't appear in a scanned identifier
+  std::string name = candidate.function->name.lexeme + "$"
+    + std::to_string(++freshNames);
+  std::shared_ptr<Stmt::Function> clone = specialize(candidate, call, name);
+
+  ConstantFolder folder(lox);
+  Stmt::Stmts scope { clone };
+  folder.fold(scope);
+  Variant& variant = candidate.variants[signature];
+  for(const auto& argument: call->arguments) {
+    variant.kept.push_back(!asLiteral(argument));
+  }
+  // the literals were only propagated, no operator or branch went away
+  if(folder.foldedCount() + folder.branchesDropped() == 0) return variant;
+
+  variant.name = name;
+  candidate.clones++;
+  droppedBranches += folder.branchesDropped();
+  clones.push_back({ candidate.function, clone });
+
+  // calls in the clone may be specialized too, this one included
+  functionDepth++;
+  cloneDepth++;
+  rewriteFunction(clone.get());
+  cloneDepth--;
+  functionDepth--;
+  return variant;
+}
+
+std::shared_ptr<Stmt::Function> FunctionSpecializer::specialize(
+    Candidate& candidate, Expr::Call* call, const std::string& name) {
+  std::shared_ptr<Stmt::Function> clone =
+    AstCloner().clone(*candidate.function);
+  clone->name = Token(IDENTIFIER, name, candidate.function->name.line);
+
+  Tokens params;
+  Stmt::Stmts constants;
+  for(size_t i = 0; i < call->arguments.size(); i++) {
+    const Token& param = candidate.function->args[i];
+    Expr::Literal* literal = asLiteral(call->arguments[i]);
+    if(!literal) {
+      params.push_back(param);
+      continue;
+    }
+    auto local = std::make_shared<Stmt::Var>(
+        std::make_shared<Expr::Literal>(*literal), param);
+    // laid out again once the passes are done
+    local->slot = { Expr::VarSlot::LOCAL, static_cast<int>(i) };
+    constants.push_back(local);
+  }
+  clone->args = params;
+  clone->body.insert(clone->body.begin(), constants.begin(), constants.end());
+  return clone;
+}
+
+Value FunctionSpecializer::visitClassStmt(Stmt::Class* stmt) {
+  functionDepth++;
+  for(auto& method: stmt->methods) rewriteFunction(method.get());
+  functionDepth--;
+  return Nil();
+}
+
+Value FunctionSpecializer::visitFunctionStmt(Stmt::Function* stmt) {
+  functionDepth++;
+  rewriteFunction(stmt);
+  functionDepth--;
+  if(functionDepth == 0) {
+    auto candidate = candidates.find(stmt->name.lexeme);
+    if(candidate != candidates.end() && candidate->second.function == stmt) {
+      candidate->second.declared = true;
+    }
+  }
+  return Nil();
+}
+
+Value FunctionSpecializer::visitCall(Expr::Call* expr) {
+  AstRewriter::visitCall(expr);
+  Candidate* candidate = specializableCall(expr);
+  if(!candidate) return Nil();
+  Variant& variant = variantFor(*candidate, expr);
+  if(variant.name.empty()) return Nil();
+
+  // a call in a clone has its source line reported already, inlined code
+  // may repeat a call too
+  Site site { candidate->function->name.lexeme, signatureOf(expr),
+    variant.name, expr->paren.line };
+  if(cloneDepth == 0
+      && std::find(sites.begin(), sites.end(), site) == sites.end()) {
+    sites.push_back(site);
+  }
+
+  Expr::Exprs arguments;
+  for(size_t i = 0; i < expr->arguments.size(); i++) {
+    if(variant.kept[i]) arguments.push_back(expr->arguments[i]);
+  }
+  expr->arguments = arguments;
+  expr->callee = std::make_shared<Expr::Variable>(
+      Token(IDENTIFIER, variant.name, expr->paren.line));
+  return Nil();
+}
@@ -0,0 +1,120 @@
+#include "../include/Heap.hpp"
+
+#include <algorithm>
+
+Heap::Heap(size_t threshold)
+  : nextGC { threshold }, minThreshold { threshold } {}
+
+Heap::~Heap() {
+  while(objects) {
+    Obj* next = objects->next;
+    delete objects;
+    objects = next;
+  }
+}
+
+void Heap::link(Obj* object, size_t size) {
+  object->size = size;
+  object->next = objects;
+  objects = object;
+  bytesAllocated += size;
+  stats.bytesAllocated += size;
+  // the new object is not reachable from anything yet, so it is kept
+  // alive explicitly together with whatever its constructor stored
+  if(bytesAllocated > nextGC) collect(object);
+}
+
+ObjString* Heap::makeString(std::string chars) {
+  size_t extra = chars.capacity();
+  ObjString* string = make<ObjString>(std::move(chars));
+  charge(string, extra);
+  return string;
+}
+
+Value Heap::makeInteger(int64_t value) {
+  if(Value::fitsSmallInt(value)) return Value::smallInt(value);
+  return make<ObjInteger>(value);
+}
+
+void Heap::charge(Obj* object, size_t bytes) {
+  object->size += bytes;
+  bytesAllocated += bytes;
+  stats.bytesAllocated += bytes;
+}
+
+void Heap::addRoots(RootSource* source) {
+  roots.push_back(source);
+}
+
+void Heap::removeRoots(RootSource* source) {
+  roots.erase(std::remove(roots.begin(), roots.end(), source), roots.end());
+}
+
+void Heap::pin(Obj* object) {
+  pinned.push_back(object);
+}
+
+void Heap::unpinAll() {
+  pinned.clear();
+}
+
+void Heap::markValue(Value value) {
+  if(value.isObj()) markObject(value.asObj());
+}
+
+void Heap::markObject(Obj* object) {
+  if(!object || object->marked) return;
+  object->marked = true;
+  grayStack.push_back(object);
+}
+
+void Heap::traceReferences() {
+  while(!grayStack.empty()) {
+    Obj* object = grayStack.back();
+    grayStack.pop_back();
+    object->trace(*this);
+  }
+}
+
+void Heap::sweep() {
+  Obj** link = &objects;
+  while(*link) {
+    Obj* object = *link;
+    if(object->marked) {
+      object->marked = false;
+      link = &object->next;
+      continue;
+    }
+    *link = object->next;
+    bytesAllocated -= object->size;
+    stats.bytesFreed += object->size;
+    delete object;
+  }
+}
+
+void Heap::collect(Obj* newest) {
+  auto start = std::chrono::steady_clock::now();
+
+  markObject(newest);
+  for(Obj* object: pinned) markObject(object);
+  for(RootSource* source: roots) source->markRoots(*this);
+  traceReferences();
+  sweep();
+
+  nextGC = std::max<size_t>(bytesAllocated * growthFactor, minThreshold);
+
+  std::chrono::duration<double, std::milli> pause =
+    std::chrono::steady_clock::now() - start;
+  stats.collections++;
+  stats.totalPause += pause;
+  stats.maxPause = std::max(stats.maxPause, pause);
+}
+
+void Heap::printStats(std::ostream& out) const {
+  out << "[gc] collections: " << stats.collections << "\n"
+      << "[gc] bytes allocated: " << stats.bytesAllocated << "\n"
+      << "[gc] bytes freed: " << stats.bytesFreed << "\n"
+      << "[gc] bytes live: " << bytesAllocated << "\n"
+      << "[gc] total pause: " << stats.totalPause.count() << " ms\n"
+      << "[gc] max pause: " << stats.maxPause.count() << " ms\n";
+}
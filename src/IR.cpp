@@ -0,0 +1,215 @@
+#include "../include/IR.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+namespace IR {
+
+const char* opName(Op op) {
+  static const char* names[] = {
+#define LOX_IR_OP_NAME(op) #op,
+    LOX_IR_OPS(LOX_IR_OP_NAME)
+#undef LOX_IR_OP_NAME
+  };
+  return names[static_cast<int>(op)];
+}
+
+bool hasResult(Op op) {
+  switch(op) {
+    case Op::STORE_CELL: case Op::SET_GLOBAL: case Op::DEFINE_GLOBAL:
+    case Op::SET_PROPERTY: case Op::PRINT: case Op::JUMP: case Op::BRANCH:
+    case Op::RETURN:
+      return false;
+    default: return true;
+  }
+}
+
+bool isTerminator(Op op) {
+  return op == Op::JUMP || op == Op::BRANCH || op == Op::RETURN;
+}
+
+bool isRemovable(Op op) {
+  switch(op) {
+    case Op::CONST: case Op::PARAM: case Op::PHI: case Op::EQUAL:
+    case Op::NOT_EQUAL: case Op::NOT: case Op::NEW_CELL: case Op::LOAD_CELL:
+    case Op::UPVALUE_CELL: case Op::CLOSURE:
+      return true;
+    default: return false;
+  }
+}
+
+Instr::Instr(Op op, Block* block, Token token)
+  : op { op }, block { block }, token { std::move(token) } {}
+
+Block::Block(int id) : id { id } {}
+
+Instr* Block::terminator() const {
+  if(instrs.empty() || !isTerminator(instrs.back()->op)) return nullptr;
+  return instrs.back().get();
+}
+
+std::vector<Block*> Block::successors() const {
+  Instr* last = terminator();
+  if(!last || last->op == Op::RETURN) return {};
+  if(last->op == Op::JUMP) return { last->targets[0] };
+  return { last->targets[0], last->targets[1] };
+}
+
+size_t Block::phiCount() const {
+  size_t count = 0;
+  while(count < instrs.size() && instrs[count]->op == Op::PHI) count++;
+  return count;
+}
+
+void Block::removePred(Block* pred) {
+  auto it = std::find(preds.begin(), preds.end(), pred);
+  if(it == preds.end()) return;
+  size_t edge = it - preds.begin();
+  preds.erase(it);
+  for(size_t i = 0; i < phiCount(); i++) {
+    auto& operands = instrs[i]->operands;
+    operands.erase(operands.begin() + edge);
+  }
+}
+
+Block* Function::newBlock() {
+  blocks.push_back(std::make_unique<Block>(nextBlockId++));
+  return blocks.back().get();
+}
+
+void Function::replaceUses(Instr* from, Instr* to) {
+  for(const auto& block: blocks) {
+    for(const auto& instr: block->instrs) {
+      for(Instr*& operand: instr->operands) {
+        if(operand == from) operand = to;
+      }
+    }
+  }
+}
+
+void Function::renumber() {
+  int next = 0;
+  for(const auto& block: blocks) {
+    for(const auto& instr: block->instrs) instr->id = next++;
+  }
+  registerCount = next;
+}
+
+namespace {
+
+std::string lowercase(const char* name) {
+  std::string result(name);
+  for(char& c: result) c = std::tolower(c);
+  return result;
+}
+
+std::string valueName(const Instr* instr) {
+  return "v" + std::to_string(instr->id);
+}
+
+void printOperands(std::ostream& out, const Instr& instr, size_t first) {
+  for(size_t i = first; i < instr.operands.size(); i++) {
+    out << (i > first ? ", " : "") << valueName(instr.operands[i]);
+  }
+}
+
+void printInstr(std::ostream& out, const Instr& instr) {
+  out << "  ";
+  if(hasResult(instr.op)) out << valueName(&instr) << " = ";
+  out << lowercase(opName(instr.op));
+  switch(instr.op) {
+    case Op::CONST:
+      if(instr.constant.isString()) {
+        out << " \"" << instr.constant.toString() << "\"";
+      } else {
+        out << " " << instr.constant.toString();
+      }
+      break;
+    case Op::PARAM:
+    case Op::UPVALUE_CELL:
+      out << " " << instr.index;
+      break;
+    case Op::PHI:
+      for(size_t i = 0; i < instr.operands.size(); i++) {
+        out << (i ? ", [" : " [") << valueName(instr.operands[i]) << ", b"
+          << instr.block->preds[i]->id << "]";
+      }
+      break;
+    case Op::GET_GLOBAL:
+    case Op::SET_GLOBAL:
+    case Op::DEFINE_GLOBAL:
+      out << " " << instr.token.lexeme;
+      if(!instr.operands.empty()) out << ", ";
+      printOperands(out, instr, 0);
+      break;
+    case Op::CLOSURE:
+      out << " " << instr.function->name << " [";
+      printOperands(out, instr, 0);
+      out << "]";
+      break;
+    case Op::CLASS:
+      out << " " << instr.token.lexeme << " [";
+      printOperands(out, instr, 0);
+      out << "]";
+      break;
+    case Op::GET_PROPERTY:
+    case Op::SET_PROPERTY:
+      out << " " << valueName(instr.operands[0]) << "." << instr.token.lexeme;
+      if(instr.operands.size() > 1) out << ", ";
+      printOperands(out, instr, 1);
+      break;
+    case Op::INVOKE:
+      out << " " << valueName(instr.operands[0]) << "." << instr.token.lexeme
+        << "(";
+      printOperands(out, instr, 1);
+      out << ")";
+      break;
+    case Op::CALL:
+      out << " " << valueName(instr.operands[0]) << "(";
+      printOperands(out, instr, 1);
+      out << ")";
+      break;
+    case Op::JUMP:
+      out << " b" << instr.targets[0]->id;
+      break;
+    case Op::BRANCH:
+      out << " " << valueName(instr.operands[0]) << ", b"
+        << instr.targets[0]->id << ", b" << instr.targets[1]->id;
+      break;
+    default:
+      if(!instr.operands.empty()) out << " ";
+      printOperands(out, instr, 0);
+  }
+  out << "\n";
+}
+
+}
+
+void Function::print(std::ostream& out) const {
+  out << "function " << name << "(" << paramCount() << " params, "
+    << upvalueCount << " upvalues)\n";
+  for(const auto& block: blocks) {
+    out << "b" << block->id << ":";
+    if(!block->preds.empty()) {
+      out << " preds";
+      for(Block* pred: block->preds) out << " b" << pred->id;
+    }
+    out << "\n";
+    for(const auto& instr: block->instrs) printInstr(out, *instr);
+  }
+}
+
+Function* Module::newFunction(const std::string& name) {
+  functions.push_back(std::make_unique<Function>());
+  functions.back()->name = name;
+  return functions.back().get();
+}
+
+void Module::print(std::ostream& out) const {
+  for(size_t i = 0; i < functions.size(); i++) {
+    if(i) out << "\n";
+    functions[i]->print(out);
+  }
+}
+
+}
@@ -0,0 +1,327 @@
+#include "../include/Inliner.hpp"
+#include "../include/AstCloner.hpp"
+
+namespace {
+
+// Collects what the Inliner needs to know about the top level functions
+class Survey : public AstRewriter {
+public:
+  struct Body {
+    Expr::ExprPtr value;
+    size_t size { 0 };
+    std::set<std::string> callees;
+    std::set<std::string> globals;
+    bool dynamicCalls { false };
+    bool hasEffects { false };
+    bool assignsParameter { false };
+  };
+
+  std::map<std::string, int> declarations;
+  std::set<std::string> assigned;
+  std::map<Stmt::Function*, Body> bodies;
+
+private:
+  int depth { 0 };
+  Stmt::Function* current { nullptr };
+
+  Body* body() { return current ? &bodies[current] : nullptr; }
+
+public:
+  Value visitBlockStmt(Stmt::Block* stmt) override {
+    depth++;
+    AstRewriter::visitBlockStmt(stmt);
+    depth--;
+    return Nil();
+  }
+
+  Value visitVarStmt(Stmt::Var* stmt) override {
+    if(depth == 0) declarations[stmt->name.lexeme]++;
+    return AstRewriter::visitVarStmt(stmt);
+  }
+
+  Value visitClassStmt(Stmt::Class* stmt) override {
+    if(depth == 0) declarations[stmt->name.lexeme]++;
+    depth++;
+    AstRewriter::visitClassStmt(stmt);
+    depth--;
+    return Nil();
+  }
+
+  Value visitFunctionStmt(Stmt::Function* stmt) override {
+    bool topLevel = depth == 0;
+    if(topLevel) {
+      declarations[stmt->name.lexeme]++;
+      current = stmt;
+      bodies[stmt] = {};
+    }
+    depth++;
+    AstRewriter::visitFunctionStmt(stmt);
+    depth--;
+    if(topLevel) {
+      current = nullptr;
+      auto* ret = stmt->body.size() == 1
+        ? dynamic_cast<Stmt::Return*>(stmt->body[0].get()) : nullptr;
+      Body& body = bodies[stmt];
+      if(ret && ret->value) {
+        AstRewriter counter;
+        body.value = ret->value;
+        counter.rewrite(body.value);
+        body.size = counter.nodeCount();
+      }
+    }
+    return Nil();
+  }
+
+  Value visitVariableExpr(Expr::Variable* var) override {
+    if(body() && var->slot.isGlobal()) body()->globals.insert(var->name.lexeme);
+    return Nil();
+  }
+
+  Value visitAssign(Expr::Assign* expr) override {
+    AstRewriter::visitAssign(expr);
+    if(expr->slot.isGlobal()) assigned.insert(expr->name.lexeme);
+    if(body()) {
+      body()->hasEffects = true;
+      if(!expr->slot.isGlobal()) body()->assignsParameter = true;
+    }
+    return Nil();
+  }
+
+  Value visitSetExpr(Expr::Set* expr) override {
+    AstRewriter::visitSetExpr(expr);
+    if(body()) body()->hasEffects = true;
+    return Nil();
+  }
+
+  Value visitCall(Expr::Call* expr) override {
+    AstRewriter::visitCall(expr);
+    if(!body()) return Nil();
+    body()->hasEffects = true;
+    auto* callee = dynamic_cast<Expr::Variable*>(expr->callee.get());
+    if(callee && callee->slot.isGlobal()) {
+      body()->callees.insert(callee->name.lexeme);
+    } else {
+      body()->dynamicCalls = true;
+    }
+    return Nil();
+  }
+};
+
+// Copies a function's returned expression, replacing its parameters
+class BodyCloner : public AstCloner {
+  std::map<std::string, Expr::ExprPtr> arguments;
+
+public:
+  BodyCloner(std::map<std::string, Expr::ExprPtr> arguments)
+    : arguments { std::move(arguments) } {}
+
+  Value visitVariableExpr(Expr::Variable* var) override {
+    auto argument = arguments.find(var->name.lexeme);
+    if(var->slot.isGlobal() || argument == arguments.end()) {
+      exprReplacement = std::make_shared<Expr::Variable>(*var);
+    } else if(auto* literal =
+        dynamic_cast<Expr::Literal*>(argument->second.get())) {
+      exprReplacement = std::make_shared<Expr::Literal>(*literal);
+    } else {
+      exprReplacement = std::make_shared<Expr::Variable>(
+          *static_cast<Expr::Variable*>(argument->second.get()));
+    }
+    return Nil();
+  }
+};
+
+}
+
+Inliner::Inliner(size_t budget) : budget { budget } {}
+
+void Inliner::inlineCalls(Stmt::Stmts& program) {
+  collect(program);
+  rewrite(program);
+}
+
+void Inliner::printSummary(std::ostream& out) const {
+  for(const auto& site: sites) {
+    out << "[opt] inlined " << site.function << " at line " << site.line
+      << (site.throughLocals ? " through locals" : "") << "\n";
+  }
+  out << "[opt] inlining: " << sites.size() << " call sites inlined\n";
+}
+
+void Inliner::collect(Stmt::Stmts& program) {
+  Survey survey;
+  survey.rewrite(program);
+
+  for(auto& [function, body]: survey.bodies) {
+    Candidate& candidate = candidates[function->name.lexeme];
+    candidate.function = function;
+    if(body.value) {
+      candidate.body = AstCloner().clone(body.value);
+    }
+    candidate.callees = body.callees;
+    candidate.globals = body.globals;
+    candidate.hasEffects = body.hasEffects;
+    candidate.declarations = survey.declarations[function->name.lexeme];
+    candidate.assigned = survey.assigned.contains(function->name.lexeme);
+    candidate.inlinable = body.size > 0 && body.size <= budget
+      && !body.dynamicCalls && !body.assignsParameter;
+  }
+  for(auto& [name, candidate]: candidates) {
+    std::set<std::string> seen;
+    candidate.recursive = reaches(name, name, seen);
+    candidate.inlinable = candidate.inlinable && !candidate.recursive
+      && !candidate.assigned && candidate.declarations == 1;
+  }
+}
+
+bool Inliner::reaches(const std::string& from, const std::string& to,
+    std::set<std::string>& seen) {
+  auto candidate = candidates.find(from);
+  // natives and anything else that is not a top level function
+  if(candidate == candidates.end()) return false;
+  for(const auto& callee: candidate->second.callees) {
+    if(callee == to) return true;
+    if(seen.insert(callee).second && reaches(callee, to, seen)) return true;
+  }
+  return false;
+}
+
+Inliner::Candidate* Inliner::inlinableCall(Expr::Call* call) {
+  auto* callee = dynamic_cast<Expr::Variable*>(call->callee.get());
+  if(!callee || !callee->slot.isGlobal()) return nullptr;
+  auto it = candidates.find(callee->name.lexeme);
+  if(it == candidates.end()) return nullptr;
+  Candidate& candidate = it->second;
+  if(!candidate.inlinable) return nullptr;
+  // a wrong argument count stays a run time error
+  if(call->arguments.size() != candidate.function->args.size()) return nullptr;
+  // top level code before the declaration can't call it yet
+  if(functionDepth == 0 && !candidate.declared) return nullptr;
+  // the body's globals would resolve to locals of the caller
+  for(const auto& scope: scopes) {
+    for(const auto& global: candidate.globals) {
+      if(scope.contains(global)) return nullptr;
+    }
+  }
+  return &candidate;
+}
+
+bool Inliner::substitutable(Candidate& candidate, Expr::Call* call) {
+  for(const auto& argument: call->arguments) {
+    if(dynamic_cast<Expr::Literal*>(argument.get())) continue;
+    // the body could change the variable before reading the parameter
+    if(!candidate.hasEffects
+        && dynamic_cast<Expr::Variable*>(argument.get())) continue;
+    return false;
+  }
+  return true;
+}
+
+Expr::ExprPtr Inliner::inlineBody(Candidate& candidate, Expr::Call* call,
+    bool throughLocals) {
+  std::map<std::string, Expr::ExprPtr> arguments;
+  const Tokens& params = candidate.function->args;
+  for(size_t i = 0; i < params.size(); i++) {
+    if(!throughLocals) {
+      arguments[params[i].lexeme] = call->arguments[i];
+      continue;
+    }
+    // '$' can't appear in a scanned identifier
+    Token local(IDENTIFIER,
+        params[i].lexeme + "$" + std::to_string(++freshNames), call->paren.line);
+    insertBefore.push_back(
+        std::make_shared<Stmt::Var>(call->arguments[i], local));
+    arguments[params[i].lexeme] = std::make_shared<Expr::Variable>(local);
+  }
+  sites.push_back({ candidate.function->name.lexeme, call->paren.line,
+      throughLocals });
+
+  return BodyCloner(arguments).clone(candidate.body);
+}
+
+void Inliner::inlineRoot(Expr::ExprPtr& expr) {
+  auto* call = dynamic_cast<Expr::Call*>(expr.get());
+  if(!call) return;
+  if(Candidate* candidate = inlinableCall(call)) {
+    expr = inlineBody(*candidate, call, true);
+  }
+}
+
+void Inliner::declare(const std::string& name) {
+  if(!scopes.empty()) scopes.back().insert(name);
+}
+
+Value Inliner::visitExprStmt(Stmt::Expr* exprstmt) {
+  AstRewriter::visitExprStmt(exprstmt);
+  // an assignment evaluates its value first
+  if(auto* assign = dynamic_cast<Expr::Assign*>(exprstmt->expr.get())) {
+    inlineRoot(assign->value);
+  } else {
+    inlineRoot(exprstmt->expr);
+  }
+  return Nil();
+}
+
+Value Inliner::visitPrintStmt(Stmt::Print* stmt) {
+  AstRewriter::visitPrintStmt(stmt);
+  inlineRoot(stmt->expr);
+  return Nil();
+}
+
+Value Inliner::visitBlockStmt(Stmt::Block* stmt) {
+  scopes.push_back({});
+  AstRewriter::visitBlockStmt(stmt);
+  scopes.pop_back();
+  return Nil();
+}
+
+Value Inliner::visitVarStmt(Stmt::Var* stmt) {
+  AstRewriter::visitVarStmt(stmt);
+  if(stmt->initializer) inlineRoot(stmt->initializer);
+  declare(stmt->name.lexeme);
+  return Nil();
+}
+
+Value Inliner::visitReturnStmt(Stmt::Return* stmt) {
+  AstRewriter::visitReturnStmt(stmt);
+  if(stmt->value) inlineRoot(stmt->value);
+  return Nil();
+}
+
+Value Inliner::visitClassStmt(Stmt::Class* stmt) {
+  declare(stmt->name.lexeme);
+  functionDepth++;
+  for(auto& method: stmt->methods) {
+    std::set<std::string> params;
+    for(const auto& param: method->args) params.insert(param.lexeme);
+    scopes.push_back(params);
+    rewriteFunction(method.get());
+    scopes.pop_back();
+  }
+  functionDepth--;
+  return Nil();
+}
+
+Value Inliner::visitFunctionStmt(Stmt::Function* stmt) {
+  declare(stmt->name.lexeme);
+  functionDepth++;
+  std::set<std::string> params;
+  for(const auto& param: stmt->args) params.insert(param.lexeme);
+  scopes.push_back(params);
+  rewriteFunction(stmt);
+  scopes.pop_back();
+  functionDepth--;
+  if(functionDepth == 0 && scopes.empty()) {
+    auto candidate = candidates.find(stmt->name.lexeme);
+    if(candidate != candidates.end()) candidate->second.declared = true;
+  }
+  return Nil();
+}
+
+Value Inliner::visitCall(Expr::Call* expr) {
+  AstRewriter::visitCall(expr);
+  Candidate* candidate = inlinableCall(expr);
+  if(candidate && substitutable(*candidate, expr)) {
+    exprReplacement = inlineBody(*candidate, expr, false);
+  }
+  return Nil();
+}
@@ -1,152 +1,197 @@
 #include "../include/Interpreter.hpp"
+#include "../include/ClosureCompiler.hpp"
 #include "../include/NativeFunctions.hpp"
 #include "../include/LoxClass.hpp"
 #include "../include/LoxInstance.hpp"
 #include "../include/LoxFunction.hpp"
+#include "../include/Numbers.hpp"
 
 #include <iostream>
 
 
-void Interpreter::checkNumberOperand(Token op, Value& val) const {
-  if(std::holds_alternative<float>(val.value)) return;
+void Interpreter::checkNumberOperand(const Token& op, Value val) const {
+  if(val.isNumber()) return;
   throw RuntimeError(op, "Operand must be a number.");
 }
 
-void Interpreter::checkNumberOperands(Token op, Value& left, Value& right) const {
-  if(std::holds_alternative<float>(left.value) &&
-      std::holds_alternative<float>(right.value)) return;
-  throw RuntimeError(op, "Operands must be a number.");
-}
-
 void Interpreter::reportDifferentTypesOperands() const {
   //throw RuntimeError(
 }
 
 bool Interpreter::isTruthy(Value val) const {
-  return std::visit([](auto&& arg) -> bool {
-      using T = std::decay_t<decltype(arg)>;
-      if constexpr (std::is_same_v<T, Nil>) {
-      return false;  // nil is false
-      } else if constexpr (std::is_same_v<T, bool>) {
-      return arg;  // return the boolean value itself
-      } else if constexpr (std::is_same_v<T, float>) {
-      return arg != 0;  // nonzero numbers are true
-      } else if constexpr (std::is_same_v<T, std::string>) {
-      return !arg.empty();  // non-empty strings are true
-      }
-      return false; // Default case (shouldn't happen)
-      }, val.value);
+  return val.isTruthy();
 }
 
 bool Interpreter::isEqual(Value left, Value right) const {
-  if(std::holds_alternative<Nil>(left.value)) {
-    return std::holds_alternative<Nil>(right.value);
-  }
-  auto eq = [&left, &right]<typename T>() -> bool {
-    auto l = std::get<T>(left.value);
-    auto r = std::get<T>(right.value);
-    return l == r;
-  };
-  if(std::holds_alternative<std::string>(left.value) 
-      && std::holds_alternative<std::string>(right.value)) 
-    return eq.template operator()<std::string>();
-  if(std::holds_alternative<float>(left.value)
-      && std::holds_alternative<float>(right.value)) 
-    return eq.template operator()<float>();
-  if(std::holds_alternative<bool>(left.value)
-      && std::holds_alternative<bool>(right.value)) 
-    return eq.template operator()<bool>();
-  //reportDifferentTypesOperands();
-  // for now two different types are always not equal
-  return false;
-}
-void Interpreter::executeBlock(const Stmts& statements,
-    std::shared_ptr<Environment> env) {
-  // tempenv sets current environment to the new one and in the
-  // destructor restores it to the old one, using RAII
-  TemporaryEnv tempenv = TemporaryEnv(this->environment, env);
+  return left.isEqual(right);
+}
+Completion Interpreter::executeBlock(const Stmts& statements) {
   for(const auto& stmt: statements) {
-    execute(stmt);
+    if(execute(stmt) != Completion::NORMAL) break;
+  }
+  return completion;
+}
+
+// the operators of a site whose operands are numbers
+Value Interpreter::onNumbers(Expr::Binop* expr, Value left, Value right) {
+  if(!expr->arithmetic) {
+    bool equal = left.isEqual(right);
+    return expr->op.type == EQUAL_EQUAL ? equal : !equal;
+  }
+  Numbers::Op op = *expr->arithmetic;
+  Value result;
+  if(Numbers::quick(op, left, right, result)) return result;
+  // numbers, but the bitwise operators also want integers
+  if(!Numbers::accepts(op, left, right)) {
+    throw RuntimeError(expr->op, Numbers::operandError(op, left, right));
+  }
+  return Numbers::binary(op, left, right, heap());
+}
+
+Value Interpreter::onNumber(const Token& op, Value right) {
+  switch(op.type) {
+    case MINUS: return *Numbers::negate(right, &heap());
+    case PLUSPLUS: return *Numbers::add(right, 1, &heap());
+    case MINUSMINUS: return *Numbers::add(right, -1, &heap());
+    case TILDE:
+      if(!right.isInt()) throw RuntimeError(op, "Operand must be an integer.");
+      return *Numbers::complement(right, &heap());
+    default: return Nil();
   }
 }
 
 Value Interpreter::visitBinop(Expr::Binop* expr) {
-  Value left = evaluate(expr->left);
+  if(expr->chain.empty()) return operate(expr, evaluate(expr->left));
+  // a chain like a + b - c runs in a loop from its innermost operator out
+  Value left = evaluate(expr->chain.front()->left);
+  for(Expr::Binop* binop: expr->chain) left = operate(binop, left);
+  return left;
+}
+
+Value Interpreter::operate(Expr::Binop* expr, Value left) {
+  temporaries.push_back(left);
   Value right = evaluate(expr->right);
+  temporaries.pop_back();
 
-  auto executeBinop = 
-    [&left, &right]<typename T, typename F>(F fn) -> T { 
-      auto l = std::get<T>(left.value);
-      auto r = std::get<T>(right.value);
-      return fn(l, r);
-    };
+  // proven by the type checker, only the tags are checked
+  Type leftType = expr->left->type;
+  if(leftType == expr->right->type) {
+    if(leftType == Type::NUMBER && left.isNumber() && right.isNumber()) {
+      return onNumbers(expr, left, right);
+    }
+    if(leftType == Type::STRING && expr->op.type == PLUS
+        && left.isString() && right.isString()) {
+      return heap().makeString(
+          left.asString()->chars + right.asString()->chars);
+    }
+  }
 
-  switch (expr->op.type) {
+  TypeFeedback& feedback = expr->feedback;
+  switch(feedback.state) {
+    case TypeFeedback::INTEGERS:
+      if(left.isSmallInt() && right.isSmallInt()) {
+        feedback.hits++;
+        return onNumbers(expr, left, right);
+      }
+      break;
+    case TypeFeedback::NUMBERS:
+      if(left.isNumber() && right.isNumber()) {
+        feedback.hits++;
+        return onNumbers(expr, left, right);
+      }
+      break;
+    case TypeFeedback::STRINGS:
+      if(left.isString() && right.isString()) {
+        feedback.hits++;
+        return heap().makeString(
+            left.asString()->chars + right.asString()->chars);
+      }
+      break;
+    case TypeFeedback::GENERIC: return binop(expr->op, left, right);
+    default: break;
+  }
+
+  if(feedback.state != TypeFeedback::UNINITIALIZED) feedback.misses++;
+  if(left.isSmallInt() && right.isSmallInt()) {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::INTEGERS);
+  } else if(left.isNumber() && right.isNumber()) {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::NUMBERS);
+  } else if(left.isString() && right.isString() && expr->op.type == PLUS) {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::STRINGS);
+  } else {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::GENERIC);
+  }
+  return binop(expr->op, left, right);
+}
+
+Value Interpreter::binop(const Token& op, Value left, Value right) {
+  switch (op.type) {
     case EQUAL_EQUAL: return isEqual(left, right);
     case BANG_EQUAL: return !isEqual(left, right);
-    case GREATER:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::greater<float>{});
-    case GREATER_EQUAL:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::greater_equal<float>{});
-    case LESS:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::less<float>{});
-    case LESS_EQUAL:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::less_equal<float>{});
-    case MINUS:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::minus<float>{});
-    case SLASH:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::divides<float>{});
-    case STAR:
-      checkNumberOperands(expr->op, left, right);
-      return executeBinop.template operator()<float>(std::multiplies<float>{});
     case PLUS:
-      if(std::holds_alternative<float>(left.value) 
-          && std::holds_alternative<float>(right.value)) {
-        return executeBinop.template operator()<float>
-          (std::plus<float>{});
+      if(left.isString() && right.isString()) {
+        return heap().makeString(
+            left.asString()->chars + right.asString()->chars);
       }
-
-      if(std::holds_alternative<std::string>(left.value) 
-          && std::holds_alternative<std::string>(right.value)) {
-        auto l = std::get<std::string>(left.value);
-        auto r = std::get<std::string>(right.value);
-        return l + r;
+      if(!left.isNumber() || !right.isNumber()) {
+        throw RuntimeError(op, "Operands must be two numbers or two strings");
       }
-      throw RuntimeError(expr->op, "Operands must be two numbers or two strings");
+      break;
     default: break;
   }
-  return Nil();
+
+  std::optional<Numbers::Op> arithmetic = Numbers::opOf(op.type);
+  if(!arithmetic) return Nil();
+  if(!Numbers::accepts(*arithmetic, left, right)) {
+    throw RuntimeError(op, Numbers::operandError(*arithmetic, left, right));
+  }
+  return Numbers::binary(*arithmetic, left, right, heap());
 }
 Value Interpreter::visitUnop(Expr::Unop* expr) {
   Value right = evaluate(expr->expr);
-  switch(expr->op.type) {
-    case BANG: {
-                 return !isTruthy(right);
-               }
-    case MINUS: {
-                  checkNumberOperand(expr->op, right);
-                  float val = std::get<float>(right.value);
-                  return -val;
-                }
-    case PLUSPLUS: {
-                     checkNumberOperand(expr->op, right);
-                     float val = std::get<float>(right.value);
-                     return ++val;
-                   }
-    case MINUSMINUS: {
-                       checkNumberOperand(expr->op, right);
-                       float val = std::get<float>(right.value);
-                       return --val;
-                     }
+
+  if(expr->expr->type == Type::NUMBER && expr->op.type != BANG
+      && right.isNumber()) {
+    return onNumber(expr->op, right);
+  }
+  if(expr->expr->type == Type::BOOLEAN && expr->op.type == BANG
+      && right.isBool()) {
+    return !right.asBool();
+  }
+
+  TypeFeedback& feedback = expr->feedback;
+  switch(feedback.state) {
+    case TypeFeedback::NUMBERS:
+      if(right.isNumber()) {
+        feedback.hits++;
+        return onNumber(expr->op, right);
+      }
+      break;
+    case TypeFeedback::BOOLEAN:
+      if(right.isBool()) {
+        feedback.hits++;
+        return !right.asBool();
+      }
+      break;
+    case TypeFeedback::GENERIC: return unop(expr->op, right);
     default: break;
   }
-  return Nil();
+
+  if(feedback.state != TypeFeedback::UNINITIALIZED) feedback.misses++;
+  if(right.isNumber() && expr->op.type != BANG) {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::NUMBERS);
+  } else if(right.isBool() && expr->op.type == BANG) {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::BOOLEAN);
+  } else {
+    quicken(feedback, expr->op, "operator ", TypeFeedback::GENERIC);
+  }
+  return unop(expr->op, right);
+}
+
+Value Interpreter::unop(const Token& op, Value right) {
+  if(op.type == BANG) return !isTruthy(right);
+  checkNumberOperand(op, right);
+  return onNumber(op, right);
 }
 Value Interpreter::visitGrouping(Expr::Grouping* expr) {
   return evaluate(expr->expr);
@@ -168,26 +213,44 @@ Value Interpreter::visitVarStmt(Stmt::Var* stmt) {
   if(stmt->initializer) {
     val = evaluate(stmt->initializer);
   }
-  environment->define(stmt->name.lexeme, val);
+  define(stmt->slot, val);
   return val;
 }
 Value Interpreter::visitVariableExpr(Expr::Variable* expr) {
-  return lookUpVariable(expr->name, expr);
+  return lookUpVariable(expr->name, expr->slot);
 }
 Value Interpreter::visitAssign(Expr::Assign* expr) {
-  Value value = evaluate(expr->value);
-
-  if(locals.contains(expr)) {
-    int distance = locals[expr];
-    environment->assignAt(distance, expr->name, value);
-  } else {
-    globals->assign(expr->name, value);
-  }
+  Value value;
+  if(!expr->step.isNil() && stepCounter(expr, value)) return value;
+  value = evaluate(expr->value);
 
+  assign(expr->name, expr->slot, value);
   return value;
 }
+
+// `name = name + step` on a counter that holds a number, anything else
+// takes the Binop for its error
+bool Interpreter::stepCounter(Expr::Assign* expr, Value& result) {
+  int slot = expr->slot.slot;
+  Value* counter = nullptr;
+  switch(expr->slot.kind) {
+    case Expr::VarSlot::LOCAL: counter = &frame[slot]; break;
+    case Expr::VarSlot::UPVALUE:
+      counter = closure->upvalues[slot]->location;
+      break;
+    default:
+      if(globals.isDefined(slot)) counter = &globals.at(slot);
+  }
+  if(!counter || !counter->isNumber()) return false;
+  if(!Numbers::quick(Numbers::Op::ADD, *counter, expr->step, result)) {
+    result = Numbers::binary(Numbers::Op::ADD, *counter, expr->step, heap());
+  }
+  *counter = result;
+  return true;
+}
 Value Interpreter::visitBlockStmt(Stmt::Block* stmt) {
-  executeBlock(stmt->statements, std::make_shared<Environment>(environment));
+  executeBlock(stmt->statements);
+  if(stmt->closesUpvalues) closeUpvalues(frame + stmt->firstSlot);
   return Nil();
 }
 Value Interpreter::visitIfStmt(Stmt::If* stmt) {
@@ -199,7 +262,13 @@ Value Interpreter::visitIfStmt(Stmt::If* stmt) {
   return Nil();
 }
 Value Interpreter::visitLogical(Expr::Logical* expr) {
-  Value left = evaluate(expr->left);
+  if(expr->chain.empty()) return shortCircuit(expr, evaluate(expr->left));
+  Value value = evaluate(expr->chain.front()->left);
+  for(Expr::Logical* logical: expr->chain) value = shortCircuit(logical, value);
+  return value;
+}
+
+Value Interpreter::shortCircuit(Expr::Logical* expr, Value left) {
   if(expr->op.type == OR) {
     if(isTruthy(left)) return left;
   } else if(expr->op.type == AND) {
@@ -208,37 +277,96 @@ Value Interpreter::visitLogical(Expr::Logical* expr) {
   return evaluate(expr->right);
 }
 Value Interpreter::visitWhileStmt(Stmt::While* stmt) {
-  while(isTruthy(evaluate(stmt->condition))) {
-    try {
-      execute(stmt->body);
-    } catch(BreakLoop e) {
+  while(true) {
+    if(tracer) tracer->loopHeader(*stmt, frame, nativeStackLimit());
+    if(!isTruthy(evaluate(stmt->condition))) break;
+    Completion result = execute(stmt->body);
+    if(result == Completion::BREAK) {
+      completion = Completion::NORMAL;
       break;
     }
+    // a return keeps unwinding up to the function call
+    if(result != Completion::NORMAL) break;
   }
   return Nil();
 }
 Value Interpreter::visitBreakStmt(Stmt::Break* stmt) {
-  throw BreakLoop();
+  completion = Completion::BREAK;
+  return Nil();
 }
 Value Interpreter::visitCall(Expr::Call* expr) {
-  Value callee = evaluate(expr->callee);
+  // callee and arguments stay on the temporaries until the call is over
+  size_t base = temporaries.size();
+  LoxFunction* method = evaluateCall(expr);
+  return finishCall(base, method, expr->paren);
+}
 
-  std::vector<Value> args {};
+// Pushes the callee and the arguments onto the temporaries and checks
+// that they can be called. A method called on an object is found without
+// binding it, the object is pushed instead to end up in slot zero.
+LoxFunction* Interpreter::evaluateCall(Expr::Call* expr) {
+  size_t base = temporaries.size();
+  LoxFunction* method = nullptr;
+  if(expr->property) {
+    method = pushCallee(expr->property, evaluate(expr->property->object));
+  } else {
+    temporaries.push_back(evaluate(expr->callee));
+  }
   for(const auto& arg: expr->arguments) {
-    args.push_back(evaluate(arg));
+    temporaries.push_back(evaluate(arg));
+  }
+  checkCall(expr, temporaries[base], method);
+  return method;
+}
+
+LoxFunction* Interpreter::pushCallee(Expr::Get* get, Value object) {
+  if(!object.isInstance()) {
+    throw RuntimeError(get->name, "Only instances have properties.");
   }
+  PropertyCache::Entry entry = lookUpProperty(get, object.asInstance());
+  temporaries.push_back(entry.method ? object
+      : object.asInstance()->fieldAt(entry.slot));
+  return entry.method;
+}
 
-  if(auto func = std::get_if<std::shared_ptr<Callable>>(&callee.value)) {
-    if(*func) {
-      if((*func)->arity() != args.size()) {
-        throw RuntimeError(expr->paren, 
-            "Expected " + std::to_string((*func)->arity()) +
-            " arguments, but got " + std::to_string(args.size()) + " instead.");
-      }
-      return (*func)->call(this, args);
+void Interpreter::checkCall(Expr::Call* expr, Value callee,
+    LoxFunction* method) {
+  Callable* callable = method;
+  if(!callable) {
+    if(!callee.isCallable()) {
+      throw RuntimeError(expr->paren, "Can only call functions and classes");
     }
+    callable = callee.asCallable();
+  }
+  if(callable->arity() != expr->arguments.size()) {
+    throw RuntimeError(expr->paren, 
+        "Expected " + std::to_string(callable->arity()) +
+        " arguments, but got " + std::to_string(expr->arguments.size())
+        + " instead.");
   }
-  throw RuntimeError(expr->paren, "Can only call functions and classes");
+}
+
+// Functions get their arguments straight from the temporaries, only
+// natives and classes need them copied
+Value Interpreter::finishCall(size_t base, LoxFunction* method,
+    const Token& paren) {
+  Value callee = temporaries[base];
+  std::span<const Value> args(temporaries.data() + base + 1,
+      temporaries.size() - base - 1);
+  Value result;
+  if(method) {
+    result = invoke(method, &temporaries[base], args);
+  } else if(callee.asObj()->type == ObjType::FUNCTION) {
+    auto* function = static_cast<LoxFunction*>(callee.asCallable());
+    result = invoke(function, function->boundReceiver(), args);
+  } else try {
+    result = callee.asCallable()->call(this,
+        std::vector<Value>(args.begin(), args.end()));
+  } catch(const NativeError& error) {
+    throw RuntimeError(paren, error.what());
+  }
+  temporaries.resize(base);
+  return result;
 }
 
 Value Interpreter::visitFunctionStmt(Stmt::Function* stmt) {
@@ -246,101 +374,450 @@ Value Interpreter::visitFunctionStmt(Stmt::Function* stmt) {
   std::shared_ptr<Stmt::Function> fstmt =
     std::make_shared<Stmt::Function>(*stmt);
   // making callable lox function
-  std::shared_ptr<Callable> calfun =
-    std::make_shared<LoxFunction>(fstmt, environment);
+  Callable* calfun = heap().make<LoxFunction>(fstmt, captureUpvalues(*stmt));
   // creating value that holds that lox function
   Value valfun = Value(calfun);
   // defining function in environment
-  environment->define(stmt->name.lexeme, valfun);
+  define(stmt->slot, valfun);
   return Nil();
 }
 
 Value Interpreter::visitClassStmt(Stmt::Class* stmt) {
-  environment->define(stmt->name.lexeme, Nil());
+  define(stmt->slot, Nil());
+
+  // the class is stored before its methods are made so it is reachable
+  // while they are being allocated
+  LoxClass* klass = heap().make<LoxClass>(stmt->name.lexeme,
+      std::map<std::string, LoxFunction*>{}, heap());
+  assign(stmt->name, stmt->slot, klass);
 
-  std::map<std::string, FunPtr> methods;
   for(auto& method: stmt->methods) {
-    FunPtr function = std::make_shared<LoxFunction>(method, environment);
-    methods.insert({method->name.lexeme, function});
+    LoxFunction* function =
+      heap().make<LoxFunction>(method, captureUpvalues(*method), true);
+    klass->methods.insert({method->name.lexeme, function});
   }
-
-  std::shared_ptr<LoxClass> klass = 
-    std::make_shared<LoxClass>(stmt->name.lexeme, methods);
-  environment->assign(stmt->name, klass);
   return Nil();
 }
 
 Value Interpreter::visitGetExpr(Expr::Get* expr) {
-  Value value = evaluate(expr->object);
-  try {
-    std::shared_ptr<LoxInstance> classInstance = 
-      std::get<std::shared_ptr<LoxInstance>>(value.value);
-    return classInstance->get(expr->name);
-  } catch(const std::bad_variant_access& e) {
+  return getProperty(expr, evaluate(expr->object));
+}
+
+Value Interpreter::getProperty(Expr::Get* expr, Value value) {
+  TypeFeedback& feedback = expr->feedback;
+  if(feedback.state == TypeFeedback::FIELD) {
+    if(value.isInstance()
+        && value.asInstance()->getShape()->id == feedback.shapeId) {
+      feedback.hits++;
+      return value.asInstance()->fieldAt(feedback.slot);
+    }
+    feedback.misses++;
+  }
+
+  if(!value.isInstance()) {
     throw RuntimeError(expr->name, "Only instances have properties.");
   }
+  LoxInstance* instance = value.asInstance();
+  PropertyCache::Entry entry = lookUpProperty(expr, instance);
+
+  if(entry.slot >= 0) {
+    if(feedback.state != TypeFeedback::GENERIC) {
+      feedback.shapeId = entry.shapeId;
+      feedback.slot = entry.slot;
+      quicken(feedback, expr->name, "get .", TypeFeedback::FIELD);
+    }
+    return instance->fieldAt(entry.slot);
+  }
+  // methods are bound through the inline cache
+  quicken(feedback, expr->name, "get .", TypeFeedback::GENERIC);
+  // the method escapes, so it has to carry its receiver
+  temporaries.push_back(value);
+  Value bound = entry.method->bind(instance, heap());
+  temporaries.pop_back();
+  return bound;
+}
+
+PropertyCache::Entry Interpreter::lookUpProperty(Expr::Get* expr,
+    LoxInstance* instance) {
+  Shape* shape = instance->getShape();
+  if(auto cached = expr->cache.find(shape->id)) return *cached;
+
+  PropertyCache::Entry entry {
+    shape->id, shape->slotOf(expr->name.lexeme), nullptr, nullptr
+  };
+  if(entry.slot < 0) {
+    entry.method = shape->klass->findMethod(expr->name.lexeme);
+    if(!entry.method) {
+      throw RuntimeError(expr->name,
+          "Undefined property '" + expr->name.lexeme + "'.");
+    }
+  }
+  cacheMiss(expr->cache, expr->name, "get", entry);
+  return entry;
 }
 
 Value Interpreter::visitSetExpr(Expr::Set* expr) {
   Value object = evaluate(expr->object);
-  try {
-    std::shared_ptr<LoxInstance> classInstance = 
-      std::get<std::shared_ptr<LoxInstance>>(object.value);
-
-    Value value = evaluate(expr->value);
-    classInstance->set(expr->name, value);
-    return value;
-  } catch(const std::bad_variant_access& e) {
+  if(!object.isInstance()) {
     throw RuntimeError(expr->name, "Only instances have fields.");
   }
 
+  temporaries.push_back(object);
+  Value value = evaluate(expr->value);
+  temporaries.pop_back();
+  return setProperty(expr, object, value);
+}
+
+Value Interpreter::setProperty(Expr::Set* expr, Value object, Value value) {
+  // the shape is only looked at now, evaluating the value may have
+  // added fields
+  LoxInstance* instance = object.asInstance();
+  Shape* shape = instance->getShape();
+
+  PropertyCache::Entry entry;
+  if(auto cached = expr->cache.find(shape->id)) {
+    entry = *cached;
+  } else {
+    entry = { shape->id, shape->slotOf(expr->name.lexeme), nullptr, nullptr };
+    if(entry.slot < 0) {
+      entry.slot = shape->fieldCount;
+      entry.transition = shape->withField(expr->name.lexeme);
+    }
+    cacheMiss(expr->cache, expr->name, "set", entry);
+  }
+
+  if(entry.transition) {
+    instance->addField(entry.transition, value, heap());
+  } else {
+    instance->fieldAt(entry.slot) = value;
+  }
+  return value;
+}
+
+void Interpreter::cacheMiss(PropertyCache& cache, const Token& name,
+    const char* kind, const PropertyCache::Entry& entry) {
+  // every site that ran misses once, so this sees all of them
+  if(cache.misses == 1) cacheSites.push_back({ &cache, &name, kind });
+  if(cache.add(entry)) megamorphicSites++;
+}
+
+void Interpreter::printCacheStats(std::ostream& out) const {
+  size_t hits = 0, misses = 0;
+  for(const auto& site: cacheSites) {
+    const PropertyCache& cache = *site.cache;
+    out << "[ic] line " << site.name->line << " " << site.kind << " ."
+        << site.name->lexeme << ": " << cache.hits << " hits, "
+        << cache.misses << " misses, ";
+    if(cache.isMegamorphic()) {
+      out << "megamorphic\n";
+    } else if(cache.size() > 1) {
+      out << "polymorphic (" << cache.size() << " shapes)\n";
+    } else {
+      out << "monomorphic\n";
+    }
+    hits += cache.hits;
+    misses += cache.misses;
+  }
+  out << "[ic] total: " << hits << " hits, " << misses << " misses, "
+      << megamorphicSites << " megamorphic sites\n";
+}
+
+void Interpreter::quicken(TypeFeedback& feedback, const Token& token,
+    const char* kind, TypeFeedback::State state) {
+  if(feedback.state == TypeFeedback::GENERIC) return;
+  if(feedback.state == TypeFeedback::UNINITIALIZED) {
+    quickenedSites.push_back({ &feedback, &token, kind });
+  }
+  feedback.quicken(state);
+}
+
+void Interpreter::printQuickening(std::ostream& out) const {
+  size_t hits = 0, misses = 0, generic = 0;
+  for(const auto& site: quickenedSites) {
+    const TypeFeedback& feedback = *site.feedback;
+    out << "[quicken] line " << site.token->line << " " << site.kind
+        << site.token->lexeme << ": "
+        << TypeFeedback::nameOf(feedback.state) << ", " << feedback.hits
+        << " hits, " << feedback.misses << " misses, quickened "
+        << feedback.quickenings << " times\n";
+    hits += feedback.hits;
+    misses += feedback.misses;
+    if(feedback.state == TypeFeedback::GENERIC) generic++;
+  }
+  out << "[quicken] total: " << quickenedSites.size() << " sites, " << hits
+      << " hits, " << misses << " misses, " << generic << " generic\n";
+}
+
+void Interpreter::printJitStats(std::ostream& out) const {
+  if(jit) jit->printStats(out);
+}
+
+void Interpreter::printTraceStats(std::ostream& out) const {
+  if(tracer) tracer->printStats(out);
+}
+
+uintptr_t Interpreter::nativeStackLimit() const {
+  return nativeStackBase - nativeStackBudget;
 }
 
 Value Interpreter::visitThisExpr(Expr::This* expr) {
-  return lookUpVariable(expr->keyword, expr);
+  return lookUpVariable(expr->keyword, expr->slot);
 }
 
 Value Interpreter::visitReturnStmt(Stmt::Return* stmt) {
+  if(stmt->tailCall) {
+    size_t base = temporaries.size();
+    auto* call = static_cast<Expr::Call*>(stmt->value.get());
+    LoxFunction* method = evaluateCall(call);
+    completion = saveTailCall(base, method, call->paren);
+    return Nil();
+  }
+
   Value value = Nil();
   if(stmt->value) value = evaluate(stmt->value); 
-  throw Return(value);
+  returnValue = std::move(value);
+  completion = Completion::RETURN;
+  return Nil();
+}
+
+// takes the call evaluateCall pushed off the temporaries
+Completion Interpreter::saveTailCall(size_t base, LoxFunction* method,
+    const Token& paren) {
+  tailCall.callee = method ? Value(method) : temporaries[base];
+  tailCall.paren = &paren;
+  tailCall.receiver = method ? temporaries[base] : Value();
+  tailCall.args.assign(temporaries.begin() + base + 1, temporaries.end());
+  temporaries.resize(base);
+  return Completion::TAIL_CALL;
 }
 
 Interpreter::Interpreter(Lox& lox) 
-  : globals { std::make_shared<Environment>() }, lox { lox }
+  : stack(STACK_MAX), frame { stack.data() }, stackTop { stack.data() },
+    lox { lox }
 {
-  std::shared_ptr<Native::Clock> clock = std::make_shared<Native::Clock>();
-  globals->define("clock", clock);
-  environment = globals;
+  nativeStackBudget = lox.nativeStackBudget();
+  heap().addRoots(this);
+  globals.define(globals.slotFor("clock"), heap().make<Native::Clock>());
+  globals.define(globals.slotFor("memoize"),
+      heap().make<Native::Memoize>(heap(), lox.memoCapacity, lox.memoized));
+#if defined(__x86_64__)
+  if(lox.jit) jit = std::make_unique<Jit>(globals, lox.jitThreshold);
+  if(lox.jit && lox.trace) {
+    tracer = std::make_unique<Tracer>(globals, jit.get(), lox.traceThreshold);
+  }
+#endif
+}
+
+Interpreter::~Interpreter() {
+  heap().removeRoots(this);
+}
+
+void Interpreter::markRoots(Heap& heap) {
+  for(Value* slot = stack.data(); slot < stackTop; slot++) {
+    heap.markValue(*slot);
+  }
+  heap.markObject(closure);
+  for(ObjUpvalue* upvalue: openUpvalues) heap.markObject(upvalue);
+  for(const Value& value: temporaries) heap.markValue(value);
+  heap.markValue(returnValue);
+  heap.markValue(tailCall.callee);
+  heap.markValue(tailCall.receiver);
+  for(const Value& value: tailCall.args) heap.markValue(value);
+  globals.mark(heap);
+  if(jit) jit->markRoots(heap);
+  if(tracer) tracer->markRoots(heap);
 }
 
-Value Interpreter::lookUpVariable(Token name, Expr::Expr* expr) {
-  if(locals.contains(expr)) {
-    return environment->getAt(locals[expr], name.lexeme);
+Heap& Interpreter::heap() {
+  return lox.heap;
+}
+
+Value Interpreter::lookUpVariable(const Token& name,
+    const Expr::VarSlot& slot) {
+  switch(slot.kind) {
+    case Expr::VarSlot::LOCAL: return frame[slot.slot];
+    case Expr::VarSlot::UPVALUE: return *closure->upvalues[slot.slot]->location;
+    default: return globals.get(slot.slot, name);
+  }
+}
+
+void Interpreter::assign(const Token& name, const Expr::VarSlot& slot,
+    Value value) {
+  switch(slot.kind) {
+    case Expr::VarSlot::LOCAL: frame[slot.slot] = value; break;
+    case Expr::VarSlot::UPVALUE:
+      *closure->upvalues[slot.slot]->location = value;
+      break;
+    default: globals.assign(slot.slot, name, value);
+  }
+}
+
+void Interpreter::define(const Expr::VarSlot& slot, Value value) {
+  if(slot.isGlobal()) {
+    globals.define(slot.slot, value);
   } else {
-    //std::cout << "looking in global\n"; 
-    return globals->get(name);
+    frame[slot.slot] = value;
+  }
+}
+
+ObjUpvalue* Interpreter::captureUpvalue(Value* local) {
+  for(auto it = openUpvalues.rbegin(); it != openUpvalues.rend(); it++) {
+    if((*it)->location == local) return *it;
+    if((*it)->location < local) break;
+  }
+  ObjUpvalue* upvalue = heap().make<ObjUpvalue>(local);
+  auto pos = openUpvalues.end();
+  while(pos != openUpvalues.begin() && (*(pos - 1))->location > local) pos--;
+  openUpvalues.insert(pos, upvalue);
+  return upvalue;
+}
+
+void Interpreter::closeUpvalues(Value* last) {
+  while(!openUpvalues.empty() && openUpvalues.back()->location >= last) {
+    ObjUpvalue* upvalue = openUpvalues.back();
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    openUpvalues.pop_back();
+  }
+}
+
+std::vector<ObjUpvalue*> Interpreter::captureUpvalues(
+    const Stmt::Function& declaration) {
+  // fresh upvalues are in openUpvalues and the others belong to the
+  // running closure, so all of them stay reachable
+  std::vector<ObjUpvalue*> upvalues;
+  upvalues.reserve(declaration.upvalues.size());
+  for(const auto& upvalue: declaration.upvalues) {
+    if(upvalue.isLocal) {
+      upvalues.push_back(captureUpvalue(frame + upvalue.index));
+    } else {
+      upvalues.push_back(closure->upvalues[upvalue.index]);
+    }
+  }
+  return upvalues;
+}
+
+Value Interpreter::invoke(LoxFunction* function, const Value* receiver,
+    std::span<const Value> args) {
+  // every nested call takes native stack, which grows down
+  uintptr_t native = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if(nativeStackBase - native > nativeStackBudget) {
+    throw RuntimeError(function->getDeclaration().name, "Stack overflow.");
   }
+  if(jit && !receiver) {
+    Value result;
+    if(jit->call(function, args, nativeStackLimit(), result)) {
+      return result;
+    }
+  }
+
+  Value* base = stackTop;
+  Value* callerFrame = frame;
+  LoxFunction* caller = closure;
+  enterFrame(function, receiver, args, base);
+
+  // A call in tail position unwinds to here and runs in the same frame,
+  // so tail recursion grows neither the frames nor the native stack
+  Completion result;
+  while((result = runBody(closure->getDeclaration()))
+      == Completion::TAIL_CALL) {
+    completion = Completion::NORMAL;
+    closeUpvalues(base);
+    TailCall call = std::move(tailCall);
+    tailCall = {};
+    if(call.callee.asObj()->type != ObjType::FUNCTION) {
+      // natives and classes don't need a frame
+      frame = callerFrame;
+      stackTop = base;
+      closure = caller;
+      temporaries.push_back(call.callee);
+      Value value;
+      try {
+        value = call.callee.asCallable()->call(this, call.args);
+      } catch(const NativeError& error) {
+        throw RuntimeError(*call.paren, error.what());
+      }
+      temporaries.pop_back();
+      return value;
+    }
+    auto* next = static_cast<LoxFunction*>(call.callee.asCallable());
+    enterFrame(next, call.receiver.isNil() ? next->boundReceiver()
+        : &call.receiver, call.args, base);
+  }
+  closeUpvalues(base);
+
+  frame = callerFrame;
+  stackTop = base;
+  closure = caller;
+  if(result == Completion::RETURN) return takeReturnValue();
+  return Nil();
+}
+
+// the receiver and arguments take the first slots, the rest is cleared so
+// the collector never sees stale values there
+void Interpreter::enterFrame(LoxFunction* function, const Value* receiver,
+    std::span<const Value> args, Value* base) {
+  const Stmt::Function& declaration = function->getDeclaration();
+  if(base + declaration.slotCount > stack.data() + stack.size()) {
+    throw RuntimeError(declaration.name, "Stack overflow.");
+  }
+
+  Value* slot = base;
+  if(receiver) *slot++ = *receiver;
+  for(const Value& arg: args) *slot++ = arg;
+  std::fill(slot, base + declaration.slotCount, Value());
+  frame = base;
+  stackTop = base + declaration.slotCount;
+  closure = function;
+}
+
+// compiled into closures under --closures, walked otherwise
+Completion Interpreter::runBody(const Stmt::Function& declaration) {
+  if(declaration.compiled) return declaration.compiled->run(*this);
+  return executeBlock(declaration.body);
 }
 
 Value Interpreter::evaluate(const ExprPtr& expr) {
   return expr->accept(this);
 }
 
-void Interpreter::execute(const StmtPtr& stmt) {
+Completion Interpreter::execute(const StmtPtr& stmt) {
   stmt->accept(this);
+  return completion;
 }
 
-void Interpreter::resolve(Expr::Expr* expr, int depth) {
-  locals.insert({expr, depth});
+Value Interpreter::takeReturnValue() {
+  completion = Completion::NORMAL;
+  return std::move(returnValue);
 }
 
-void Interpreter::interpret(const Stmts& program) {
+void Interpreter::interpret(const Stmts& program, int slotCount) {
+  nativeStackBase = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  stackTop = frame + slotCount;
   try {
     for(const auto& stmt: program) {
       execute(stmt);
     }
   } catch(RuntimeError error) {
-    lox.runtimeError(error); 
+    recover(error, slotCount);
   }
 }
+
+void Interpreter::interpret(const Closures::Body& program, int slotCount) {
+  nativeStackBase = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  stackTop = frame + slotCount;
+  try {
+    program.run(*this);
+  } catch(RuntimeError error) {
+    recover(error, slotCount);
+  }
+}
+
+void Interpreter::recover(const RuntimeError& error, int slotCount) {
+  lox.runtimeError(error); 
+  temporaries.clear();
+  openUpvalues.clear();
+  frame = stack.data();
+  stackTop = frame + slotCount;
+  closure = nullptr;
+}
@@ -0,0 +1,563 @@
+#include "../include/IrBuilder.hpp"
+#include "../include/AstRewriter.hpp"
+#include "../include/IrInterpreter.hpp"
+
+namespace {
+
+// Slots of the function being scanned that functions declared in it
+// capture. Their own nested functions capture through them, so the scan
+// doesn't look inside.
+class CaptureScan : public AstRewriter {
+  void capture(const Stmt::Function& function) {
+    for(const auto& upvalue: function.upvalues) {
+      if(upvalue.isLocal) slots.insert(upvalue.index);
+    }
+  }
+
+public:
+  std::set<int> slots;
+
+  Value visitFunctionStmt(Stmt::Function* stmt) override {
+    capture(*stmt);
+    return Nil();
+  }
+
+  Value visitClassStmt(Stmt::Class* stmt) override {
+    for(const auto& method: stmt->methods) capture(*method);
+    return Nil();
+  }
+};
+
+std::set<int> capturedSlots(Stmt::Stmts& body) {
+  CaptureScan scan;
+  scan.rewrite(body);
+  return scan.slots;
+}
+
+IR::Op binaryOp(TokenType type) {
+  switch(type) {
+    case PLUS: return IR::Op::ADD;
+    case MINUS: return IR::Op::SUBTRACT;
+    case STAR: return IR::Op::MULTIPLY;
+    case SLASH: return IR::Op::DIVIDE;
+    case EQUAL_EQUAL: return IR::Op::EQUAL;
+    case BANG_EQUAL: return IR::Op::NOT_EQUAL;
+    case GREATER: return IR::Op::GREATER;
+    case GREATER_EQUAL: return IR::Op::GREATER_EQUAL;
+    case LESS: return IR::Op::LESS;
+    case AMPERSAND: return IR::Op::BIT_AND;
+    case PIPE: return IR::Op::BIT_OR;
+    case CARET: return IR::Op::BIT_XOR;
+    case LESS_LESS: return IR::Op::SHIFT_LEFT;
+    case GREATER_GREATER: return IR::Op::SHIFT_RIGHT;
+    default: return IR::Op::LESS_EQUAL;
+  }
+}
+
+IR::Op unaryOp(TokenType type) {
+  switch(type) {
+    case BANG: return IR::Op::NOT;
+    case MINUS: return IR::Op::NEGATE;
+    case PLUSPLUS: return IR::Op::INCREMENT;
+    case TILDE: return IR::Op::BIT_NOT;
+    default: return IR::Op::DECREMENT;
+  }
+}
+
+}
+
+IrBuilder::IrBuilder(IrInterpreter& interpreter) : interpreter { interpreter } {}
+
+void IrBuilder::lower(Stmt::Stmts& program, IR::Module& module) {
+  this->module = &module;
+  IR::Function* script = module.newFunction("script");
+  functions.push_back({ script });
+  current().cells = capturedSlots(program);
+  IR::Block* entry = newBlock();
+  seal(entry);
+  startBlock(entry);
+
+  lower(program);
+  emit(IR::Op::RETURN, here(), { constant(Nil()) });
+  functions.pop_back();
+
+  for(const auto& function: module.functions) function->renumber();
+}
+
+Token IrBuilder::here() const {
+  return Token(NIL, "", line);
+}
+
+IR::Instr* IrBuilder::emit(IR::Op op, const Token& token,
+    std::vector<IR::Instr*> operands) {
+  IR::Block* block = current().block;
+  block->instrs.push_back(std::make_unique<IR::Instr>(op, block, token));
+  IR::Instr* instr = block->instrs.back().get();
+  instr->operands = std::move(operands);
+  return instr;
+}
+
+IR::Instr* IrBuilder::constant(Value value) {
+  IR::Instr* instr = emit(IR::Op::CONST, here());
+  instr->constant = value;
+  return instr;
+}
+
+IR::Instr* IrBuilder::newPhi(IR::Block* block) {
+  auto position = block->instrs.begin() + block->phiCount();
+  auto phi = block->instrs.insert(position,
+      std::make_unique<IR::Instr>(IR::Op::PHI, block, here()));
+  return phi->get();
+}
+
+IR::Block* IrBuilder::newBlock() {
+  return current().function->newBlock();
+}
+
+void IrBuilder::startBlock(IR::Block* block) {
+  current().block = block;
+}
+
+void IrBuilder::startUnreachable() {
+  IR::Block* block = newBlock();
+  seal(block);
+  startBlock(block);
+}
+
+void IrBuilder::jump(IR::Block* target) {
+  IR::Instr* instr = emit(IR::Op::JUMP, here());
+  instr->targets[0] = target;
+  target->preds.push_back(current().block);
+}
+
+void IrBuilder::branch(IR::Instr* condition, IR::Block* whenTrue,
+    IR::Block* whenFalse) {
+  IR::Instr* instr = emit(IR::Op::BRANCH, here(), { condition });
+  instr->targets[0] = whenTrue;
+  instr->targets[1] = whenFalse;
+  whenTrue->preds.push_back(current().block);
+  whenFalse->preds.push_back(current().block);
+}
+
+void IrBuilder::seal(IR::Block* block) {
+  FunctionState& state = current();
+  // every predecessor is known now, finish the phis made before
+  auto incomplete = state.incompletePhis.find(block);
+  if(incomplete != state.incompletePhis.end()) {
+    for(const auto& [slot, phi]: incomplete->second) {
+      state.unfilledPhis.push_back({ slot, phi });
+    }
+    fillPhis();
+    state.incompletePhis.erase(incomplete);
+  }
+  state.sealed.insert(block);
+}
+
+void IrBuilder::writeVariable(int slot, IR::Block* block, IR::Instr* value) {
+  current().definitions[block][slot] = value;
+}
+
+IR::Instr* IrBuilder::readVariable(int slot, IR::Block* block) {
+  IR::Instr* value = lookUp(slot, block);
+  fillPhis();
+  return value;
+}
+
+// Looks through blocks with a single predecessor in a loop, and the phis
+// it makes wait in unfilledPhis for their operands. Recursing instead
+// would go as deep as there are blocks between a read and the write it
+// finds, a long chain of `or` makes that many.
+IR::Instr* IrBuilder::lookUp(int slot, IR::Block* block) {
+  FunctionState& state = current();
+  std::vector<IR::Block*> passed;
+  IR::Instr* value;
+  while(true) {
+    auto& definitions = state.definitions[block];
+    auto known = definitions.find(slot);
+    if(known != definitions.end()) {
+      value = known->second;
+      break;
+    }
+    if(!state.sealed.contains(block)) {
+      value = newPhi(block);
+      state.incompletePhis[block][slot] = value;
+    } else if(block->preds.size() == 1) {
+      passed.push_back(block);
+      block = block->preds[0];
+      continue;
+    } else if(block->preds.empty()) {
+      // only unreachable code gets here
+      auto position = block->instrs.begin() + block->phiCount();
+      value = block->instrs.insert(position,
+          std::make_unique<IR::Instr>(IR::Op::CONST, block, here()))->get();
+    } else {
+      // written before its operands are read, so a loop back to this
+      // block finds the phi
+      value = newPhi(block);
+      state.unfilledPhis.push_back({ slot, value });
+    }
+    writeVariable(slot, block, value);
+    break;
+  }
+  for(IR::Block* on: passed) writeVariable(slot, on, value);
+  return value;
+}
+
+void IrBuilder::fillPhis() {
+  FunctionState& state = current();
+  while(!state.unfilledPhis.empty()) {
+    auto [slot, phi] = state.unfilledPhis.back();
+    state.unfilledPhis.pop_back();
+    for(IR::Block* pred: phi->block->preds) {
+      phi->operands.push_back(lookUp(slot, pred));
+    }
+  }
+}
+
+void IrBuilder::defineLocal(int slot, IR::Instr* value) {
+  if(current().cells.contains(slot)) {
+    value = emit(IR::Op::NEW_CELL, here(), { value });
+  }
+  writeVariable(slot, current().block, value);
+}
+
+IR::Instr* IrBuilder::read(const Expr::VarSlot& slot, const Token& name) {
+  line = name.line;
+  switch(slot.kind) {
+    case Expr::VarSlot::LOCAL: {
+      IR::Instr* value = readVariable(slot.slot, current().block);
+      if(!current().cells.contains(slot.slot)) return value;
+      return emit(IR::Op::LOAD_CELL, name, { value });
+    }
+    case Expr::VarSlot::UPVALUE: {
+      IR::Instr* cell = emit(IR::Op::UPVALUE_CELL, name);
+      cell->index = slot.slot;
+      return emit(IR::Op::LOAD_CELL, name, { cell });
+    }
+    default: {
+      IR::Instr* global = emit(IR::Op::GET_GLOBAL, name);
+      global->index = interpreter.globalSlot(name.lexeme);
+      return global;
+    }
+  }
+}
+
+void IrBuilder::assign(const Expr::VarSlot& slot, const Token& name,
+    IR::Instr* value) {
+  line = name.line;
+  switch(slot.kind) {
+    case Expr::VarSlot::LOCAL:
+      if(current().cells.contains(slot.slot)) {
+        IR::Instr* cell = readVariable(slot.slot, current().block);
+        emit(IR::Op::STORE_CELL, name, { cell, value });
+      } else {
+        writeVariable(slot.slot, current().block, value);
+      }
+      break;
+    case Expr::VarSlot::UPVALUE: {
+      IR::Instr* cell = emit(IR::Op::UPVALUE_CELL, name);
+      cell->index = slot.slot;
+      emit(IR::Op::STORE_CELL, name, { cell, value });
+      break;
+    }
+    default: {
+      IR::Instr* global = emit(IR::Op::SET_GLOBAL, name, { value });
+      global->index = interpreter.globalSlot(name.lexeme);
+    }
+  }
+}
+
+void IrBuilder::define(const Expr::VarSlot& slot, const Token& name,
+    IR::Instr* value) {
+  if(slot.isGlobal()) {
+    IR::Instr* global = emit(IR::Op::DEFINE_GLOBAL, name, { value });
+    global->index = interpreter.globalSlot(name.lexeme);
+  } else {
+    defineLocal(slot.slot, value);
+  }
+}
+
+IR::Instr* IrBuilder::declareCell(const Expr::VarSlot& slot) {
+  if(slot.isGlobal() || !current().cells.contains(slot.slot)) return nullptr;
+  IR::Instr* cell = emit(IR::Op::NEW_CELL, here(), { constant(Nil()) });
+  writeVariable(slot.slot, current().block, cell);
+  return cell;
+}
+
+IR::Function* IrBuilder::lowerFunction(Stmt::Function* stmt, bool isMethod) {
+  IR::Function* function = module->newFunction(stmt->name.lexeme);
+  function->arity = stmt->args.size();
+  function->isMethod = isMethod;
+  function->upvalueCount = stmt->upvalues.size();
+
+  int outerLine = line;
+  functions.push_back({ function });
+  current().cells = capturedSlots(stmt->body);
+  IR::Block* entry = newBlock();
+  seal(entry);
+  startBlock(entry);
+
+  // parameters take the first slots, after the receiver of a method
+  line = stmt->name.line;
+  for(int i = 0; i < function->paramCount(); i++) {
+    IR::Instr* param = emit(IR::Op::PARAM, here());
+    param->index = i;
+    defineLocal(i, param);
+  }
+  lower(stmt->body);
+  emit(IR::Op::RETURN, here(), { constant(Nil()) });
+
+  functions.pop_back();
+  line = outerLine;
+  return function;
+}
+
+IR::Instr* IrBuilder::makeClosure(Stmt::Function* stmt, bool isMethod) {
+  IR::Function* function = lowerFunction(stmt, isMethod);
+  std::vector<IR::Instr*> cells;
+  for(const auto& upvalue: stmt->upvalues) {
+    if(upvalue.isLocal) {
+      cells.push_back(readVariable(upvalue.index, current().block));
+    } else {
+      IR::Instr* cell = emit(IR::Op::UPVALUE_CELL, stmt->name);
+      cell->index = upvalue.index;
+      cells.push_back(cell);
+    }
+  }
+  IR::Instr* closure = emit(IR::Op::CLOSURE, stmt->name, cells);
+  closure->function = function;
+  return closure;
+}
+
+IR::Instr* IrBuilder::lower(const Expr::ExprPtr& expr) {
+  expr->accept(this);
+  return result;
+}
+
+void IrBuilder::lower(const Stmt::Stmts& statements) {
+  for(const auto& stmt: statements) stmt->accept(this);
+}
+
+Value IrBuilder::visitBinop(Expr::Binop* expr) {
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  IR::Instr* left = lower(chain.front()->left);
+  for(Expr::Binop* binop: chain) {
+    IR::Instr* right = lower(binop->right);
+    line = binop->op.line;
+    left = emit(binaryOp(binop->op.type), binop->op, { left, right });
+  }
+  result = left;
+  return Nil();
+}
+
+Value IrBuilder::visitUnop(Expr::Unop* expr) {
+  IR::Instr* operand = lower(expr->expr);
+  line = expr->op.line;
+  result = emit(unaryOp(expr->op.type), expr->op, { operand });
+  return Nil();
+}
+
+Value IrBuilder::visitGrouping(Expr::Grouping* expr) {
+  lower(expr->expr);
+  return Nil();
+}
+
+Value IrBuilder::visitLiteralExpr(Expr::Literal* expr) {
+  result = constant(expr->value->value);
+  return Nil();
+}
+
+Value IrBuilder::visitExprStmt(Stmt::Expr* exprstmt) {
+  lower(exprstmt->expr);
+  return Nil();
+}
+
+Value IrBuilder::visitPrintStmt(Stmt::Print* varstmt) {
+  emit(IR::Op::PRINT, here(), { lower(varstmt->expr) });
+  return Nil();
+}
+
+Value IrBuilder::visitVarStmt(Stmt::Var* stmt) {
+  IR::Instr* value = stmt->initializer
+    ? lower(stmt->initializer) : constant(Nil());
+  define(stmt->slot, stmt->name, value);
+  return Nil();
+}
+
+Value IrBuilder::visitVariableExpr(Expr::Variable* var) {
+  result = read(var->slot, var->name);
+  return Nil();
+}
+
+Value IrBuilder::visitAssign(Expr::Assign* expr) {
+  IR::Instr* value = lower(expr->value);
+  assign(expr->slot, expr->name, value);
+  result = value;
+  return Nil();
+}
+
+Value IrBuilder::visitBlockStmt(Stmt::Block* stmt) {
+  lower(stmt->statements);
+  return Nil();
+}
+
+Value IrBuilder::visitIfStmt(Stmt::If* stmt) {
+  line = stmt->line;
+  IR::Instr* condition = lower(stmt->condition);
+  IR::Block* thenBlock = newBlock();
+  IR::Block* elseBlock = stmt->elseBranch ? newBlock() : nullptr;
+  IR::Block* merge = newBlock();
+  branch(condition, thenBlock, elseBlock ? elseBlock : merge);
+
+  seal(thenBlock);
+  startBlock(thenBlock);
+  stmt->thenBranch->accept(this);
+  jump(merge);
+
+  if(elseBlock) {
+    seal(elseBlock);
+    startBlock(elseBlock);
+    stmt->elseBranch->accept(this);
+    jump(merge);
+  }
+  seal(merge);
+  startBlock(merge);
+  return Nil();
+}
+
+Value IrBuilder::visitLogical(Expr::Logical* expr) {
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  IR::Instr* left = lower(chain.front()->left);
+  for(Expr::Logical* logical: chain) {
+    line = logical->op.line;
+    IR::Block* rightBlock = newBlock();
+    IR::Block* merge = newBlock();
+    if(logical->op.type == OR) {
+      branch(left, merge, rightBlock);
+    } else {
+      branch(left, rightBlock, merge);
+    }
+
+    seal(rightBlock);
+    startBlock(rightBlock);
+    IR::Instr* right = lower(logical->right);
+    jump(merge);
+
+    seal(merge);
+    startBlock(merge);
+    // the left operand's block is the first predecessor
+    IR::Instr* phi = newPhi(merge);
+    phi->operands = { left, right };
+    left = phi;
+  }
+  result = left;
+  return Nil();
+}
+
+Value IrBuilder::visitWhileStmt(Stmt::While* stmt) {
+  line = stmt->line;
+  IR::Block* header = newBlock();
+  jump(header);
+  // the back edge isn't there yet
+  startBlock(header);
+  IR::Instr* condition = lower(stmt->condition);
+  IR::Block* body = newBlock();
+  IR::Block* exit = newBlock();
+  branch(condition, body, exit);
+
+  seal(body);
+  startBlock(body);
+  current().loopExits.push_back(exit);
+  stmt->body->accept(this);
+  current().loopExits.pop_back();
+  jump(header);
+
+  seal(header);
+  seal(exit);
+  startBlock(exit);
+  return Nil();
+}
+
+Value IrBuilder::visitBreakStmt(Stmt::Break* stmt) {
+  line = stmt->keyword.line;
+  jump(current().loopExits.back());
+  startUnreachable();
+  return Nil();
+}
+
+Value IrBuilder::visitClassStmt(Stmt::Class* stmt) {
+  line = stmt->name.line;
+  // methods may capture the class
+  IR::Instr* cell = declareCell(stmt->slot);
+  std::vector<IR::Instr*> methods;
+  for(const auto& method: stmt->methods) {
+    methods.push_back(makeClosure(method.get(), true));
+  }
+  IR::Instr* klass = emit(IR::Op::CLASS, stmt->name, methods);
+  if(cell) {
+    emit(IR::Op::STORE_CELL, stmt->name, { cell, klass });
+  } else {
+    define(stmt->slot, stmt->name, klass);
+  }
+  return Nil();
+}
+
+Value IrBuilder::visitCall(Expr::Call* expr) {
+  std::vector<IR::Instr*> operands;
+  IR::Op op = IR::Op::CALL;
+  Token token = expr->paren;
+  if(expr->property) {
+    operands.push_back(lower(expr->property->object));
+    op = IR::Op::INVOKE;
+    token = expr->property->name;
+  } else {
+    operands.push_back(lower(expr->callee));
+  }
+  for(const auto& arg: expr->arguments) operands.push_back(lower(arg));
+  line = expr->paren.line;
+  token.line = line;
+  result = emit(op, token, operands);
+  return Nil();
+}
+
+Value IrBuilder::visitFunctionStmt(Stmt::Function* stmt) {
+  line = stmt->name.line;
+  // a recursive function captures its own variable
+  IR::Instr* cell = declareCell(stmt->slot);
+  IR::Instr* closure = makeClosure(stmt, false);
+  if(cell) {
+    emit(IR::Op::STORE_CELL, stmt->name, { cell, closure });
+  } else {
+    define(stmt->slot, stmt->name, closure);
+  }
+  return Nil();
+}
+
+Value IrBuilder::visitReturnStmt(Stmt::Return* stmt) {
+  line = stmt->keyword.line;
+  IR::Instr* value = stmt->value ? lower(stmt->value) : constant(Nil());
+  emit(IR::Op::RETURN, stmt->keyword, { value });
+  startUnreachable();
+  return Nil();
+}
+
+Value IrBuilder::visitGetExpr(Expr::Get* expr) {
+  IR::Instr* object = lower(expr->object);
+  line = expr->name.line;
+  result = emit(IR::Op::GET_PROPERTY, expr->name, { object });
+  return Nil();
+}
+
+Value IrBuilder::visitSetExpr(Expr::Set* expr) {
+  IR::Instr* object = lower(expr->object);
+  IR::Instr* value = lower(expr->value);
+  line = expr->name.line;
+  emit(IR::Op::SET_PROPERTY, expr->name, { object, value });
+  result = value;
+  return Nil();
+}
+
+Value IrBuilder::visitThisExpr(Expr::This* expr) {
+  result = read(expr->slot, expr->keyword);
+  return Nil();
+}
@@ -0,0 +1,437 @@
+#include "../include/IrInterpreter.hpp"
+#include "../include/LoxInstance.hpp"
+#include "../include/NativeFunctions.hpp"
+#include "../include/Numbers.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+IrClosure::IrClosure(IR::Function* function, IrInterpreter* interpreter)
+  : Callable(ObjType::IR_CLOSURE), function { function },
+    interpreter { interpreter }
+{
+  cells.reserve(function->upvalueCount);
+}
+
+void IrClosure::trace(Heap& heap) {
+  for(ObjUpvalue* cell: cells) heap.markObject(cell);
+}
+
+std::string IrClosure::toString() { return "fun type"; }
+
+std::string IrClosure::label() { return function->name; }
+
+int IrClosure::arity() { return function->arity; }
+
+Value IrClosure::call(Interpreter* interpreter, std::vector<Value> args) {
+  return this->interpreter->callFromHost(Value(this), args);
+}
+
+IrBoundMethod::IrBoundMethod(const Value& receiver, IrClosure* method)
+  : Callable(ObjType::IR_BOUND_METHOD), receiver { receiver },
+    method { method } {}
+
+void IrBoundMethod::trace(Heap& heap) {
+  heap.markValue(receiver);
+  heap.markObject(method);
+}
+
+std::string IrBoundMethod::toString() { return "fun type"; }
+
+std::string IrBoundMethod::label() { return method->label(); }
+
+int IrBoundMethod::arity() { return method->arity(); }
+
+Value IrBoundMethod::call(Interpreter* interpreter, std::vector<Value> args) {
+  return method->interpreter->callFromHost(Value(this), args);
+}
+
+IrClass::IrClass(const std::string& name, Heap& heap)
+  : LoxClass(name, {}, heap) {}
+
+void IrClass::trace(Heap& heap) {
+  LoxClass::trace(heap);
+  for(auto& [name, method]: irMethods) heap.markObject(method);
+}
+
+IrClosure* IrClass::findIrMethod(const std::string& name) {
+  auto it = irMethods.find(name);
+  if(it == irMethods.end()) return nullptr;
+  return it->second;
+}
+
+
+IrInterpreter::IrInterpreter(Lox& lox) : lox { lox }, stack(INITIAL_SLOTS) {
+  stackTop = stack.data();
+  frames.reserve(INITIAL_FRAMES);
+  nativeStackBudget = lox.nativeStackBudget();
+  lox.heap.addRoots(this);
+  globals.define(globals.slotFor("clock"), lox.heap.make<Native::Clock>());
+  globals.define(globals.slotFor("memoize"), lox.heap.make<Native::Memoize>(
+      lox.heap, lox.memoCapacity, lox.memoized));
+}
+
+IrInterpreter::~IrInterpreter() {
+  lox.heap.removeRoots(this);
+}
+
+void IrInterpreter::markRoots(Heap& heap) {
+  for(Value* slot = stack.data(); slot < stackTop; slot++) {
+    heap.markValue(*slot);
+  }
+  for(IrClosure* closure: frames) heap.markObject(closure);
+  globals.mark(heap);
+}
+
+int IrInterpreter::globalSlot(const std::string& name) {
+  return globals.slotFor(name);
+}
+
+void IrInterpreter::checkArity(int expected, int argCount,
+    const Token& token) {
+  if(expected != argCount) {
+    throw RuntimeError(token, "Expected " + std::to_string(expected) +
+        " arguments, but got " + std::to_string(argCount) + " instead.");
+  }
+}
+
+// the arguments are right above stackTop, past a slot left free for the
+// receiver of a method
+Value IrInterpreter::callValue(const Value& callee, int argCount,
+    const Token& token) {
+  if(!callee.isCallable()) {
+    throw RuntimeError(token, "Can only call functions and classes");
+  }
+  Callable* fn = callee.asCallable();
+
+  if(fn->type == ObjType::IR_CLOSURE) {
+    return callClosure(static_cast<IrClosure*>(fn), false, argCount, token);
+  }
+  if(fn->type == ObjType::IR_BOUND_METHOD) {
+    auto bound = static_cast<IrBoundMethod*>(fn);
+    *stackTop = bound->receiver;
+    return callClosure(bound->method, true, argCount, token);
+  }
+
+  // classes and natives
+  checkArity(fn->arity(), argCount, token);
+  std::vector<Value> args(stackTop + 1, stackTop + 1 + argCount);
+  const Token* caller = nativeCaller;
+  nativeCaller = &token;
+  Value result;
+  try {
+    result = fn->call(nullptr, std::move(args));
+  } catch(const NativeError& error) {
+    throw RuntimeError(token, error.what());
+  }
+  nativeCaller = caller;
+  return result;
+}
+
+Value IrInterpreter::callClosure(IrClosure* closure, bool withReceiver,
+    int argCount, const Token& token) {
+  IR::Function* function = closure->function;
+  checkArity(function->arity, argCount, token);
+  uintptr_t native = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if(nativeStackBase - native > nativeStackBudget) {
+    throw RuntimeError(token, "Stack overflow.");
+  }
+  if(frames.size() == frames.capacity()) growFrames(token);
+  size_t receiver = withReceiver ? 0 : 1;
+  reserveStack(receiver + function->paramCount() + function->registerCount,
+      token);
+  Value* frame = stackTop + receiver;
+  Value* registers = frame + function->paramCount();
+  // cleared so the collector never sees stale values there
+  std::fill(registers, registers + function->registerCount, Value());
+
+  size_t callerTop = stackTop - stack.data();
+  stackTop = registers + function->registerCount;
+  frames.push_back(closure);
+  Value result = execute(closure, frame);
+  frames.pop_back();
+  stackTop = stack.data() + callerTop;
+  return result;
+}
+
+void IrInterpreter::growFrames(const Token& token) {
+  if(frames.capacity() * 2 * sizeof(IrClosure*) + stack.size() * sizeof(Value)
+      > lox.stackBudget) {
+    throw RuntimeError(token, "Stack overflow.");
+  }
+  frames.reserve(frames.capacity() * 2);
+}
+
+void IrInterpreter::reserveStack(size_t slots, const Token& token) {
+  size_t used = stackTop - stack.data();
+  if(used + slots <= stack.size()) return;
+  size_t size = stack.size();
+  while(used + slots > size) size *= 2;
+  if(frames.capacity() * sizeof(IrClosure*) + size * sizeof(Value)
+      > lox.stackBudget) {
+    throw RuntimeError(token, "Stack overflow.");
+  }
+  stack.resize(size);
+  stackTop = stack.data() + used;
+}
+
+void IrInterpreter::pushArguments(const IR::Instr* instr, Value* registers) {
+  // the first operand is the callee or the receiver
+  size_t argCount = instr->operands.size() - 1;
+  size_t offset = registers - stack.data();
+  reserveStack(1 + argCount, instr->token);
+  registers = stack.data() + offset;
+  for(size_t i = 0; i < argCount; i++) {
+    stackTop[i + 1] = registers[instr->operands[i + 1]->id];
+  }
+}
+
+size_t IrInterpreter::enterBlock(IR::Block* from, IR::Block* to,
+    Value* registers) {
+  size_t phis = to->phiCount();
+  if(phis == 0) return 0;
+  size_t edge = std::find(to->preds.begin(), to->preds.end(), from)
+    - to->preds.begin();
+  // all phis read their operands before any of them is written
+  phiValues.resize(phis);
+  for(size_t i = 0; i < phis; i++) {
+    phiValues[i] = registers[to->instrs[i]->operands[edge]->id];
+  }
+  for(size_t i = 0; i < phis; i++) {
+    registers[to->instrs[i]->id] = phiValues[i];
+  }
+  return phis;
+}
+
+Value IrInterpreter::execute(IrClosure* closure, Value* frame) {
+  IR::Function* function = closure->function;
+  Value* registers = frame + function->paramCount();
+  // where the frame is found again when a call moved the stack
+  size_t frameOffset = frame - stack.data();
+  auto rebase = [&]() {
+    frame = stack.data() + frameOffset;
+    registers = frame + function->paramCount();
+  };
+  IR::Block* block = function->entry();
+  size_t pc = 0;
+
+#define OPERAND(n) registers[instr->operands[n]->id]
+#define BINARY(op)                                              \
+  if(Numbers::quick(op, OPERAND(0), OPERAND(1), result)) break; \
+  if(!Numbers::accepts(op, OPERAND(0), OPERAND(1))) {           \
+    throw RuntimeError(instr->token,                            \
+        Numbers::operandError(op, OPERAND(0), OPERAND(1)));     \
+  }                                                             \
+  result = Numbers::binary(op, OPERAND(0), OPERAND(1), lox.heap); \
+  break;
+#define ARITHMETIC(op) BINARY(Numbers::Op::op)
+#define UNARY(expression)                                       \
+  if(!OPERAND(0).isNumber()) {                                  \
+    throw RuntimeError(instr->token, "Operand must be a number."); \
+  }                                                             \
+  result = *expression;                                         \
+  break;
+
+  while(true) {
+    IR::Instr* instr = block->instrs[pc++].get();
+    Value& result = registers[instr->id];
+    switch(instr->op) {
+      case IR::Op::CONST: result = instr->constant; break;
+      case IR::Op::PARAM: result = frame[instr->index]; break;
+      // written when the block is entered
+      case IR::Op::PHI: break;
+
+      case IR::Op::ADD:
+        if(OPERAND(0).isString() && OPERAND(1).isString()) {
+          result = lox.heap.makeString(
+              OPERAND(0).asString()->chars + OPERAND(1).asString()->chars);
+          break;
+        }
+        if(!OPERAND(0).isNumber() || !OPERAND(1).isNumber()) {
+          throw RuntimeError(instr->token,
+              "Operands must be two numbers or two strings");
+        }
+        ARITHMETIC(ADD)
+      case IR::Op::SUBTRACT: ARITHMETIC(SUBTRACT)
+      case IR::Op::MULTIPLY: ARITHMETIC(MULTIPLY)
+      case IR::Op::DIVIDE: ARITHMETIC(DIVIDE)
+      case IR::Op::GREATER: ARITHMETIC(GREATER)
+      case IR::Op::GREATER_EQUAL: ARITHMETIC(GREATER_EQUAL)
+      case IR::Op::LESS: ARITHMETIC(LESS)
+      case IR::Op::LESS_EQUAL: ARITHMETIC(LESS_EQUAL)
+      case IR::Op::BIT_AND: ARITHMETIC(BIT_AND)
+      case IR::Op::BIT_OR: ARITHMETIC(BIT_OR)
+      case IR::Op::BIT_XOR: ARITHMETIC(BIT_XOR)
+      case IR::Op::SHIFT_LEFT: ARITHMETIC(SHIFT_LEFT)
+      case IR::Op::SHIFT_RIGHT: ARITHMETIC(SHIFT_RIGHT)
+      case IR::Op::EQUAL: result = OPERAND(0).isEqual(OPERAND(1)); break;
+      case IR::Op::NOT_EQUAL: result = !OPERAND(0).isEqual(OPERAND(1)); break;
+      case IR::Op::NEGATE: UNARY(Numbers::negate(OPERAND(0), &lox.heap))
+      case IR::Op::NOT: result = !OPERAND(0).isTruthy(); break;
+      case IR::Op::INCREMENT: UNARY(Numbers::add(OPERAND(0), 1, &lox.heap))
+      case IR::Op::DECREMENT: UNARY(Numbers::add(OPERAND(0), -1, &lox.heap))
+      case IR::Op::BIT_NOT:
+        if(!OPERAND(0).isInt()) {
+          throw RuntimeError(instr->token, "Operand must be an integer.");
+        }
+        result = *Numbers::complement(OPERAND(0), &lox.heap);
+        break;
+
+      case IR::Op::NEW_CELL: {
+        ObjUpvalue* cell = lox.heap.make<ObjUpvalue>(nullptr);
+        cell->location = &cell->closed;
+        cell->closed = OPERAND(0);
+        result = Value(cell);
+        break;
+      }
+      case IR::Op::LOAD_CELL:
+        result = *static_cast<ObjUpvalue*>(OPERAND(0).asObj())->location;
+        break;
+      case IR::Op::STORE_CELL:
+        *static_cast<ObjUpvalue*>(OPERAND(0).asObj())->location = OPERAND(1);
+        break;
+      case IR::Op::UPVALUE_CELL:
+        result = Value(closure->cells[instr->index]);
+        break;
+
+      case IR::Op::GET_GLOBAL:
+        result = globals.get(instr->index, instr->token);
+        break;
+      case IR::Op::SET_GLOBAL:
+        globals.assign(instr->index, instr->token, OPERAND(0));
+        break;
+      case IR::Op::DEFINE_GLOBAL:
+        globals.define(instr->index, OPERAND(0));
+        break;
+
+      case IR::Op::CLOSURE: {
+        auto made = lox.heap.make<IrClosure>(instr->function, this);
+        for(size_t i = 0; i < instr->operands.size(); i++) {
+          made->cells.push_back(static_cast<ObjUpvalue*>(OPERAND(i).asObj()));
+        }
+        result = Value(made);
+        break;
+      }
+      case IR::Op::CLASS: {
+        auto klass = lox.heap.make<IrClass>(instr->token.lexeme, lox.heap);
+        for(size_t i = 0; i < instr->operands.size(); i++) {
+          auto method = static_cast<IrClosure*>(OPERAND(i).asObj());
+          klass->irMethods[method->function->name] = method;
+        }
+        result = Value(klass);
+        break;
+      }
+
+      case IR::Op::GET_PROPERTY: {
+        if(!OPERAND(0).isInstance()) {
+          throw RuntimeError(instr->token, "Only instances have properties.");
+        }
+        LoxInstance* instance = OPERAND(0).asInstance();
+        int slot = instance->getShape()->slotOf(instr->token.lexeme);
+        if(slot >= 0) {
+          result = instance->fieldAt(slot);
+          break;
+        }
+        IrClosure* method = static_cast<IrClass*>(instance->getClass())
+          ->findIrMethod(instr->token.lexeme);
+        if(!method) {
+          throw RuntimeError(instr->token,
+              "Undefined property '" + instr->token.lexeme + "'.");
+        }
+        result = Value(lox.heap.make<IrBoundMethod>(OPERAND(0), method));
+        break;
+      }
+      case IR::Op::SET_PROPERTY:
+        if(!OPERAND(0).isInstance()) {
+          throw RuntimeError(instr->token, "Only instances have fields.");
+        }
+        OPERAND(0).asInstance()->setField(instr->token.lexeme, OPERAND(1),
+            lox.heap);
+        break;
+
+      case IR::Op::CALL: {
+        pushArguments(instr, registers);
+        rebase();
+        Value called = callValue(OPERAND(0), instr->operands.size() - 1,
+            instr->token);
+        rebase();
+        registers[instr->id] = called;
+        break;
+      }
+      case IR::Op::INVOKE: {
+        if(!OPERAND(0).isInstance()) {
+          throw RuntimeError(instr->token, "Only instances have properties.");
+        }
+        LoxInstance* instance = OPERAND(0).asInstance();
+        int argCount = instr->operands.size() - 1;
+        pushArguments(instr, registers);
+        rebase();
+        int slot = instance->getShape()->slotOf(instr->token.lexeme);
+        Value called;
+        if(slot >= 0) {
+          called = callValue(instance->fieldAt(slot), argCount, instr->token);
+          rebase();
+          registers[instr->id] = called;
+          break;
+        }
+        // the receiver goes where the callee would, no bound method needed
+        IrClosure* method = static_cast<IrClass*>(instance->getClass())
+          ->findIrMethod(instr->token.lexeme);
+        if(!method) {
+          throw RuntimeError(instr->token,
+              "Undefined property '" + instr->token.lexeme + "'.");
+        }
+        *stackTop = OPERAND(0);
+        called = callClosure(method, true, argCount, instr->token);
+        rebase();
+        registers[instr->id] = called;
+        break;
+      }
+
+      case IR::Op::PRINT:
+        std::cout << OPERAND(0).toString() << std::endl;
+        break;
+
+      case IR::Op::JUMP: {
+        IR::Block* target = instr->targets[0];
+        pc = enterBlock(block, target, registers);
+        block = target;
+        break;
+      }
+      case IR::Op::BRANCH: {
+        IR::Block* target = OPERAND(0).isTruthy()
+          ? instr->targets[0] : instr->targets[1];
+        pc = enterBlock(block, target, registers);
+        block = target;
+        break;
+      }
+      case IR::Op::RETURN:
+        return OPERAND(0);
+    }
+  }
+
+#undef OPERAND
+#undef ARITHMETIC
+#undef BINARY
+#undef UNARY
+}
+
+Value IrInterpreter::callFromHost(const Value& callee,
+    const std::vector<Value>& args) {
+  reserveStack(1 + args.size(), *nativeCaller);
+  std::copy(args.begin(), args.end(), stackTop + 1);
+  return callValue(callee, args.size(), *nativeCaller);
+}
+
+void IrInterpreter::interpret(IR::Module& module) {
+  IrClosure* script =
+    lox.heap.make<IrClosure>(module.functions.front().get(), this);
+  nativeStackBase = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  try {
+    callClosure(script, false, 0, Token(IDENTIFIER, "script", 0));
+  } catch(const RuntimeError& error) {
+    lox.runtimeError(error);
+    stackTop = stack.data();
+    frames.clear();
+  }
+}
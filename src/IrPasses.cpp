@@ -0,0 +1,375 @@
+#include "../include/IrPasses.hpp"
+#include "../include/Numbers.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+bool allConstant(const IR::Instr& instr) {
+  return std::all_of(instr.operands.begin(), instr.operands.end(),
+      [](const IR::Instr* operand) { return operand->op == IR::Op::CONST; });
+}
+
+// what the instruction evaluates to when its operands are constants,
+// nothing when it would fail or allocate
+std::optional<Value> evaluate(const IR::Instr& instr) {
+  if(instr.operands.empty() || !allConstant(instr)) return std::nullopt;
+  Value a = instr.operands[0]->constant;
+  if(instr.operands.size() == 1) {
+    switch(instr.op) {
+      case IR::Op::NOT: return Value(!a.isTruthy());
+      case IR::Op::NEGATE:
+        if(a.isNumber()) return Numbers::negate(a, nullptr);
+        break;
+      case IR::Op::INCREMENT:
+        if(a.isNumber()) return Numbers::add(a, 1, nullptr);
+        break;
+      case IR::Op::DECREMENT:
+        if(a.isNumber()) return Numbers::add(a, -1, nullptr);
+        break;
+      case IR::Op::BIT_NOT:
+        if(a.isInt()) return Numbers::complement(a, nullptr);
+        break;
+      default: break;
+    }
+    return std::nullopt;
+  }
+
+  Value b = instr.operands[1]->constant;
+  if(instr.op == IR::Op::EQUAL) return Value(a.isEqual(b));
+  if(instr.op == IR::Op::NOT_EQUAL) return Value(!a.isEqual(b));
+  std::optional<Numbers::Op> op;
+  switch(instr.op) {
+    case IR::Op::ADD: op = Numbers::Op::ADD; break;
+    case IR::Op::SUBTRACT: op = Numbers::Op::SUBTRACT; break;
+    case IR::Op::MULTIPLY: op = Numbers::Op::MULTIPLY; break;
+    case IR::Op::DIVIDE: op = Numbers::Op::DIVIDE; break;
+    case IR::Op::GREATER: op = Numbers::Op::GREATER; break;
+    case IR::Op::GREATER_EQUAL: op = Numbers::Op::GREATER_EQUAL; break;
+    case IR::Op::LESS: op = Numbers::Op::LESS; break;
+    case IR::Op::LESS_EQUAL: op = Numbers::Op::LESS_EQUAL; break;
+    case IR::Op::BIT_AND: op = Numbers::Op::BIT_AND; break;
+    case IR::Op::BIT_OR: op = Numbers::Op::BIT_OR; break;
+    case IR::Op::BIT_XOR: op = Numbers::Op::BIT_XOR; break;
+    case IR::Op::SHIFT_LEFT: op = Numbers::Op::SHIFT_LEFT; break;
+    case IR::Op::SHIFT_RIGHT: op = Numbers::Op::SHIFT_RIGHT; break;
+    default: return std::nullopt;
+  }
+  if(!Numbers::accepts(*op, a, b)) return std::nullopt;
+  return Numbers::binary(*op, a, b, nullptr);
+}
+
+// pure operations, the same operands always give an equal result
+bool isNumberable(IR::Op op) {
+  switch(op) {
+    case IR::Op::CONST: case IR::Op::ADD: case IR::Op::SUBTRACT:
+    case IR::Op::MULTIPLY: case IR::Op::DIVIDE: case IR::Op::EQUAL:
+    case IR::Op::NOT_EQUAL: case IR::Op::GREATER: case IR::Op::GREATER_EQUAL:
+    case IR::Op::LESS: case IR::Op::LESS_EQUAL: case IR::Op::NEGATE:
+    case IR::Op::NOT: case IR::Op::INCREMENT: case IR::Op::DECREMENT:
+    case IR::Op::BIT_AND: case IR::Op::BIT_OR: case IR::Op::BIT_XOR:
+    case IR::Op::SHIFT_LEFT: case IR::Op::SHIFT_RIGHT: case IR::Op::BIT_NOT:
+    case IR::Op::UPVALUE_CELL:
+      return true;
+    default: return false;
+  }
+}
+
+class Numbering {
+  const DominatorTree& dominators;
+  std::map<std::string, IR::Instr*> available;
+
+public:
+  std::map<IR::Instr*, IR::Instr*> replaced;
+
+  Numbering(const DominatorTree& dominators) : dominators { dominators } {}
+
+  IR::Instr* resolve(IR::Instr* instr) const {
+    auto it = replaced.find(instr);
+    return it == replaced.end() ? instr : it->second;
+  }
+
+  std::string keyOf(const IR::Instr& instr) const {
+    std::ostringstream key;
+    key << static_cast<int>(instr.op) << ":" << instr.index;
+    if(instr.op == IR::Op::CONST) {
+      uint64_t bits;
+      std::memcpy(&bits, &instr.constant, sizeof(bits));
+      key << ":" << bits;
+    }
+    for(IR::Instr* operand: instr.operands) key << ":" << resolve(operand);
+    return key.str();
+  }
+
+  // preorder over the dominator tree, so whatever is available was
+  // computed on every path here. Without recursion, a long chain of `or`
+  // makes a deep tree.
+  void walk(IR::Block* entry) {
+    struct Visit {
+      IR::Block* block;
+      size_t next;
+      std::vector<std::string> added;
+    };
+    std::vector<Visit> stack;
+    stack.push_back({ entry, 0, number(entry) });
+    while(!stack.empty()) {
+      Visit& visit = stack.back();
+      const auto& children = dominators.childrenOf(visit.block);
+      if(visit.next < children.size()) {
+        IR::Block* child = children[visit.next++];
+        stack.push_back({ child, 0, number(child) });
+      } else {
+        for(const auto& key: visit.added) available.erase(key);
+        stack.pop_back();
+      }
+    }
+  }
+
+  // the keys the block made available
+  std::vector<std::string> number(IR::Block* block) {
+    std::vector<std::string> added;
+    for(const auto& instr: block->instrs) {
+      if(!isNumberable(instr->op)) continue;
+      std::string key = keyOf(*instr);
+      auto known = available.find(key);
+      if(known != available.end()) {
+        replaced[instr.get()] = known->second;
+      } else {
+        available.emplace(key, instr.get());
+        added.push_back(key);
+      }
+    }
+    return added;
+  }
+};
+
+std::string valueName(const IR::Instr* instr) {
+  return "v" + std::to_string(instr->id);
+}
+
+}
+
+namespace IrPasses {
+
+bool SimplifyPhis::run(IR::Function& function, AnalysisManager& analyses) {
+  bool changed = false;
+  bool progress = true;
+  // removing one phi can make another one trivial
+  while(progress) {
+    progress = false;
+    for(const auto& block: function.blocks) {
+      for(size_t i = 0; i < block->phiCount(); i++) {
+        IR::Instr* phi = block->instrs[i].get();
+        IR::Instr* same = nullptr;
+        bool trivial = true;
+        for(IR::Instr* operand: phi->operands) {
+          if(operand == phi || operand == same) continue;
+          if(same) {
+            trivial = false;
+            break;
+          }
+          same = operand;
+        }
+        if(!trivial || !same) continue;
+        function.replaceUses(phi, same);
+        block->instrs.erase(block->instrs.begin() + i--);
+        progress = changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+bool FoldConstants::run(IR::Function& function, AnalysisManager& analyses) {
+  bool changed = false;
+  for(const auto& block: function.blocks) {
+    for(const auto& instr: block->instrs) {
+      std::optional<Value> value = evaluate(*instr);
+      if(!value) continue;
+      instr->op = IR::Op::CONST;
+      instr->constant = *value;
+      instr->operands.clear();
+      changed = true;
+    }
+
+    IR::Instr* last = block->terminator();
+    if(!last || last->op != IR::Op::BRANCH) continue;
+    if(last->operands[0]->op != IR::Op::CONST) continue;
+    bool taken = last->operands[0]->constant.isTruthy();
+    IR::Block* target = last->targets[taken ? 0 : 1];
+    IR::Block* dropped = last->targets[taken ? 1 : 0];
+    last->op = IR::Op::JUMP;
+    last->operands.clear();
+    last->targets[0] = target;
+    last->targets[1] = nullptr;
+    if(dropped != target) dropped->removePred(block.get());
+    changed = true;
+  }
+  return changed;
+}
+
+bool SimplifyCfg::run(IR::Function& function, AnalysisManager& analyses) {
+  bool changed = false;
+
+  std::set<IR::Block*> reached { function.entry() };
+  std::vector<IR::Block*> work { function.entry() };
+  while(!work.empty()) {
+    IR::Block* block = work.back();
+    work.pop_back();
+    for(IR::Block* successor: block->successors()) {
+      if(reached.insert(successor).second) work.push_back(successor);
+    }
+  }
+  for(const auto& block: function.blocks) {
+    if(reached.contains(block.get())) continue;
+    for(IR::Block* successor: block->successors()) {
+      successor->removePred(block.get());
+    }
+    changed = true;
+  }
+  std::erase_if(function.blocks, [&reached](const auto& block) {
+    return !reached.contains(block.get());
+  });
+
+  // a jump to a block nothing else jumps to joins the two
+  for(size_t i = 0; i < function.blocks.size(); i++) {
+    IR::Block* block = function.blocks[i].get();
+    IR::Instr* last = block->terminator();
+    if(!last || last->op != IR::Op::JUMP) continue;
+    IR::Block* next = last->targets[0];
+    if(next == block || next == function.entry() || next->preds.size() != 1) {
+      continue;
+    }
+
+    size_t phis = next->phiCount();
+    for(size_t p = 0; p < phis; p++) {
+      function.replaceUses(next->instrs[p].get(), next->instrs[p]->operands[0]);
+    }
+    block->instrs.pop_back();
+    for(size_t p = phis; p < next->instrs.size(); p++) {
+      next->instrs[p]->block = block;
+      block->instrs.push_back(std::move(next->instrs[p]));
+    }
+    for(IR::Block* successor: block->successors()) {
+      std::replace(successor->preds.begin(), successor->preds.end(), next,
+          block);
+    }
+    std::erase_if(function.blocks, [next](const auto& other) {
+      return other.get() == next;
+    });
+    changed = true;
+    // the merged block may end in another jump that can be merged
+    i = -1;
+  }
+  return changed;
+}
+
+bool ValueNumbering::run(IR::Function& function, AnalysisManager& analyses) {
+  Numbering numbering(analyses.dominatorsOf(function));
+  numbering.walk(function.entry());
+  if(numbering.replaced.empty()) return false;
+
+  for(const auto& block: function.blocks) {
+    for(const auto& instr: block->instrs) {
+      for(IR::Instr*& operand: instr->operands) {
+        operand = numbering.resolve(operand);
+      }
+    }
+    std::erase_if(block->instrs, [&numbering](const auto& instr) {
+      return numbering.replaced.contains(instr.get());
+    });
+  }
+  return true;
+}
+
+bool DeadCodeElimination::run(IR::Function& function,
+    AnalysisManager& analyses) {
+  std::set<IR::Instr*> live;
+  std::vector<IR::Instr*> work;
+  for(const auto& block: function.blocks) {
+    for(const auto& instr: block->instrs) {
+      if(IR::isRemovable(instr->op)) continue;
+      live.insert(instr.get());
+      work.push_back(instr.get());
+    }
+  }
+  while(!work.empty()) {
+    IR::Instr* instr = work.back();
+    work.pop_back();
+    for(IR::Instr* operand: instr->operands) {
+      if(live.insert(operand).second) work.push_back(operand);
+    }
+  }
+
+  bool changed = false;
+  for(const auto& block: function.blocks) {
+    size_t removed = std::erase_if(block->instrs, [&live](const auto& instr) {
+      return !live.contains(instr.get());
+    });
+    if(removed) changed = true;
+  }
+  return changed;
+}
+
+bool Verify::run(IR::Function& function, AnalysisManager& analyses) {
+  const DominatorTree& dominators = analyses.dominatorsOf(function);
+  std::map<const IR::Instr*, size_t> positions;
+  for(const auto& block: function.blocks) {
+    for(size_t i = 0; i < block->instrs.size(); i++) {
+      positions[block->instrs[i].get()] = i;
+    }
+  }
+
+  auto fail = [&function](const std::string& problem) {
+    throw std::logic_error("IR verification failed in " + function.name +
+        ": " + problem);
+  };
+  for(const auto& block: function.blocks) {
+    if(!dominators.isReachable(block.get())) continue;
+    if(!block->terminator()) fail("b" + std::to_string(block->id) +
+        " has no terminator");
+    for(const auto& instr: block->instrs) {
+      if(instr->block != block.get()) fail(valueName(instr.get()) +
+          " is in the wrong block");
+      bool phi = instr->op == IR::Op::PHI;
+      if(phi && instr->operands.size() != block->preds.size()) {
+        fail(valueName(instr.get()) + " doesn't match its predecessors");
+      }
+      for(size_t i = 0; i < instr->operands.size(); i++) {
+        IR::Instr* operand = instr->operands[i];
+        if(!positions.contains(operand)) {
+          fail(valueName(instr.get()) + " uses a removed value");
+        }
+        bool defined;
+        if(phi) {
+          defined = dominators.dominates(operand->block, block->preds[i]);
+        } else if(operand->block == block.get()) {
+          defined = positions[operand] < positions[instr.get()];
+        } else {
+          defined = dominators.dominates(operand->block, block.get());
+        }
+        if(!defined) fail(valueName(operand) + " used by " +
+            valueName(instr.get()) + " before it is defined");
+      }
+    }
+  }
+  return false;
+}
+
+}
+
+std::unique_ptr<Pass> createPass(const std::string& name) {
+  if(name == "phis") return std::make_unique<IrPasses::SimplifyPhis>();
+  if(name == "fold") return std::make_unique<IrPasses::FoldConstants>();
+  if(name == "cfg") return std::make_unique<IrPasses::SimplifyCfg>();
+  if(name == "gvn") return std::make_unique<IrPasses::ValueNumbering>();
+  if(name == "dce") return std::make_unique<IrPasses::DeadCodeElimination>();
+  if(name == "verify") return std::make_unique<IrPasses::Verify>();
+  return nullptr;
+}
@@ -0,0 +1,189 @@
+#include "../include/Jit.hpp"
+#include "../include/Heap.hpp"
+#include "../include/JitCompiler.hpp"
+#include "../include/LoxFunction.hpp"
+#include "../include/Numbers.hpp"
+
+#include <bit>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace {
+
+uint64_t bitsOf(Value value) {
+  return std::bit_cast<uint64_t>(value);
+}
+
+Value valueOf(uint64_t bits) {
+  return std::bit_cast<Value>(bits);
+}
+
+}
+
+const uint64_t Jit::NIL_BITS = bitsOf(Value());
+const uint64_t Jit::TRUE_BITS = bitsOf(Value(true));
+const uint64_t Jit::FALSE_BITS = bitsOf(Value(false));
+const uint64_t Jit::INT_BITS = bitsOf(Value::smallInt(0));
+// sign, quiet NaN and integer tag
+const uint64_t Jit::INT_MASK =
+  bitsOf(Value(static_cast<Obj*>(nullptr))) | Jit::INT_BITS;
+
+uint64_t Jit::binary(uint64_t op, uint64_t left, uint64_t right) {
+  auto arithmetic = static_cast<Numbers::Op>(op);
+  Value result;
+  if(Numbers::quick(arithmetic, valueOf(left), valueOf(right), result)) {
+    return bitsOf(result);
+  }
+  if(!Numbers::accepts(arithmetic, valueOf(left), valueOf(right))) {
+    return BAIL_OUT;
+  }
+  std::optional<Value> value =
+    Numbers::binary(arithmetic, valueOf(left), valueOf(right), nullptr);
+  return value ? bitsOf(*value) : BAIL_OUT;
+}
+
+uint64_t Jit::equal(uint64_t left, uint64_t right) {
+  return bitsOf(Value(valueOf(left).isEqual(valueOf(right))));
+}
+
+uint64_t Jit::unary(uint64_t type, uint64_t operand) {
+  Value value = valueOf(operand);
+  if(!value.isNumber()) return BAIL_OUT;
+  std::optional<Value> result;
+  switch(static_cast<TokenType>(type)) {
+    case MINUS: result = Numbers::negate(value, nullptr); break;
+    case PLUSPLUS: result = Numbers::add(value, 1, nullptr); break;
+    case MINUSMINUS: result = Numbers::add(value, -1, nullptr); break;
+    case TILDE:
+      if(value.isInt()) result = Numbers::complement(value, nullptr);
+      break;
+    default: break;
+  }
+  return result ? bitsOf(*result) : BAIL_OUT;
+}
+
+uint64_t Jit::truthy(uint64_t value) {
+  return valueOf(value).isTruthy();
+}
+
+Jit::Jit(Globals& globals, int threshold)
+  : globals { globals }, threshold { threshold } {}
+
+Jit::~Jit() {
+  for(const Mapping& mapping: mappings) munmap(mapping.memory, mapping.size);
+}
+
+bool Jit::call(LoxFunction* function, std::span<const Value> args,
+    uintptr_t stackLimit, Value& result) {
+  JitFunction* native = function->native;
+  if(!native) {
+    if(++function->calls < threshold) return false;
+    native = compile(function);
+  }
+  if(!native->entry || native->bail != NONE) return false;
+
+  native->entries++;
+  // the code reads them last one first
+  arguments.assign(args.size(), 0);
+  for(size_t i = 0; i < args.size(); i++) {
+    arguments[args.size() - 1 - i] = bitsOf(args[i]);
+  }
+  JitContext context { &globals.at(0), stackLimit, NONE };
+  uint64_t bits = native->entry(&context, arguments.data());
+  if(bits == BAIL_OUT) {
+    // it would most likely bail out again
+    native->bail = context.bail;
+    bails++;
+    return false;
+  }
+  result = valueOf(bits);
+  return true;
+}
+
+// Compiles the function and the functions it calls. When one of them
+// can't be compiled none of those compiled along with it are kept, they
+// may jump into code that won't exist.
+JitFunction* Jit::compile(LoxFunction* function) {
+  const Stmt::Function& declaration = function->getDeclaration();
+  functions.push_back(std::make_unique<JitFunction>());
+  JitFunction* native = functions.back().get();
+  native->name = declaration.name.lexeme;
+  native->line = declaration.name.line;
+  native->hotAfter = function->calls;
+  function->native = native;
+
+  if(compiling == 0) batch.clear();
+  batch.push_back(native);
+  native->compiling = true;
+  compiling++;
+  JitCompiler compiler(*this, globals, declaration);
+  bool compiled = compiler.compile();
+  compiling--;
+  native->compiling = false;
+
+  if(!compiled) {
+    native->rejected = compiler.why();
+  } else if(install(native, compiler.code())) {
+    guarded.insert(guarded.end(), compiler.callees.begin(),
+        compiler.callees.end());
+  }
+
+  if(compiling == 0 && !native->rejected.empty()) {
+    for(JitFunction* other: batch) {
+      if(other == native || !other->rejected.empty()) continue;
+      other->entry = nullptr;
+      other->rejected = "was compiled for '" + native->name
+        + "', which " + native->rejected;
+    }
+  }
+  return native;
+}
+
+// copies the code into memory that can be executed but not written
+bool Jit::install(JitFunction* function, const std::vector<uint8_t>& code) {
+  void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(memory == MAP_FAILED) {
+    function->rejected = "didn't get executable memory";
+    return false;
+  }
+  std::memcpy(memory, code.data(), code.size());
+  mappings.push_back({ memory, code.size() });
+  if(mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    function->rejected = "didn't get executable memory";
+    return false;
+  }
+  function->entry = reinterpret_cast<JitFunction::Entry>(memory);
+  function->codeSize = code.size();
+  return true;
+}
+
+void Jit::markRoots(Heap& heap) const {
+  for(LoxFunction* function: guarded) heap.markObject(function);
+}
+
+void Jit::printStats(std::ostream& out) const {
+  static const char* bailNames[] = {
+    "", "an operand it can't handle", "a reassigned callee",
+    "deep recursion",
+  };
+  size_t compiled = 0, rejected = 0;
+  for(const auto& function: functions) {
+    out << "[jit] " << function->name << " (line " << function->line
+        << "): ";
+    if(!function->rejected.empty()) {
+      out << "not compiled, " << function->rejected << "\n";
+      rejected++;
+      continue;
+    }
+    compiled++;
+    out << function->codeSize << " bytes after " << function->hotAfter
+        << " calls, entered " << function->entries << " times";
+    if(function->bail != NONE) {
+      out << ", disabled after bailing out on " << bailNames[function->bail];
+    }
+    out << "\n";
+  }
+  out << "[jit] total: " << compiled << " compiled, " << rejected
+      << " rejected, " << bails << " bail outs\n";
+}
@@ -0,0 +1,517 @@
+#include "../include/JitCompiler.hpp"
+#include "../include/Jit.hpp"
+#include "../include/LoxFunction.hpp"
+#include "../include/Numbers.hpp"
+
+#include <bit>
+#include <cstddef>
+
+using Reg = X64Assembler::Reg;
+using Label = X64Assembler::Label;
+using enum X64Assembler::Reg;
+
+namespace {
+
+uint64_t bitsOf(Value value) {
+  return std::bit_cast<uint64_t>(value);
+}
+
+// rbx, r12, r13 and r14 are saved below rbp
+constexpr int32_t SAVED = 4 * 8;
+
+}
+
+JitCompiler::JitCompiler(Jit& jit, Globals& globals,
+    const Stmt::Function& declaration)
+  : jit { jit }, globals { globals }, declaration { declaration } {}
+
+bool JitCompiler::compile() {
+  if(!declaration.upvalues.empty()) reject("captures variables");
+  if(rejected()) return false;
+
+  X64Assembler& a = assembler;
+  a.push(RBP);
+  a.mov(RBP, RSP);
+  a.push(RBX);
+  a.push(R12);
+  a.push(R13);
+  a.push(R14);
+  // five pushes on top of the return address leave rsp aligned
+  int32_t frameSize = (declaration.slotCount * 8 + 15) / 16 * 16;
+  if(frameSize) a.aluImm(X64Assembler::SUB, RSP, frameSize);
+  a.mov(RBX, RDI);
+  a.movImm(R12, Jit::INT_MASK);
+  a.movImm(R13, Jit::INT_BITS);
+  a.movImm(R14, Jit::BAIL_OUT);
+  a.cmpMem(RSP, RBX, offsetof(JitContext, stackLimit));
+  a.jcc(X64Assembler::BELOW, bailStack);
+
+  int arity = declaration.args.size();
+  for(int i = 0; i < arity; i++) {
+    a.load(RAX, RSI, (arity - 1 - i) * 8);
+    a.store(RBP, localOffset(i), RAX);
+  }
+  a.movImm(RAX, Jit::NIL_BITS);
+  for(int slot = arity; slot < declaration.slotCount; slot++) {
+    a.store(RBP, localOffset(slot), RAX);
+  }
+
+  for(const auto& stmt: declaration.body) compile(stmt);
+  if(rejected()) return false;
+  a.movImm(RAX, Jit::NIL_BITS);
+
+  a.bind(epilogue);
+  a.lea(RSP, RBP, -SAVED);
+  a.pop(R14);
+  a.pop(R13);
+  a.pop(R12);
+  a.pop(RBX);
+  a.pop(RBP);
+  a.ret();
+
+  std::pair<Label*, Jit::Bail> bails[] = {
+    { &bailOperands, Jit::OPERANDS },
+    { &bailCallee, Jit::CALLEE },
+    { &bailStack, Jit::STACK },
+  };
+  for(auto [label, reason]: bails) {
+    a.bind(*label);
+    a.storeImm32(RBX, offsetof(JitContext, bail), reason);
+    a.mov(RAX, R14);
+    a.jmp(epilogue);
+  }
+  return true;
+}
+
+const std::string& JitCompiler::why() const {
+  return problem;
+}
+
+const std::vector<uint8_t>& JitCompiler::code() const {
+  return assembler.code;
+}
+
+void JitCompiler::reject(const std::string& why) {
+  if(problem.empty()) problem = why;
+}
+
+bool JitCompiler::rejected() const {
+  return !problem.empty();
+}
+
+int32_t JitCompiler::localOffset(int slot) const {
+  return -SAVED - 8 * (slot + 1);
+}
+
+void JitCompiler::compile(const Expr::ExprPtr& expr) {
+  if(!rejected()) expr->accept(this);
+}
+
+void JitCompiler::compile(const Stmt::StmtPtr& stmt) {
+  if(!rejected()) stmt->accept(this);
+}
+
+void JitCompiler::push() {
+  assembler.push(RAX);
+  depth++;
+}
+
+void JitCompiler::pop(Reg reg) {
+  assembler.pop(reg);
+  depth--;
+}
+
+// the arguments are in rdi, rsi and rdx already
+void JitCompiler::callHelper(const void* helper, bool canBail) {
+  X64Assembler& a = assembler;
+  if(depth % 2) a.aluImm(X64Assembler::SUB, RSP, 8);
+  a.movImm(RAX, reinterpret_cast<uint64_t>(helper));
+  a.call(RAX);
+  if(depth % 2) a.aluImm(X64Assembler::ADD, RSP, 8);
+  if(canBail) {
+    a.alu(X64Assembler::CMP, RAX, R14);
+    a.jcc(X64Assembler::EQUAL, bailOperands);
+  }
+}
+
+void JitCompiler::checkSmallInt(Reg reg, Label& otherwise) {
+  X64Assembler& a = assembler;
+  a.mov(RDX, reg);
+  a.alu(X64Assembler::AND, RDX, R12);
+  a.alu(X64Assembler::CMP, RDX, R13);
+  a.jcc(X64Assembler::NOT_EQUAL, otherwise);
+}
+
+void JitCompiler::branchIfFalsy(Label& falsy) {
+  X64Assembler& a = assembler;
+  Label isTrue;
+  a.movImm(RDX, Jit::TRUE_BITS);
+  a.alu(X64Assembler::CMP, RAX, RDX);
+  a.jcc(X64Assembler::EQUAL, isTrue);
+  a.movImm(RDX, Jit::FALSE_BITS);
+  a.alu(X64Assembler::CMP, RAX, RDX);
+  a.jcc(X64Assembler::EQUAL, falsy);
+  a.movImm(RDX, Jit::NIL_BITS);
+  a.alu(X64Assembler::CMP, RAX, RDX);
+  a.jcc(X64Assembler::EQUAL, falsy);
+  // numbers and the rest
+  push();
+  a.mov(RDI, RAX);
+  callHelper(reinterpret_cast<const void*>(Jit::truthy), false);
+  a.mov(RDX, RAX);
+  pop(RAX);
+  a.test(RDX, RDX);
+  a.jcc(X64Assembler::EQUAL, falsy);
+  a.bind(isTrue);
+}
+
+// 0 or 1 in rax to false or true
+void JitCompiler::boolFromAl() {
+  assembler.movImm(RDX, Jit::FALSE_BITS);
+  assembler.alu(X64Assembler::ADD, RAX, RDX);
+}
+
+// Expressions ----------------------------------------------------------------
+
+Value JitCompiler::visitBinop(Expr::Binop* expr) {
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  compile(chain.front()->left);
+  for(Expr::Binop* binop: chain) {
+    push();
+    compile(binop->right);
+    pop(RCX);
+    if(rejected()) return Nil();
+    emitOperator(binop);
+  }
+  return Nil();
+}
+
+// left in rcx, right in rax
+void JitCompiler::emitOperator(Expr::Binop* expr) {
+  X64Assembler& a = assembler;
+  Label slow, done;
+  Numbers::Op op = expr->arithmetic.value_or(Numbers::Op::DIVIDE);
+  bool inlined = !expr->arithmetic || (op != Numbers::Op::DIVIDE
+    && op != Numbers::Op::SHIFT_LEFT && op != Numbers::Op::SHIFT_RIGHT);
+  if(inlined) {
+    checkSmallInt(RCX, slow);
+    checkSmallInt(RAX, slow);
+  }
+
+  if(!expr->arithmetic) {
+    a.alu(X64Assembler::CMP, RCX, RAX);
+    a.setAl(expr->op.type == EQUAL_EQUAL
+        ? X64Assembler::EQUAL : X64Assembler::NOT_EQUAL);
+    boolFromAl();
+    a.jmp(done);
+    a.bind(slow);
+    a.mov(RDI, RCX);
+    a.mov(RSI, RAX);
+    callHelper(reinterpret_cast<const void*>(Jit::equal), false);
+    // true and false differ in the lowest bit
+    if(expr->op.type == BANG_EQUAL) a.aluImm(X64Assembler::XOR, RAX, 1);
+    a.bind(done);
+    return;
+  }
+
+  // both shifted into the top 48 bits, where the flags tell whether the
+  // result still fits
+  auto shifted = [&] {
+    a.mov(RDX, RCX);
+    a.shl(RDX, 16);
+    a.mov(RSI, RAX);
+    a.shl(RSI, 16);
+  };
+  auto boxShifted = [&] {
+    a.mov(RAX, RDX);
+    a.shr(RAX, 16);
+    a.alu(X64Assembler::OR, RAX, R13);
+    a.jmp(done);
+  };
+  auto compare = [&](X64Assembler::Cond cond) {
+    shifted();
+    a.alu(X64Assembler::CMP, RDX, RSI);
+    a.setAl(cond);
+    boolFromAl();
+    a.jmp(done);
+  };
+
+  switch(op) {
+    case Numbers::Op::ADD:
+      shifted();
+      a.alu(X64Assembler::ADD, RDX, RSI);
+      a.jcc(X64Assembler::OVERFLOW, slow);
+      boxShifted();
+      break;
+    case Numbers::Op::SUBTRACT:
+      shifted();
+      a.alu(X64Assembler::SUB, RDX, RSI);
+      a.jcc(X64Assembler::OVERFLOW, slow);
+      boxShifted();
+      break;
+    case Numbers::Op::MULTIPLY:
+      shifted();
+      a.sar(RSI, 16);
+      a.imul(RDX, RSI);
+      a.jcc(X64Assembler::OVERFLOW, slow);
+      boxShifted();
+      break;
+    case Numbers::Op::LESS: compare(X64Assembler::LESS); break;
+    case Numbers::Op::LESS_EQUAL: compare(X64Assembler::LESS_EQUAL); break;
+    case Numbers::Op::GREATER: compare(X64Assembler::GREATER); break;
+    case Numbers::Op::GREATER_EQUAL:
+      compare(X64Assembler::GREATER_EQUAL);
+      break;
+    // the tags of two small integers survive and and or
+    case Numbers::Op::BIT_AND:
+      a.alu(X64Assembler::AND, RAX, RCX);
+      a.jmp(done);
+      break;
+    case Numbers::Op::BIT_OR:
+      a.alu(X64Assembler::OR, RAX, RCX);
+      a.jmp(done);
+      break;
+    case Numbers::Op::BIT_XOR:
+      a.alu(X64Assembler::XOR, RAX, RCX);
+      a.alu(X64Assembler::OR, RAX, R13);
+      a.jmp(done);
+      break;
+    default: break;
+  }
+
+  a.bind(slow);
+  a.mov(RSI, RCX);
+  a.mov(RDX, RAX);
+  a.movImm(RDI, static_cast<uint64_t>(op));
+  callHelper(reinterpret_cast<const void*>(Jit::binary), true);
+  a.bind(done);
+}
+
+Value JitCompiler::visitUnop(Expr::Unop* expr) {
+  X64Assembler& a = assembler;
+  compile(expr->expr);
+  if(rejected()) return Nil();
+  if(expr->op.type == BANG) {
+    Label falsy, done;
+    branchIfFalsy(falsy);
+    a.movImm(RAX, Jit::FALSE_BITS);
+    a.jmp(done);
+    a.bind(falsy);
+    a.movImm(RAX, Jit::TRUE_BITS);
+    a.bind(done);
+    return Nil();
+  }
+  a.mov(RSI, RAX);
+  a.movImm(RDI, expr->op.type);
+  callHelper(reinterpret_cast<const void*>(Jit::unary), true);
+  return Nil();
+}
+
+Value JitCompiler::visitGrouping(Expr::Grouping* expr) {
+  compile(expr->expr);
+  return Nil();
+}
+
+Value JitCompiler::visitLiteralExpr(Expr::Literal* expr) {
+  Value value = expr->value->value;
+  // strings and boxed integers would have to stay alive
+  if(value.isObj()) {
+    reject("uses a string or a big integer literal");
+    return Nil();
+  }
+  assembler.movImm(RAX, bitsOf(value));
+  return Nil();
+}
+
+Value JitCompiler::visitVariableExpr(Expr::Variable* expr) {
+  if(expr->slot.kind != Expr::VarSlot::LOCAL) {
+    reject("reads '" + expr->name.lexeme + "', which isn't a local");
+    return Nil();
+  }
+  assembler.load(RAX, RBP, localOffset(expr->slot.slot));
+  return Nil();
+}
+
+Value JitCompiler::visitAssign(Expr::Assign* expr) {
+  if(expr->slot.kind != Expr::VarSlot::LOCAL) {
+    reject("assigns '" + expr->name.lexeme + "', which isn't a local");
+    return Nil();
+  }
+  compile(expr->value);
+  assembler.store(RBP, localOffset(expr->slot.slot), RAX);
+  return Nil();
+}
+
+Value JitCompiler::visitLogical(Expr::Logical* expr) {
+  X64Assembler& a = assembler;
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  compile(chain.front()->left);
+  for(Expr::Logical* logical: chain) {
+    Label end;
+    if(logical->op.type == OR) {
+      Label right;
+      branchIfFalsy(right);
+      a.jmp(end);
+      a.bind(right);
+    } else {
+      branchIfFalsy(end);
+    }
+    compile(logical->right);
+    a.bind(end);
+  }
+  return Nil();
+}
+
+// Only calls of top level functions that can be compiled too. The code
+// checks that the global still holds the function it was compiled for.
+Value JitCompiler::visitCall(Expr::Call* expr) {
+  X64Assembler& a = assembler;
+  auto* callee = dynamic_cast<Expr::Variable*>(expr->callee.get());
+  if(expr->property || !callee || !callee->slot.isGlobal()) {
+    reject("calls something other than a top level function");
+    return Nil();
+  }
+  int slot = callee->slot.slot;
+  Value value = globals.isDefined(slot) ? globals.at(slot) : Value();
+  LoxFunction* function = nullptr;
+  if(value.isCallable() && value.asObj()->type == ObjType::FUNCTION) {
+    function = static_cast<LoxFunction*>(value.asCallable());
+  }
+  if(!function || function->boundReceiver()
+      || function->arity() != static_cast<int>(expr->arguments.size())) {
+    reject("calls '" + callee->name.lexeme + "', which isn't a function "
+        "taking " + std::to_string(expr->arguments.size()) + " arguments");
+    return Nil();
+  }
+  JitFunction* target = function->native ? function->native
+    : jit.compile(function);
+  if(!target->rejected.empty()) {
+    reject("calls '" + callee->name.lexeme + "', which "
+        + target->rejected);
+    return Nil();
+  }
+  callees.push_back(function);
+
+  a.load(RAX, RBX, offsetof(JitContext, globals));
+  a.load(RAX, RAX, slot * 8);
+  a.movImm(RCX, bitsOf(Value(static_cast<Obj*>(function))));
+  a.alu(X64Assembler::CMP, RAX, RCX);
+  a.jcc(X64Assembler::NOT_EQUAL, bailCallee);
+
+  int count = expr->arguments.size();
+  int padding = (depth + count) % 2;
+  if(padding) a.aluImm(X64Assembler::SUB, RSP, 8);
+  depth += padding;
+  for(const auto& argument: expr->arguments) {
+    compile(argument);
+    push();
+  }
+  a.mov(RDI, RBX);
+  a.mov(RSI, RSP);
+  a.movImm(RAX, reinterpret_cast<uint64_t>(&target->entry));
+  a.callIndirect(RAX);
+  if(count + padding) a.aluImm(X64Assembler::ADD, RSP, (count + padding) * 8);
+  depth -= count + padding;
+  // the callee bailed out, so does the caller
+  a.alu(X64Assembler::CMP, RAX, R14);
+  a.jcc(X64Assembler::EQUAL, epilogue);
+  return Nil();
+}
+
+Value JitCompiler::visitGetExpr(Expr::Get* expr) {
+  reject("reads a property");
+  return Nil();
+}
+
+Value JitCompiler::visitSetExpr(Expr::Set* expr) {
+  reject("sets a property");
+  return Nil();
+}
+
+Value JitCompiler::visitThisExpr(Expr::This* expr) {
+  reject("uses 'this'");
+  return Nil();
+}
+
+// Statements -----------------------------------------------------------------
+
+Value JitCompiler::visitExprStmt(Stmt::Expr* stmt) {
+  compile(stmt->expr);
+  return Nil();
+}
+
+Value JitCompiler::visitPrintStmt(Stmt::Print* stmt) {
+  reject("prints");
+  return Nil();
+}
+
+Value JitCompiler::visitVarStmt(Stmt::Var* stmt) {
+  if(stmt->slot.isGlobal()) {
+    reject("declares a global");
+    return Nil();
+  }
+  if(stmt->initializer) {
+    compile(stmt->initializer);
+  } else {
+    assembler.movImm(RAX, Jit::NIL_BITS);
+  }
+  assembler.store(RBP, localOffset(stmt->slot.slot), RAX);
+  return Nil();
+}
+
+Value JitCompiler::visitBlockStmt(Stmt::Block* stmt) {
+  for(const auto& statement: stmt->statements) compile(statement);
+  return Nil();
+}
+
+Value JitCompiler::visitIfStmt(Stmt::If* stmt) {
+  X64Assembler& a = assembler;
+  Label otherwise, end;
+  compile(stmt->condition);
+  branchIfFalsy(otherwise);
+  compile(stmt->thenBranch);
+  a.jmp(end);
+  a.bind(otherwise);
+  if(stmt->elseBranch) compile(stmt->elseBranch);
+  a.bind(end);
+  return Nil();
+}
+
+Value JitCompiler::visitWhileStmt(Stmt::While* stmt) {
+  X64Assembler& a = assembler;
+  Label top, end;
+  a.bind(top);
+  compile(stmt->condition);
+  branchIfFalsy(end);
+  loopEnds.push_back(&end);
+  compile(stmt->body);
+  loopEnds.pop_back();
+  a.jmp(top);
+  a.bind(end);
+  return Nil();
+}
+
+Value JitCompiler::visitBreakStmt(Stmt::Break* stmt) {
+  assembler.jmp(*loopEnds.back());
+  return Nil();
+}
+
+Value JitCompiler::visitReturnStmt(Stmt::Return* stmt) {
+  if(stmt->value) {
+    compile(stmt->value);
+  } else {
+    assembler.movImm(RAX, Jit::NIL_BITS);
+  }
+  assembler.jmp(epilogue);
+  return Nil();
+}
+
+Value JitCompiler::visitFunctionStmt(Stmt::Function* stmt) {
+  reject("declares a function");
+  return Nil();
+}
+
+Value JitCompiler::visitClassStmt(Stmt::Class* stmt) {
+  reject("declares a class");
+  return Nil();
+}
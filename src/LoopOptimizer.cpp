@@ -0,0 +1,328 @@
+#include "../include/LoopOptimizer.hpp"
+#include "../include/AstCloner.hpp"
+#include "../include/AstQueries.hpp"
+#include "../include/Numbers.hpp"
+
+namespace {
+
+// Names a loop declares or assigns, and whether it calls or sets fields
+class EffectScan : public AstRewriter {
+public:
+  std::set<std::string> declared;
+  std::map<std::string, std::vector<Expr::Assign*>> assigns;
+  bool calls { false };
+  bool sets { false };
+
+  Value visitVarStmt(Stmt::Var* stmt) override {
+    declared.insert(stmt->name.lexeme);
+    return AstRewriter::visitVarStmt(stmt);
+  }
+
+  Value visitFunctionStmt(Stmt::Function* stmt) override {
+    declared.insert(stmt->name.lexeme);
+    for(const auto& param: stmt->args) declared.insert(param.lexeme);
+    return AstRewriter::visitFunctionStmt(stmt);
+  }
+
+  Value visitClassStmt(Stmt::Class* stmt) override {
+    declared.insert(stmt->name.lexeme);
+    for(const auto& method: stmt->methods) {
+      for(const auto& param: method->args) declared.insert(param.lexeme);
+    }
+    return AstRewriter::visitClassStmt(stmt);
+  }
+
+  Value visitAssign(Expr::Assign* expr) override {
+    assigns[expr->name.lexeme].push_back(expr);
+    return AstRewriter::visitAssign(expr);
+  }
+
+  Value visitCall(Expr::Call* expr) override {
+    calls = true;
+    return AstRewriter::visitCall(expr);
+  }
+
+  Value visitSetExpr(Expr::Set* expr) override {
+    sets = true;
+    return AstRewriter::visitSetExpr(expr);
+  }
+};
+
+// Whether a statement can leave the loop it is in
+class ExitScan : public AstRewriter {
+  int loops { 0 };
+
+public:
+  bool exits { false };
+
+  Value visitReturnStmt(Stmt::Return* stmt) override {
+    exits = true;
+    return Nil();
+  }
+
+  Value visitBreakStmt(Stmt::Break* stmt) override {
+    if(loops == 0) exits = true;
+    return Nil();
+  }
+
+  Value visitWhileStmt(Stmt::While* stmt) override {
+    loops++;
+    AstRewriter::visitWhileStmt(stmt);
+    loops--;
+    return Nil();
+  }
+
+  // their bodies don't run where they are declared
+  Value visitFunctionStmt(Stmt::Function* stmt) override { return Nil(); }
+  Value visitClassStmt(Stmt::Class* stmt) override { return Nil(); }
+};
+
+bool exits(Stmt::Stmt* stmt) {
+  ExitScan scan;
+  stmt->accept(&scan);
+  return scan.exits;
+}
+
+// Replaces the hoisted expressions with reads of their locals
+class InvariantReplacer : public AstRewriter {
+  const std::map<std::string, Token>& locals;
+
+  bool replace(Expr::Expr* expr) {
+    auto local = locals.find(pureKey(expr));
+    if(local == locals.end()) return false;
+    exprReplacement = std::make_shared<Expr::Variable>(local->second);
+    return true;
+  }
+
+public:
+  InvariantReplacer(const std::map<std::string, Token>& locals)
+    : locals { locals } {}
+
+  Value visitBinop(Expr::Binop* expr) override {
+    if(replace(expr)) return Nil();
+    return AstRewriter::visitBinop(expr);
+  }
+
+  Value visitUnop(Expr::Unop* expr) override {
+    if(replace(expr)) return Nil();
+    return AstRewriter::visitUnop(expr);
+  }
+
+  Value visitLogical(Expr::Logical* expr) override {
+    if(replace(expr)) return Nil();
+    return AstRewriter::visitLogical(expr);
+  }
+
+  Value visitGetExpr(Expr::Get* expr) override {
+    if(replace(expr)) return Nil();
+    return AstRewriter::visitGetExpr(expr);
+  }
+
+  // closures keep reading what they captured
+  Value visitFunctionStmt(Stmt::Function* stmt) override { return Nil(); }
+  Value visitClassStmt(Stmt::Class* stmt) override { return Nil(); }
+};
+
+}
+
+void LoopOptimizer::optimize(Stmt::Stmts& program) {
+  hasClosures.push_back(declaresClosures(program, true));
+  rewrite(program);
+  hasClosures.pop_back();
+}
+
+void LoopOptimizer::printSummary(std::ostream& out) const {
+  out << "[opt] loops: " << hoisted << " invariant expressions hoisted out of "
+    << peeled << " loops, " << counters << " counters updated in place\n";
+}
+
+void LoopOptimizer::optimizeFunction(Stmt::Function* function) {
+  hasClosures.push_back(declaresClosures(function->body, false));
+  rewriteFunction(function);
+  hasClosures.pop_back();
+}
+
+LoopOptimizer::Effects LoopOptimizer::effectsOf(Stmt::While* loop) {
+  EffectScan scan;
+  scan.rewrite(loop->condition);
+  scan.rewrite(loop->body);
+
+  Effects effects;
+  effects.declared = std::move(scan.declared);
+  effects.assigns = std::move(scan.assigns);
+  effects.calls = scan.calls;
+  effects.sets = scan.sets;
+  effects.size = scan.nodeCount();
+  return effects;
+}
+
+bool LoopOptimizer::invariant(Expr::Expr* expr, const Effects& effects) {
+  if(dynamic_cast<Expr::Literal*>(expr)) return true;
+  if(dynamic_cast<Expr::This*>(expr)) return true;
+  if(auto* var = dynamic_cast<Expr::Variable*>(expr)) {
+    if(effects.changes(var->name.lexeme)) return false;
+    // a call can change anything but a local no closure sees
+    if(!effects.calls) return true;
+    return var->slot.kind == Expr::VarSlot::LOCAL && !hasClosures.back();
+  }
+  if(auto* grouping = dynamic_cast<Expr::Grouping*>(expr)) {
+    return invariant(grouping->expr.get(), effects);
+  }
+  if(auto* unop = dynamic_cast<Expr::Unop*>(expr)) {
+    return invariant(unop->expr.get(), effects);
+  }
+  if(auto* binop = dynamic_cast<Expr::Binop*>(expr)) {
+    return invariant(binop->left.get(), effects)
+      && invariant(binop->right.get(), effects);
+  }
+  if(auto* logical = dynamic_cast<Expr::Logical*>(expr)) {
+    return invariant(logical->left.get(), effects)
+      && invariant(logical->right.get(), effects);
+  }
+  if(auto* get = dynamic_cast<Expr::Get*>(expr)) {
+    return !effects.calls && !effects.sets
+      && invariant(get->object.get(), effects);
+  }
+  return false;
+}
+
+void LoopOptimizer::collectInvariants(Expr::ExprPtr& expr,
+    const Effects& effects, std::map<std::string, Expr::ExprPtr>& invariants) {
+  if(!expr) return;
+  Expr::Expr* node = expr.get();
+  bool operation = dynamic_cast<Expr::Binop*>(node)
+    || dynamic_cast<Expr::Unop*>(node) || dynamic_cast<Expr::Logical*>(node)
+    || dynamic_cast<Expr::Get*>(node);
+  if(operation && invariant(node, effects)) {
+    invariants.emplace(pureKey(node), expr);
+    return;
+  }
+  // only operands evaluated every time the expression is
+  if(auto* grouping = dynamic_cast<Expr::Grouping*>(node)) {
+    collectInvariants(grouping->expr, effects, invariants);
+  } else if(auto* unop = dynamic_cast<Expr::Unop*>(node)) {
+    collectInvariants(unop->expr, effects, invariants);
+  } else if(auto* binop = dynamic_cast<Expr::Binop*>(node)) {
+    collectInvariants(binop->left, effects, invariants);
+    collectInvariants(binop->right, effects, invariants);
+  } else if(auto* logical = dynamic_cast<Expr::Logical*>(node)) {
+    collectInvariants(logical->left, effects, invariants);
+  } else if(auto* call = dynamic_cast<Expr::Call*>(node)) {
+    collectInvariants(call->callee, effects, invariants);
+    for(auto& arg: call->arguments) collectInvariants(arg, effects, invariants);
+  } else if(auto* get = dynamic_cast<Expr::Get*>(node)) {
+    collectInvariants(get->object, effects, invariants);
+  } else if(auto* set = dynamic_cast<Expr::Set*>(node)) {
+    collectInvariants(set->object, effects, invariants);
+    collectInvariants(set->value, effects, invariants);
+  } else if(auto* assign = dynamic_cast<Expr::Assign*>(node)) {
+    collectInvariants(assign->value, effects, invariants);
+  }
+}
+
+bool LoopOptimizer::collectInvariants(Stmt::Stmt* stmt,
+    const Effects& effects, std::map<std::string, Expr::ExprPtr>& invariants) {
+  if(auto* exprStmt = dynamic_cast<Stmt::Expr*>(stmt)) {
+    collectInvariants(exprStmt->expr, effects, invariants);
+  } else if(auto* print = dynamic_cast<Stmt::Print*>(stmt)) {
+    collectInvariants(print->expr, effects, invariants);
+  } else if(auto* var = dynamic_cast<Stmt::Var*>(stmt)) {
+    collectInvariants(var->initializer, effects, invariants);
+  } else if(auto* block = dynamic_cast<Stmt::Block*>(stmt)) {
+    for(auto& statement: block->statements) {
+      if(!collectInvariants(statement.get(), effects, invariants)) return false;
+    }
+  } else if(auto* ifStmt = dynamic_cast<Stmt::If*>(stmt)) {
+    collectInvariants(ifStmt->condition, effects, invariants);
+    return !exits(stmt);
+  } else if(auto* loop = dynamic_cast<Stmt::While*>(stmt)) {
+    collectInvariants(loop->condition, effects, invariants);
+    return !exits(stmt);
+  } else if(auto* ret = dynamic_cast<Stmt::Return*>(stmt)) {
+    collectInvariants(ret->value, effects, invariants);
+    return false;
+  } else if(dynamic_cast<Stmt::Break*>(stmt)) {
+    return false;
+  }
+  return true;
+}
+
+void LoopOptimizer::markCounters(const Effects& effects) {
+  for(const auto& [name, assigns]: effects.assigns) {
+    if(effects.declared.contains(name)) continue;
+    std::vector<Value> steps;
+    for(Expr::Assign* assign: assigns) {
+      auto* binop = dynamic_cast<Expr::Binop*>(assign->value.get());
+      if(!binop || (binop->op.type != PLUS && binop->op.type != MINUS)) break;
+      auto* var = dynamic_cast<Expr::Variable*>(binop->left.get());
+      auto* literal = dynamic_cast<Expr::Literal*>(binop->right.get());
+      if(!var || var->name.lexeme != name || !literal) break;
+      Value step = literal->value->value;
+      if(!step.isNumber() || step.asNumber() == 0) break;
+      if(binop->op.type == MINUS) {
+        // a negated integer too big to store inline needs the heap
+        std::optional<Value> negated = Numbers::negate(step, nullptr);
+        if(!negated) break;
+        step = *negated;
+      }
+      steps.push_back(step);
+    }
+    // every update of the counter has to be a step
+    if(steps.size() != assigns.size()) continue;
+    for(size_t i = 0; i < assigns.size(); i++) assigns[i]->step = steps[i];
+    counters++;
+  }
+}
+
+Value LoopOptimizer::visitWhileStmt(Stmt::While* stmt) {
+  AstRewriter::visitWhileStmt(stmt);
+
+  Effects effects = effectsOf(stmt);
+  markCounters(effects);
+  if(effects.size > MAX_PEELED) return Nil();
+
+  std::map<std::string, Expr::ExprPtr> invariants;
+  collectInvariants(stmt->condition, effects, invariants);
+  // the condition is false or the body ran once by the time they're stored
+  collectInvariants(stmt->body.get(), effects, invariants);
+  invariants.erase("");
+  if(invariants.empty()) return Nil();
+
+  auto peeledBody = std::make_shared<Stmt::Block>(stmt->body);
+  std::map<std::string, Token> locals;
+  for(const auto& [key, expr]: invariants) {
+    // '$' can't appear in a scanned identifier
+    Token local(IDENTIFIER, "inv$" + std::to_string(++freshNames), stmt->line);
+    locals.emplace(key, local);
+    peeledBody->statements.push_back(
+        std::make_shared<Stmt::Var>(AstCloner().clone(expr), local));
+    hoisted++;
+  }
+
+  InvariantReplacer replacer(locals);
+  Expr::ExprPtr condition = AstCloner().clone(stmt->condition);
+  Stmt::StmtPtr body = AstCloner().clone(stmt->body);
+  replacer.rewrite(condition);
+  replacer.rewrite(body);
+  auto rest = std::make_shared<Stmt::While>(condition, body);
+  rest->line = stmt->line;
+  peeledBody->statements.push_back(rest);
+  peeledBody->statements.push_back(std::make_shared<Stmt::Break>(
+        Token(BREAK, "break", stmt->line)));
+
+  auto loop = std::make_shared<Stmt::While>(stmt->condition, peeledBody);
+  loop->line = stmt->line;
+  stmtReplacement = loop;
+  peeled++;
+  return Nil();
+}
+
+Value LoopOptimizer::visitClassStmt(Stmt::Class* stmt) {
+  for(auto& method: stmt->methods) optimizeFunction(method.get());
+  return Nil();
+}
+
+Value LoopOptimizer::visitFunctionStmt(Stmt::Function* stmt) {
+  optimizeFunction(stmt);
+  return Nil();
+}
@@ -1,13 +1,31 @@
 #include "../include/Lox.hpp"
+#include "../include/ClosureCompiler.hpp"
+#include "../include/CppTranslator.hpp"
 #include "../include/Parser.hpp"
 #include "../include/Scanner.hpp"
+#include "../include/SubexpressionEliminator.hpp"
+#include "../include/ConstantFolder.hpp"
+#include "../include/FunctionSpecializer.hpp"
+#include "../include/Inliner.hpp"
 #include "../include/Interpreter.hpp"
+#include "../include/IrBuilder.hpp"
+#include "../include/IrInterpreter.hpp"
+#include "../include/LoopOptimizer.hpp"
+#include "../include/PassManager.hpp"
 #include "../include/Resolver.hpp"
 #include "../include/TypeChecker.hpp"
+#include "../include/VM.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
 
 void Lox::runFile(std::string path) {
   std::ifstream input(path);
@@ -34,6 +52,35 @@ void Lox::runPrompt() {
 
 void Lox::run(std::string source) {
   if(hadError) return;
+  // on a thread of its own the native stack is as big as the budget says,
+  // not as ulimit -s allows
+  size_t stackSize = std::max(stackBudget, MIN_NATIVE_STACK);
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setstacksize(&attributes, stackSize);
+  std::pair<Lox*, const std::string*> work { this, &source };
+  pthread_t thread;
+  int failed = pthread_create(&thread, &attributes, [](void* arg) -> void* {
+    auto [lox, source] = *static_cast<std::pair<Lox*, const std::string*>*>(
+        arg);
+    lox->execute(*source);
+    return nullptr;
+  }, &work);
+  pthread_attr_destroy(&attributes);
+  if(failed) {
+    std::cerr << "Failed to make a native stack of " << stackSize
+      << " bytes" << std::endl;
+    hadError = true;
+    return;
+  }
+  pthread_join(thread, nullptr);
+}
+
+size_t Lox::nativeStackBudget() const {
+  return std::max(stackBudget, MIN_NATIVE_STACK) / 4 * 3;
+}
+
+void Lox::execute(const std::string& source) {
   Scanner scanner(source, *this);
   auto tokens = scanner.scanTokens();
 
@@ -43,7 +90,10 @@ void Lox::run(std::string source) {
 
   std::vector<StmtPtr> program = parser.parse();
   // Stop if there was a syntax error 
-  if(hadError) return;
+  if(hadError) {
+    heap.unpinAll();
+    return;
+  }
 
   Resolver resolver(interpreter, this);
   resolver.resolve(program);
@@ -52,9 +102,119 @@ void Lox::run(std::string source) {
   typechecker.typeCheck(program);
   
   // Stop if there was a resolver or type checker error 
-  if(hadError) return;
+  if(hadError) {
+    heap.unpinAll();
+    return;
+  }
+
+  int scriptSlotCount = resolver.scriptSlotCount();
+  if(optLevel >= 1) {
+    Inliner inliner(inlineBudget);
+    inliner.inlineCalls(program);
+    inliner.printSummary(std::cerr);
+
+    ConstantFolder folder(*this);
+    folder.fold(program);
+    folder.printSummary(std::cerr);
+
+    FunctionSpecializer specializer(*this, specializeLimit);
+    specializer.specialize(program);
+    specializer.printSummary(std::cerr);
 
-  interpreter.interpret(program);
+    LoopOptimizer loops;
+    loops.optimize(program);
+    loops.printSummary(std::cerr);
+
+    SubexpressionEliminator cse;
+    cse.optimize(program);
+    cse.printSummary(std::cerr, dumpCse);
+
+    // the passes added and dropped locals, lay the frames out again
+    Resolver optimized(interpreter, this);
+    optimized.resolve(program);
+    scriptSlotCount = optimized.scriptSlotCount();
+  }
+
+  if(!lox2cpp.empty()) {
+    CppTranslator translator(interpreter.globals);
+    std::string source = translator.translate(program, scriptSlotCount);
+    if(!buildExecutable(source, lox2cpp)) hadError = true;
+    heap.unpinAll();
+    return;
+  }
+
+  if(engine == Engine::IR || dumpIr) {
+    IrInterpreter irInterpreter(*this);
+    IR::Module module;
+    IrBuilder(irInterpreter).lower(program, module);
+
+    PassManager passes;
+    std::string problem;
+    std::string pipeline = irPasses.empty() && optLevel >= 1
+      ? PassManager::DEFAULT_PIPELINE : irPasses;
+    if(!passes.addPipeline(pipeline, problem)) {
+      std::cerr << problem << std::endl;
+      hadError = true;
+      heap.unpinAll();
+      return;
+    }
+    passes.run(module);
+    if(timePasses) passes.printTimings(std::cerr);
+    if(dumpIr) module.print(std::cerr);
+    if(engine == Engine::IR) irInterpreter.interpret(module);
+  }
+
+  if(engine == Engine::VM) {
+    VM vm(*this);
+    vm.interpret(program);
+  } else if(engine == Engine::TREE_WALKER || engine == Engine::CLOSURES) {
+    if(engine == Engine::CLOSURES) {
+      Closures::Body code = ClosureCompiler().compile(program);
+      interpreter.interpret(code, scriptSlotCount);
+    } else {
+      interpreter.interpret(program, scriptSlotCount);
+    }
+    if(icStats) interpreter.printCacheStats(std::cerr);
+    if(dumpQuickening) interpreter.printQuickening(std::cerr);
+    if(jitStats) interpreter.printJitStats(std::cerr);
+    if(traceStats) interpreter.printTraceStats(std::cerr);
+  }
+  heap.unpinAll();
+  if(memoStats) Native::printMemoStats(memoized, std::cerr);
+  if(gcStats) heap.printStats(std::cerr);
+}
+
+bool Lox::buildExecutable(const std::string& source,
+    const std::string& output) {
+  std::string path = output + ".cpp";
+  std::ofstream file(path);
+  file << source;
+  file.close();
+  if(!file) {
+    std::cerr << "Failed to write " << path << std::endl;
+    return false;
+  }
+  // no shell in between, the paths are passed exactly as they are, the
+  // ones that look like options as relative paths
+  auto pathArg = [](const std::string& name) {
+    return name.starts_with("-") ? "./" + name : name;
+  };
+  std::vector<std::string> args = {
+    LOX_CXX, "-std=c++23", "-O2", "-I", LOX_INCLUDE_DIR, pathArg(path),
+    LOX_RUNTIME, "-o", pathArg(output),
+  };
+  std::vector<char*> argv;
+  for(std::string& arg: args) argv.push_back(arg.data());
+  argv.push_back(nullptr);
+  pid_t pid;
+  int status;
+  if(posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0
+      || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+      || WEXITSTATUS(status) != 0) {
+    std::cerr << "Failed to compile " << path << std::endl;
+    return false;
+  }
+  return true;
 }
 
 void Lox::error(Token token, std::string message) {
@@ -1,16 +1,26 @@
 #include "../include/LoxClass.hpp"
+#include "../include/Heap.hpp"
 #include "../include/LoxFunction.hpp"
 #include "../include/LoxInstance.hpp"
 
 #include <iostream>
 
 LoxClass::LoxClass(const std::string &name,
-                   const std::map<std::string, FunPtr> &methods)
-    : name{name}, methods{methods} {}
+                   const std::map<std::string, LoxFunction *> &methods,
+                   Heap &heap)
+    : Callable(ObjType::CLASS), heap{heap}, name{name}, methods{methods},
+      rootShape{std::make_unique<Shape>(this)} {}
 
-FunPtr LoxClass::findMethod(const std::string &name) {
-  if (methods.contains(name)) {
-    return methods[name];
+void LoxClass::trace(Heap &heap) {
+  for (auto &[name, method] : methods) {
+    heap.markObject(method);
+  }
+}
+
+LoxFunction *LoxClass::findMethod(const std::string &name) {
+  auto it = methods.find(name);
+  if (it != methods.end()) {
+    return it->second;
   }
   return nullptr;
 }
@@ -20,11 +30,12 @@ std::string LoxClass::toString() {
   return name;
 }
 
+std::string LoxClass::label() {
+  return name;
+}
+
 int LoxClass::arity() { return 0; }
 
 Value LoxClass::call(Interpreter *interpreter, std::vector<Value> args) {
-  //LoxInstance instance = LoxInstance(this);
-  // return instance;
-  //return {std::make_shared<LoxInstance>(instance)};
-  return {std::make_shared<LoxInstance>(this)};
+  return LoxInstance::create(this, heap);
 }
@@ -1,38 +1,43 @@
 #include "../include/LoxFunction.hpp"
+#include "../include/Heap.hpp"
 #include "../include/Interpreter.hpp"
 #include "../include/LoxInstance.hpp"
 
 LoxFunction::LoxFunction(std::shared_ptr<Stmt::Function> declaration, 
-    std::shared_ptr<Environment> env)
-  : declaration{ declaration }, closure { std::move(env) } {}
+    std::vector<ObjUpvalue*> upvalues, bool isMethod, Value receiver)
+  : Callable(ObjType::FUNCTION), declaration{ declaration },
+  isMethod { isMethod }, receiver { receiver },
+  upvalues { std::move(upvalues) } {}
+
+void LoxFunction::trace(Heap& heap) {
+  for(ObjUpvalue* upvalue: upvalues) heap.markObject(upvalue);
+  heap.markValue(receiver);
+}
 
 std::string LoxFunction::toString() {
   return "fun type";
 }
 
+std::string LoxFunction::label() {
+  return declaration->name.lexeme;
+}
+
 int LoxFunction::arity() {
   return declaration->args.size();
 }
 
+const Stmt::Function& LoxFunction::getDeclaration() const {
+  return *declaration;
+}
+
+const Value* LoxFunction::boundReceiver() const {
+  return isMethod ? &receiver : nullptr;
+}
+
 Value LoxFunction::call(Interpreter* interpreter, std::vector<Value> args) {
-  std::shared_ptr<Environment> env = std::make_shared<Environment>(closure);
-
-  for(size_t i = 0; i < declaration->args.size(); i++) {
-    env->define(declaration->args[i].lexeme, args[i]);
-  }
-
-  try {
-    interpreter->executeBlock(declaration->body, env);
-  } catch(Return retval) {
-    return retval.value;
-  }
-  return Nil();
-}
-
-FunPtr LoxFunction::bind(LoxInstance* instance) {
-  std::shared_ptr<Environment> env = std::make_shared<Environment>(closure);
-  std::shared_ptr<LoxInstance> thisPtr = 
-    std::shared_ptr<LoxInstance>(instance, [](LoxInstance*){});
-  env->define("this", thisPtr);
-  return std::make_shared<LoxFunction>(declaration, env);
+  return interpreter->invoke(this, boundReceiver(), args);
+}
+
+LoxFunction* LoxFunction::bind(LoxInstance* instance, Heap& heap) {
+  return heap.make<LoxFunction>(declaration, upvalues, true, instance);
 }
@@ -1,28 +1,75 @@
 #include "../include/LoxInstance.hpp"
-#include "../include/LoxFunction.hpp"
+#include "../include/Heap.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <new>
 
-LoxInstance::LoxInstance(LoxClass *klass) : klass{klass} {}
+LoxInstance *LoxInstance::create(LoxClass *klass, Heap &heap) {
+  uint32_t capacity = klass->fieldCapacity;
+  return heap.makeWithTail<LoxInstance>(capacity * sizeof(Value), klass,
+                                        capacity);
+}
 
-LoxInstance::LoxInstance(const LoxInstance &other)
-    : klass{other.klass}, fields{other.fields} {}
+LoxInstance::LoxInstance(LoxClass *klass, uint32_t capacity)
+    : Obj(ObjType::INSTANCE), shape{klass->rootShape.get()},
+      fields{inlineFields()}, capacity{capacity} {
+  std::uninitialized_fill_n(fields, capacity, Value());
+}
 
-std::string LoxInstance::toString() { return klass->name + " instance"; }
+LoxInstance::~LoxInstance() {
+  if (fields != inlineFields())
+    delete[] fields;
+}
 
-Value LoxInstance::get(Token fieldName) {
-  if (fields.contains(fieldName.lexeme)) {
-    return fields[fieldName.lexeme];
+void LoxInstance::trace(Heap &heap) {
+  heap.markObject(shape->klass);
+  for (int i = 0; i < shape->fieldCount; i++) {
+    heap.markValue(fields[i]);
   }
+}
 
-  FunPtr method = klass->findMethod(fieldName.lexeme);
-  if (method)
-    return method->bind(this);
+std::string LoxInstance::toString() {
+  return shape->klass->name + " instance";
+}
 
-  throw RuntimeError(fieldName,
-                     "Undefined property '" + fieldName.lexeme + "'.");
+Value *LoxInstance::findField(const std::string &name) {
+  int slot = shape->slotOf(name);
+  if (slot < 0)
+    return nullptr;
+  return &fields[slot];
 }
 
-void LoxInstance::set(Token fieldName, Value value) {
-  fields[fieldName.lexeme] = value;
+void LoxInstance::setField(const std::string &name, const Value &value,
+                           Heap &heap) {
+  if (Value *field = findField(name)) {
+    *field = value;
+    return;
+  }
+  addField(shape->withField(name), value, heap);
 }
+
+void LoxInstance::addField(Shape *next, Value value, Heap &heap) {
+  uint32_t slot = shape->fieldCount;
+  if (slot == capacity) {
+    uint32_t grown = std::max<uint32_t>(capacity * 2, 4);
+    Value *moved = new Value[grown];
+    std::copy_n(fields, slot, moved);
+    if (fields != inlineFields()) {
+      delete[] fields;
+      heap.charge(this, (grown - capacity) * sizeof(Value));
+    } else {
+      heap.charge(this, grown * sizeof(Value));
+    }
+    fields = moved;
+    capacity = grown;
+  }
+  shape = next;
+  fields[slot] = value;
+
+  // later instances of the class get room for this many fields up front
+  LoxClass *klass = shape->klass;
+  klass->fieldCapacity = std::max<uint32_t>(klass->fieldCapacity, slot + 1);
+}
+
+LoxClass *LoxInstance::getClass() const { return shape->klass; }
@@ -1,15 +1,135 @@
 #include "../include/NativeFunctions.hpp"
+#include "../include/Heap.hpp"
+#include "../include/Lox.hpp"
 
-Native::Clock::Clock(const std::shared_ptr<Clock>& other) {}
+#include <cstring>
 
-Native::Clock::Clock() { }
+Native::Clock::Clock() : Callable(ObjType::NATIVE) { }
 
 std::string Native::Clock::toString() { return "() -> Number"; }
 
+std::string Native::Clock::label() { return "clock"; }
+
 int Native::Clock::arity() { return 0; }
 
 Value Native::Clock::call(Interpreter* interpreter, std::vector<Value> args) {
-  return std::chrono::duration<float>(
+  return std::chrono::duration<double>(
         std::chrono::system_clock::now().time_since_epoch()
     ).count();
 }
+
+void Native::printMemoStats(const std::deque<MemoStats>& stats,
+    std::ostream& out) {
+  for(const MemoStats& function: stats) {
+    size_t cached = function.hits + function.misses;
+    out << "[memo] " << function.function << ": " << function.hits
+        << " hits, " << function.misses << " misses";
+    if(cached > 0) out << " (" << function.hits * 100 / cached << "% hits)";
+    out << ", " << function.evictions << " evictions, " << function.uncached
+        << " calls not cached\n";
+  }
+}
+
+Native::Memoize::Memoize(Heap& heap, size_t capacity,
+    std::deque<MemoStats>& stats)
+  : Callable(ObjType::NATIVE), heap { heap }, capacity { capacity },
+    stats { stats } {}
+
+std::string Native::Memoize::toString() { return "(Function) -> Function"; }
+
+std::string Native::Memoize::label() { return "memoize"; }
+
+int Native::Memoize::arity() { return 1; }
+
+Value Native::Memoize::call(Interpreter* interpreter, std::vector<Value> args) {
+  if(!args[0].isCallable()) {
+    throw NativeError("Can only memoize functions and classes.");
+  }
+  stats.push_back({ args[0].asCallable()->label() });
+  return heap.make<Memoized>(heap, args[0], capacity, stats.back());
+}
+
+Native::Memoized::Memoized(Heap& heap, Value function, size_t capacity,
+    MemoStats& stats)
+  : Callable(ObjType::NATIVE), heap { heap }, function { function },
+    capacity { capacity }, stats { stats } {}
+
+void Native::Memoized::trace(Heap& heap) {
+  heap.markValue(function);
+  for(const Entry& entry: entries) heap.markValue(entry.result);
+}
+
+std::string Native::Memoized::toString() {
+  return function.asCallable()->toString();
+}
+
+std::string Native::Memoized::label() {
+  return function.asCallable()->label();
+}
+
+int Native::Memoized::arity() { return function.asCallable()->arity(); }
+
+bool Native::Memoized::makeKey(const std::vector<Value>& args,
+    std::string& key) {
+  auto append = [&](char tag, const void* bytes, size_t size) {
+    key += tag;
+    key.append(static_cast<const char*>(bytes), size);
+  };
+  for(const Value& arg: args) {
+    // integers and doubles stay apart, 1 and 1.0 may give different results
+    if(arg.isInt()) {
+      int64_t value = arg.asInt();
+      append('i', &value, sizeof(value));
+    } else if(arg.isDouble()) {
+      double value = arg.asDouble();
+      append('d', &value, sizeof(value));
+    } else if(arg.isString()) {
+      const std::string& chars = arg.asString()->chars;
+      size_t size = chars.size();
+      append('s', &size, sizeof(size));
+      key += chars;
+    } else if(arg.isBool()) {
+      key += arg.asBool() ? 't' : 'f';
+    } else if(arg.isNil()) {
+      key += 'n';
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+Value Native::Memoized::call(Interpreter* interpreter, std::vector<Value> args) {
+  std::string key;
+  if(!makeKey(args, key)) {
+    stats.uncached++;
+    return function.asCallable()->call(interpreter, std::move(args));
+  }
+  auto found = index.find(key);
+  if(found != index.end()) {
+    stats.hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->result;
+  }
+
+  stats.misses++;
+  Value result = function.asCallable()->call(interpreter, std::move(args));
+  if(capacity == 0) return result;
+  // the call may have got here with the same arguments itself
+  found = index.find(key);
+  if(found != index.end()) {
+    entries.splice(entries.begin(), entries, found->second);
+    found->second->result = result;
+    return result;
+  }
+  if(entries.size() == capacity) {
+    index.erase(entries.back().key);
+    entries.pop_back();
+    stats.evictions++;
+  } else {
+    heap.charge(this, sizeof(Entry) + 2 * sizeof(void*) + key.size());
+  }
+  entries.push_front({ std::move(key), result });
+  index.emplace(entries.front().key, entries.begin());
+  return result;
+}
@@ -0,0 +1,107 @@
+#include "../include/Numbers.hpp"
+#include "../include/Heap.hpp"
+
+namespace {
+
+std::optional<Value> integer(int64_t value, Heap* heap) {
+  if(Value::fitsSmallInt(value)) return Value::smallInt(value);
+  if(!heap) return std::nullopt;
+  return heap->makeInteger(value);
+}
+
+}
+
+namespace Numbers {
+
+bool isBitwise(Op op) {
+  return op >= Op::BIT_AND;
+}
+
+namespace {
+
+bool isShift(Op op) {
+  return op == Op::SHIFT_LEFT || op == Op::SHIFT_RIGHT;
+}
+
+}
+
+bool accepts(Op op, Value left, Value right) {
+  if(isShift(op)) {
+    return left.isInt() && right.isInt()
+      && right.asInt() >= 0 && right.asInt() < 64;
+  }
+  if(isBitwise(op)) return left.isInt() && right.isInt();
+  return left.isNumber() && right.isNumber();
+}
+
+const char* operandError(Op op, Value left, Value right) {
+  if(isShift(op) && left.isInt() && right.isInt()) {
+    return "Shift count must be between 0 and 63.";
+  }
+  return isBitwise(op) ? "Operands must be integers." :
+    "Operands must be a number.";
+}
+
+std::optional<Value> binary(Op op, Value left, Value right, Heap* heap) {
+  if(left.isInt() && right.isInt()) {
+    int64_t a = left.asInt(), b = right.asInt(), r;
+    switch(op) {
+      case Op::ADD:
+        if(!__builtin_add_overflow(a, b, &r)) return integer(r, heap);
+        break;
+      case Op::SUBTRACT:
+        if(!__builtin_sub_overflow(a, b, &r)) return integer(r, heap);
+        break;
+      case Op::MULTIPLY:
+        if(!__builtin_mul_overflow(a, b, &r)) return integer(r, heap);
+        break;
+      case Op::DIVIDE: break;
+      case Op::LESS: return Value(a < b);
+      case Op::LESS_EQUAL: return Value(a <= b);
+      case Op::GREATER: return Value(a > b);
+      case Op::GREATER_EQUAL: return Value(a >= b);
+      case Op::BIT_AND: return integer(a & b, heap);
+      case Op::BIT_OR: return integer(a | b, heap);
+      case Op::BIT_XOR: return integer(a ^ b, heap);
+      case Op::SHIFT_LEFT:
+        return integer(static_cast<int64_t>(static_cast<uint64_t>(a) << b),
+            heap);
+      case Op::SHIFT_RIGHT: return integer(a >> b, heap);
+    }
+  }
+
+  // overflowed, divided or one of them is a double
+  double a = left.asNumber(), b = right.asNumber();
+  switch(op) {
+    case Op::ADD: return Value(a + b);
+    case Op::SUBTRACT: return Value(a - b);
+    case Op::MULTIPLY: return Value(a * b);
+    case Op::DIVIDE: return Value(a / b);
+    case Op::LESS: return Value(a < b);
+    case Op::LESS_EQUAL: return Value(a <= b);
+    case Op::GREATER: return Value(a > b);
+    case Op::GREATER_EQUAL: return Value(a >= b);
+    default: return std::nullopt;
+  }
+}
+
+std::optional<Value> negate(Value value, Heap* heap) {
+  if(value.isInt() && value.asInt() != INT64_MIN) {
+    return integer(-value.asInt(), heap);
+  }
+  return Value(-value.asNumber());
+}
+
+std::optional<Value> add(Value value, int64_t delta, Heap* heap) {
+  int64_t r;
+  if(value.isInt() && !__builtin_add_overflow(value.asInt(), delta, &r)) {
+    return integer(r, heap);
+  }
+  return Value(value.asNumber() + delta);
+}
+
+std::optional<Value> complement(Value value, Heap* heap) {
+  return integer(~value.asInt(), heap);
+}
+
+}
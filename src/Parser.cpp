@@ -3,7 +3,15 @@
 //#include "../include/Expr.hpp"
 //#include "../include/Stmt.hpp"
 
+Parser::Nesting::Nesting(Parser& parser) {
+  uintptr_t native = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if(parser.nativeStackBase - native > parser.nativeStackBudget) {
+    throw parser.parserError(parser.peek(), "Nested too deeply.");
+  }
+}
+
 ExprPtr Parser::expression() {
+  Nesting level(*this);
   return assignment();
 }
 
@@ -31,6 +39,7 @@ ExprPtr Parser::assignment() {
   ExprPtr expr = orExpr();
 
   if(match(EQUAL)) {
+    Nesting level(*this);
     Token equals = previous();
     ExprPtr value = assignment();
 
@@ -57,8 +66,9 @@ ExprPtr Parser::equality() {
 }
 
 ExprPtr Parser::comparison() {
-  auto expr = term();
+  auto expr = bitwiseOr();
   while(match(GREATER, GREATER_EQUAL, LESS, LESS_EQUAL)) {
+    Nesting level(*this);
     Token op = previous();
     auto right = comparison();
     expr = std::make_unique<Expr::Binop>(std::move(expr), op, std::move(right));
@@ -66,6 +76,48 @@ ExprPtr Parser::comparison() {
   return expr;
 }
 
+// bitwise operators bind tighter than comparisons, `a & 1 == 1` compares
+// the result
+ExprPtr Parser::bitwiseOr() {
+  auto expr = bitwiseXor();
+  while(match(PIPE)) {
+    Token op = previous();
+    auto right = bitwiseXor();
+    expr = std::make_unique<Expr::Binop>(std::move(expr), op, std::move(right));
+  }
+  return expr;
+}
+
+ExprPtr Parser::bitwiseXor() {
+  auto expr = bitwiseAnd();
+  while(match(CARET)) {
+    Token op = previous();
+    auto right = bitwiseAnd();
+    expr = std::make_unique<Expr::Binop>(std::move(expr), op, std::move(right));
+  }
+  return expr;
+}
+
+ExprPtr Parser::bitwiseAnd() {
+  auto expr = shift();
+  while(match(AMPERSAND)) {
+    Token op = previous();
+    auto right = shift();
+    expr = std::make_unique<Expr::Binop>(std::move(expr), op, std::move(right));
+  }
+  return expr;
+}
+
+ExprPtr Parser::shift() {
+  auto expr = term();
+  while(match(LESS_LESS, GREATER_GREATER)) {
+    Token op = previous();
+    auto right = term();
+    expr = std::make_unique<Expr::Binop>(std::move(expr), op, std::move(right));
+  }
+  return expr;
+}
+
 ExprPtr Parser::term() {
   auto expr = factor();
   while(match(MINUS, PLUS)) {
@@ -87,7 +139,8 @@ ExprPtr Parser::factor() {
 }
 
 ExprPtr Parser::unary() {
-  if(match(BANG, MINUS, PLUSPLUS, MINUSMINUS)) {
+  if(match(BANG, MINUS, PLUSPLUS, MINUSMINUS, TILDE)) {
+    Nesting level(*this);
     Token op = previous();
     auto right = unary();
     return std::make_unique<Expr::Unop>(op, std::move(right));
@@ -96,16 +149,22 @@ ExprPtr Parser::unary() {
 }
 
 ExprPtr Parser::call() {
-  ExprPtr expr = primary();
-  while(true) {
-    if(match(LEFT_PAREN)) {
-      expr = finishCall(expr);
-    } else if(match(DOT)) {
-      Token name = consume(IDENTIFIER, "Expect property name after '.'.");
-      expr = std::make_shared<Expr::Get>(expr, name);
-    } else break;
+  return suffix(primary());
+}
+
+// every call and property read of a.b().c nests one level deeper, so it
+// recurses like the passes that walk it later
+ExprPtr Parser::suffix(ExprPtr expr) {
+  if(match(LEFT_PAREN)) {
+    expr = finishCall(expr);
+  } else if(match(DOT)) {
+    Token name = consume(IDENTIFIER, "Expect property name after '.'.");
+    expr = std::make_shared<Expr::Get>(expr, name);
+  } else {
+    return expr;
   }
-  return expr;
+  Nesting level(*this);
+  return suffix(std::move(expr));
 }
 
 ExprPtr Parser::finishCall(ExprPtr callee) {
@@ -249,6 +308,7 @@ StmtPtr Parser::whileStatement() {
 
 StmtPtr Parser::forStatement() {
   consume(LEFT_PAREN, "Expect '(' after 'for'.");
+  int line = previous().line;
   StmtPtr initializer; 
   if(match(SEMICOLON)) {
     initializer = nullptr;
@@ -280,7 +340,10 @@ StmtPtr Parser::forStatement() {
   }
 
   if(!condition) condition = std::make_shared<Expr::Literal>(true);
-  body = std::make_shared<Stmt::While>(std::move(condition), std::move(body));
+  auto loop = std::make_shared<Stmt::While>(std::move(condition),
+      std::move(body));
+  loop->line = line;
+  body = loop;
 
   if(initializer) {
     body = std::make_shared<Stmt::Block>(
@@ -303,6 +366,7 @@ StmtPtr Parser::returnStatement() {
 }
 
 StmtPtr Parser::statement() {
+  Nesting level(*this);
   if(match(FOR)) return forStatement();
   if(match(IF)) return ifStatement();
   if(match(PRINT)) return printStatement();
@@ -372,6 +436,7 @@ StmtPtr Parser::classDeclaration() {
 }
 
 std::shared_ptr<Stmt::Function> Parser::function(std::string kind) {
+  Nesting level(*this);
   Token name = consume(IDENTIFIER, "Expect " + kind + " name.");
   consume(LEFT_PAREN, "Expect '(' after " + kind + " name.");
   std::vector<Token> args {};
@@ -402,9 +467,15 @@ StmtPtr Parser::varDeclaration() {
 }
 
 Parser::Parser(std::vector<Token> tokens, Lox& lox) :
-  tokens { tokens }, current { 0 }, lox { lox } {}
+  tokens { tokens }, current { 0 }, lox { lox }
+{
+  // a quarter, the passes after the parser and destroying the tree recurse
+  // as deep with up to a few times the stack a level
+  nativeStackBudget = lox.nativeStackBudget() / 4;
+}
 
 std::vector<StmtPtr> Parser::parse() {
+  nativeStackBase = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
   std::vector<StmtPtr> statements;
   while(!isAtEnd()) {
     statements.push_back(declaration());
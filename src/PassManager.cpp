@@ -0,0 +1,86 @@
+#include "../include/PassManager.hpp"
+#include "../include/IrPasses.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+PassTimings::Entry& PassTimings::entry(const std::string& name,
+    bool analysis) {
+  for(auto& entry: entries) {
+    if(entry.name == name && entry.analysis == analysis) return entry;
+  }
+  entries.push_back({ name, analysis });
+  return entries.back();
+}
+
+void PassTimings::print(std::ostream& out) const {
+  std::chrono::duration<double, std::milli> total { 0 };
+  for(const auto& entry: entries) {
+    out << "[ir] " << (entry.analysis ? "analysis " : "pass ") << entry.name
+      << ": " << entry.runs << " runs";
+    if(!entry.analysis) out << ", " << entry.changed << " changed";
+    out << ", " << std::fixed << std::setprecision(3) << entry.time.count()
+      << " ms\n";
+    // analyses run inside the passes that asked for them
+    if(!entry.analysis) total += entry.time;
+  }
+  out << "[ir] total: " << std::fixed << std::setprecision(3) << total.count()
+    << " ms\n";
+}
+
+AnalysisManager::AnalysisManager(PassTimings& timings) : timings { timings } {}
+
+const DominatorTree& AnalysisManager::dominatorsOf(
+    const IR::Function& function) {
+  auto& tree = dominators[&function];
+  if(!tree) {
+    auto start = std::chrono::steady_clock::now();
+    tree = std::make_unique<DominatorTree>(function);
+    PassTimings::Entry& entry = timings.entry("dominators", true);
+    entry.runs++;
+    entry.time += std::chrono::steady_clock::now() - start;
+  }
+  return *tree;
+}
+
+void AnalysisManager::invalidate(const IR::Function& function) {
+  dominators.erase(&function);
+}
+
+void PassManager::add(std::unique_ptr<Pass> pass) {
+  passes.push_back(std::move(pass));
+}
+
+bool PassManager::addPipeline(const std::string& pipeline,
+    std::string& error) {
+  std::stringstream names(pipeline);
+  std::string name;
+  while(std::getline(names, name, ',')) {
+    if(name.empty()) continue;
+    std::unique_ptr<Pass> pass = createPass(name);
+    if(!pass) {
+      error = "Unknown IR pass '" + name + "'.";
+      return false;
+    }
+    add(std::move(pass));
+  }
+  return true;
+}
+
+void PassManager::run(IR::Module& module) {
+  AnalysisManager analyses(timings);
+  for(const auto& function: module.functions) {
+    for(const auto& pass: passes) {
+      auto start = std::chrono::steady_clock::now();
+      bool changed = pass->run(*function, analyses);
+      PassTimings::Entry& entry = timings.entry(pass->name(), false);
+      entry.runs++;
+      entry.time += std::chrono::steady_clock::now() - start;
+      if(changed) {
+        entry.changed++;
+        analyses.invalidate(*function);
+      }
+    }
+    function->renumber();
+  }
+}
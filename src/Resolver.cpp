@@ -1,5 +1,6 @@
 #include "../include/Resolver.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 //#define DEBUG
@@ -19,33 +20,90 @@ void Resolver::resolve(Stmt::StmtPtr stmt) {
 }
 
 void Resolver::resolve(Stmt::Stmts statements) {
+  // only the program itself is resolved outside of every scope
+  bool program = scopes.empty();
   for(const auto& statement: statements) {
     resolve(statement);
   }
+  if(program && lox->checkPurity) checkPurity();
 }
 
-void Resolver::resolveLocal(Expr::Expr* expr, Token name) {
-  for(int i = scopes.size() - 1; i >= 0; i--) {
-    if(scopes.at(i).contains(name.lexeme)) {
-      interpreter.resolve(expr, scopes.size() - 1 - i);
-      return;
-    }
+int Resolver::scriptSlotCount() const {
+  return functions.front().slotCount;
+}
+
+void Resolver::resolveLocal(Expr::VarSlot& slot, const Token& name) {
+  size_t current = functions.size() - 1;
+  if(Local* local = findLocal(current, name.lexeme)) {
+    slot = { Expr::VarSlot::LOCAL, local->slot };
+    return;
+  }
+  int upvalue = resolveUpvalue(current, name.lexeme);
+  if(upvalue >= 0) {
+    slot = { Expr::VarSlot::UPVALUE, upvalue };
+    return;
+  }
+  slot = { Expr::VarSlot::GLOBAL, interpreter.globals.slotFor(name.lexeme) };
+}
+
+Resolver::Local* Resolver::findLocal(size_t function,
+    const std::string& name) {
+  size_t end = function + 1 < functions.size()
+    ? functions[function + 1].firstScope : scopes.size();
+  for(size_t i = end; i > functions[function].firstScope; i--) {
+    auto it = scopes[i - 1].find(name);
+    if(it != scopes[i - 1].end()) return &it->second;
+  }
+  return nullptr;
+}
+
+int Resolver::resolveUpvalue(size_t function, const std::string& name) {
+  // the script has nothing around it to capture from
+  if(function == 0) return -1;
+
+  if(Local* local = findLocal(function - 1, name)) {
+    local->captured = true;
+    return addUpvalue(function, true, local->slot);
   }
+  int upvalue = resolveUpvalue(function - 1, name);
+  if(upvalue >= 0) return addUpvalue(function, false, upvalue);
+  return -1;
+}
+
+int Resolver::addUpvalue(size_t function, bool isLocal, int index) {
+  auto& upvalues = functions[function].function->upvalues;
+  for(size_t i = 0; i < upvalues.size(); i++) {
+    if(upvalues[i].isLocal == isLocal && upvalues[i].index == index) return i;
+  }
+  upvalues.push_back({ isLocal, index });
+  return upvalues.size() - 1;
 }
 
 void Resolver::resolveFunction(Stmt::Function* function,
     FunctionType type) {
   FunctionType enclosingFunction = currentFunction;
   currentFunction = type;
+  // a loop around the declaration can't be broken out of from the body
+  bool enclosingLoopState = inLoop;
+  inLoop = false;
 
+  function->upvalues.clear();
+  functions.push_back({ function, scopes.size() });
   beginScope();
+  // methods get their receiver as an implicit first slot
+  if(type == FunctionType::METHOD) {
+    scopes.back().insert({"this", { true, functions.back().nextSlot++ }});
+  }
   for(const auto& param: function->args) {
     declare(param);
     define(param);
   }
   resolve(function->body);
   endScope();
+  function->slotCount = functions.back().slotCount;
+  functions.pop_back();
 
+  inLoop = enclosingLoopState;
   currentFunction = enclosingFunction;
 }
 
@@ -56,34 +114,94 @@ void Resolver::beginScope() {
 
 void Resolver::endScope() {
   DEBPRINT("closing scope!");
+  FunctionScope& function = functions.back();
+  function.slotCount = std::max(function.slotCount, function.nextSlot);
+  function.nextSlot -= scopes.back().size();
   scopes.pop_back();
 }
 
-void Resolver::declare(Token name) {
-  if(scopes.empty()) return;
+Expr::VarSlot Resolver::declare(Token name) {
+  if(scopes.empty()) {
+    return { Expr::VarSlot::GLOBAL, interpreter.globals.slotFor(name.lexeme) };
+  }
   DEBPRINT("Declaring: " + name.lexeme);
   Scope& scope = scopes.back();
   if(scope.contains(name.lexeme)) {
     lox->error(name,
         "Already a variable with this name in this scope");
+    return { Expr::VarSlot::LOCAL, scope[name.lexeme].slot };
   }
-  scope[name.lexeme] = false;
+  int slot = functions.back().nextSlot++;
+  scope[name.lexeme] = { false, slot };
+  return { Expr::VarSlot::LOCAL, slot };
 }
 
 void Resolver::define(Token name) {
   if(scopes.empty()) return;
   DEBPRINT("Defining: " + name.lexeme);
-  scopes.back()[name.lexeme] = true;
+  scopes.back()[name.lexeme].defined = true;
+}
+
+void Resolver::markImpure(const std::string& reason) {
+  // the script itself may do anything
+  if(!lox->checkPurity || functions.size() == 1) return;
+  impurities.try_emplace(functions.back().function, reason);
+}
+
+// remembers `f` of a `memoize(f)` that calls the native
+void Resolver::noteMemoized(Expr::Call* expr) {
+  auto* callee = dynamic_cast<Expr::Variable*>(expr->callee.get());
+  if(!callee || callee->name.lexeme != "memoize" || !callee->slot.isGlobal()
+      || expr->arguments.size() != 1) {
+    return;
+  }
+  auto* argument = dynamic_cast<Expr::Variable*>(expr->arguments[0].get());
+  if(!argument) return;
+  if(argument->slot.isGlobal()) {
+    memoized.push_back({ argument->name, nullptr });
+    return;
+  }
+  for(size_t i = scopes.size(); i > 0; i--) {
+    auto it = scopes[i - 1].find(argument->name.lexeme);
+    if(it == scopes[i - 1].end()) continue;
+    if(it->second.function) {
+      memoized.push_back({ argument->name, it->second.function });
+    }
+    return;
+  }
+}
+
+void Resolver::checkPurity() {
+  for(const auto& [name, function]: memoized) {
+    Stmt::Function* declaration = function;
+    if(!declaration) {
+      auto it = globalFunctions.find(name.lexeme);
+      if(it == globalFunctions.end()) continue;
+      declaration = it->second;
+    }
+    auto impurity = impurities.find(declaration);
+    if(impurity != impurities.end()) {
+      lox->error(name, "Memoized function '" + name.lexeme + "' "
+          + impurity->second + ".");
+    }
+  }
 }
 
 Resolver::Resolver(Interpreter& interpreter, Lox* lox)
   : interpreter { interpreter }, scopes {}, lox {lox},
-   inLoop {false} {}
+   inLoop {false} {
+  functions.push_back({ nullptr, 0 });
+}
 
 
 Value Resolver::visitBinop(Expr::Binop* expr) {
-  resolve(expr->left);
-  resolve(expr->right);
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  resolve(chain.front()->left);
+  for(Expr::Binop* binop: chain) {
+    binop->chain.clear();
+    resolve(binop->right);
+  }
+  if(chain.size() > 1) expr->chain = std::move(chain);
   return Nil();
 }
 
@@ -108,11 +226,13 @@ Value Resolver::visitExprStmt(Stmt::Expr* exprstmt) {
 
 Value Resolver::visitPrintStmt(Stmt::Print* stmt) {
   resolve(stmt->expr);
+  markImpure("prints");
   return Nil();
 }
 
 Value Resolver::visitVarStmt(Stmt::Var* stmt) {
-  declare(stmt->name);
+  stmt->slot = declare(stmt->name);
+  if(stmt->slot.isGlobal()) globalFunctions.erase(stmt->name.lexeme);
   if(stmt->initializer) {
     resolve(stmt->initializer);
   }
@@ -122,23 +242,32 @@ Value Resolver::visitVarStmt(Stmt::Var* stmt) {
 
 Value Resolver::visitVariableExpr(Expr::Variable* var) {
   if(!scopes.empty() && scopes.back().contains(var->name.lexeme) 
-     && !scopes.back()[var->name.lexeme]) {
+     && !scopes.back()[var->name.lexeme].defined) {
     lox->error(var->name, "Can't read local variable in its own initializer."); 
   } else {
-    resolveLocal(var, var->name);
+    resolveLocal(var->slot, var->name);
   }
   return Nil();
 }
 
 Value Resolver::visitAssign(Expr::Assign* expr) {
   resolve(expr->value);
-  resolveLocal(expr, expr->name);
+  resolveLocal(expr->slot, expr->name);
+  if(expr->slot.kind != Expr::VarSlot::LOCAL) {
+    markImpure("assigns '" + expr->name.lexeme
+        + "', which isn't one of its locals");
+  }
   return Nil();
 }
 
 Value Resolver::visitBlockStmt(Stmt::Block* stmt) {
+  stmt->firstSlot = functions.back().nextSlot;
   beginScope();
   resolve(stmt->statements);  
+  stmt->closesUpvalues = false;
+  for(const auto& [name, local]: scopes.back()) {
+    if(local.captured) stmt->closesUpvalues = true;
+  }
   endScope();
   return Nil();
 }
@@ -151,8 +280,13 @@ Value Resolver::visitIfStmt(Stmt::If* stmt) {
 }
 
 Value Resolver::visitLogical(Expr::Logical* expr) {
-  resolve(expr->left);
-  resolve(expr->right);
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  resolve(chain.front()->left);
+  for(Expr::Logical* logical: chain) {
+    logical->chain.clear();
+    resolve(logical->right);
+  }
+  if(chain.size() > 1) expr->chain = std::move(chain);
   return Nil();
 }
 
@@ -179,12 +313,18 @@ Value Resolver::visitCall(Expr::Call* expr) {
   for(const auto& arg: expr->arguments) {
     resolve(arg);
   }
+  if(lox->checkPurity) noteMemoized(expr);
   return Nil();
 }
 
 Value Resolver::visitFunctionStmt(Stmt::Function* stmt) {
-  declare(stmt->name);
+  stmt->slot = declare(stmt->name);
   define(stmt->name);
+  if(stmt->slot.isGlobal()) {
+    globalFunctions[stmt->name.lexeme] = stmt;
+  } else {
+    scopes.back()[stmt->name.lexeme].function = stmt;
+  }
 
   resolveFunction(stmt, FunctionType::FUNCTION);
   return Nil();
@@ -195,6 +335,8 @@ Value Resolver::visitReturnStmt(Stmt::Return* stmt) {
     lox->error(stmt->keyword, "Return statement outside of a function.");
   }
   if(stmt->value) resolve(stmt->value);
+  stmt->tailCall = currentFunction != FunctionType::NONE
+    && dynamic_cast<Expr::Call*>(stmt->value.get());
   return Nil();
 }
 
@@ -202,18 +344,15 @@ Value Resolver::visitClassStmt(Stmt::Class* stmt) {
   ClassType enclosingClass = currentClass;
   currentClass = ClassType::CLASS;
 
-  declare(stmt->name);
+  stmt->slot = declare(stmt->name);
   define(stmt->name);
-
-  beginScope();
-  scopes.back().insert({"this", true});
+  if(stmt->slot.isGlobal()) globalFunctions.erase(stmt->name.lexeme);
 
   for(auto& method: stmt->methods) {
     FunctionType declaration = FunctionType::METHOD;
     resolveFunction(method.get(), declaration);
   }
 
-  endScope();
   currentClass = enclosingClass;
 
   return Nil();
@@ -235,6 +374,6 @@ Value Resolver::visitThisExpr(Expr::This* expr) {
     return Nil();
   }
 
-  resolveLocal(expr, expr->keyword);
+  resolveLocal(expr->slot, expr->keyword);
   return Nil();
 }
@@ -0,0 +1,379 @@
+#include "../include/Runtime.hpp"
+#include "../include/NativeFunctions.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sys/resource.h>
+
+AotFunction::AotFunction(Runtime& runtime, Code code, std::string name,
+    int params, int frameSize, int line, bool isMethod,
+    std::vector<ObjUpvalue*> upvalues, Value receiver)
+  : Callable(ObjType::AOT_FUNCTION), runtime { runtime }, code { code },
+    name { std::move(name) }, params { params }, frameSize { frameSize },
+    line { line }, isMethod { isMethod }, receiver { receiver },
+    upvalues { std::move(upvalues) } {}
+
+void AotFunction::trace(Heap& heap) {
+  for(ObjUpvalue* upvalue: upvalues) heap.markObject(upvalue);
+  heap.markValue(receiver);
+}
+
+std::string AotFunction::toString() { return "fun type"; }
+
+std::string AotFunction::label() { return name; }
+
+int AotFunction::arity() { return params; }
+
+Value AotFunction::call(Interpreter* interpreter, std::vector<Value> args) {
+  return runtime.callFromHost(Value(this), args);
+}
+
+AotClass::AotClass(const std::string& name, Heap& heap)
+  : LoxClass(name, {}, heap) {}
+
+void AotClass::trace(Heap& heap) {
+  LoxClass::trace(heap);
+  for(auto& [name, method]: aotMethods) heap.markObject(method);
+}
+
+AotFunction* AotClass::findAotMethod(const std::string& name) {
+  auto it = aotMethods.find(name);
+  if(it == aotMethods.end()) return nullptr;
+  return it->second;
+}
+
+Runtime::Runtime() : stack(STACK_MAX) {
+  top = stack.data();
+  // three quarters, like the interpreter
+  rlimit limit;
+  nativeStackBudget = getrlimit(RLIMIT_STACK, &limit) == 0
+      && limit.rlim_cur != RLIM_INFINITY ? limit.rlim_cur / 4 * 3 : 6 << 20;
+  heap.addRoots(this);
+  globals.define(globals.slotFor("clock"), heap.make<Native::Clock>());
+  globals.define(globals.slotFor("memoize"), heap.make<Native::Memoize>(heap,
+      Native::Memoize::DEFAULT_CAPACITY, memoized));
+}
+
+Runtime::~Runtime() {
+  heap.removeRoots(this);
+}
+
+int Runtime::run(AotFunction::Code script, int frameSize) {
+  nativeStackBase = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  top = stack.data() + frameSize;
+  try {
+    script(*this, nullptr, stack.data());
+  } catch(const RuntimeError& error) {
+    std::cerr << error.what() << "\n[line " << error.token.line << "]\n";
+    return 70;
+  }
+  return 0;
+}
+
+void Runtime::markRoots(Heap& heap) {
+  for(Value* slot = stack.data(); slot < top; slot++) heap.markValue(*slot);
+  for(ObjUpvalue* upvalue: openUpvalues) heap.markObject(upvalue);
+  globals.mark(heap);
+}
+
+void Runtime::fail(int line, const std::string& message) {
+  throw RuntimeError(Token(IDENTIFIER, "", line), message);
+}
+
+void Runtime::undefined(int slot, int line) {
+  const std::string& name = globals.nameOf(slot);
+  throw RuntimeError(Token(IDENTIFIER, name, line),
+      "Undefined variable '" + name + "'.");
+}
+
+Value Runtime::string(std::string chars) {
+  ObjString* string = heap.makeString(std::move(chars));
+  heap.pin(string);
+  return string;
+}
+
+Value Runtime::integer(int64_t value) {
+  Value boxed = heap.makeInteger(value);
+  if(boxed.isObj()) heap.pin(boxed.asObj());
+  return boxed;
+}
+
+// the upvalues are made first, while they are reachable from
+// openUpvalues or the enclosing function
+Value Runtime::function(AotFunction::Code code, const char* name, int params,
+    int frameSize, int line, bool isMethod, AotFunction* enclosing,
+    Value* frame, std::initializer_list<Capture> captures) {
+  std::vector<ObjUpvalue*> upvalues;
+  upvalues.reserve(captures.size());
+  for(const Capture& capture: captures) {
+    if(capture.isLocal) {
+      upvalues.push_back(captureUpvalue(frame + capture.index));
+    } else {
+      upvalues.push_back(enclosing->upvalues[capture.index]);
+    }
+  }
+  return heap.make<AotFunction>(*this, code, name, params, frameSize, line,
+      isMethod, std::move(upvalues));
+}
+
+Value Runtime::makeClass(const char* name) {
+  return heap.make<AotClass>(name, heap);
+}
+
+void Runtime::addMethod(Value klass, Value method) {
+  auto* function = static_cast<AotFunction*>(method.asObj());
+  static_cast<AotClass*>(klass.asObj())->aotMethods.insert(
+      { function->name, function });
+}
+
+ObjUpvalue* Runtime::captureUpvalue(Value* local) {
+  for(auto it = openUpvalues.rbegin(); it != openUpvalues.rend(); it++) {
+    if((*it)->location == local) return *it;
+    if((*it)->location < local) break;
+  }
+  ObjUpvalue* upvalue = heap.make<ObjUpvalue>(local);
+  auto pos = openUpvalues.end();
+  while(pos != openUpvalues.begin() && (*(pos - 1))->location > local) pos--;
+  openUpvalues.insert(pos, upvalue);
+  return upvalue;
+}
+
+void Runtime::closeUpvalues(Value* last) {
+  while(!openUpvalues.empty() && openUpvalues.back()->location >= last) {
+    ObjUpvalue* upvalue = openUpvalues.back();
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    openUpvalues.pop_back();
+  }
+}
+
+void Runtime::checkCall(Value callee, int argc, int line) {
+  if(!callee.isCallable()) fail(line, "Can only call functions and classes");
+  int arity = callee.asCallable()->arity();
+  if(arity != argc) {
+    fail(line, "Expected " + std::to_string(arity) + " arguments, but got "
+        + std::to_string(argc) + " instead.");
+  }
+}
+
+Value Runtime::call(Value* base, int argc, int line) {
+  checkCall(base[0], argc, line);
+  return finishCall(base, argc, false, line);
+}
+
+// memoize()d functions call back from the native that wraps them, which
+// reports errors at its own call
+Value Runtime::callFromHost(Value callee, const std::vector<Value>& args) {
+  Value* base = top;
+  if(base + 1 + args.size() > stack.data() + stack.size()) {
+    throw NativeError("Stack overflow.");
+  }
+  base[0] = callee;
+  std::copy(args.begin(), args.end(), base + 1);
+  return call(base, args.size(), 0);
+}
+
+void Runtime::lookUpCallee(Value* base, Site& site, int line) {
+  Value object = base[1];
+  if(!object.isInstance()) fail(line, "Only instances have properties.");
+  LoxInstance* instance = object.asInstance();
+  Shape* shape = instance->getShape();
+  if(site.shapeId != shape->id) {
+    site.slot = shape->slotOf(site.name);
+    site.method = nullptr;
+    if(site.slot < 0) {
+      site.method = static_cast<AotClass*>(shape->klass)
+        ->findAotMethod(site.name);
+      if(!site.method) fail(line, "Undefined property '" + site.name + "'.");
+    }
+    site.shapeId = shape->id;
+  }
+  if(site.method) {
+    base[0] = site.method;
+  } else {
+    base[0] = Nil();
+    base[1] = instance->fieldAt(site.slot);
+  }
+}
+
+Value Runtime::invoke(Value* base, int argc, int line) {
+  if(base[0].isNil()) return call(base + 1, argc, line);
+  // the arguments are behind `this`
+  checkCall(base[0], argc, line);
+  return finishCall(base, argc, true, line);
+}
+
+// Natives and classes are called right away, functions get a frame past
+// `base`. A function that returns with a tail call left the next callee
+// and its arguments in `base` and is replaced by it.
+Value Runtime::finishCall(Value* base, int argc, bool shifted, int line) {
+  while(true) {
+    Value callee = base[0];
+    if(callee.asObj()->type != ObjType::AOT_FUNCTION) try {
+      return callee.asCallable()->call(nullptr,
+          std::vector<Value>(base + 1, base + 1 + argc));
+    } catch(const NativeError& error) {
+      fail(line, error.what());
+    }
+    auto* function = static_cast<AotFunction*>(callee.asObj());
+    if(base + 1 + function->frameSize > stack.data() + stack.size()) {
+      fail(function->line, "Stack overflow.");
+    }
+    int count = argc;
+    if(function->isMethod && !shifted) {
+      std::copy_backward(base + 1, base + 1 + argc, base + 2 + argc);
+      base[1] = function->receiver;
+    }
+    if(function->isMethod) count++;
+
+    Value result = enter(function, base + 1, count);
+    if(!tailCalled) return result;
+    tailCalled = false;
+    argc = tailArgc;
+    shifted = tailShifted;
+    line = tailLine;
+  }
+}
+
+// the first `count` slots of the frame are filled in, the rest is cleared
+// so the collector never sees stale values there
+Value Runtime::enter(AotFunction* function, Value* frame, int count) {
+  uintptr_t native = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if(nativeStackBase - native > nativeStackBudget) {
+    fail(function->line, "Stack overflow.");
+  }
+  std::fill(frame + count, frame + function->frameSize, Value());
+  Value* callerTop = top;
+  top = std::max(top, frame + function->frameSize);
+  Value result = function->code(*this, function, frame);
+  closeUpvalues(frame);
+  top = callerTop;
+  return result;
+}
+
+Value Runtime::tailCall(Value* frame, Value* base, int argc, int line) {
+  checkCall(base[0], argc, line);
+  prepareTailCall(frame, base, argc, false, line);
+  return Nil();
+}
+
+Value Runtime::tailInvoke(Value* frame, Value* base, int argc, int line) {
+  if(base[0].isNil()) return tailCall(frame, base + 1, argc, line);
+  checkCall(base[0], argc, line);
+  prepareTailCall(frame, base, argc + 1, true, line);
+  tailArgc = argc;
+  return Nil();
+}
+
+// moves the callee and its arguments down to where the returning call
+// was made from, finishCall takes it from there
+void Runtime::prepareTailCall(Value* frame, Value* base, int count,
+    bool shifted, int line) {
+  closeUpvalues(frame);
+  std::copy(base, base + 1 + count, frame - 1);
+  tailCalled = true;
+  tailArgc = count;
+  tailShifted = shifted;
+  tailLine = line;
+}
+
+Value Runtime::get(Value object, Site& site, int line) {
+  if(!object.isInstance()) fail(line, "Only instances have properties.");
+  LoxInstance* instance = object.asInstance();
+  Shape* shape = instance->getShape();
+  if(site.shapeId != shape->id) {
+    site.slot = shape->slotOf(site.name);
+    site.method = nullptr;
+    site.transition = nullptr;
+    if(site.slot < 0) {
+      site.method = static_cast<AotClass*>(shape->klass)
+        ->findAotMethod(site.name);
+      if(!site.method) fail(line, "Undefined property '" + site.name + "'.");
+    }
+    site.shapeId = shape->id;
+  }
+  if(site.slot >= 0) return instance->fieldAt(site.slot);
+  // the method escapes, so it has to carry its receiver
+  AotFunction* method = site.method;
+  return heap.make<AotFunction>(*this, method->code, method->name,
+      method->params, method->frameSize, method->line, true,
+      method->upvalues, object);
+}
+
+void Runtime::set(Value object, Site& site, Value value) {
+  LoxInstance* instance = object.asInstance();
+  Shape* shape = instance->getShape();
+  if(site.shapeId != shape->id) {
+    site.slot = shape->slotOf(site.name);
+    site.method = nullptr;
+    site.transition = nullptr;
+    if(site.slot < 0) {
+      site.slot = shape->fieldCount;
+      site.transition = shape->withField(site.name);
+    }
+    site.shapeId = shape->id;
+  }
+  if(site.transition) {
+    instance->addField(site.transition, value, heap);
+  } else {
+    instance->fieldAt(site.slot) = value;
+  }
+}
+
+Value Runtime::slowNumbers(Numbers::Op op, Value left, Value right,
+    int line) {
+  // numbers, but the bitwise operators also want integers
+  if(!Numbers::accepts(op, left, right)) {
+    fail(line, Numbers::operandError(op, left, right));
+  }
+  return Numbers::binary(op, left, right, heap);
+}
+
+Value Runtime::number(TokenType op, Value operand, int line) {
+  if(!operand.isNumber()) return unary(op, operand, line);
+  switch(op) {
+    case MINUS: return *Numbers::negate(operand, &heap);
+    case PLUSPLUS: return *Numbers::add(operand, 1, &heap);
+    case MINUSMINUS: return *Numbers::add(operand, -1, &heap);
+    case TILDE:
+      if(!operand.isInt()) fail(line, "Operand must be an integer.");
+      return *Numbers::complement(operand, &heap);
+    default: return Nil();
+  }
+}
+
+Value Runtime::concat(Value left, Value right, int line) {
+  if(!left.isString() || !right.isString()) {
+    return slowBinary(PLUS, left, right, line);
+  }
+  return heap.makeString(left.asString()->chars + right.asString()->chars);
+}
+
+Value Runtime::slowBinary(TokenType op, Value left, Value right,
+    int line) {
+  switch(op) {
+    case EQUAL_EQUAL: return left.isEqual(right);
+    case BANG_EQUAL: return !left.isEqual(right);
+    case PLUS:
+      if(left.isString() && right.isString()) return concat(left, right, line);
+      if(!left.isNumber() || !right.isNumber()) {
+        fail(line, "Operands must be two numbers or two strings");
+      }
+      break;
+    default: break;
+  }
+
+  std::optional<Numbers::Op> arithmetic = Numbers::opOf(op);
+  if(!arithmetic) return Nil();
+  return numbers(*arithmetic, left, right, line);
+}
+
+Value Runtime::unary(TokenType op, Value operand, int line) {
+  if(op == BANG) return !operand.isTruthy();
+  if(!operand.isNumber()) fail(line, "Operand must be a number.");
+  return number(op, operand, line);
+}
+
+void Runtime::print(Value value) {
+  std::cout << value.toString() << std::endl;
+}
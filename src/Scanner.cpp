@@ -1,6 +1,8 @@
 #include "../include/Scanner.hpp"
 
-std::string substring(std::string str, int start, int end) {
+#include <charconv>
+
+std::string substring(const std::string& str, int start, int end) {
   std::string res = "";
   for(int i = start; i < end; i++) {
     res += str[i];     
@@ -36,6 +38,10 @@ void Scanner::scanToken() {
               addToken(match('+') ? PLUSPLUS : PLUS); 
               break;
     case '*': addToken(STAR); break; 
+    case '&': addToken(AMPERSAND); break;
+    case '|': addToken(PIPE); break;
+    case '^': addToken(CARET); break;
+    case '~': addToken(TILDE); break;
     case ';': addToken(SEMICOLON); break;
     case '!':
               addToken(match('=') ? BANG_EQUAL : BANG);
@@ -44,10 +50,12 @@ void Scanner::scanToken() {
               addToken(match('=') ? EQUAL_EQUAL : EQUAL);
               break;
     case '<':
-              addToken(match('=') ? LESS_EQUAL : LESS);
+              if(match('<')) addToken(LESS_LESS);
+              else addToken(match('=') ? LESS_EQUAL : LESS);
               break;
     case '>':
-              addToken(match('=') ? GREATER_EQUAL : GREATER);
+              if(match('>')) addToken(GREATER_GREATER);
+              else addToken(match('=') ? GREATER_EQUAL : GREATER);
               break;
     case '/':
               if (match('/')) {
@@ -86,15 +94,26 @@ void Scanner::identifierLex() {
 }
 
 void Scanner::numberLex() {
+  bool fraction = false;
   while(isDigit(peek())) advance();
   if(peek() == '.' && isDigit(peekNext())) {
     // we consume '.'
     advance();
     while(isDigit(peek())) advance();
+    fraction = true;
   } 
-  std::optional<Literal> literalopt = 
-    Literal(std::stof(substring(source, start, current)));
-  addToken(NUMBER, literalopt); 
+  std::string text = substring(source, start, current);
+  int64_t integer;
+  auto [end, error] =
+    std::from_chars(text.data(), text.data() + text.size(), integer);
+  // too big for an int64 it's a double
+  if(fraction || error != std::errc()) {
+    addToken(NUMBER, Literal(std::stod(text)));
+    return;
+  }
+  Value value = lox.heap.makeInteger(integer);
+  if(value.isObj()) lox.heap.pin(value.asObj());
+  addToken(NUMBER, Literal(value));
 }
 
 char Scanner::peekNext() {
@@ -125,7 +144,11 @@ void Scanner::stringLex() {
   }
   advance();
   std::string finalStr = substring(source, start + 1, current - 1);
-  std::optional<Literal> literalopt { std::optional<Literal>(finalStr) };
+  // literals live as long as the AST, not as long as something refers
+  // to them at runtime
+  ObjString* string = lox.heap.makeString(finalStr);
+  lox.heap.pin(string);
+  std::optional<Literal> literalopt { std::optional<Literal>(string) };
   addToken(STRING, literalopt);
 }
 
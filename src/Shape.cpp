@@ -0,0 +1,28 @@
+#include "../include/Shape.hpp"
+
+static uint64_t nextShapeId = 0;
+
+Shape::Shape(LoxClass* klass)
+  : klass { klass }, parent { nullptr }, fieldCount { 0 },
+    id { nextShapeId++ } {}
+
+Shape::Shape(Shape* parent, const std::string& name)
+  : slots { parent->slots }, klass { parent->klass }, parent { parent },
+    fieldCount { parent->fieldCount + 1 }, id { nextShapeId++ }
+{
+  slots.insert({name, parent->fieldCount});
+}
+
+int Shape::slotOf(const std::string& name) const {
+  auto it = slots.find(name);
+  if(it == slots.end()) return -1;
+  return it->second;
+}
+
+Shape* Shape::withField(const std::string& name) {
+  auto it = transitions.find(name);
+  if(it != transitions.end()) return it->second.get();
+  Shape* child = new Shape(this, name);
+  transitions.insert({name, std::unique_ptr<Shape>(child)});
+  return child;
+}
@@ -46,7 +46,8 @@ Function::Function(Token name, const std::vector<Token>& args,
 {}
 
 Function::Function(const Function& other) 
-  : name {other.name}, body {other.body}, args{other.args}
+  : name {other.name}, body {other.body}, args{other.args},
+  slot {other.slot}, slotCount {other.slotCount}, upvalues {other.upvalues}
 {}
 
 Value Function::accept(Visitor<Value>* visitor) {
@@ -101,7 +102,9 @@ Type If::accept(Visitor<Type>* visitor) {
 Block::Block() : statements {} {}
 Block::Block(const std::vector<StmtPtr>& otherStatements)
   : statements(otherStatements) {}
-Block::Block(const Block& other) { Block(other.statements); }
+Block::Block(const Block& other)
+  : statements(other.statements), firstSlot(other.firstSlot),
+    closesUpvalues(other.closesUpvalues) {}
 
 
 Value Block::accept(Visitor<Value>* visitor) {
@@ -0,0 +1,245 @@
+#include "../include/SubexpressionEliminator.hpp"
+#include "../include/AstQueries.hpp"
+
+namespace {
+
+// Variables and properties a pure expression reads
+void operandsOf(Expr::Expr* expr, std::set<std::string>& variables,
+    std::set<std::string>& properties, bool& onlyLocals) {
+  if(auto* var = dynamic_cast<Expr::Variable*>(expr)) {
+    variables.insert(var->name.lexeme);
+    if(var->slot.kind != Expr::VarSlot::LOCAL) onlyLocals = false;
+  } else if(auto* grouping = dynamic_cast<Expr::Grouping*>(expr)) {
+    operandsOf(grouping->expr.get(), variables, properties, onlyLocals);
+  } else if(auto* unop = dynamic_cast<Expr::Unop*>(expr)) {
+    operandsOf(unop->expr.get(), variables, properties, onlyLocals);
+  } else if(auto* binop = dynamic_cast<Expr::Binop*>(expr)) {
+    operandsOf(binop->left.get(), variables, properties, onlyLocals);
+    operandsOf(binop->right.get(), variables, properties, onlyLocals);
+  } else if(auto* logical = dynamic_cast<Expr::Logical*>(expr)) {
+    operandsOf(logical->left.get(), variables, properties, onlyLocals);
+    operandsOf(logical->right.get(), variables, properties, onlyLocals);
+  } else if(auto* get = dynamic_cast<Expr::Get*>(expr)) {
+    properties.insert(get->name.lexeme);
+    operandsOf(get->object.get(), variables, properties, onlyLocals);
+  }
+}
+
+// Left operand of an operator that chains, `a + b - c` nests to the left
+Expr::ExprPtr* leftOperand(Expr::Expr* expr) {
+  if(auto* binop = dynamic_cast<Expr::Binop*>(expr)) return &binop->left;
+  if(auto* logical = dynamic_cast<Expr::Logical*>(expr)) return &logical->left;
+  return nullptr;
+}
+
+// Line of the operator, for the dump
+int lineOf(Expr::Expr* expr) {
+  if(auto* unop = dynamic_cast<Expr::Unop*>(expr)) return unop->op.line;
+  if(auto* binop = dynamic_cast<Expr::Binop*>(expr)) return binop->op.line;
+  if(auto* logical = dynamic_cast<Expr::Logical*>(expr)) return logical->op.line;
+  if(auto* get = dynamic_cast<Expr::Get*>(expr)) return get->name.line;
+  return 0;
+}
+
+}
+
+void SubexpressionEliminator::optimize(Stmt::Stmts& program) {
+  // top level statements are left alone, their locals would be globals
+  hasClosures.push_back(declaresClosures(program, true));
+  rewrite(program);
+  hasClosures.pop_back();
+}
+
+void SubexpressionEliminator::printSummary(std::ostream& out,
+    bool dump) const {
+  if(dump) {
+    for(const auto& rewrite: rewrites) {
+      out << "[cse] line " << rewrite.line << ": " << rewrite.expr
+        << " reused from " << rewrite.local << "\n";
+    }
+  }
+  out << "[opt] common subexpressions: " << reused << " reused through "
+    << freshNames << " locals\n";
+}
+
+void SubexpressionEliminator::eliminateFunction(Stmt::Function* function) {
+  hasClosures.push_back(declaresClosures(function->body, false));
+  eliminate(function->body);
+  hasClosures.pop_back();
+}
+
+void SubexpressionEliminator::eliminate(Stmt::Stmts& statements) {
+  // blocks inside start over with their own state
+  auto outerAvailable = std::move(available);
+  auto outerDeclarations = std::move(declarations);
+  size_t outerStatement = statement;
+  available.clear();
+  declarations.clear();
+
+  for(statement = 0; statement < statements.size(); statement++) {
+    Stmt::Stmt* stmt = statements[statement].get();
+    if(auto* exprStmt = dynamic_cast<Stmt::Expr*>(stmt)) {
+      walk(exprStmt->expr, false);
+    } else if(auto* print = dynamic_cast<Stmt::Print*>(stmt)) {
+      walk(print->expr, false);
+    } else if(auto* var = dynamic_cast<Stmt::Var*>(stmt)) {
+      if(var->initializer) walk(var->initializer, false);
+      forgetVariable(var->name.lexeme);
+    } else if(auto* ret = dynamic_cast<Stmt::Return*>(stmt)) {
+      if(ret->value) walk(ret->value, false);
+    } else if(auto* ifStmt = dynamic_cast<Stmt::If*>(stmt)) {
+      walk(ifStmt->condition, false);
+      rewrite(ifStmt->thenBranch);
+      rewrite(ifStmt->elseBranch);
+      // the branches may have changed anything
+      available.clear();
+    } else {
+      rewrite(statements[statement]);
+      available.clear();
+    }
+  }
+
+  for(auto it = declarations.rbegin(); it != declarations.rend(); it++) {
+    Stmt::Stmts locals;
+    for(const Token& local: it->second) {
+      locals.push_back(std::make_shared<Stmt::Var>(nullptr, local));
+    }
+    statements.insert(statements.begin() + it->first,
+        locals.begin(), locals.end());
+  }
+
+  available = std::move(outerAvailable);
+  declarations = std::move(outerDeclarations);
+  statement = outerStatement;
+}
+
+void SubexpressionEliminator::walk(Expr::ExprPtr& expr, bool conditional) {
+  // a chain like a + b - c isn't walked recursively through its left
+  // operands: the operators down to the first other node are collected and
+  // walked in loops, in the order recursion would have
+  std::vector<Expr::ExprPtr*> chain { &expr };
+  while(Expr::ExprPtr* left = leftOperand(chain.back()->get())) {
+    chain.push_back(left);
+  }
+  // an operator whose left operand has no key has none either, keys are
+  // built innermost first so a long chain isn't keyed again at every link
+  std::vector<std::string> keys(chain.size());
+  for(size_t i = chain.size(); i-- > 0;) {
+    if(i + 1 == chain.size() || !keys[i + 1].empty()) {
+      keys[i] = pureKey(chain[i]->get());
+    }
+  }
+  std::vector<Available> entries;
+  for(size_t i = 0; i < chain.size(); i++) {
+    Expr::ExprPtr& link = *chain[i];
+    Expr::Expr* node = link.get();
+    bool candidate = dynamic_cast<Expr::Binop*>(node)
+      || dynamic_cast<Expr::Unop*>(node) || dynamic_cast<Expr::Logical*>(node)
+      || dynamic_cast<Expr::Get*>(node);
+    if(!candidate) keys[i].clear();
+    if(!keys[i].empty()) {
+      auto entry = available.find(keys[i]);
+      if(entry != available.end()) {
+        reuse(link, entry->second, keys[i]);
+        break;
+      }
+    }
+    // before any operand is replaced by a read of a local
+    Available entry { &link, statement };
+    if(!keys[i].empty()) {
+      bool onlyLocals = true;
+      operandsOf(node, entry.variables, entry.properties, onlyLocals);
+      entry.survivesCalls = onlyLocals && entry.properties.empty()
+        && !hasClosures.back();
+    }
+    entries.push_back(entry);
+    if(i + 1 == chain.size()) walkOperands(node, conditional);
+  }
+
+  // back up the chain, the right operand of each operator and then itself
+  for(size_t i = entries.size(); i-- > 0;) {
+    Expr::Expr* node = chain[i]->get();
+    if(auto* binop = dynamic_cast<Expr::Binop*>(node)) {
+      walk(binop->right, conditional);
+    } else if(auto* logical = dynamic_cast<Expr::Logical*>(node)) {
+      walk(logical->right, true);
+    }
+    // something that may not run can't be reused after it
+    if(!keys[i].empty() && !conditional) available.emplace(keys[i], entries[i]);
+  }
+}
+
+// Operands of anything but an operator of a chain, in the order they are
+// evaluated
+void SubexpressionEliminator::walkOperands(Expr::Expr* node,
+    bool conditional) {
+  if(auto* grouping = dynamic_cast<Expr::Grouping*>(node)) {
+    walk(grouping->expr, conditional);
+  } else if(auto* unop = dynamic_cast<Expr::Unop*>(node)) {
+    walk(unop->expr, conditional);
+  } else if(auto* call = dynamic_cast<Expr::Call*>(node)) {
+    walk(call->callee, conditional);
+    for(auto& arg: call->arguments) walk(arg, conditional);
+    call->property = dynamic_cast<Expr::Get*>(call->callee.get());
+    forgetAfterCall();
+  } else if(auto* get = dynamic_cast<Expr::Get*>(node)) {
+    walk(get->object, conditional);
+  } else if(auto* set = dynamic_cast<Expr::Set*>(node)) {
+    walk(set->object, conditional);
+    walk(set->value, conditional);
+    forgetProperty(set->name.lexeme);
+  } else if(auto* assign = dynamic_cast<Expr::Assign*>(node)) {
+    // a counter update with a step skips evaluating its value
+    walk(assign->value, conditional || !assign->step.isNil());
+    forgetVariable(assign->name.lexeme);
+  }
+}
+
+void SubexpressionEliminator::reuse(Expr::ExprPtr& expr, Available& entry,
+    const std::string& key) {
+  int line = lineOf(expr.get());
+  if(entry.first) {
+    // '$' can't appear in a scanned identifier
+    entry.local = "cse$" + std::to_string(++freshNames);
+    Token local(IDENTIFIER, entry.local, line);
+    *entry.first = std::make_shared<Expr::Assign>(local, *entry.first);
+    declarations[entry.statement].push_back(local);
+    entry.first = nullptr;
+  }
+  rewrites.push_back({ line, key, entry.local });
+  expr = std::make_shared<Expr::Variable>(Token(IDENTIFIER, entry.local, line));
+  reused++;
+}
+
+void SubexpressionEliminator::forgetVariable(const std::string& name) {
+  std::erase_if(available, [&name](const auto& entry) {
+    return entry.second.variables.contains(name);
+  });
+}
+
+void SubexpressionEliminator::forgetProperty(const std::string& name) {
+  std::erase_if(available, [&name](const auto& entry) {
+    return entry.second.properties.contains(name);
+  });
+}
+
+void SubexpressionEliminator::forgetAfterCall() {
+  std::erase_if(available, [](const auto& entry) {
+    return !entry.second.survivesCalls;
+  });
+}
+
+Value SubexpressionEliminator::visitBlockStmt(Stmt::Block* stmt) {
+  eliminate(stmt->statements);
+  return Nil();
+}
+
+Value SubexpressionEliminator::visitClassStmt(Stmt::Class* stmt) {
+  for(auto& method: stmt->methods) eliminateFunction(method.get());
+  return Nil();
+}
+
+Value SubexpressionEliminator::visitFunctionStmt(Stmt::Function* stmt) {
+  eliminateFunction(stmt);
+  return Nil();
+}
@@ -28,6 +28,10 @@ std::string tokenTypeToString(TokenType type) {
     case SEMICOLON: return "SEMICOLON"; break;
     case SLASH: return "SLASH"; break;
     case STAR: return "STAR"; break;
+    case AMPERSAND: return "AMPERSAND"; break;
+    case PIPE: return "PIPE"; break;
+    case CARET: return "CARET"; break;
+    case TILDE: return "TILDE"; break;
     case BANG: return "BANG"; break;
     case BANG_EQUAL: return "BANG_EQUAL"; break;
     case EQUAL: return "EQUAL"; break;
@@ -36,6 +40,8 @@ std::string tokenTypeToString(TokenType type) {
     case GREATER_EQUAL: return "GREATER_EQUAL"; break;
     case LESS: return "LESS"; break;
     case LESS_EQUAL: return "LESS_EQUAL"; break;
+    case LESS_LESS: return "LESS_LESS"; break;
+    case GREATER_GREATER: return "GREATER_GREATER"; break;
     case IDENTIFIER: return "IDENTIFIER"; break;
     case STRING: return "STRING"; break;
     case NUMBER: return "NUMBER"; break;
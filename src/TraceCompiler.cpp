@@ -0,0 +1,401 @@
+#include "../include/TraceCompiler.hpp"
+#include "../include/Jit.hpp"
+#include "../include/LoxFunction.hpp"
+#include "../include/Tracer.hpp"
+
+#include <bit>
+#include <cstddef>
+
+using Reg = X64Assembler::Reg;
+using Label = X64Assembler::Label;
+using enum X64Assembler::Reg;
+
+namespace {
+
+uint64_t bitsOf(Value value) {
+  return std::bit_cast<uint64_t>(value);
+}
+
+// rbx, r12, r13 and r14 are saved below rbp
+constexpr int32_t SAVED = 4 * 8;
+
+X64Assembler::Cond conditionOf(Numbers::Op op) {
+  switch(op) {
+    case Numbers::Op::LESS: return X64Assembler::LESS;
+    case Numbers::Op::LESS_EQUAL: return X64Assembler::LESS_EQUAL;
+    case Numbers::Op::GREATER: return X64Assembler::GREATER;
+    default: return X64Assembler::GREATER_EQUAL;
+  }
+}
+
+bool isComparison(Numbers::Op op) {
+  return op == Numbers::Op::LESS || op == Numbers::Op::LESS_EQUAL
+    || op == Numbers::Op::GREATER || op == Numbers::Op::GREATER_EQUAL;
+}
+
+// the opposite condition differs in the lowest bit
+X64Assembler::Cond negate(X64Assembler::Cond cond) {
+  return static_cast<X64Assembler::Cond>(cond ^ 1);
+}
+
+}
+
+TraceCompiler::TraceCompiler(const RecordedTrace& trace)
+  : trace { trace }, exits(trace.exitLines.size()),
+    known(trace.registers) {}
+
+const std::vector<uint8_t>& TraceCompiler::compile() {
+  X64Assembler& a = assembler;
+  a.push(RBP);
+  a.mov(RBP, RSP);
+  a.push(RBX);
+  a.push(R12);
+  a.push(R13);
+  a.push(R14);
+  int32_t frameSize = (trace.registers * 8 + 15) / 16 * 16;
+  if(frameSize) a.aluImm(X64Assembler::SUB, RSP, frameSize);
+  a.mov(RBX, RDI);
+  a.movImm(R12, Jit::INT_MASK);
+  a.movImm(R13, Jit::INT_BITS);
+  a.movImm(R14, Jit::BAIL_OUT);
+
+  std::vector<bool> integers = integerVariables();
+  for(const auto& variable: trace.variables) {
+    home(variable);
+    a.load(RAX, RCX, 0);
+    if(integers[variable.reg]) checkSmallInt(RAX, entryExit);
+    store(variable.reg, RAX);
+  }
+
+  Label top;
+  a.bind(top);
+  known = integers;
+  std::vector<int> reads = uses();
+  for(size_t i = 0; i < trace.ops.size(); i++) {
+    const TraceOp& op = trace.ops[i];
+    switch(op.kind) {
+      case TraceOp::CONSTANT:
+        a.movImm(RAX, op.bits);
+        store(op.dst, RAX);
+        known[op.dst] = std::bit_cast<Value>(op.bits).isSmallInt();
+        break;
+      case TraceOp::MOVE:
+        load(RAX, op.a);
+        store(op.dst, RAX);
+        known[op.dst] = known[op.a];
+        break;
+      case TraceOp::INT_BINARY: {
+        // a comparison only a guard reads jumps right away
+        const TraceOp* guard = nullptr;
+        if(isComparison(op.op) && i + 1 < trace.ops.size()
+            && trace.ops[i + 1].kind == TraceOp::GUARD
+            && trace.ops[i + 1].a == op.dst && reads[op.dst] == 1) {
+          guard = &trace.ops[++i];
+        }
+        emitIntBinary(op, guard);
+        break;
+      }
+      case TraceOp::BINARY:
+        a.movImm(RDI, static_cast<uint64_t>(op.op));
+        load(RSI, op.a);
+        load(RDX, op.b);
+        callHelper(reinterpret_cast<const void*>(Jit::binary));
+        a.alu(X64Assembler::CMP, RAX, R14);
+        a.jcc(X64Assembler::EQUAL, exits[op.exit]);
+        store(op.dst, RAX);
+        known[op.dst] = false;
+        break;
+      case TraceOp::EQUAL:
+        emitEqual(op);
+        break;
+      case TraceOp::UNARY:
+        a.movImm(RDI, op.token);
+        load(RSI, op.a);
+        callHelper(reinterpret_cast<const void*>(Jit::unary));
+        a.alu(X64Assembler::CMP, RAX, R14);
+        a.jcc(X64Assembler::EQUAL, exits[op.exit]);
+        store(op.dst, RAX);
+        known[op.dst] = false;
+        break;
+      case TraceOp::NOT: {
+        Label truthy, done;
+        load(RAX, op.a);
+        branchOnTruth(true, truthy);
+        a.movImm(RAX, Jit::TRUE_BITS);
+        a.jmp(done);
+        a.bind(truthy);
+        a.movImm(RAX, Jit::FALSE_BITS);
+        a.bind(done);
+        store(op.dst, RAX);
+        known[op.dst] = false;
+        break;
+      }
+      case TraceOp::GUARD:
+        load(RAX, op.a);
+        branchOnTruth(!op.expected, exits[op.exit]);
+        break;
+      case TraceOp::CALL:
+        emitCall(op);
+        break;
+    }
+  }
+
+  // the iteration is over, let the interpreter see it
+  for(const auto& variable: trace.variables) {
+    if(!variable.written) continue;
+    home(variable);
+    load(RAX, variable.reg);
+    a.store(RCX, 0, RAX);
+  }
+  a.load(RAX, RBX, offsetof(TraceContext, iterations));
+  a.aluImm(X64Assembler::ADD, RAX, 1);
+  a.store(RBX, offsetof(TraceContext, iterations), RAX);
+  a.jmp(top);
+
+  for(size_t exit = 0; exit < exits.size(); exit++) {
+    a.bind(exits[exit]);
+    a.movImm(RAX, exit);
+    a.jmp(epilogue);
+  }
+  a.bind(entryExit);
+  a.movImm(RAX, static_cast<uint64_t>(-1));
+  a.bind(epilogue);
+  a.lea(RSP, RBP, -SAVED);
+  a.pop(R14);
+  a.pop(R13);
+  a.pop(R12);
+  a.pop(RBX);
+  a.pop(RBP);
+  a.ret();
+  return a.code;
+}
+
+int32_t TraceCompiler::registerOffset(int reg) const {
+  return -SAVED - 8 * (reg + 1);
+}
+
+void TraceCompiler::load(Reg dst, int reg) {
+  assembler.load(dst, RBP, registerOffset(reg));
+}
+
+void TraceCompiler::store(int reg, Reg src) {
+  assembler.store(RBP, registerOffset(reg), src);
+}
+
+void TraceCompiler::home(const RecordedTrace::Variable& variable) {
+  if(variable.slot.isGlobal()) {
+    assembler.load(RCX, RBX, offsetof(TraceContext, jit)
+        + offsetof(JitContext, globals));
+  } else {
+    assembler.load(RCX, RBX, offsetof(TraceContext, frame));
+  }
+  assembler.lea(RCX, RCX, variable.slot.slot * 8);
+}
+
+// Variables that held small integers when the trace was recorded and
+// only get small integers assigned. The integer operations of the trace
+// exit on anything else, so they still hold one at the end of every
+// iteration.
+std::vector<bool> TraceCompiler::integerVariables() const {
+  std::vector<bool> candidates(trace.registers);
+  for(const auto& variable: trace.variables) {
+    candidates[variable.reg] = variable.entry.isSmallInt();
+  }
+  for(bool changed = true; changed;) {
+    changed = false;
+    std::vector<bool> integers = candidates;
+    for(const TraceOp& op: trace.ops) {
+      if(op.dst < 0) continue;
+      integers[op.dst] = producesInteger(op, integers);
+      if(candidates[op.dst] && !integers[op.dst]) {
+        candidates[op.dst] = false;
+        changed = true;
+      }
+    }
+  }
+  return candidates;
+}
+
+bool TraceCompiler::producesInteger(const TraceOp& op,
+    const std::vector<bool>& integers) const {
+  switch(op.kind) {
+    case TraceOp::CONSTANT: return std::bit_cast<Value>(op.bits).isSmallInt();
+    case TraceOp::MOVE: return integers[op.a];
+    case TraceOp::INT_BINARY: return !isComparison(op.op);
+    default: return false;
+  }
+}
+
+std::vector<int> TraceCompiler::uses() const {
+  std::vector<int> reads(trace.registers);
+  for(const TraceOp& op: trace.ops) {
+    if(op.a >= 0) reads[op.a]++;
+    if(op.b >= 0) reads[op.b]++;
+    for(int arg: op.args) reads[arg]++;
+  }
+  return reads;
+}
+
+// the arguments are in rdi, rsi and rdx already, the stack is aligned
+// outside of calls
+void TraceCompiler::callHelper(const void* helper) {
+  assembler.movImm(RAX, reinterpret_cast<uint64_t>(helper));
+  assembler.call(RAX);
+}
+
+void TraceCompiler::checkSmallInt(Reg reg, Label& otherwise) {
+  X64Assembler& a = assembler;
+  a.mov(RDX, reg);
+  a.alu(X64Assembler::AND, RDX, R12);
+  a.alu(X64Assembler::CMP, RDX, R13);
+  a.jcc(X64Assembler::NOT_EQUAL, otherwise);
+}
+
+void TraceCompiler::branchOnTruth(bool when, Label& target) {
+  X64Assembler& a = assembler;
+  Label done;
+  Label& falsy = when ? done : target;
+  a.movImm(RDX, Jit::FALSE_BITS);
+  a.alu(X64Assembler::CMP, RAX, RDX);
+  a.jcc(X64Assembler::EQUAL, falsy);
+  a.movImm(RDX, Jit::NIL_BITS);
+  a.alu(X64Assembler::CMP, RAX, RDX);
+  a.jcc(X64Assembler::EQUAL, falsy);
+  a.movImm(RDX, Jit::TRUE_BITS);
+  a.alu(X64Assembler::CMP, RAX, RDX);
+  a.jcc(X64Assembler::EQUAL, when ? target : done);
+  // numbers and the rest
+  a.mov(RDI, RAX);
+  callHelper(reinterpret_cast<const void*>(Jit::truthy));
+  a.test(RAX, RAX);
+  a.jcc(when ? X64Assembler::NOT_EQUAL : X64Assembler::EQUAL, target);
+  a.bind(done);
+}
+
+// 0 or 1 in rax to false or true
+void TraceCompiler::boolFromAl() {
+  assembler.movImm(RDX, Jit::FALSE_BITS);
+  assembler.alu(X64Assembler::ADD, RAX, RDX);
+}
+
+void TraceCompiler::emitIntBinary(const TraceOp& op, const TraceOp* guard) {
+  X64Assembler& a = assembler;
+  Label& exit = exits[op.exit];
+  load(RCX, op.a);
+  load(RAX, op.b);
+  if(!known[op.a]) checkSmallInt(RCX, exit);
+  if(!known[op.b]) checkSmallInt(RAX, exit);
+
+  // both shifted into the top 48 bits, where the flags tell whether the
+  // result still fits
+  auto shifted = [&] {
+    a.mov(RDX, RCX);
+    a.shl(RDX, 16);
+    a.mov(RSI, RAX);
+    a.shl(RSI, 16);
+  };
+  auto boxShifted = [&] {
+    a.jcc(X64Assembler::OVERFLOW, exit);
+    a.mov(RAX, RDX);
+    a.shr(RAX, 16);
+    a.alu(X64Assembler::OR, RAX, R13);
+  };
+
+  switch(op.op) {
+    case Numbers::Op::ADD:
+      shifted();
+      a.alu(X64Assembler::ADD, RDX, RSI);
+      boxShifted();
+      break;
+    case Numbers::Op::SUBTRACT:
+      shifted();
+      a.alu(X64Assembler::SUB, RDX, RSI);
+      boxShifted();
+      break;
+    case Numbers::Op::MULTIPLY:
+      shifted();
+      a.sar(RSI, 16);
+      a.imul(RDX, RSI);
+      boxShifted();
+      break;
+    // the tags of two small integers survive and and or
+    case Numbers::Op::BIT_AND:
+      a.alu(X64Assembler::AND, RAX, RCX);
+      break;
+    case Numbers::Op::BIT_OR:
+      a.alu(X64Assembler::OR, RAX, RCX);
+      break;
+    case Numbers::Op::BIT_XOR:
+      a.alu(X64Assembler::XOR, RAX, RCX);
+      a.alu(X64Assembler::OR, RAX, R13);
+      break;
+    default: {
+      X64Assembler::Cond cond = conditionOf(op.op);
+      shifted();
+      a.alu(X64Assembler::CMP, RDX, RSI);
+      if(guard) {
+        a.jcc(guard->expected ? negate(cond) : cond, exits[guard->exit]);
+        return;
+      }
+      a.setAl(cond);
+      boolFromAl();
+      store(op.dst, RAX);
+      known[op.dst] = false;
+      return;
+    }
+  }
+  store(op.dst, RAX);
+  known[op.dst] = true;
+}
+
+void TraceCompiler::emitEqual(const TraceOp& op) {
+  X64Assembler& a = assembler;
+  bool negated = op.token == BANG_EQUAL;
+  load(RDI, op.a);
+  load(RSI, op.b);
+  Label slow, done;
+  if(op.integers) {
+    if(!known[op.a]) checkSmallInt(RDI, slow);
+    if(!known[op.b]) checkSmallInt(RSI, slow);
+    a.alu(X64Assembler::CMP, RDI, RSI);
+    a.setAl(negated ? X64Assembler::NOT_EQUAL : X64Assembler::EQUAL);
+    boolFromAl();
+    a.jmp(done);
+  }
+  a.bind(slow);
+  callHelper(reinterpret_cast<const void*>(Jit::equal));
+  // true and false differ in the lowest bit
+  if(negated) a.aluImm(X64Assembler::XOR, RAX, 1);
+  a.bind(done);
+  store(op.dst, RAX);
+  known[op.dst] = false;
+}
+
+// checks that the global still holds the function, then calls its code
+// the way compiled functions call each other
+void TraceCompiler::emitCall(const TraceOp& op) {
+  X64Assembler& a = assembler;
+  Label& exit = exits[op.exit];
+  a.load(RAX, RBX, offsetof(TraceContext, jit) + offsetof(JitContext, globals));
+  a.load(RAX, RAX, op.global * 8);
+  a.movImm(RCX, bitsOf(Value(static_cast<Obj*>(op.function))));
+  a.alu(X64Assembler::CMP, RAX, RCX);
+  a.jcc(X64Assembler::NOT_EQUAL, exit);
+
+  int count = op.args.size();
+  int padding = count % 2;
+  if(padding) a.aluImm(X64Assembler::SUB, RSP, 8);
+  for(int arg: op.args) {
+    load(RAX, arg);
+    a.push(RAX);
+  }
+  a.mov(RDI, RBX);
+  a.mov(RSI, RSP);
+  a.movImm(RAX, reinterpret_cast<uint64_t>(&op.target->entry));
+  a.callIndirect(RAX);
+  if(count + padding) a.aluImm(X64Assembler::ADD, RSP, (count + padding) * 8);
+  a.alu(X64Assembler::CMP, RAX, R14);
+  a.jcc(X64Assembler::EQUAL, exit);
+  store(op.dst, RAX);
+  known[op.dst] = false;
+}
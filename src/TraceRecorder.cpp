@@ -0,0 +1,434 @@
+#include "../include/TraceRecorder.hpp"
+#include "../include/Jit.hpp"
+#include "../include/LoxFunction.hpp"
+
+#include <bit>
+
+namespace {
+
+uint64_t bitsOf(Value value) {
+  return std::bit_cast<uint64_t>(value);
+}
+
+Value valueOf(uint64_t bits) {
+  return std::bit_cast<Value>(bits);
+}
+
+// longer iterations are unlikely to pay off
+constexpr size_t MAX_OPS = 1000;
+
+bool inlined(Numbers::Op op) {
+  switch(op) {
+    case Numbers::Op::ADD:
+    case Numbers::Op::SUBTRACT:
+    case Numbers::Op::MULTIPLY:
+    case Numbers::Op::LESS:
+    case Numbers::Op::LESS_EQUAL:
+    case Numbers::Op::GREATER:
+    case Numbers::Op::GREATER_EQUAL:
+    case Numbers::Op::BIT_AND:
+    case Numbers::Op::BIT_OR:
+    case Numbers::Op::BIT_XOR:
+      return true;
+    default: return false;
+  }
+}
+
+}
+
+TraceRecorder::TraceRecorder(Jit* jit, Globals& globals, Value* frame,
+    uintptr_t stackLimit)
+  : jit { jit }, globals { globals }, frame { frame },
+    stackLimit { stackLimit } {}
+
+bool TraceRecorder::record(Stmt::While& loop) {
+  Value condition = record(loop.condition);
+  if(aborted()) return false;
+  if(!condition.isTruthy()) {
+    abort("ended while being recorded");
+    return false;
+  }
+  guard(result, true, loop.line);
+  trace.loopExit = trace.exitLines.size() - 1;
+  record(loop.body);
+  return !aborted();
+}
+
+const std::string& TraceRecorder::why() const {
+  return problem;
+}
+
+const RecordedTrace& TraceRecorder::recorded() const {
+  return trace;
+}
+
+void TraceRecorder::abort(const std::string& why) {
+  if(problem.empty()) problem = why;
+}
+
+bool TraceRecorder::aborted() const {
+  return !problem.empty();
+}
+
+Value TraceRecorder::record(const Expr::ExprPtr& expr) {
+  if(aborted()) return Nil();
+  if(trace.ops.size() > MAX_OPS) {
+    abort("is too long");
+    return Nil();
+  }
+  return expr->accept(this);
+}
+
+void TraceRecorder::record(const Stmt::StmtPtr& stmt) {
+  if(!aborted()) stmt->accept(this);
+}
+
+int TraceRecorder::newRegister(Value value) {
+  values.push_back(value);
+  return trace.registers++;
+}
+
+// the register of a local or global, the first use gets it one
+int TraceRecorder::variable(const Token& name, const Expr::VarSlot& slot) {
+  if(slot.kind == Expr::VarSlot::UPVALUE) {
+    abort("uses '" + name.lexeme + "', which a closure captured");
+    return -1;
+  }
+  if(slot.isGlobal() && !globals.isDefined(slot.slot)) {
+    abort("uses '" + name.lexeme + "' before it is defined");
+    return -1;
+  }
+  for(const RecordedTrace::Variable& variable: trace.variables) {
+    if(variable.slot.kind == slot.kind && variable.slot.slot == slot.slot) {
+      return variable.reg;
+    }
+  }
+  Value value = slot.isGlobal() ? globals.at(slot.slot) : frame[slot.slot];
+  int reg = newRegister(value);
+  trace.variables.push_back({ slot, reg, value, false });
+  return reg;
+}
+
+void TraceRecorder::assign(int reg, int source, Value value) {
+  TraceOp& op = emit(TraceOp::MOVE, reg);
+  op.a = source;
+  values[reg] = value;
+  for(RecordedTrace::Variable& variable: trace.variables) {
+    if(variable.reg == reg) variable.written = true;
+  }
+}
+
+// A variable read as an operand still has to hold what it held then
+// when operands recorded after it assign it, like `a + (a = 1)`. Copies
+// it before them if they do.
+int TraceRecorder::keep(int reg, Value value, size_t from) {
+  for(size_t i = from; i < trace.ops.size(); i++) {
+    const TraceOp& op = trace.ops[i];
+    if(op.kind != TraceOp::MOVE || op.dst != reg) continue;
+    TraceOp copy { .kind = TraceOp::MOVE, .dst = newRegister(value), .a = reg };
+    trace.ops.insert(trace.ops.begin() + from, copy);
+    return copy.dst;
+  }
+  return reg;
+}
+
+int TraceRecorder::exit(int line) {
+  trace.exitLines.push_back(line);
+  return trace.exitLines.size() - 1;
+}
+
+TraceOp& TraceRecorder::emit(TraceOp::Kind kind, int dst) {
+  trace.ops.push_back({ .kind = kind, .dst = dst });
+  return trace.ops.back();
+}
+
+void TraceRecorder::guard(int reg, bool expected, int line) {
+  TraceOp& op = emit(TraceOp::GUARD, -1);
+  op.a = reg;
+  op.expected = expected;
+  op.exit = exit(line);
+}
+
+// Expressions ----------------------------------------------------------------
+
+Value TraceRecorder::visitBinop(Expr::Binop* expr) {
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  Value value = record(chain.front()->left);
+  for(Expr::Binop* binop: chain) {
+    if(aborted()) return Nil();
+    value = operate(binop, value);
+  }
+  return value;
+}
+
+// the left operand was recorded into `result`
+Value TraceRecorder::operate(Expr::Binop* expr, Value left) {
+  int leftReg = result;
+  size_t rightOps = trace.ops.size();
+  Value right = record(expr->right);
+  int rightReg = result;
+  if(aborted()) return Nil();
+  leftReg = keep(leftReg, left, rightOps);
+
+  bool integers = left.isSmallInt() && right.isSmallInt();
+  uint64_t bits;
+  if(!expr->arithmetic) {
+    bits = Jit::equal(bitsOf(left), bitsOf(right));
+    if(expr->op.type == BANG_EQUAL) bits ^= 1;
+  } else {
+    bits = Jit::binary(static_cast<uint64_t>(*expr->arithmetic),
+        bitsOf(left), bitsOf(right));
+    if(bits == Jit::BAIL_OUT) {
+      abort(left.isNumber() && right.isNumber()
+          ? "needs a big integer at line " + std::to_string(expr->op.line)
+          : "operates on something other than numbers at line "
+            + std::to_string(expr->op.line));
+      return Nil();
+    }
+  }
+
+  Value value = valueOf(bits);
+  TraceOp::Kind kind = !expr->arithmetic ? TraceOp::EQUAL
+    : integers && inlined(*expr->arithmetic) ? TraceOp::INT_BINARY
+    : TraceOp::BINARY;
+  TraceOp& op = emit(kind, newRegister(value));
+  op.a = leftReg;
+  op.b = rightReg;
+  op.op = expr->arithmetic.value_or(Numbers::Op::ADD);
+  op.token = expr->op.type;
+  op.integers = integers;
+  // inline integer arithmetic exits on overflow, Numbers when it would
+  // allocate
+  if(kind != TraceOp::EQUAL) op.exit = exit(expr->op.line);
+  result = op.dst;
+  return value;
+}
+
+Value TraceRecorder::visitUnop(Expr::Unop* expr) {
+  Value operand = record(expr->expr);
+  if(aborted()) return Nil();
+  Value value;
+  TraceOp::Kind kind;
+  if(expr->op.type == BANG) {
+    value = Value(!operand.isTruthy());
+    kind = TraceOp::NOT;
+  } else {
+    uint64_t bits = Jit::unary(expr->op.type, bitsOf(operand));
+    if(bits == Jit::BAIL_OUT) {
+      abort("can't apply '" + expr->op.lexeme + "' at line "
+          + std::to_string(expr->op.line));
+      return Nil();
+    }
+    value = valueOf(bits);
+    kind = TraceOp::UNARY;
+  }
+  int operandReg = result;
+  TraceOp& op = emit(kind, newRegister(value));
+  op.a = operandReg;
+  op.token = expr->op.type;
+  if(kind == TraceOp::UNARY) op.exit = exit(expr->op.line);
+  result = op.dst;
+  return value;
+}
+
+Value TraceRecorder::visitGrouping(Expr::Grouping* expr) {
+  return record(expr->expr);
+}
+
+Value TraceRecorder::visitLiteralExpr(Expr::Literal* expr) {
+  Value value = expr->value->value;
+  if(value.isObj()) {
+    abort("uses a string or a big integer literal");
+    return Nil();
+  }
+  TraceOp& op = emit(TraceOp::CONSTANT, newRegister(value));
+  op.bits = bitsOf(value);
+  result = op.dst;
+  return value;
+}
+
+Value TraceRecorder::visitVariableExpr(Expr::Variable* expr) {
+  result = variable(expr->name, expr->slot);
+  if(aborted()) return Nil();
+  return values[result];
+}
+
+Value TraceRecorder::visitAssign(Expr::Assign* expr) {
+  Value value = record(expr->value);
+  int source = result;
+  int reg = variable(expr->name, expr->slot);
+  if(aborted()) return Nil();
+  assign(reg, source, value);
+  result = reg;
+  return value;
+}
+
+Value TraceRecorder::visitLogical(Expr::Logical* expr) {
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  Value value = record(chain.front()->left);
+  for(Expr::Logical* logical: chain) {
+    if(aborted()) return Nil();
+    bool truthy = value.isTruthy();
+    guard(result, truthy, logical->op.line);
+    // `a or b` is a when a is truthy, `a and b` when it isn't
+    if(truthy != (logical->op.type == OR)) value = record(logical->right);
+  }
+  return value;
+}
+
+// Only calls of top level functions the method JIT compiled, which run
+// right away to see what they return.
+Value TraceRecorder::visitCall(Expr::Call* expr) {
+  auto* callee = dynamic_cast<Expr::Variable*>(expr->callee.get());
+  if(expr->property || !callee || !callee->slot.isGlobal()) {
+    abort("calls something other than a top level function");
+    return Nil();
+  }
+  if(!jit) {
+    abort("calls a function without the method JIT");
+    return Nil();
+  }
+  int slot = callee->slot.slot;
+  Value value = globals.isDefined(slot) ? globals.at(slot) : Value();
+  LoxFunction* function = nullptr;
+  if(value.isCallable() && value.asObj()->type == ObjType::FUNCTION) {
+    function = static_cast<LoxFunction*>(value.asCallable());
+  }
+  if(!function || function->boundReceiver()
+      || function->arity() != static_cast<int>(expr->arguments.size())) {
+    abort("calls '" + callee->name.lexeme + "', which isn't a function "
+        "taking " + std::to_string(expr->arguments.size()) + " arguments");
+    return Nil();
+  }
+  JitFunction* target = function->native ? function->native
+    : jit->compile(function);
+  if(!target->rejected.empty() || target->bail != Jit::NONE) {
+    abort("calls '" + callee->name.lexeme + "', which can't be compiled");
+    return Nil();
+  }
+
+  std::vector<int> args;
+  std::vector<Value> arguments;
+  std::vector<size_t> ends;
+  for(const auto& argument: expr->arguments) {
+    arguments.push_back(record(argument));
+    args.push_back(result);
+    ends.push_back(trace.ops.size());
+  }
+  if(aborted()) return Nil();
+  // from the last one, an insertion moves what comes after it
+  for(size_t i = args.size(); i-- > 0;) {
+    args[i] = keep(args[i], arguments[i], ends[i]);
+  }
+  // the compiled function takes them last one first
+  std::vector<uint64_t> reversed;
+  for(auto it = arguments.rbegin(); it != arguments.rend(); it++) {
+    reversed.push_back(bitsOf(*it));
+  }
+  JitContext context { &globals.at(0), stackLimit, Jit::NONE };
+  uint64_t bits = target->entry(&context, reversed.data());
+  if(bits == Jit::BAIL_OUT) {
+    abort("calls '" + callee->name.lexeme + "', which bailed out");
+    return Nil();
+  }
+
+  Value returned = valueOf(bits);
+  TraceOp& op = emit(TraceOp::CALL, newRegister(returned));
+  op.args = std::move(args);
+  op.global = slot;
+  op.function = function;
+  op.target = target;
+  op.exit = exit(expr->paren.line);
+  result = op.dst;
+  return returned;
+}
+
+Value TraceRecorder::visitGetExpr(Expr::Get* expr) {
+  abort("reads a property");
+  return Nil();
+}
+
+Value TraceRecorder::visitSetExpr(Expr::Set* expr) {
+  abort("sets a property");
+  return Nil();
+}
+
+Value TraceRecorder::visitThisExpr(Expr::This* expr) {
+  abort("uses 'this'");
+  return Nil();
+}
+
+// Statements -----------------------------------------------------------------
+
+Value TraceRecorder::visitExprStmt(Stmt::Expr* stmt) {
+  record(stmt->expr);
+  return Nil();
+}
+
+Value TraceRecorder::visitPrintStmt(Stmt::Print* stmt) {
+  abort("prints");
+  return Nil();
+}
+
+Value TraceRecorder::visitVarStmt(Stmt::Var* stmt) {
+  if(stmt->slot.isGlobal()) {
+    abort("declares a global");
+    return Nil();
+  }
+  Value value;
+  int source;
+  if(stmt->initializer) {
+    value = record(stmt->initializer);
+    source = result;
+  } else {
+    TraceOp& op = emit(TraceOp::CONSTANT, newRegister(value));
+    op.bits = bitsOf(value);
+    source = op.dst;
+  }
+  int reg = variable(stmt->name, stmt->slot);
+  if(aborted()) return Nil();
+  assign(reg, source, value);
+  return Nil();
+}
+
+Value TraceRecorder::visitBlockStmt(Stmt::Block* stmt) {
+  for(const auto& statement: stmt->statements) record(statement);
+  return Nil();
+}
+
+Value TraceRecorder::visitIfStmt(Stmt::If* stmt) {
+  bool truthy = record(stmt->condition).isTruthy();
+  if(aborted()) return Nil();
+  guard(result, truthy, stmt->line);
+  if(truthy) {
+    record(stmt->thenBranch);
+  } else if(stmt->elseBranch) {
+    record(stmt->elseBranch);
+  }
+  return Nil();
+}
+
+Value TraceRecorder::visitWhileStmt(Stmt::While* stmt) {
+  abort("has an inner loop at line " + std::to_string(stmt->line));
+  return Nil();
+}
+
+Value TraceRecorder::visitBreakStmt(Stmt::Break* stmt) {
+  abort("breaks out of the loop");
+  return Nil();
+}
+
+Value TraceRecorder::visitReturnStmt(Stmt::Return* stmt) {
+  abort("returns from the function");
+  return Nil();
+}
+
+Value TraceRecorder::visitFunctionStmt(Stmt::Function* stmt) {
+  abort("declares a function");
+  return Nil();
+}
+
+Value TraceRecorder::visitClassStmt(Stmt::Class* stmt) {
+  abort("declares a class");
+  return Nil();
+}
@@ -0,0 +1,149 @@
+#include "../include/Tracer.hpp"
+#include "../include/Heap.hpp"
+#include "../include/LoxFunction.hpp"
+#include "../include/TraceCompiler.hpp"
+#include "../include/TraceRecorder.hpp"
+
+#include <cstring>
+#include <sys/mman.h>
+
+Tracer::Tracer(Globals& globals, Jit* jit, int threshold)
+  : globals { globals }, jit { jit }, threshold { threshold } {}
+
+Tracer::~Tracer() {
+  for(const Mapping& mapping: mappings) munmap(mapping.memory, mapping.size);
+}
+
+void Tracer::loopHeader(Stmt::While& loop, Value* frame,
+    uintptr_t stackLimit) {
+  LoopTrace* trace = loop.trace;
+  if(trace && trace->entry) {
+    run(*trace, frame, stackLimit);
+    return;
+  }
+  if(trace && trace->blacklisted) return;
+  if(++loop.hotness < threshold) return;
+  loop.hotness = 0;
+  record(loop, frame, stackLimit);
+}
+
+void Tracer::record(Stmt::While& loop, Value* frame, uintptr_t stackLimit) {
+  if(!loop.trace) {
+    traces.push_back(std::make_unique<LoopTrace>());
+    loop.trace = traces.back().get();
+    loop.trace->line = loop.line;
+    loop.trace->hotAfter = threshold;
+  }
+  LoopTrace& trace = *loop.trace;
+  trace.attempts++;
+
+  TraceRecorder recorder(jit, globals, frame, stackLimit);
+  if(!recorder.record(loop)) {
+    abort(trace, recorder.why());
+    return;
+  }
+  const RecordedTrace& recorded = recorder.recorded();
+  TraceCompiler compiler(recorded);
+  if(!install(trace, compiler.compile())) {
+    abort(trace, "didn't get executable memory");
+    return;
+  }
+  trace.ops = recorded.ops.size();
+  trace.exitLines = recorded.exitLines;
+  trace.exits.assign(recorded.exitLines.size(), 0);
+  trace.loopExit = recorded.loopExit;
+  trace.stuck = 0;
+  for(const TraceOp& op: recorded.ops) {
+    if(op.function) trace.callees.push_back(op.function);
+  }
+  // the recording only looked, the iteration has yet to run
+  run(trace, frame, stackLimit);
+}
+
+void Tracer::run(LoopTrace& trace, Value* frame, uintptr_t stackLimit) {
+  TraceContext context { { &globals.at(0), stackLimit, Jit::NONE }, frame, 0 };
+  int64_t exit = trace.entry(&context);
+  trace.entries++;
+  trace.iterations += context.iterations;
+  if(exit < 0) {
+    trace.entryExits++;
+  } else {
+    trace.exits[exit]++;
+  }
+  if(context.iterations > 0 || exit == trace.loopExit) {
+    trace.stuck = 0;
+  } else if(++trace.stuck >= MAX_STUCK) {
+    trace.entry = nullptr;
+    abort(trace, exit < 0 ? "kept finding other types on entry"
+        : "kept exiting at line " + std::to_string(trace.exitLines[exit]));
+  }
+}
+
+void Tracer::abort(LoopTrace& trace, const std::string& why) {
+  aborts++;
+  auto it = trace.aborts.begin();
+  while(it != trace.aborts.end() && it->first != why) it++;
+  if(it == trace.aborts.end()) {
+    trace.aborts.emplace_back(why, 1);
+  } else {
+    it->second++;
+  }
+  if(trace.attempts >= MAX_ATTEMPTS) trace.blacklisted = true;
+}
+
+// copies the code into memory that can be executed but not written
+bool Tracer::install(LoopTrace& trace, const std::vector<uint8_t>& code) {
+  void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(memory == MAP_FAILED) return false;
+  std::memcpy(memory, code.data(), code.size());
+  mappings.push_back({ memory, code.size() });
+  if(mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) return false;
+  trace.entry = reinterpret_cast<LoopTrace::Entry>(memory);
+  trace.codeSize = code.size();
+  return true;
+}
+
+// the code compares globals against the functions it calls
+void Tracer::markRoots(Heap& heap) const {
+  for(const auto& trace: traces) {
+    for(LoxFunction* function: trace->callees) heap.markObject(function);
+  }
+}
+
+void Tracer::printStats(std::ostream& out) const {
+  size_t compiled = 0, iterations = 0, exits = 0;
+  for(const auto& trace: traces) {
+    out << "[trace] loop at line " << trace->line << ": ";
+    if(trace->codeSize) {
+      compiled++;
+      iterations += trace->iterations;
+      out << trace->ops << " ops, " << trace->codeSize << " bytes after "
+          << trace->hotAfter << " iterations, entered " << trace->entries
+          << " times, ran " << trace->iterations << " iterations";
+      for(size_t exit = 0; exit < trace->exits.size(); exit++) {
+        if(!trace->exits[exit] || static_cast<int>(exit) == trace->loopExit) {
+          continue;
+        }
+        out << ", exited at line " << trace->exitLines[exit] << " "
+            << trace->exits[exit] << " times";
+        exits += trace->exits[exit];
+      }
+      if(trace->entryExits) {
+        out << ", found other types on entry " << trace->entryExits
+            << " times";
+        exits += trace->entryExits;
+      }
+    } else {
+      out << "not traced";
+    }
+    for(const auto& [why, count]: trace->aborts) {
+      out << ", aborted " << count << " times: " << why;
+    }
+    if(trace->blacklisted) out << ", left to the interpreter";
+    out << "\n";
+  }
+  out << "[trace] total: " << compiled << " traces, " << iterations
+      << " iterations, " << exits << " side exits, " << aborts
+      << " aborts\n";
+}
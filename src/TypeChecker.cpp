@@ -28,54 +28,125 @@ void TypeChecker::endScope() {
   scopes.pop_back();
 }
 
-Type TypeChecker::getVarType(const Token& name) {
+void TypeChecker::error(const Token& token, const std::string& message) {
+  if(!scanning) lox.error(token, message);
+}
+
+void TypeChecker::error(int line, const std::string& message) {
+  if(!scanning) lox.error(line, message);
+}
+
+void TypeChecker::declare(const Token& name, Type type, bool proven) {
+  if(demoted.contains(&name)) type = Type::ANY;
+  if(scopes.size() == 1 && demotedGlobals.contains(name.lexeme)) {
+    type = Type::ANY;
+  }
+  if(unprovenLocals.contains(&name)) proven = false;
+  scopes.back()[name.lexeme] = { type, &name, proven };
+}
+
+const TypeChecker::Binding* TypeChecker::lookUp(const Token& name) {
   for(int i = scopes.size() - 1; i >= 0; i--) {
     auto& currentScope = scopes[i];
     if(currentScope.contains(name.lexeme)) {
-      return currentScope[name.lexeme];
+      return &currentScope[name.lexeme];
     }
   }
-  return Type::NIL;
+  return nullptr;
+}
+
+Type TypeChecker::getVarType(const Token& name) {
+  const Binding* binding = lookUp(name);
+  // declared later or in another run
+  return binding ? binding->type : Type::ANY;
 }
 
 Type TypeChecker::typeCheck(Expr::ExprPtr expr) {
-  return expr->accept(this);
+  bool outer = unproven;
+  unproven = false;
+  Type type = expr->accept(this);
+  expr->type = unproven ? Type::ANY : type;
+  // and so is everything computed from it
+  unproven = outer || unproven;
+  return type;
 }
 
 Type TypeChecker::typeCheck(Stmt::StmtPtr stmt) {
+  unproven = false;
   stmt->accept(this);
+  unproven = false;
   return Type::NIL;
 }
 
 Type TypeChecker::typeCheck(const Stmt::Stmts& program) {
+  // demoting a variable makes what is computed from it ANY, which can
+  // demote others, so scan until nothing changes
+  scanning = true;
+  auto found = [this]() {
+    return demoted.size() + unprovenLocals.size() + demotedGlobals.size();
+  };
+  size_t before;
+  do {
+    before = found();
+    walk(program);
+  } while(found() != before);
+
+  scanning = false;
+  walk(program);
+  return Type::NIL;
+}
+
+void TypeChecker::walk(const Stmt::Stmts& program) {
+  scopes.clear();
+  scopes.push_back({});
   for(const auto& stmt: program) {
     typeCheck(stmt);
   }
-  return Type::NIL;
 }
 
 Type TypeChecker::visitBinop(Expr::Binop* expr) { 
-  Type typeLeft = typeCheck(expr->left);
-  Type typeRight = typeCheck(expr->right);
+  // the operators of a chain get the type typeCheck() would have given them,
+  // unproven gathers what their operands left
+  std::vector<Expr::Binop*> chain = Expr::leftChain(expr);
+  Type type = typeCheck(chain.front()->left);
+  for(Expr::Binop* binop: chain) {
+    type = binopType(binop, type, typeCheck(binop->right));
+    if(binop != expr) binop->type = unproven ? Type::ANY : type;
+  }
+  return type;
+}
+
+Type TypeChecker::binopType(Expr::Binop* expr, Type typeLeft,
+    Type typeRight) {
   //DPRINT("binop | left = %s | right = %s\n", typeToString(typeLeft).c_str(), typeToString(typeRight).c_str());
-  if(typeLeft != typeRight) {
-    lox.error(expr->op, "Cannot do " + expr->op.toString() + "between [" +
+  if(typeLeft != typeRight && typeLeft != Type::ANY && typeRight != Type::ANY) {
+    error(expr->op, "Cannot do " + expr->op.toString() + "between [" +
         typeToString(typeLeft) + "] and [" + typeToString(typeRight) + "]."); 
     return Type::NIL;
   }
 
   switch(expr->op.type) {
+    case EQUAL_EQUAL:
+    case BANG_EQUAL:
     case LESS:
     case LESS_EQUAL:
     case GREATER:
     case GREATER_EQUAL:
       return Type::BOOLEAN;
       break;
-    case PLUS:
+    // anything else fails when it runs
     case MINUS:
     case STAR:
     case SLASH:
-      return typeLeft;
+    case AMPERSAND:
+    case PIPE:
+    case CARET:
+    case LESS_LESS:
+    case GREATER_GREATER:
+      return Type::NUMBER;
+      break;
+    case PLUS:
+      return typeLeft == Type::ANY ? typeRight : typeLeft;
       break;
     // shouldn't happen
     default:
@@ -86,16 +157,23 @@ Type TypeChecker::visitBinop(Expr::Binop* expr) {
 
 Type TypeChecker::visitUnop(Expr::Unop* expr) { 
   Type exprType = typeCheck(expr->expr);
-  // ++, -- aren't here, won't be in my language in the future TODO
+  bool known = exprType != Type::ANY;
   switch(expr->op.type) {
     case MINUS:
-      if(exprType != Type::NUMBER) lox.error(expr->op.line, 
+      if(known && exprType != Type::NUMBER) error(expr->op.line, 
           "Expression after '-' should have type [Number].");
-      break;
+      return Type::NUMBER;
     case BANG:
-      if(exprType != Type::BOOLEAN) lox.error(expr->op.line, 
+      if(known && exprType != Type::BOOLEAN) error(expr->op.line, 
           "Expression after '!' should have type [Boolean].");
-      break;
+      return Type::BOOLEAN;
+    case TILDE:
+      if(known && exprType != Type::NUMBER) error(expr->op.line, 
+          "Expression after '~' should have type [Number].");
+      return Type::NUMBER;
+    case PLUSPLUS:
+    case MINUSMINUS:
+      return Type::NUMBER;
     // this shouldn't happen
     default:
       break;
@@ -121,8 +199,11 @@ Type TypeChecker::visitPrintStmt(Stmt::Print* varstmt) {
 }
 
 Type TypeChecker::visitVarStmt(Stmt::Var* stmt) { 
-  auto& currentScope = scopes.back();
-  currentScope[stmt->name.lexeme] = typeCheck(stmt->initializer);
+  // nil, or no initializer, says nothing about what it holds later
+  Type type = Type::ANY;
+  if(stmt->initializer) type = typeCheck(stmt->initializer);
+  if(type == Type::NIL) type = Type::ANY;
+  declare(stmt->name, type, !unproven);
   /*DPRINT("putting stuff into scope, %s\n", 
       typeToString(currentScope[stmt->name.lexeme]).c_str());
   */
@@ -130,20 +211,38 @@ Type TypeChecker::visitVarStmt(Stmt::Var* stmt) {
 }
 
 Type TypeChecker::visitVariableExpr(Expr::Variable* var) { 
-  Type t = getVarType(var->name);
+  const Binding* binding = lookUp(var->name);
+  Type t = binding ? binding->type : Type::ANY;
+  if(var->slot.isGlobal() || (binding && !binding->proven)) unproven = true;
   //DPRINT("var expr type = %s\n", typeToString(t).c_str());
   return t; 
 }
 
 Type TypeChecker::visitAssign(Expr::Assign* expr) { 
   Type assValType = typeCheck(expr->value);
-  Type prevVarType = getVarType(expr->name);
-  if(assValType != prevVarType) {
-    lox.error(expr->name.line, 
+  const Binding* binding = lookUp(expr->name);
+  if(!binding) {
+    // a global declared later, it holds more than its initializer says
+    if(scanning && expr->slot.isGlobal()) {
+      demotedGlobals.insert(expr->name.lexeme);
+    }
+    return assValType;
+  }
+  if(scanning && unproven && !expr->slot.isGlobal()) {
+    unprovenLocals.insert(binding->declaration);
+  }
+  if(binding->type == Type::ANY) return assValType;
+
+  Type prevVarType = binding->type;
+  if(assValType == Type::ANY) {
+    // the variable can hold anything from now on
+    if(scanning) demoted.insert(binding->declaration);
+  } else if(assValType != prevVarType) {
+    error(expr->name.line, 
         "Cannot assign value of type [" + typeToString(assValType) + 
         "] to variable of type [" + typeToString(prevVarType) +"].");
   }
-  return Type::NIL; 
+  return assValType; 
 }
 
 Type TypeChecker::visitBlockStmt(Stmt::Block* stmt) { 
@@ -157,8 +256,8 @@ Type TypeChecker::visitBlockStmt(Stmt::Block* stmt) {
 
 Type TypeChecker::visitIfStmt(Stmt::If* stmt) { 
   Type condType = typeCheck(stmt->condition);
-  if(condType != Type::BOOLEAN) {
-    lox.error(stmt->line, "Condition must be of type [Boolean]."); 
+  if(condType != Type::BOOLEAN && condType != Type::ANY) {
+    error(stmt->line, "Condition must be of type [Boolean]."); 
   }
 
   typeCheck(stmt->thenBranch);
@@ -168,22 +267,35 @@ Type TypeChecker::visitIfStmt(Stmt::If* stmt) {
 }
 
 Type TypeChecker::visitLogical(Expr::Logical* expr) { 
-  Type typeLeft = typeCheck(expr->left);
-  Type typeRight = typeCheck(expr->right);
+  std::vector<Expr::Logical*> chain = Expr::leftChain(expr);
+  Type type = typeCheck(chain.front()->left);
+  for(Expr::Logical* logical: chain) {
+    type = logicalType(logical, type, typeCheck(logical->right));
+    if(logical != expr) logical->type = unproven ? Type::ANY : type;
+  }
+  return type;
+}
+
+Type TypeChecker::logicalType(Expr::Logical* expr, Type typeLeft,
+    Type typeRight) {
   //DPRINT("left = %s | right = %s\n", typeToString(typeLeft).c_str(), typeToString(typeRight).c_str());
-  if(typeLeft != Type::BOOLEAN || typeRight != Type::BOOLEAN) {
-    lox.error(expr->op.line, 
+  auto isBoolean = [](Type type) {
+    return type == Type::BOOLEAN || type == Type::ANY;
+  };
+  if(!isBoolean(typeLeft) || !isBoolean(typeRight)) {
+    error(expr->op.line, 
         "Expected values in logical expression to be [Boolean], but got [" +
         typeToString(typeLeft) + "] and [" + typeToString(typeRight) + "] instead.");
     return Type::NIL;
   }
-  return Type::BOOLEAN; 
+  // the result is one of the operands
+  return typeLeft == typeRight ? typeLeft : Type::ANY; 
 }
 
 Type TypeChecker::visitWhileStmt(Stmt::While* stmt) { 
   Type condType = typeCheck(stmt->condition);
-  if(condType != Type::BOOLEAN) {
-    lox.error(stmt->line, "Condition must be of [Boolean] type."); 
+  if(condType != Type::BOOLEAN && condType != Type::ANY) {
+    error(stmt->line, "Condition must be of [Boolean] type."); 
   }
   typeCheck(stmt->body);
   return {}; 
@@ -193,10 +305,67 @@ Type TypeChecker::visitBreakStmt(Stmt::Break* stmt) {
   return Type::NIL; 
 }
 
-Type TypeChecker::visitClassStmt(Stmt::Class* stmt) { return {}; }
-Type TypeChecker::visitCall(Expr::Call* expr) { return {}; }
-Type TypeChecker::visitFunctionStmt(Stmt::Function* stmt) { return {}; }
-Type TypeChecker::visitReturnStmt(Stmt::Return* stmt) { return {}; }
-Type TypeChecker::visitGetExpr(Expr::Get* expr) { return {}; }
-Type TypeChecker::visitSetExpr(Expr::Set* expr) { return {}; }
-Type TypeChecker::visitThisExpr(Expr::This* expr) { return {}; }
+void TypeChecker::checkFunction(Stmt::Function* stmt) {
+  beginScope();
+  for(const Token& param: stmt->args) declare(param, Type::ANY);
+  for(const auto& stmt: stmt->body) {
+    typeCheck(stmt);
+  }
+  endScope();
+}
+
+Type TypeChecker::visitClassStmt(Stmt::Class* stmt) {
+  declare(stmt->name, Type::FUNCTION);
+  for(const auto& method: stmt->methods) {
+    checkFunction(method.get());
+  }
+  return Type::NIL;
+}
+
+Type TypeChecker::visitCall(Expr::Call* expr) {
+  Type calleeType = typeCheck(expr->callee);
+  if(calleeType != Type::FUNCTION && calleeType != Type::ANY) {
+    error(expr->paren, "Can only call functions and classes.");
+  }
+  std::vector<Type> argumentTypes;
+  for(const auto& argument: expr->arguments) {
+    argumentTypes.push_back(typeCheck(argument));
+  }
+  auto* callee = dynamic_cast<Expr::Variable*>(expr->callee.get());
+  if(callee && callee->slot.isGlobal() && callee->name.lexeme == "memoize"
+      && argumentTypes.size() == 1 && argumentTypes[0] != Type::FUNCTION
+      && argumentTypes[0] != Type::ANY) {
+    error(expr->paren, "Can only memoize functions and classes.");
+  }
+  return Type::ANY;
+}
+
+Type TypeChecker::visitFunctionStmt(Stmt::Function* stmt) {
+  // declared first, the body can call it
+  declare(stmt->name, Type::FUNCTION);
+  checkFunction(stmt);
+  return Type::NIL;
+}
+
+Type TypeChecker::visitReturnStmt(Stmt::Return* stmt) {
+  if(stmt->value) typeCheck(stmt->value);
+  return Type::NIL;
+}
+
+Type TypeChecker::visitGetExpr(Expr::Get* expr) {
+  Type objectType = typeCheck(expr->object);
+  if(objectType != Type::INSTANCE && objectType != Type::ANY) {
+    error(expr->name, "Only instances have properties.");
+  }
+  return Type::ANY;
+}
+
+Type TypeChecker::visitSetExpr(Expr::Set* expr) {
+  Type objectType = typeCheck(expr->object);
+  if(objectType != Type::INSTANCE && objectType != Type::ANY) {
+    error(expr->name, "Only instances have fields.");
+  }
+  return typeCheck(expr->value);
+}
+
+Type TypeChecker::visitThisExpr(Expr::This* expr) { return Type::INSTANCE; }
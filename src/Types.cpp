@@ -2,57 +2,62 @@
 #include "../include/Token.hpp"
 #include "../include/LoxInstance.hpp"
 
+#include <climits>
+#include <cmath>
 #include <iostream>
 
-Value::Value(const Value& other)
-  : value{other.value} {}
-
-Value::Value()
-  : value{42.0f} {}
-
-
-template <typename T>
-T Value::get() const {
-  return std::get<T>(value);
-}
-
 std::string Value::toString() const {
-  if(std::holds_alternative<std::string>(value)) {
-    return std::get<std::string>(value);
-  } else if(std::holds_alternative<float>(value)) {
-    float f = std::get<float>(value);
-    int c;
-    if(std::abs(f - int(f)) == 0.0) {
+  if(isString()) {
+    return asString()->chars;
+  } else if(isInt()) {
+    return std::to_string(asInt());
+  } else if(isDouble()) {
+    double f = asDouble();
+    if(std::trunc(f) == f && f >= INT_MIN && f <= INT_MAX) {
       int c = f;
       return std::to_string(c);
     }
     return std::to_string(f);
-  } else if(std::holds_alternative<bool>(value)) {
-    return std::get<bool>(value) ? "1" : "0";
-  } else if(std::holds_alternative<std::shared_ptr<Callable>>(value)) {
-    auto callable_ptr = std::get<std::shared_ptr<Callable>>(value);
-    return callable_ptr->toString();
-  } else if(std::holds_alternative<std::shared_ptr<LoxInstance>>(value)) {
-    auto instance_ptr = std::get<std::shared_ptr<LoxInstance>>(value);
-    return instance_ptr->toString();
-  } else if(std::holds_alternative<Nil>(value)) {
-
+  } else if(isBool()) {
+    return asBool() ? "1" : "0";
+  } else if(isInstance()) {
+    return asInstance()->toString();
+  } else if(isCallable()) {
+    return asCallable()->toString();
+  } else if(isNil()) {
     return "nil";
   }
   return "";
 }
 
+bool Value::isTruthy() const {
+  if(isBool()) return asBool();
+  if(isNil()) return false;  // nil is false
+  if(isInt()) return asInt() != 0;
+  if(isNumber()) return asNumber() != 0;  // nonzero numbers are true
+  if(isString()) return !asString()->chars.empty();  // non-empty strings are true
+  return false; // functions and instances
+}
+
+bool Value::isEqual(const Value& other) const {
+  if(isNil()) return other.isNil();
+  if(isInt() && other.isInt()) return asInt() == other.asInt();
+  if(isNumber() && other.isNumber()) return asNumber() == other.asNumber();
+  if(isBool() && other.isBool()) return asBool() == other.asBool();
+  if(isString() && other.isString()) {
+    return asString()->chars == other.asString()->chars;
+  }
+  // for now two different types are always not equal
+  return false;
+}
+
 Type Value::getType() const {
-  return std::visit([](auto&& arg) -> Type {
-      using T = std::decay_t<decltype(arg)>;
-      if constexpr (std::is_same_v<T, Nil>) return Type::NIL;
-      else if constexpr (std::is_same_v<T, bool>) return Type::BOOLEAN;
-      else if constexpr (std::is_same_v<T, float>) return Type::NUMBER;
-      else if constexpr (std::is_same_v<T, std::string>) return Type::STRING;
-      //else if constexpr (std::is_same_v<T, std::shared_ptr<LoxClass>>) return Type::CLASS;
-      //else if constexpr (std::is_same_v<T, std::shared_ptr<LoxInstance>>) return Type::INSTANCE;
-      else return Type::FUNCTION; // For Callable
-    }, value);
+  if(isNil()) return Type::NIL;
+  if(isBool()) return Type::BOOLEAN;
+  if(isNumber()) return Type::NUMBER;
+  if(isString()) return Type::STRING;
+  if(isInstance()) return Type::INSTANCE;
+  return Type::FUNCTION; // For Callable
 }
 
 bool Value::isType(Type type) const {
@@ -66,24 +71,18 @@ std::string Value::getTypeName() const {
     case Type::NUMBER: return "Number";
     case Type::STRING: return "String";
     case Type::FUNCTION: return "Function";
+    case Type::INSTANCE: return "Instance";
     //case Type::CLASS: return "class";
-    //case Type::INSTANCE: return "instance";
     default: return "Unknown Type!";
   }
 }
 
-Literal::Literal(float v): value {v} {}
+Literal::Literal(double v): value {v} {}
 Literal::Literal(bool v): value {v} {}
-Literal::Literal(const std::string& v): value {v} {}
+Literal::Literal(ObjString* v): value {v} {}
 Literal::Literal(Nil v): value {v} {}
-Literal::Literal(std::shared_ptr<Callable> cal): value {cal} {}
-
-template <typename T>
-T Literal::get() const {
-  return value.get<T>();
-}
+Literal::Literal(Value v): value {v} {}
 
 std::string Literal::toString() const {
   return value.toString();
 }
-
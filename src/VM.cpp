@@ -0,0 +1,626 @@
+#include "../include/VM.hpp"
+#include "../include/Compiler.hpp"
+#include "../include/LoxInstance.hpp"
+#include "../include/NativeFunctions.hpp"
+#include "../include/Numbers.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// Computed goto dispatch where the compiler supports it, every handler
+// jumps straight to the next one instead of going back through a switch
+#if defined(__GNUC__) || defined(__clang__)
+  #define LOX_THREADED_DISPATCH
+#endif
+
+VMUpvalue::VMUpvalue(Value* slot) : location { slot }, closed { Nil() } {}
+
+VMClosure::VMClosure(std::shared_ptr<VMFunction> function, VM* vm)
+  : Callable(ObjType::VM_CLOSURE), function { std::move(function) }, vm { vm }
+{
+  upvalues.reserve(this->function->upvalueCount);
+}
+
+void VMClosure::trace(Heap& heap) {
+  // open upvalues point into the stack which is marked anyway
+  for(const auto& upvalue: upvalues) heap.markValue(upvalue->closed);
+}
+
+std::string VMClosure::toString() { return "fun type"; }
+
+std::string VMClosure::label() { return function->name; }
+
+int VMClosure::arity() { return function->arity; }
+
+Value VMClosure::call(Interpreter* interpreter, std::vector<Value> args) {
+  return vm->callFromHost(Value(this), args);
+}
+
+VMBoundMethod::VMBoundMethod(const Value& receiver, VMClosure* method)
+  : Callable(ObjType::VM_BOUND_METHOD), receiver { receiver },
+    method { method } {}
+
+void VMBoundMethod::trace(Heap& heap) {
+  heap.markValue(receiver);
+  heap.markObject(method);
+}
+
+std::string VMBoundMethod::toString() { return "fun type"; }
+
+std::string VMBoundMethod::label() { return method->label(); }
+
+int VMBoundMethod::arity() { return method->arity(); }
+
+Value VMBoundMethod::call(Interpreter* interpreter, std::vector<Value> args) {
+  return method->vm->callFromHost(Value(this), args);
+}
+
+VMClass::VMClass(const std::string& name, Heap& heap)
+  : LoxClass(name, {}, heap) {}
+
+void VMClass::trace(Heap& heap) {
+  LoxClass::trace(heap);
+  for(auto& [name, method]: vmMethods) heap.markObject(method);
+}
+
+VMClosure* VMClass::findVMMethod(const std::string& name) {
+  auto it = vmMethods.find(name);
+  if(it == vmMethods.end()) return nullptr;
+  return it->second;
+}
+
+
+VM::VM(Lox& lox)
+  : lox { lox }, stack(INITIAL_SLOTS), frames(INITIAL_FRAMES)
+{
+  resetStack();
+  nativeStackBudget = lox.nativeStackBudget();
+  lox.heap.addRoots(this);
+  defineNative("clock", lox.heap.make<Native::Clock>());
+  defineNative("memoize", lox.heap.make<Native::Memoize>(lox.heap,
+      lox.memoCapacity, lox.memoized));
+}
+
+VM::~VM() {
+  lox.heap.removeRoots(this);
+}
+
+void VM::markRoots(Heap& heap) {
+  for(Value* slot = stack.data(); slot < stackTop; slot++) {
+    heap.markValue(*slot);
+  }
+  // a bound method call replaces the callee with the receiver, so the
+  // closure is only referenced by its frame
+  for(int i = 0; i < frameCount; i++) heap.markObject(frames[i].closure);
+  globals.mark(heap);
+}
+
+void VM::resetStack() {
+  stackTop = stack.data();
+  frameCount = 0;
+  openUpvalues.clear();
+}
+
+void VM::push(Value value) {
+  *stackTop++ = std::move(value);
+}
+
+Value VM::pop() {
+  return std::move(*--stackTop);
+}
+
+RuntimeError VM::error(const std::string& message) {
+  CallFrame& frame = frames[frameCount - 1];
+  const Chunk& chunk = frame.closure->function->chunk;
+  int offset = frame.ip - chunk.code.data() - 1;
+  return RuntimeError(Token(IDENTIFIER, "", chunk.getLine(offset)), message);
+}
+
+int VM::globalSlot(const std::string& name) {
+  return globals.slotFor(name);
+}
+
+void VM::defineNative(const std::string& name, Callable* fn) {
+  globals.define(globals.slotFor(name), Value(fn));
+}
+
+void VM::checkArity(int expected, int argCount) {
+  if(expected != argCount) {
+    throw error("Expected " + std::to_string(expected) +
+        " arguments, but got " + std::to_string(argCount) + " instead.");
+  }
+}
+
+void VM::callClosure(VMClosure* closure, int argCount, Value* base) {
+  checkArity(closure->function->arity, argCount);
+  if(frameCount == static_cast<int>(frames.size())) growFrames();
+  if(stackTop + FRAME_SLOTS > stack.data() + stack.size()) {
+    ptrdiff_t offset = base - stack.data();
+    growStack();
+    base = stack.data() + offset;
+  }
+  CallFrame& frame = frames[frameCount++];
+  frame.closure = closure;
+  frame.ip = closure->function->chunk.code.data();
+  frame.slots = stackTop - argCount - 1;
+  frame.base = base;
+}
+
+void VM::growFrames() {
+  if(frames.size() * 2 * sizeof(CallFrame) + stack.size() * sizeof(Value)
+      > lox.stackBudget) {
+    throw error("Stack overflow.");
+  }
+  frames.resize(frames.size() * 2);
+}
+
+void VM::growStack() {
+  if(frames.size() * sizeof(CallFrame) + stack.size() * 2 * sizeof(Value)
+      > lox.stackBudget) {
+    throw error("Stack overflow.");
+  }
+  std::vector<Value> bigger(stack.size() * 2);
+  std::copy(stack.data(), stackTop, bigger.data());
+  // everything pointing into the old stack moves along
+  auto moved = [this, &bigger](Value* slot) {
+    return bigger.data() + (slot - stack.data());
+  };
+  for(int i = 0; i < frameCount; i++) {
+    frames[i].slots = moved(frames[i].slots);
+    frames[i].base = moved(frames[i].base);
+  }
+  for(auto& upvalue: openUpvalues) upvalue->location = moved(upvalue->location);
+  stackTop = moved(stackTop);
+  stack.swap(bigger);
+}
+
+void VM::callValue(const Value& callee, int argCount) {
+  if(!callee.isCallable()) {
+    throw error("Can only call functions and classes");
+  }
+  Callable* fn = callee.asCallable();
+
+  if(fn->type == ObjType::VM_CLOSURE) {
+    callClosure(static_cast<VMClosure*>(fn), argCount, stackTop - argCount - 1);
+    return;
+  }
+  if(fn->type == ObjType::VM_BOUND_METHOD) {
+    auto bound = static_cast<VMBoundMethod*>(fn);
+    // the receiver takes the place of the callee as slot zero
+    stackTop[-argCount - 1] = bound->receiver;
+    callClosure(bound->method, argCount, stackTop - argCount - 1);
+    return;
+  }
+
+  // classes and natives run to completion right away
+  checkArity(fn->arity(), argCount);
+  std::vector<Value> args(stackTop - argCount, stackTop);
+  Value result;
+  try {
+    result = fn->call(nullptr, std::move(args));
+  } catch(const NativeError& e) {
+    throw error(e.what());
+  }
+  stackTop -= argCount;
+  stackTop[-1] = std::move(result);
+}
+
+std::shared_ptr<VMUpvalue> VM::captureUpvalue(Value* local) {
+  for(auto it = openUpvalues.rbegin(); it != openUpvalues.rend(); it++) {
+    if((*it)->location == local) return *it;
+    if((*it)->location < local) break;
+  }
+  auto upvalue = std::make_shared<VMUpvalue>(local);
+  auto pos = openUpvalues.end();
+  while(pos != openUpvalues.begin() && (*(pos - 1))->location > local) pos--;
+  openUpvalues.insert(pos, upvalue);
+  return upvalue;
+}
+
+void VM::closeUpvalues(Value* last) {
+  while(!openUpvalues.empty() && openUpvalues.back()->location >= last) {
+    VMUpvalue& upvalue = *openUpvalues.back();
+    upvalue.closed = *upvalue.location;
+    upvalue.location = &upvalue.closed;
+    openUpvalues.pop_back();
+  }
+}
+
+Value VM::callFromHost(const Value& callee, const std::vector<Value>& args) {
+  uintptr_t native = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  if(nativeStackBase - native > nativeStackBudget) {
+    throw error("Stack overflow.");
+  }
+  int exitFrame = frameCount;
+  push(callee);
+  for(const auto& arg: args) push(arg);
+  callValue(callee, args.size());
+  if(frameCount > exitFrame) run(exitFrame);
+  return pop();
+}
+
+void VM::interpret(const Stmt::Stmts& program) {
+  Compiler compiler(lox, *this);
+  std::shared_ptr<VMFunction> script = compiler.compile(program);
+  if(lox.hadError) return;
+
+  VMClosure* closure = lox.heap.make<VMClosure>(script, this);
+  push(Value(closure));
+  nativeStackBase = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  try {
+    callClosure(closure, 0, stack.data());
+    run(0);
+  } catch(const RuntimeError& error) {
+    lox.runtimeError(error);
+    resetStack();
+  }
+}
+
+void VM::run(int exitFrame) {
+  CallFrame* frame;
+  uint8_t* ip;
+  Value* slots;
+  Value* constants;
+
+#define LOAD_FRAME() \
+  do { \
+    frame = &frames[frameCount - 1]; \
+    ip = frame->ip; \
+    slots = frame->slots; \
+    constants = frame->closure->function->chunk.constants.data(); \
+  } while(false)
+#define SAVE_FRAME() (frame->ip = ip)
+#define THROW(message) do { SAVE_FRAME(); throw error(message); } while(false)
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (constants[READ_SHORT()])
+#define READ_STRING() (READ_CONSTANT().asString()->chars)
+#define PEEK(distance) (stackTop[-1 - (distance)])
+
+#define BINARY_OP(op) \
+  do { \
+    Value result; \
+    if(!Numbers::quick(op, PEEK(1), PEEK(0), result)) { \
+      if(!Numbers::accepts(op, PEEK(1), PEEK(0))) \
+        THROW(Numbers::operandError(op, PEEK(1), PEEK(0))); \
+      result = Numbers::binary(op, PEEK(1), PEEK(0), lox.heap); \
+    } \
+    stackTop--; \
+    PEEK(0) = result; \
+  } while(false)
+#define ARITHMETIC(op) BINARY_OP(Numbers::Op::op)
+#define COMPARISON(op) BINARY_OP(Numbers::Op::op)
+
+#ifdef LOX_THREADED_DISPATCH
+  static void* dispatchTable[] = {
+  #define LOX_OPCODE_LABEL(op) &&do_##op,
+    LOX_OPCODES(LOX_OPCODE_LABEL)
+  #undef LOX_OPCODE_LABEL
+  };
+  static_assert(sizeof(dispatchTable) / sizeof(void*) == OP_COUNT_);
+  #define CASE(op) do_##op:
+  #define DISPATCH() goto *dispatchTable[READ_BYTE()]
+#else
+  #define CASE(op) case op:
+  #define DISPATCH() continue
+#endif
+
+  LOAD_FRAME();
+
+#ifdef LOX_THREADED_DISPATCH
+  DISPATCH();
+#else
+  for(;;) switch(READ_BYTE()) {
+#endif
+
+  CASE(OP_CONSTANT) {
+    push(READ_CONSTANT());
+    DISPATCH();
+  }
+  CASE(OP_NIL) {
+    push(Nil());
+    DISPATCH();
+  }
+  CASE(OP_TRUE) {
+    push(true);
+    DISPATCH();
+  }
+  CASE(OP_FALSE) {
+    push(false);
+    DISPATCH();
+  }
+  CASE(OP_POP) {
+    stackTop--;
+    DISPATCH();
+  }
+
+  CASE(OP_GET_LOCAL) {
+    push(slots[READ_BYTE()]);
+    DISPATCH();
+  }
+  CASE(OP_SET_LOCAL) {
+    slots[READ_BYTE()] = PEEK(0);
+    DISPATCH();
+  }
+  CASE(OP_GET_GLOBAL) {
+    uint16_t slot = READ_SHORT();
+    if(!globals.isDefined(slot)) {
+      THROW("Undefined variable '" + globals.nameOf(slot) + "'.");
+    }
+    push(globals.at(slot));
+    DISPATCH();
+  }
+  CASE(OP_DEFINE_GLOBAL) {
+    globals.define(READ_SHORT(), PEEK(0));
+    stackTop--;
+    DISPATCH();
+  }
+  CASE(OP_SET_GLOBAL) {
+    uint16_t slot = READ_SHORT();
+    if(!globals.isDefined(slot)) {
+      THROW("Undefined variable '" + globals.nameOf(slot) + "'.");
+    }
+    globals.at(slot) = PEEK(0);
+    DISPATCH();
+  }
+  CASE(OP_GET_UPVALUE) {
+    push(*frame->closure->upvalues[READ_BYTE()]->location);
+    DISPATCH();
+  }
+  CASE(OP_SET_UPVALUE) {
+    *frame->closure->upvalues[READ_BYTE()]->location = PEEK(0);
+    DISPATCH();
+  }
+  CASE(OP_GET_PROPERTY) {
+    const std::string& name = READ_STRING();
+    if(!PEEK(0).isInstance()) THROW("Only instances have properties.");
+    LoxInstance* instance = PEEK(0).asInstance();
+
+    if(Value* field = instance->findField(name)) {
+      PEEK(0) = *field;
+      DISPATCH();
+    }
+    auto klass = static_cast<VMClass*>(instance->getClass());
+    if(VMClosure* method = klass->findVMMethod(name)) {
+      PEEK(0) = lox.heap.make<VMBoundMethod>(PEEK(0), method);
+      DISPATCH();
+    }
+    THROW("Undefined property '" + name + "'.");
+  }
+  CASE(OP_SET_PROPERTY) {
+    const std::string& name = READ_STRING();
+    if(!PEEK(1).isInstance()) THROW("Only instances have fields.");
+    PEEK(1).asInstance()->setField(name, PEEK(0), lox.heap);
+    PEEK(1) = PEEK(0);
+    stackTop--;
+    DISPATCH();
+  }
+  CASE(OP_GET_METHOD) {
+    // leaves [method, receiver] for methods and [field, nil] for fields
+    const std::string& name = READ_STRING();
+    if(!PEEK(0).isInstance()) THROW("Only instances have properties.");
+    LoxInstance* instance = PEEK(0).asInstance();
+
+    if(Value* field = instance->findField(name)) {
+      PEEK(0) = *field;
+      push(Nil());
+      DISPATCH();
+    }
+    auto klass = static_cast<VMClass*>(instance->getClass());
+    if(VMClosure* method = klass->findVMMethod(name)) {
+      push(PEEK(0));
+      PEEK(1) = method;
+      DISPATCH();
+    }
+    THROW("Undefined property '" + name + "'.");
+  }
+
+  CASE(OP_EQUAL) {
+    bool result = PEEK(1).isEqual(PEEK(0));
+    stackTop--;
+    PEEK(0) = result;
+    DISPATCH();
+  }
+  CASE(OP_NOT_EQUAL) {
+    bool result = !PEEK(1).isEqual(PEEK(0));
+    stackTop--;
+    PEEK(0) = result;
+    DISPATCH();
+  }
+  CASE(OP_GREATER) {
+    COMPARISON(GREATER);
+    DISPATCH();
+  }
+  CASE(OP_GREATER_EQUAL) {
+    COMPARISON(GREATER_EQUAL);
+    DISPATCH();
+  }
+  CASE(OP_LESS) {
+    COMPARISON(LESS);
+    DISPATCH();
+  }
+  CASE(OP_LESS_EQUAL) {
+    COMPARISON(LESS_EQUAL);
+    DISPATCH();
+  }
+  CASE(OP_ADD) {
+    Value sum;
+    if(Numbers::quick(Numbers::Op::ADD, PEEK(1), PEEK(0), sum)) {
+      stackTop--;
+      PEEK(0) = sum;
+      DISPATCH();
+    }
+    if(PEEK(0).isNumber() && PEEK(1).isNumber()) {
+      ARITHMETIC(ADD);
+      DISPATCH();
+    }
+    if(PEEK(0).isString() && PEEK(1).isString()) {
+      PEEK(1) = lox.heap.makeString(
+          PEEK(1).asString()->chars + PEEK(0).asString()->chars);
+      stackTop--;
+      DISPATCH();
+    }
+    THROW("Operands must be two numbers or two strings");
+  }
+  CASE(OP_SUBTRACT) {
+    ARITHMETIC(SUBTRACT);
+    DISPATCH();
+  }
+  CASE(OP_MULTIPLY) {
+    ARITHMETIC(MULTIPLY);
+    DISPATCH();
+  }
+  CASE(OP_DIVIDE) {
+    ARITHMETIC(DIVIDE);
+    DISPATCH();
+  }
+  CASE(OP_NOT) {
+    PEEK(0) = !PEEK(0).isTruthy();
+    DISPATCH();
+  }
+  CASE(OP_BIT_AND) {
+    ARITHMETIC(BIT_AND);
+    DISPATCH();
+  }
+  CASE(OP_BIT_OR) {
+    ARITHMETIC(BIT_OR);
+    DISPATCH();
+  }
+  CASE(OP_BIT_XOR) {
+    ARITHMETIC(BIT_XOR);
+    DISPATCH();
+  }
+  CASE(OP_SHIFT_LEFT) {
+    ARITHMETIC(SHIFT_LEFT);
+    DISPATCH();
+  }
+  CASE(OP_SHIFT_RIGHT) {
+    ARITHMETIC(SHIFT_RIGHT);
+    DISPATCH();
+  }
+  CASE(OP_NEGATE) {
+    if(!PEEK(0).isNumber()) THROW("Operand must be a number.");
+    PEEK(0) = *Numbers::negate(PEEK(0), &lox.heap);
+    DISPATCH();
+  }
+  CASE(OP_INCREMENT) {
+    if(!PEEK(0).isNumber()) THROW("Operand must be a number.");
+    PEEK(0) = *Numbers::add(PEEK(0), 1, &lox.heap);
+    DISPATCH();
+  }
+  CASE(OP_DECREMENT) {
+    if(!PEEK(0).isNumber()) THROW("Operand must be a number.");
+    PEEK(0) = *Numbers::add(PEEK(0), -1, &lox.heap);
+    DISPATCH();
+  }
+  CASE(OP_BIT_NOT) {
+    if(!PEEK(0).isInt()) THROW("Operand must be an integer.");
+    PEEK(0) = *Numbers::complement(PEEK(0), &lox.heap);
+    DISPATCH();
+  }
+
+  CASE(OP_PRINT) {
+    std::cout << pop().toString() << std::endl;
+    DISPATCH();
+  }
+  CASE(OP_JUMP) {
+    uint16_t offset = READ_SHORT();
+    ip += offset;
+    DISPATCH();
+  }
+  CASE(OP_JUMP_IF_FALSE) {
+    uint16_t offset = READ_SHORT();
+    if(!PEEK(0).isTruthy()) ip += offset;
+    DISPATCH();
+  }
+  CASE(OP_LOOP) {
+    uint16_t offset = READ_SHORT();
+    ip -= offset;
+    DISPATCH();
+  }
+  CASE(OP_CALL) {
+    int argCount = READ_BYTE();
+    SAVE_FRAME();
+    callValue(PEEK(argCount), argCount);
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  CASE(OP_CALL_METHOD) {
+    int argCount = READ_BYTE();
+    Value* base = stackTop - argCount - 2;
+    SAVE_FRAME();
+    if(base[1].isInstance()) {
+      callClosure(static_cast<VMClosure*>(base[0].asObj()), argCount, base);
+    } else {
+      // a field holding a callable, drop the nil placeholder
+      for(int i = 1; i <= argCount; i++) {
+        base[i] = base[i + 1];
+      }
+      stackTop--;
+      callValue(base[0], argCount);
+    }
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  CASE(OP_CLOSURE) {
+    const auto& function = frame->closure->function->chunk.functions[READ_SHORT()];
+    VMClosure* closure = lox.heap.make<VMClosure>(function, this);
+    for(int i = 0; i < function->upvalueCount; i++) {
+      uint8_t isLocal = READ_BYTE();
+      uint8_t index = READ_BYTE();
+      if(isLocal) {
+        closure->upvalues.push_back(captureUpvalue(slots + index));
+      } else {
+        closure->upvalues.push_back(frame->closure->upvalues[index]);
+      }
+    }
+    push(Value(closure));
+    DISPATCH();
+  }
+  CASE(OP_CLOSE_UPVALUE) {
+    closeUpvalues(stackTop - 1);
+    stackTop--;
+    DISPATCH();
+  }
+  CASE(OP_RETURN) {
+    Value result = pop();
+    closeUpvalues(slots);
+    frameCount--;
+    stackTop = frame->base;
+    push(std::move(result));
+    if(frameCount == exitFrame) return;
+    LOAD_FRAME();
+    DISPATCH();
+  }
+  CASE(OP_CLASS) {
+    push(Value(lox.heap.make<VMClass>(READ_STRING(), lox.heap)));
+    DISPATCH();
+  }
+  CASE(OP_METHOD) {
+    const std::string& name = READ_STRING();
+    auto klass = static_cast<VMClass*>(PEEK(1).asObj());
+    klass->vmMethods[name] = static_cast<VMClosure*>(PEEK(0).asObj());
+    stackTop--;
+    DISPATCH();
+  }
+
+#ifndef LOX_THREADED_DISPATCH
+  default: break;
+  }
+#endif
+
+#undef LOAD_FRAME
+#undef SAVE_FRAME
+#undef THROW
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef PEEK
+#undef BINARY_OP
+#undef ARITHMETIC
+#undef COMPARISON
+#undef CASE
+#undef DISPATCH
+}
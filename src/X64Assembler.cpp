@@ -0,0 +1,179 @@
+#include "../include/X64Assembler.hpp"
+
+#include <cstring>
+
+// REX.W with the high bits of the reg and rm/base fields
+void X64Assembler::rex(uint8_t reg, uint8_t base) {
+  code.push_back(0x48 | ((reg >> 3) << 2) | (base >> 3));
+}
+
+void X64Assembler::modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+  code.push_back((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X64Assembler::memory(uint8_t reg, Reg base, int32_t disp) {
+  modrm(2, reg, base);
+  // rsp and r12 as a base need a SIB byte
+  if((base & 7) == RSP) code.push_back(0x24);
+  emit32(disp);
+}
+
+void X64Assembler::emit32(uint32_t value) {
+  for(int i = 0; i < 4; i++) code.push_back(value >> (8 * i));
+}
+
+void X64Assembler::movImm(Reg dst, uint64_t imm) {
+  rex(0, dst);
+  code.push_back(0xb8 + (dst & 7));
+  for(int i = 0; i < 8; i++) code.push_back(imm >> (8 * i));
+}
+
+void X64Assembler::mov(Reg dst, Reg src) {
+  rex(src, dst);
+  code.push_back(0x89);
+  modrm(3, src, dst);
+}
+
+void X64Assembler::load(Reg dst, Reg base, int32_t disp) {
+  rex(dst, base);
+  code.push_back(0x8b);
+  memory(dst, base, disp);
+}
+
+void X64Assembler::store(Reg base, int32_t disp, Reg src) {
+  rex(src, base);
+  code.push_back(0x89);
+  memory(src, base, disp);
+}
+
+void X64Assembler::storeImm32(Reg base, int32_t disp, uint32_t imm) {
+  // 32 bit operand size, only REX.B when the base needs it
+  if(base >= R8) code.push_back(0x41);
+  code.push_back(0xc7);
+  memory(0, base, disp);
+  emit32(imm);
+}
+
+void X64Assembler::lea(Reg dst, Reg base, int32_t disp) {
+  rex(dst, base);
+  code.push_back(0x8d);
+  memory(dst, base, disp);
+}
+
+void X64Assembler::push(Reg reg) {
+  if(reg >= R8) code.push_back(0x41);
+  code.push_back(0x50 + (reg & 7));
+}
+
+void X64Assembler::pop(Reg reg) {
+  if(reg >= R8) code.push_back(0x41);
+  code.push_back(0x58 + (reg & 7));
+}
+
+void X64Assembler::alu(Alu op, Reg dst, Reg src) {
+  rex(src, dst);
+  code.push_back(op);
+  modrm(3, src, dst);
+}
+
+void X64Assembler::aluImm(Alu op, Reg dst, int32_t imm) {
+  rex(0, dst);
+  code.push_back(0x81);
+  // the /digit of the immediate form is the opcode's middle bits
+  modrm(3, op >> 3, dst);
+  emit32(imm);
+}
+
+void X64Assembler::cmpMem(Reg reg, Reg base, int32_t disp) {
+  rex(reg, base);
+  code.push_back(0x3b);
+  memory(reg, base, disp);
+}
+
+void X64Assembler::test(Reg dst, Reg src) {
+  rex(src, dst);
+  code.push_back(0x85);
+  modrm(3, src, dst);
+}
+
+void X64Assembler::imul(Reg dst, Reg src) {
+  rex(dst, src);
+  code.push_back(0x0f);
+  code.push_back(0xaf);
+  modrm(3, dst, src);
+}
+
+void X64Assembler::shl(Reg reg, uint8_t count) {
+  rex(0, reg);
+  code.push_back(0xc1);
+  modrm(3, 4, reg);
+  code.push_back(count);
+}
+
+void X64Assembler::shr(Reg reg, uint8_t count) {
+  rex(0, reg);
+  code.push_back(0xc1);
+  modrm(3, 5, reg);
+  code.push_back(count);
+}
+
+void X64Assembler::sar(Reg reg, uint8_t count) {
+  rex(0, reg);
+  code.push_back(0xc1);
+  modrm(3, 7, reg);
+  code.push_back(count);
+}
+
+void X64Assembler::setAl(Cond cond) {
+  code.push_back(0x0f);
+  code.push_back(0x90 + cond);
+  modrm(3, 0, RAX);
+  // movzx eax, al
+  code.push_back(0x0f);
+  code.push_back(0xb6);
+  modrm(3, RAX, RAX);
+}
+
+void X64Assembler::call(Reg target) {
+  if(target >= R8) code.push_back(0x41);
+  code.push_back(0xff);
+  modrm(3, 2, target);
+}
+
+void X64Assembler::callIndirect(Reg base) {
+  if(base >= R8) code.push_back(0x41);
+  code.push_back(0xff);
+  memory(2, base, 0);
+}
+
+void X64Assembler::ret() {
+  code.push_back(0xc3);
+}
+
+void X64Assembler::jmp(Label& label) {
+  code.push_back(0xe9);
+  jumpTo(label);
+}
+
+void X64Assembler::jcc(Cond cond, Label& label) {
+  code.push_back(0x0f);
+  code.push_back(0x80 + cond);
+  jumpTo(label);
+}
+
+void X64Assembler::jumpTo(Label& label) {
+  label.uses.push_back(code.size());
+  emit32(0);
+  if(label.position >= 0) bind(label);
+}
+
+// patches every jump to the label so far, later ones are patched as they
+// are emitted
+void X64Assembler::bind(Label& label) {
+  if(label.position < 0) label.position = code.size();
+  for(size_t use: label.uses) {
+    int32_t offset = label.position - static_cast<int32_t>(use + 4);
+    std::memcpy(&code[use], &offset, 4);
+  }
+  label.uses.clear();
+}
@@ -1,6 +1,8 @@
+#include <charconv>
 #include <iostream>
 #include <string>
 #include <memory>
+#include <vector>
 
 // Language goals:
 // simple types
@@ -14,16 +16,107 @@
 
 #include "../include/Lox.hpp"
 
+// exit code for bad command line arguments, like sysexits' EX_USAGE
+static constexpr int EXIT_USAGE = 64;
 
+static void printUsage(std::ostream& out) {
+  out << "Usage: ./dupa [--closures|--vm|--ir] [-O0|-O1] [--inline-budget=nodes] "
+    "[--specialize-limit=clones] [--stack-budget=bytes] [--dump-cse] [--ir-passes=list] [--dump-ir] [--time-passes] "
+    "[--ic-stats] [--dump-quickening] [--no-jit] [--jit-threshold=calls] [--jit-stats] "
+    "[--no-trace] [--trace-threshold=iterations] [--trace-stats] [--lox2cpp=executable] "
+    "[--memo-size=entries] [--memo-stats] [--check-purity] [--gc-stats] "
+    "[--gc-threshold=bytes] [--gc-growth=factor] [script]" << std::endl;
+}
+
+// reads the number after the '=' of a flag, false unless all of it is one
+// that isn't negative
+template <typename T>
+static bool parseValue(const std::string& arg, T& value) {
+  std::string text = arg.substr(arg.find('=') + 1);
+  T parsed;
+  auto [end, error] =
+    std::from_chars(text.data(), text.data() + text.size(), parsed);
+  if(error != std::errc() || end != text.data() + text.size()) return false;
+  if(parsed < T()) return false;
+  value = parsed;
+  return true;
+}
 
+static int usageError(const std::string& arg) {
+  std::cerr << "Invalid value in '" << arg << "'." << std::endl;
+  printUsage(std::cerr);
+  return EXIT_USAGE;
+}
 
 int main(int argc, char** argv) {
   Lox lox;
 
-  if(argc > 2) {
-    std::cout << "Usage: ./dupa [script]" << std::endl;
-  } else if(argc == 2) {
-    lox.runFile(std::string(argv[1]));
+  std::vector<std::string> args;
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if(arg == "--vm") {
+      lox.engine = Engine::VM;
+    } else if(arg == "--closures") {
+      lox.engine = Engine::CLOSURES;
+    } else if(arg == "--ir") {
+      lox.engine = Engine::IR;
+    } else if(arg.starts_with("--ir-passes=")) {
+      lox.irPasses = arg.substr(arg.find('=') + 1);
+    } else if(arg == "--dump-ir") {
+      lox.dumpIr = true;
+    } else if(arg == "--time-passes") {
+      lox.timePasses = true;
+    } else if(arg == "-O0" || arg == "-O1") {
+      lox.optLevel = arg[2] - '0';
+    } else if(arg.starts_with("--inline-budget=")) {
+      if(!parseValue(arg, lox.inlineBudget)) return usageError(arg);
+    } else if(arg.starts_with("--specialize-limit=")) {
+      if(!parseValue(arg, lox.specializeLimit)) return usageError(arg);
+    } else if(arg.starts_with("--stack-budget=")) {
+      if(!parseValue(arg, lox.stackBudget)) return usageError(arg);
+    } else if(arg == "--dump-cse") {
+      lox.dumpCse = true;
+    } else if(arg == "--ic-stats") {
+      lox.icStats = true;
+    } else if(arg == "--dump-quickening") {
+      lox.dumpQuickening = true;
+    } else if(arg == "--no-jit") {
+      lox.jit = false;
+    } else if(arg.starts_with("--jit-threshold=")) {
+      if(!parseValue(arg, lox.jitThreshold)) return usageError(arg);
+    } else if(arg == "--jit-stats") {
+      lox.jitStats = true;
+    } else if(arg == "--no-trace") {
+      lox.trace = false;
+    } else if(arg.starts_with("--trace-threshold=")) {
+      if(!parseValue(arg, lox.traceThreshold)) return usageError(arg);
+    } else if(arg == "--trace-stats") {
+      lox.traceStats = true;
+    } else if(arg.starts_with("--lox2cpp=")) {
+      lox.lox2cpp = arg.substr(arg.find('=') + 1);
+    } else if(arg.starts_with("--memo-size=")) {
+      if(!parseValue(arg, lox.memoCapacity)) return usageError(arg);
+    } else if(arg == "--memo-stats") {
+      lox.memoStats = true;
+    } else if(arg == "--check-purity") {
+      lox.checkPurity = true;
+    } else if(arg == "--gc-stats") {
+      lox.gcStats = true;
+    } else if(arg.starts_with("--gc-threshold=")) {
+      size_t threshold;
+      if(!parseValue(arg, threshold)) return usageError(arg);
+      lox.heap.setThreshold(threshold);
+    } else if(arg.starts_with("--gc-growth=")) {
+      if(!parseValue(arg, lox.heap.growthFactor)) return usageError(arg);
+    } else {
+      args.push_back(arg);
+    }
+  }
+
+  if(args.size() > 1) {
+    printUsage(std::cout);
+  } else if(args.size() == 1) {
+    lox.runFile(args[0]);
   } else {
     lox.runPrompt();
   }
@@ -0,0 +1,18 @@
+#!/bin/sh
+# runs every tests/*/*.lox with the interpreter given as the first argument,
+# with and without -O1, and compares what it prints with the .out file next
+# to it: ./tests/run.sh build/main
+main=${1:-build/main}
+dir=$(dirname "$0")
+failed=0
+for script in "$dir"/*/*.lox; do
+  expected="${script%.lox}.out"
+  for flags in -O0 -O1; do
+    if ! "$main" $flags "$script" 2>/dev/null | diff -u "$expected" - >/dev/null; then
+      echo "FAIL $script $flags"
+      failed=1
+    fi
+  done
+done
+[ $failed = 0 ] && echo "all passed"
+exit $failed